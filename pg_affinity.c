@@ -0,0 +1,463 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Placement of pipeline stages on CPUs. The CPUs the shell may use are grouped
+ * by the last level cache they share and by NUMA node, as sysfs describes
+ * them. Before a pipeline starts, every stage gets a CPU set from the
+ * placement mode of the session, and the stage applies it to itself with
+ * sched_setaffinity: a process before exec, a builtin thread before it runs.
+ * By default neighbouring stages share a last level cache, so the data they
+ * stream through a pipe stays in it, but only on machines with more than one.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE		// sched_setaffinity(), CPU_SET
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "pg_error.h"
+#include "processes.h"
+#include "pg_builtin.h"
+#include "pg_affinity.h"
+
+#define SYS_CPU		"/sys/devices/system/cpu"
+#define SYS_NODE	"/sys/devices/system/node"
+#define MAX_CACHE_INDEX	16	// cache/indexN directories looked at
+
+enum PlaceMode pg_place = PLACE_CACHE;
+
+static const char * const modeNames[] = { "off", "cache", "compact", "spread", NULL };
+
+static cpu_set_t allowed;		// CPUs of the shell
+static cpu_set_t *caches;		// CPUs sharing a last level cache
+static int ncaches;
+static cpu_set_t *nodes;		// CPUs of a NUMA node
+static int nnodes;
+static int topoState;			// 0: not loaded, 1: loaded, -1: unknown
+static cpu_set_t placeList;		// CPUs of PLACE_LIST
+
+static cpu_set_t *masks;		// CPUs of every stage of the running pipeline
+static int nmasks;
+
+// Static Function Prototypes //
+static int topo_load(void);
+static int llc_of(int cpu, cpu_set_t *set);
+static void nodes_load(void);
+static int set_add(cpu_set_t **sets, int *n, const cpu_set_t *set);
+static int set_find(const cpu_set_t *sets, int n, int cpu);
+static int home_of(const cpu_set_t *sets, int n);
+static int nth_cpu(const cpu_set_t *set, int n);
+static int cpulist_parse(const char *str, cpu_set_t *set);
+static int cpulist_format(const cpu_set_t *set, char *buf, size_t size);
+static int read_line(const char *path, char *buf, size_t size);
+static int affinity_setup(void *arg);
+
+/* Description: Sets the placement of the pipelines of the session: "off",
+ *				"cache", "compact", "spread" or a CPU list such as "0-3,8".
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG: Unknown mode or invalid CPU list
+ */
+int place_set(const char *spec) {
+	cpu_set_t set;
+	int i;
+
+	for (i = 0; modeNames[i] != NULL; ++i) {
+		if (strcmp(spec, modeNames[i]) == 0) {
+			pg_place = (enum PlaceMode)i;
+			return 0;
+		}
+	}
+
+	if (cpulist_parse(spec, &set) == -1) {
+		pg_errno = EARG;
+		return -1;
+	}
+	placeList = set;
+	pg_place = PLACE_LIST;
+
+	return 0;
+}
+
+/* Description: Writes the placement of the session, as place_set reads it.
+ *
+ * Returns:		Length of the string, as snprintf
+ */
+int place_format(char *buf, size_t size) {
+	if (pg_place == PLACE_LIST) {
+		return cpulist_format(&placeList, buf, size);
+	}
+	return snprintf(buf, size, "%s", modeNames[pg_place]);
+}
+
+/* Description: Chooses the CPUs of every stage of a pipeline about to start.
+ *
+ * Arguments:	n:	Number of stages
+ *
+ * Returns:		- On success, or if the stages are not placed,  0
+ * 				- On failure, -1 and the stages are not placed
+ *
+ * Notes:		Stages apply their CPUs with place_enter, and place_end frees
+ *				them when the pipeline ends.
+ */
+int place_begin(int n) {
+	const cpu_set_t *sets;
+	int nsets, g, used = 0, i;
+
+	place_end();
+	if (pg_place == PLACE_OFF || n < 1 || topo_load() == -1) {
+		return 0;
+	}
+
+	// Nothing to gain where every CPU shares the same cache or node
+	if ((pg_place == PLACE_CACHE && ncaches < 2) ||
+		(pg_place == PLACE_COMPACT && nnodes < 2) ||
+		(pg_place == PLACE_SPREAD && ncaches < 2 && nnodes < 2)) {
+		return 0;
+	}
+
+	if ((masks = (cpu_set_t *)malloc(n * sizeof(cpu_set_t))) == NULL) {
+		return -1;
+	}
+	nmasks = n;
+
+	switch (pg_place) {
+		case PLACE_CACHE:		// Fill the cache of the shell first, then the next
+			g = home_of(caches, ncaches);
+			for (i = 0; i < n; ++i) {
+				if (used == CPU_COUNT(&caches[g])) {
+					g = (g + 1) % ncaches;
+					used = 0;
+				}
+				masks[i] = caches[g];
+				++used;
+			}
+			break;
+		case PLACE_COMPACT:
+			g = home_of(nodes, nnodes);
+			for (i = 0; i < n; ++i) {
+				masks[i] = nodes[g];
+			}
+			break;
+		case PLACE_SPREAD:
+			sets = (nnodes > 1) ? nodes : caches;
+			nsets = (nnodes > 1) ? nnodes : ncaches;
+			g = home_of(sets, nsets);
+			for (i = 0; i < n; ++i) {
+				masks[i] = sets[(g + i) % nsets];
+			}
+			break;
+		default:			// PLACE_LIST, stage i on the i-th CPU
+			for (i = 0; i < n; ++i) {
+				CPU_ZERO(&masks[i]);
+				CPU_SET(nth_cpu(&placeList, i % CPU_COUNT(&placeList)), &masks[i]);
+			}
+	}
+
+	return 0;
+}
+
+/* Description: Moves the calling process or thread to the CPUs of its stage.
+ *				It is called by the stage, after fork or at the start of its
+ *				thread.
+ *
+ * Arguments:	stage:	Index of the stage in the pipeline
+ *
+ * Returns:		- On success, or if the stage is not placed,  0
+ * 				- On failure, -1 (check errno)
+ *
+ * Notes:		Only async signal safe calls are made.
+ */
+int place_enter(int stage) {
+	if (masks == NULL || stage >= nmasks) {
+		return 0;
+	}
+	return sched_setaffinity(0, sizeof(cpu_set_t), &masks[stage]);
+}
+
+/* Description: Frees the placement of the pipeline that ended.
+ *
+ * Returns:		void: Nothing
+ */
+void place_end(void) {
+	free(masks);
+	masks = NULL;
+	nmasks = 0;
+}
+
+/* Description: affinity [off | cache | compact | spread | CPULIST [--] [COMMAND
+ *						[ARG]...]]
+ *				Shows or sets how the stages of pipelines are placed on CPUs:
+ *				cache puts neighbouring stages on CPUs sharing a last level
+ *				cache (the default), compact the whole pipeline on the NUMA
+ *				node of the shell, spread every stage on another node (or
+ *				cache) and a CPULIST, e.g. 0-3,8, pins stage i to its i-th CPU.
+ *				With a COMMAND, runs it on the CPUs of CPULIST, so a single
+ *				stage can be placed inside a pipeline.
+ */
+int bi_affinity(int argc, char **argv, struct bi_ctx *ctx) {
+	cpu_set_t set;
+	char buf[256];
+	pid_t pid;
+	int i = 2, status;
+
+	if (argc == 1) {
+		place_format(buf, sizeof(buf));
+		if (topo_load() == -1) {
+			return bi_printf(ctx, "%s\n", buf) == -1 ? 1 : 0;
+		}
+		return bi_printf(ctx, "%s (%d cpus, %d cache%s, %d node%s)\n", buf,
+			CPU_COUNT(&allowed), ncaches, ncaches > 1 ? "s" : "", nnodes,
+			nnodes > 1 ? "s" : "") == -1 ? 1 : 0;
+	}
+
+	if (argc == 2) {
+		if (place_set(argv[1]) == -1) {
+			bi_error(ctx, "%s: not a mode or CPU list", argv[1]);
+			return 2;
+		}
+		return 0;
+	}
+
+	// Run a command on the CPUs of the list
+	if (cpulist_parse(argv[1], &set) == -1) {
+		bi_error(ctx, "%s: invalid CPU list", argv[1]);
+		return 2;
+	}
+	if (strcmp(argv[i], "--") == 0 && ++i == argc) {
+		bi_error(ctx, "usage: affinity CPULIST [--] COMMAND [ARG]...");
+		return 2;
+	}
+	if (ctx->in < 0 || ctx->out < 0 || ctx->err < 0) {
+		bi_error(ctx, "cannot run a command connected to a ring");
+		return 1;
+	}
+
+	if ((pid = fork_argv(argv + i, ctx->in, ctx->out, ctx->err, affinity_setup,
+		&set)) == -1) {
+		bi_error(ctx, "fork: %s", strerror(errno));
+		return 1;
+	}
+	if ((status = wait_argv(pid, NULL)) == -1) {
+		bi_error(ctx, "wait: %s", strerror(errno));
+		return 1;
+	}
+	return status;
+}
+
+// Moves the child of bi_affinity to its CPUs
+static int affinity_setup(void *arg) {
+	return sched_setaffinity(0, sizeof(cpu_set_t), (cpu_set_t *)arg);
+}
+
+// Finds the caches and nodes of the CPUs of the shell. Returns -1 if the CPUs
+// of the shell are unknown.
+static int topo_load(void) {
+	cpu_set_t set;
+	int cpu;
+
+	if (topoState != 0) {
+		return topoState == 1 ? 0 : -1;
+	}
+
+	topoState = -1;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1) {
+		return -1;
+	}
+
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (!CPU_ISSET(cpu, &allowed) || set_find(caches, ncaches, cpu) != -1) {
+			continue;
+		}
+		if (llc_of(cpu, &set) == -1) {	// Unknown, as if all shared one
+			ncaches = 0;
+			set = allowed;
+			set_add(&caches, &ncaches, &set);
+			break;
+		}
+		CPU_AND(&set, &set, &allowed);
+		CPU_SET(cpu, &set);
+		if (set_add(&caches, &ncaches, &set) == -1) {
+			return -1;
+		}
+	}
+
+	nodes_load();
+	topoState = 1;
+
+	return 0;
+}
+
+// Gets the CPUs sharing the last level cache of a CPU. Returns -1 if sysfs
+// does not tell.
+static int llc_of(int cpu, cpu_set_t *set) {
+	char path[128], buf[1024];
+	int i, level, top = 0;
+
+	for (i = 0; i < MAX_CACHE_INDEX; ++i) {
+		snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/level", cpu, i);
+		if (read_line(path, buf, sizeof(buf)) == -1) {
+			break;
+		}
+		if ((level = atoi(buf)) <= top) {
+			continue;
+		}
+		snprintf(path, sizeof(path), SYS_CPU "/cpu%d/cache/index%d/shared_cpu_list",
+			cpu, i);
+		if (read_line(path, buf, sizeof(buf)) == -1 || cpulist_parse(buf, set) == -1) {
+			continue;
+		}
+		top = level;
+	}
+
+	return top > 0 ? 0 : -1;
+}
+
+// Finds the CPUs of every NUMA node that has CPUs of the shell
+static void nodes_load(void) {
+	char path[300], buf[1024];
+	struct dirent *entry;
+	cpu_set_t set;
+	DIR *dir;
+
+	if ((dir = opendir(SYS_NODE)) == NULL) {
+		return;
+	}
+	while ((entry = readdir(dir)) != NULL) {
+		if (strncmp(entry->d_name, "node", 4) != 0 || entry->d_name[4] < '0' ||
+			entry->d_name[4] > '9') {
+			continue;
+		}
+		snprintf(path, sizeof(path), SYS_NODE "/%s/cpulist", entry->d_name);
+		if (read_line(path, buf, sizeof(buf)) == -1 || cpulist_parse(buf, &set) == -1) {
+			continue;
+		}
+		CPU_AND(&set, &set, &allowed);
+		if (CPU_COUNT(&set) > 0 && set_add(&nodes, &nnodes, &set) == -1) {
+			break;
+		}
+	}
+	closedir(dir);
+}
+
+// Appends a CPU set to an array. Returns -1 if out of memory.
+static int set_add(cpu_set_t **sets, int *n, const cpu_set_t *set) {
+	cpu_set_t *grown;
+
+	if ((grown = (cpu_set_t *)realloc(*sets, (*n + 1) * sizeof(cpu_set_t))) == NULL) {
+		return -1;
+	}
+	grown[(*n)++] = *set;
+	*sets = grown;
+
+	return 0;
+}
+
+// Finds the set that has a CPU. Returns -1 if none has it.
+static int set_find(const cpu_set_t *sets, int n, int cpu) {
+	int i;
+
+	for (i = 0; cpu >= 0 && i < n; ++i) {
+		if (CPU_ISSET(cpu, &sets[i])) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+// Finds the set that has the CPU the shell runs on, or else the first one
+static int home_of(const cpu_set_t *sets, int n) {
+	int g = set_find(sets, n, sched_getcpu());
+
+	return g == -1 ? 0 : g;
+}
+
+// Gives the n-th CPU of a set, counting from 0
+static int nth_cpu(const cpu_set_t *set, int n) {
+	int cpu;
+
+	for (cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, set) && n-- == 0) {
+			return cpu;
+		}
+	}
+	return 0;
+}
+
+// Converts a CPU list such as "0-3,8" to a set. Returns -1 if it is invalid or
+// has no CPU.
+static int cpulist_parse(const char *str, cpu_set_t *set) {
+	char *end;
+	long first, last;
+
+	CPU_ZERO(set);
+	while (*str != '\0' && *str != '\n') {
+		if (*str < '0' || *str > '9') {
+			return -1;
+		}
+		first = last = strtol(str, &end, 10);
+		if (*end == '-') {
+			if (end[1] < '0' || end[1] > '9') {
+				return -1;
+			}
+			last = strtol(end + 1, &end, 10);
+		}
+		if (first > last || last >= CPU_SETSIZE) {
+			return -1;
+		}
+		for (; first <= last; ++first) {
+			CPU_SET(first, set);
+		}
+
+		if (*end == ',') {
+			++end;
+		} else if (*end != '\0' && *end != '\n') {
+			return -1;
+		}
+		str = end;
+	}
+
+	return CPU_COUNT(set) > 0 ? 0 : -1;
+}
+
+// Writes a CPU set as a CPU list. Returns the length, as snprintf.
+static int cpulist_format(const cpu_set_t *set, char *buf, size_t size) {
+	size_t len = 0;
+	int cpu, last;
+
+	buf[0] = '\0';
+	for (cpu = 0; cpu < CPU_SETSIZE && len < size; ++cpu) {
+		if (!CPU_ISSET(cpu, set)) {
+			continue;
+		}
+		for (last = cpu; last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set); ++last)
+			;
+		if (last == cpu) {
+			len += snprintf(buf + len, size - len, "%s%d", len > 0 ? "," : "", cpu);
+		} else {
+			len += snprintf(buf + len, size - len, "%s%d-%d", len > 0 ? "," : "",
+				cpu, last);
+		}
+		cpu = last;
+	}
+
+	return (int)len;
+}
+
+// Reads the first line of a small file. Returns -1 if it cannot be read.
+static int read_line(const char *path, char *buf, size_t size) {
+	FILE *fp;
+	int found;
+
+	if ((fp = fopen(path, "re")) == NULL) {
+		return -1;
+	}
+	found = (fgets(buf, size, fp) != NULL) ? 0 : -1;
+	fclose(fp);
+
+	return found;
+}
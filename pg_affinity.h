@@ -0,0 +1,23 @@
+#ifndef PG_AFFINITY_H
+#define PG_AFFINITY_H
+
+#include <stddef.h>
+
+// Placement of the stages of a pipeline on CPUs
+enum PlaceMode {
+	PLACE_OFF,		// Left to the scheduler
+	PLACE_CACHE,	// Neighbouring stages share a last level cache
+	PLACE_COMPACT,	// The whole pipeline on the NUMA node of the shell
+	PLACE_SPREAD,	// Stages spread over nodes (or caches)
+	PLACE_LIST		// Stage i pinned to the i-th CPU of a list
+};
+
+extern enum PlaceMode pg_place;	// Placement of the pipelines of the session
+
+int place_set(const char *spec);
+int place_format(char *buf, size_t size);
+int place_begin(int n);
+int place_enter(int stage);
+void place_end(void);
+
+#endif
@@ -0,0 +1,352 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Aliases. The body of an alias is lexed once, when it is defined, and kept as
+ * a tokens array in an open addressing hash table (linear probing). The parser
+ * splices copies of these tokens in place of a word in the place of a command
+ * name (see pg_parse.c), so the text of a body is never lexed again.
+ * Plans are cached by the text of their line, so defining or removing an
+ * alias drops the cached plans, which may have been made with the old body.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pg_error.h"
+#include "pg_builtin.h"
+#include "pg_parse.h"
+#include "pg_plan.h"
+#include "pg_alias.h"
+
+#define ALIAS_SLOTS_MIN	64		// Initial size of the table, a power of two
+
+static struct alias **slots;	// Hash table
+static size_t nslots;			// Size of the table, a power of two
+static size_t nused;			// Slots that are not empty, deleted ones too
+static size_t naliases;			// Defined aliases
+static struct alias deleted;	// Slot of a removed alias
+
+unsigned long alias_splices;	// Aliases spliced into lines so far
+
+// Static Function Prototypes //
+static struct alias ** alias_slot(const char *name, unsigned long hash);
+static int alias_grow(void);
+static void alias_free(struct alias *a);
+static int alias_name_ok(const char *name, size_t len);
+static int alias_print(struct bi_ctx *ctx, const struct alias *a);
+static int alias_cmp(const void *a, const void *b);
+static unsigned long hash_name(const char *name, size_t len);
+
+/* Description: Finds an alias by its name.
+ *
+ * Arguments:	name:	Word in the place of a command name
+ *
+ * Returns:		- If it is an alias, the alias
+ * 				- Otherwise, NULL
+ *
+ * Notes:		The alias is only valid till the next alias_define or
+ *				alias_remove.
+ */
+struct alias * alias_find(const char *name) {
+	struct alias **slot;
+
+	if (naliases == 0 || name == NULL) {
+		return NULL;
+	}
+	slot = alias_slot(name, hash_name(name, strlen(name)));
+	return (*slot != NULL && *slot != &deleted) ? *slot : NULL;
+}
+
+/* Description: Defines an alias, or replaces the body of a defined one.
+ *
+ * Arguments:	name:	Alias name
+ *				text:	Body, lexed here
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL    : NULL pointer passed as an argument
+ *						# EARG     : Invalid name
+ *						# EPARSE   : A quote of the body was not closed
+ *						# EHEREDOC : The body has a here-document
+ *						# EUNKNOWN : Allocation error
+ */
+int alias_define(const char *name, const char *text) {
+	struct alias *a, **slot;
+	size_t len, tlen;
+	int i;
+
+	if (name == NULL || text == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+	len = strlen(name);
+	if (!alias_name_ok(name, len)) {
+		pg_errno = EARG;
+		return -1;
+	}
+
+	if ((a = (struct alias *)calloc(1, sizeof(struct alias))) == NULL) {
+		perror("calloc");
+		pg_errno = EUNKNOWN;
+		return -1;
+	}
+	if ((a->tokens = lex_line(text, &a->ntokens)) == NULL) {
+		free(a);
+		return -1;
+	}
+	--a->ntokens;		// TK_EOF is not spliced
+	for (i = 0; i < a->ntokens; ++i) {
+		if (a->tokens[i].type == TK_DLESS || a->tokens[i].type == TK_DLESSDASH) {
+			alias_free(a);		// The body would be on the lines after the alias
+			pg_errno = EHEREDOC;
+			return -1;
+		}
+	}
+	if ((a->name = strdup(name)) == NULL || (a->text = strdup(text)) == NULL) {
+		perror("strdup");
+		alias_free(a);
+		pg_errno = EUNKNOWN;
+		return -1;
+	}
+	tlen = strlen(text);
+	a->blank = (tlen > 0 && (text[tlen - 1] == ' ' || text[tlen - 1] == '\t'));
+	a->hash = hash_name(name, len);
+
+	if ((nused + 1) * 2 > nslots && alias_grow() == -1) {
+		alias_free(a);
+		pg_errno = EUNKNOWN;
+		return -1;
+	}
+	slot = alias_slot(name, a->hash);
+	if (*slot == NULL) {
+		++nused;
+	}
+	if (*slot != NULL && *slot != &deleted) {
+		alias_free(*slot);
+	} else {
+		++naliases;
+	}
+	*slot = a;
+
+	plan_flush();
+	return 0;
+}
+
+/* Description: Removes an alias.
+ *
+ * Arguments:	name:	Alias name
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG : There is no such alias
+ */
+int alias_remove(const char *name) {
+	struct alias **slot;
+
+	if (naliases == 0 || name == NULL) {
+		pg_errno = EARG;
+		return -1;
+	}
+	slot = alias_slot(name, hash_name(name, strlen(name)));
+	if (*slot == NULL || *slot == &deleted) {
+		pg_errno = EARG;
+		return -1;
+	}
+
+	alias_free(*slot);
+	*slot = &deleted;
+	--naliases;
+
+	plan_flush();
+	return 0;
+}
+
+/* Description: alias [NAME[=VALUE]]...
+ *				Defines aliases, or prints the named ones. Without arguments
+ *				prints every alias.
+ */
+int bi_alias(int argc, char **argv, struct bi_ctx *ctx) {
+	struct alias **all, *a;
+	const char *eq;
+	char *name;
+	size_t i, n = 0;
+	int status = 0;
+
+	if (argc == 1) {
+		if (naliases == 0) {
+			return 0;
+		}
+		if ((all = (struct alias **)malloc(naliases * sizeof(struct alias *))) == NULL) {
+			perror("malloc");
+			return 1;
+		}
+		for (i = 0; i < nslots; ++i) {
+			if (slots[i] != NULL && slots[i] != &deleted) {
+				all[n++] = slots[i];
+			}
+		}
+		qsort(all, n, sizeof(struct alias *), alias_cmp);
+		for (i = 0; i < n && alias_print(ctx, all[i]) != -1; ++i)
+			;
+		free(all);
+		return (i < n) ? 1 : 0;
+	}
+
+	for (i = 1; i < (size_t)argc; ++i) {
+		if ((eq = strchr(argv[i], '=')) == NULL) {
+			if ((a = alias_find(argv[i])) == NULL) {
+				bi_error(ctx, "%s: not found", argv[i]);
+				status = 1;
+			} else if (alias_print(ctx, a) == -1) {
+				return 1;
+			}
+			continue;
+		}
+
+		if ((name = strndup(argv[i], eq - argv[i])) == NULL) {
+			perror("strndup");
+			return 1;
+		}
+		if (alias_define(name, eq + 1) == -1) {
+			if (pg_errno == EARG) {
+				bi_error(ctx, "%s: invalid alias name", name);
+			} else if (pg_errno == EHEREDOC) {		// Quotes are reported by lex_line
+				bi_error(ctx, "%s: %s", name, pg_strerror(pg_errno));
+			}
+			status = 1;
+		}
+		free(name);
+	}
+
+	return status;
+}
+
+/* Description: unalias -a | NAME...
+ *				Removes aliases, every one with -a.
+ */
+int bi_unalias(int argc, char **argv, struct bi_ctx *ctx) {
+	size_t i;
+	int status = 0;
+
+	if (argc == 1) {
+		bi_error(ctx, "usage: unalias -a | NAME...");
+		return 2;
+	}
+
+	if (strcmp(argv[1], "-a") == 0) {
+		for (i = 0; i < nslots; ++i) {
+			if (slots[i] != NULL && slots[i] != &deleted) {
+				alias_free(slots[i]);
+			}
+		}
+		free(slots);
+		slots = NULL;
+		nslots = nused = naliases = 0;
+		plan_flush();
+		return 0;
+	}
+
+	for (i = 1; i < (size_t)argc; ++i) {
+		if (alias_remove(argv[i]) == -1) {
+			bi_error(ctx, "%s: not found", argv[i]);
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+// Finds the slot of an alias, or the empty slot it would take. The table
+// must exist.
+static struct alias ** alias_slot(const char *name, unsigned long hash) {
+	struct alias **tomb = NULL;		// First deleted slot on the way
+	size_t i;
+
+	for (i = hash & (nslots - 1); ; i = (i + 1) & (nslots - 1)) {
+		if (slots[i] == NULL) {
+			return tomb != NULL ? tomb : &slots[i];
+		}
+		if (slots[i] == &deleted) {
+			if (tomb == NULL) {
+				tomb = &slots[i];
+			}
+		} else if (slots[i]->hash == hash && strcmp(slots[i]->name, name) == 0) {
+			return &slots[i];
+		}
+	}
+}
+
+// Doubles the table (or creates it) and drops the deleted slots. Returns -1
+// on failure.
+static int alias_grow(void) {
+	struct alias **old = slots;
+	size_t oldn = nslots, i, j;
+
+	nslots = (oldn == 0) ? ALIAS_SLOTS_MIN : oldn * 2;
+	if ((slots = (struct alias **)calloc(nslots, sizeof(struct alias *))) == NULL) {
+		perror("calloc");
+		slots = old;
+		nslots = oldn;
+		return -1;
+	}
+
+	nused = 0;
+	for (i = 0; i < oldn; ++i) {
+		if (old[i] == NULL || old[i] == &deleted) {
+			continue;
+		}
+		for (j = old[i]->hash & (nslots - 1); slots[j] != NULL;
+			j = (j + 1) & (nslots - 1))
+			;
+		slots[j] = old[i];
+		++nused;
+	}
+	free(old);
+
+	return 0;
+}
+
+// Frees an alias and its tokens
+static void alias_free(struct alias *a) {
+	tokens_free(a->tokens, a->ntokens + 1);
+	free(a->name);
+	free(a->text);
+	free(a);
+}
+
+// Checks that an alias name has no quotes, expansions, operators or blanks
+static int alias_name_ok(const char *name, size_t len) {
+	return len > 0 && strcspn(name, " \t\n|&;<>()$`\\\"'=/") == len;
+}
+
+// Prints an alias the way it is defined, with its body in single quotes.
+// Returns -1 on failure.
+static int alias_print(struct bi_ctx *ctx, const struct alias *a) {
+	const char *p;
+
+	if (bi_printf(ctx, "alias %s='", a->name) == -1) {
+		return -1;
+	}
+	for (p = a->text; *p != '\0'; ++p) {
+		if ((*p == '\'' ? bi_printf(ctx, "'\\''") : bi_write(ctx, p, 1)) == -1) {
+			return -1;
+		}
+	}
+	return bi_printf(ctx, "'\n");
+}
+
+// Orders aliases by name, for qsort
+static int alias_cmp(const void *a, const void *b) {
+	return strcmp((*(struct alias * const *)a)->name,
+		(*(struct alias * const *)b)->name);
+}
+
+// Hashes an alias name (FNV-1a)
+static unsigned long hash_name(const char *name, size_t len) {
+	unsigned long hash = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash = (hash ^ (unsigned char)name[i]) * 16777619UL;
+	}
+	return hash;
+}
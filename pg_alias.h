@@ -0,0 +1,29 @@
+#ifndef PG_ALIAS_H
+#define PG_ALIAS_H
+
+#include "pg_builtin.h"
+#include "pg_parse.h"
+
+// Alias, its body is lexed once when it is defined
+struct alias {
+	char *name;
+	char *text;				// Body as it was given, for printing
+	struct token *tokens;	// Tokens of the body, without the TK_EOF token
+	int ntokens;
+	int blank;				// Body ends with a blank, the next word is a command
+	int active;				// Being spliced, not expanded again inside itself
+	unsigned long hash;
+};
+
+extern unsigned long alias_splices;	// Aliases spliced into lines so far
+
+// Function Prototypes
+
+struct alias * alias_find(const char *name);
+int alias_define(const char *name, const char *text);
+int alias_remove(const char *name);
+
+int bi_alias(int argc, char **argv, struct bi_ctx *ctx);
+int bi_unalias(int argc, char **argv, struct bi_ctx *ctx);
+
+#endif
@@ -0,0 +1,732 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Arithmetic of "$((expression))" and let, with 64 bit integers that wrap
+ * around. An expression is compiled once to a short program in reverse
+ * polish notation, numbers and variables pushed on a stack and operators
+ * applied to its top, and the program is cached by the text of the
+ * expression, so a loop evaluating the same expression does not parse it
+ * again. '&&', '||' and '?:' are jumps, so only the operand that is used is
+ * evaluated, along with its assignments.
+ * Operators are the ones of C, '**' is the power, and variables hold the
+ * numbers as text: unset or empty variables are 0.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include "pg_error.h"
+#include "pg_builtin.h"
+#include "pg_var.h"
+#include "pg_arith.h"
+
+#define ARITH_BUCKETS	64		// Hash table buckets
+#define ARITH_CACHE_MAX	256		// Cached expressions, dropped all at once past it
+#define ARITH_STACK		32		// Stack of most expressions, bigger ones allocate
+
+// Tokens of an expression. Binary operators are ordered as in enum ArithOp.
+enum ArithTok {
+	T_MUL, T_DIV, T_MOD, T_ADD, T_SUB, T_SHL, T_SHR, T_LT, T_LE, T_GT, T_GE,
+	T_EQ, T_NE, T_BAND, T_BXOR, T_BOR, T_POW, T_AND, T_OR,
+	T_END, T_NUM, T_NAME, T_LP, T_RP, T_QUEST, T_COLON, T_COMMA, T_INC, T_DEC,
+	T_NOT, T_BNOT, T_ASSIGN
+};
+
+// Instructions. The binary operators come first, in the order of their tokens.
+enum ArithOp {
+	A_MUL, A_DIV, A_MOD, A_ADD, A_SUB, A_SHL, A_SHR, A_LT, A_LE, A_GT, A_GE,
+	A_EQ, A_NE, A_BAND, A_BXOR, A_BOR, A_POW,
+	A_NUM,		// Push val
+	A_GET,		// Push a variable
+	A_SET,		// Set a variable to the top, after the binary operator in arg
+	A_INC,		// Add val to a variable, push the new value
+	A_POSTINC,	// Add val to a variable, push the old value
+	A_NEG, A_NOT, A_BNOT,
+	A_BOOL,		// Top to 0 or 1
+	A_POP,
+	A_JZ,		// Pop, jump to arg if it is 0
+	A_JNZ,		// Pop, jump to arg if it is not 0
+	A_JMP		// Jump to arg
+};
+
+// Instruction of a compiled expression
+struct aop {
+	int op;				// enum ArithOp
+	int arg;			// A_SET: binary operator or -1, jumps: target
+	int name;			// Variables: offset of the name in the text
+	int nlen;			// Variables: length of the name
+	long long val;		// A_NUM: number, A_INC and A_POSTINC: step
+};
+
+// Compiled expression, cached by its text
+struct arith_expr {
+	char *text;			// Expression, NUL terminated
+	size_t len;
+	unsigned long hash;
+	struct aop *code;
+	int ncode;
+	struct arith_expr *next;	// Hash chain
+};
+
+// Compiler state
+struct acomp {
+	const char *text;
+	const char *p;			// Position after the current token
+	const char *start;		// Start of the current token
+	int tok;				// enum ArithTok
+	int assign;				// The operator is followed by '=', as in "+="
+	long long val;			// T_NUM: value
+	const char *name;		// T_NAME: name
+	int nlen;
+	struct aop *code;
+	int n;
+	int cap;
+	const char *err;		// First error
+};
+
+// Operators, longer ones first
+static const struct {
+	const char *s;
+	int tok;
+} ops[] = {
+	{ "**", T_POW }, { "<<", T_SHL }, { ">>", T_SHR }, { "<=", T_LE },
+	{ ">=", T_GE }, { "==", T_EQ }, { "!=", T_NE }, { "&&", T_AND },
+	{ "||", T_OR }, { "++", T_INC }, { "--", T_DEC }, { "*", T_MUL },
+	{ "/", T_DIV }, { "%", T_MOD }, { "+", T_ADD }, { "-", T_SUB },
+	{ "<", T_LT }, { ">", T_GT }, { "&", T_BAND }, { "^", T_BXOR },
+	{ "|", T_BOR }, { "!", T_NOT }, { "~", T_BNOT }, { "=", T_ASSIGN },
+	{ "?", T_QUEST }, { ":", T_COLON }, { ",", T_COMMA }, { "(", T_LP },
+	{ ")", T_RP }, { NULL, 0 }
+};
+
+// Precedence of the binary operators, by token
+static const int precedence[] = {
+	10, 10, 10, 9, 9, 8, 8, 7, 7, 7, 7,		// * / % + - << >> < <= > >=
+	6, 6, 5, 4, 3, 11, 2, 1					// == != & ^ | ** && ||
+};
+
+static struct arith_expr *cache[ARITH_BUCKETS];
+static int ncached;
+
+// Static Function Prototypes //
+static struct arith_expr * arith_get(const char *text, size_t len);
+static int arith_run(const struct arith_expr *e, long long *value);
+static int binary(int op, long long a, long long b, long long *r);
+static const char * binary_error(int op);
+static int get_var(const char *name, int nlen, long long *value);
+static int set_var(const char *name, int nlen, long long value);
+static void next(struct acomp *c);
+static int emit(struct acomp *c, int op);
+static int emit_var(struct acomp *c, int op, const char *name, int nlen);
+static int parse_comma(struct acomp *c);
+static int parse_assign(struct acomp *c);
+static int parse_cond(struct acomp *c);
+static int parse_binary(struct acomp *c, int min);
+static int parse_unary(struct acomp *c);
+static int parse_primary(struct acomp *c);
+static int fail(struct acomp *c, const char *err);
+
+/* Description: Evaluates an arithmetic expression.
+ *
+ * Arguments:	text:	Expression, not necessarily NUL terminated
+ *				len:	Length of the expression
+ *				value:	Stores the value
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARITH : Bad expression, division by 0 or negative
+ *								   exponent (reported)
+ *
+ * Notes:		Assignments of the expression set shell variables. An empty
+ *				expression is 0.
+ */
+int arith_eval(const char *text, size_t len, long long *value) {
+	struct arith_expr *e;
+
+	if ((e = arith_get(text, len)) == NULL) {
+		pg_errno = EARITH;
+		return -1;
+	}
+	if (arith_run(e, value) == -1) {
+		pg_errno = EARITH;
+		return -1;
+	}
+	return 0;
+}
+
+/* Description: Drops the cached expressions.
+ *
+ * Returns:		void: Nothing
+ */
+void arith_clear(void) {
+	struct arith_expr *e, *next;
+	int i;
+
+	for (i = 0; i < ARITH_BUCKETS; ++i) {
+		for (e = cache[i]; e != NULL; e = next) {
+			next = e->next;
+			free(e->text);
+			free(e->code);
+			free(e);
+		}
+		cache[i] = NULL;
+	}
+	ncached = 0;
+}
+
+/* Description: let expression...
+ *				Evaluates expressions, exits with 0 if the last one is not 0.
+ */
+int bi_let(int argc, char **argv, struct bi_ctx *ctx) {
+	long long value = 0;
+	int i;
+
+	if (argc < 2) {
+		bi_error(ctx, "expression expected");
+		return 1;
+	}
+	for (i = 1; i < argc; ++i) {
+		if (arith_eval(argv[i], strlen(argv[i]), &value) == -1) {
+			return 1;
+		}
+	}
+	return value == 0;
+}
+
+// Finds the compiled expression of a text, compiling it if it is not
+// cached. Returns NULL on failure (reported).
+static struct arith_expr * arith_get(const char *text, size_t len) {
+	struct arith_expr *e;
+	struct acomp c;
+	unsigned long hash = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash = (hash ^ (unsigned char)text[i]) * 16777619UL;	// FNV-1a
+	}
+	for (e = cache[hash % ARITH_BUCKETS]; e != NULL; e = e->next) {
+		if (e->hash == hash && e->len == len && memcmp(e->text, text, len) == 0) {
+			return e;
+		}
+	}
+
+	if ((e = (struct arith_expr *)calloc(1, sizeof(struct arith_expr))) == NULL ||
+		(e->text = strndup(text, len)) == NULL) {
+		perror("malloc");
+		free(e);
+		return NULL;
+	}
+	e->len = len;
+	e->hash = hash;
+
+	memset(&c, 0, sizeof(c));
+	c.text = c.p = e->text;
+	next(&c);
+	if (c.tok != T_END) {
+		parse_comma(&c);
+		if (c.tok != T_END) {
+			fail(&c, "syntax error in expression");
+		}
+	} else {
+		emit(&c, A_NUM);		// Empty expression, 0
+	}
+	if (c.err != NULL) {
+		fprintf(stderr, "pgsh: %s: %s (error token is \"%s\")\n", e->text, c.err,
+			c.start);
+		free(c.code);
+		free(e->text);
+		free(e);
+		return NULL;
+	}
+	e->code = c.code;
+	e->ncode = c.n;
+
+	if (ncached >= ARITH_CACHE_MAX) {
+		arith_clear();
+	}
+	e->next = cache[hash % ARITH_BUCKETS];
+	cache[hash % ARITH_BUCKETS] = e;
+	++ncached;
+
+	return e;
+}
+
+// Runs a compiled expression. Returns -1 on failure (reported).
+static int arith_run(const struct arith_expr *e, long long *value) {
+	long long small[ARITH_STACK];
+	long long *stack = small;
+	long long a;
+	const struct aop *op;
+	int sp = 0, pc, status = 0;
+
+	// No instruction pushes more than one value
+	if (e->ncode > ARITH_STACK &&
+		(stack = (long long *)malloc(e->ncode * sizeof(long long))) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (pc = 0; pc < e->ncode && status == 0; ++pc) {
+		op = &e->code[pc];
+		switch (op->op) {
+			case A_NUM:
+				stack[sp++] = op->val;
+				break;
+			case A_GET:
+				status = get_var(e->text + op->name, op->nlen, &stack[sp++]);
+				break;
+			case A_SET:
+				if (op->arg != -1) {		// Compound assignment
+					if ((status = get_var(e->text + op->name, op->nlen, &a)) == -1) {
+						break;
+					}
+					if ((status = binary(op->arg, a, stack[sp - 1], &stack[sp - 1])) == -1) {
+						fprintf(stderr, "pgsh: %s: %s\n", e->text, binary_error(op->arg));
+						break;
+					}
+				}
+				status = set_var(e->text + op->name, op->nlen, stack[sp - 1]);
+				break;
+			case A_INC:
+			case A_POSTINC:
+				if ((status = get_var(e->text + op->name, op->nlen, &a)) == 0) {
+					stack[sp++] = (op->op == A_INC) ?
+						(long long)((unsigned long long)a + op->val) : a;
+					status = set_var(e->text + op->name, op->nlen,
+						(long long)((unsigned long long)a + op->val));
+				}
+				break;
+			case A_NEG:
+				stack[sp - 1] = (long long)(0ULL - (unsigned long long)stack[sp - 1]);
+				break;
+			case A_NOT:
+				stack[sp - 1] = !stack[sp - 1];
+				break;
+			case A_BNOT:
+				stack[sp - 1] = ~stack[sp - 1];
+				break;
+			case A_BOOL:
+				stack[sp - 1] = stack[sp - 1] != 0;
+				break;
+			case A_POP:
+				--sp;
+				break;
+			case A_JZ:
+				if (stack[--sp] == 0) {
+					pc = op->arg - 1;
+				}
+				break;
+			case A_JNZ:
+				if (stack[--sp] != 0) {
+					pc = op->arg - 1;
+				}
+				break;
+			case A_JMP:
+				pc = op->arg - 1;
+				break;
+			default:		// Binary operators
+				--sp;
+				status = binary(op->op, stack[sp - 1], stack[sp], &stack[sp - 1]);
+				if (status == -1) {
+					fprintf(stderr, "pgsh: %s: %s\n", e->text, binary_error(op->op));
+				}
+				break;
+		}
+	}
+
+	if (status == 0) {
+		*value = stack[sp - 1];
+	}
+	if (stack != small) {
+		free(stack);
+	}
+	return status;
+}
+
+// Applies a binary operator, wrapping around on overflow. Returns -1 on a
+// division by 0 or a negative exponent (see binary_error).
+static int binary(int op, long long a, long long b, long long *r) {
+	unsigned long long ua = (unsigned long long)a, ub = (unsigned long long)b;
+	unsigned long long p;
+
+	switch (op) {
+		case A_MUL:		*r = (long long)(ua * ub);		break;
+		case A_ADD:		*r = (long long)(ua + ub);		break;
+		case A_SUB:		*r = (long long)(ua - ub);		break;
+		case A_SHL:		*r = (long long)(ua << (ub & 63));	break;
+		case A_SHR:		*r = a >> (ub & 63);			break;
+		case A_LT:		*r = a < b;						break;
+		case A_LE:		*r = a <= b;					break;
+		case A_GT:		*r = a > b;						break;
+		case A_GE:		*r = a >= b;					break;
+		case A_EQ:		*r = a == b;					break;
+		case A_NE:		*r = a != b;					break;
+		case A_BAND:	*r = a & b;						break;
+		case A_BXOR:	*r = a ^ b;						break;
+		case A_BOR:		*r = a | b;						break;
+		case A_DIV:
+		case A_MOD:
+			if (b == 0) {
+				return -1;
+			}
+			if (b == -1) {		// LLONG_MIN / -1 overflows
+				*r = (op == A_DIV) ? (long long)(0ULL - ua) : 0;
+			} else {
+				*r = (op == A_DIV) ? a / b : a % b;
+			}
+			break;
+		case A_POW:
+			if (b < 0) {
+				return -1;
+			}
+			for (p = 1; ub > 0; ub >>= 1, ua *= ua) {
+				if (ub & 1) {
+					p *= ua;
+				}
+			}
+			*r = (long long)p;
+			break;
+	}
+	return 0;
+}
+
+// Returns the message of an operator binary failed on
+static const char * binary_error(int op) {
+	return (op == A_POW) ? "exponent less than 0" : "division by 0";
+}
+
+// Reads the number of a variable, 0 if it is unset or empty. Returns -1 if
+// the value is not a number (reported).
+static int get_var(const char *name, int nlen, long long *value) {
+	char num[24];
+	const char *s = var_param(name, nlen, num);
+	char *end;
+
+	if (s == NULL) {
+		*value = 0;
+		return 0;
+	}
+	while (isspace((unsigned char)*s)) {
+		++s;
+	}
+	if (*s == '\0') {
+		*value = 0;
+		return 0;
+	}
+
+	errno = 0;
+	*value = (*s == '-') ? (long long)(0ULL - strtoull(s + 1, &end, 0)) :
+		(long long)strtoull(s + (*s == '+'), &end, 0);
+	while (isspace((unsigned char)*end)) {
+		++end;
+	}
+	if (*end != '\0' || errno != 0) {
+		fprintf(stderr, "pgsh: %.*s: %s: not a number\n", nlen, name, s);
+		return -1;
+	}
+	return 0;
+}
+
+// Sets a variable to a number. Returns -1 on failure (reported).
+static int set_var(const char *name, int nlen, long long value) {
+	char num[24];
+
+	snprintf(num, sizeof(num), "%lld", value);
+	if (var_set(name, nlen, num, 0) == -1) {
+		fprintf(stderr, "pgsh: %.*s: cannot assign\n", nlen, name);
+		return -1;
+	}
+	return 0;
+}
+
+// Reads the next token
+static void next(struct acomp *c) {
+	unsigned long long v;
+	const char *p = c->p;
+	char *end;
+	size_t len;
+	int i;
+
+	while (isspace((unsigned char)*p)) {
+		++p;
+	}
+	c->start = p;
+	c->assign = 0;
+
+	if (*p == '\0') {
+		c->tok = T_END;
+	} else if (isdigit((unsigned char)*p)) {
+		errno = 0;
+		v = strtoull(p, &end, 0);
+		if (errno != 0 || isalnum((unsigned char)*end) || *end == '_') {
+			fail(c, "invalid number");
+			c->tok = T_END;
+			return;
+		}
+		c->tok = T_NUM;
+		c->val = (long long)v;
+		p = end;
+	} else if ((len = var_name_len(p + (*p == '$'))) > 0 ||
+		(p[0] == '$' && p[1] == '{' && (len = var_name_len(p + 2)) > 0 &&
+		p[len + 2] == '}') ||
+		(p[0] == '$' && p[1] != '\0' && strchr("?$#", p[1]) != NULL)) {
+		// NAME, $NAME, ${NAME} or a special parameter
+		c->tok = T_NAME;
+		if (*p == '$' && p[1] == '{') {
+			c->name = p + 2;
+			c->nlen = (int)len;
+			p += len + 3;
+		} else if (*p == '$' && len == 0) {
+			c->name = p + 1;
+			c->nlen = 1;
+			p += 2;
+		} else {
+			c->name = p + (*p == '$');
+			c->nlen = (int)len;
+			p = c->name + len;
+		}
+	} else {
+		for (i = 0; ops[i].s != NULL; ++i) {
+			len = strlen(ops[i].s);
+			if (strncmp(p, ops[i].s, len) == 0) {
+				break;
+			}
+		}
+		if (ops[i].s == NULL) {
+			fail(c, "syntax error: invalid arithmetic operator");
+			c->tok = T_END;
+			return;
+		}
+		c->tok = ops[i].tok;
+		p += len;
+		// Compound assignment, "+=" and the like
+		if (c->tok < T_POW && c->tok != T_LT && c->tok != T_LE && c->tok != T_GT &&
+			c->tok != T_GE && c->tok != T_EQ && c->tok != T_NE && *p == '=' &&
+			p[1] != '=') {
+			c->assign = 1;
+			++p;
+		}
+	}
+	c->p = p;
+}
+
+// Appends an instruction. Returns its index, -1 on failure.
+static int emit(struct acomp *c, int op) {
+	struct aop *tmp;
+
+	if (c->n == c->cap) {
+		c->cap = (c->cap == 0) ? 16 : c->cap * 2;
+		tmp = (struct aop *)realloc(c->code, c->cap * sizeof(struct aop));
+		if (tmp == NULL) {
+			perror("realloc");
+			return fail(c, "out of memory");
+		}
+		c->code = tmp;
+	}
+	memset(&c->code[c->n], 0, sizeof(struct aop));
+	c->code[c->n].op = op;
+	c->code[c->n].arg = -1;
+	return c->n++;
+}
+
+// Appends an instruction on a variable. Returns its index, -1 on failure.
+static int emit_var(struct acomp *c, int op, const char *name, int nlen) {
+	int i;
+
+	if ((i = emit(c, op)) != -1) {
+		c->code[i].name = (int)(name - c->text);
+		c->code[i].nlen = nlen;
+	}
+	return i;
+}
+
+// expression , expression ...
+static int parse_comma(struct acomp *c) {
+	if (parse_assign(c) == -1) {
+		return -1;
+	}
+	while (c->tok == T_COMMA) {
+		next(c);
+		if (emit(c, A_POP) == -1 || parse_assign(c) == -1) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// NAME = expression, NAME op= expression, or a conditional expression
+static int parse_assign(struct acomp *c) {
+	const char *start = c->start, *name = c->name;
+	int nlen = c->nlen, i, bop;
+
+	if (c->tok == T_NAME) {
+		next(c);
+		if (c->tok == T_ASSIGN || c->assign) {
+			bop = (c->tok == T_ASSIGN) ? -1 : c->tok;	// Tokens match the ops
+			if (var_name_len(name) != (size_t)nlen) {
+				return fail(c, "cannot assign to a special parameter");
+			}
+			next(c);
+			if (parse_assign(c) == -1 || (i = emit_var(c, A_SET, name, nlen)) == -1) {
+				return -1;
+			}
+			c->code[i].arg = bop;
+			return 0;
+		}
+		c->p = start;		// Not an assignment, read the name again
+		next(c);
+	}
+	return parse_cond(c);
+}
+
+// condition ? expression : expression
+static int parse_cond(struct acomp *c) {
+	int jz, jmp;
+
+	if (parse_binary(c, 1) == -1) {
+		return -1;
+	}
+	if (c->tok != T_QUEST) {
+		return 0;
+	}
+
+	next(c);
+	if ((jz = emit(c, A_JZ)) == -1 || parse_assign(c) == -1) {
+		return -1;
+	}
+	if (c->tok != T_COLON) {
+		return fail(c, "`:' expected for conditional expression");
+	}
+	next(c);
+	if ((jmp = emit(c, A_JMP)) == -1) {
+		return -1;
+	}
+	c->code[jz].arg = c->n;
+	if (parse_cond(c) == -1) {
+		return -1;
+	}
+	c->code[jmp].arg = c->n;
+	return 0;
+}
+
+// Binary operators of precedence min or higher (precedence climbing)
+static int parse_binary(struct acomp *c, int min) {
+	int tok, prec, jump, end;
+
+	if (parse_unary(c) == -1) {
+		return -1;
+	}
+
+	while (c->tok <= T_OR && !c->assign && (prec = precedence[c->tok]) >= min) {
+		tok = c->tok;
+		next(c);
+
+		if (tok == T_AND || tok == T_OR) {
+			if ((jump = emit(c, tok == T_AND ? A_JZ : A_JNZ)) == -1 ||
+				parse_binary(c, prec + 1) == -1 || emit(c, A_BOOL) == -1 ||
+				(end = emit(c, A_JMP)) == -1) {
+				return -1;
+			}
+			c->code[jump].arg = c->n;
+			if ((jump = emit(c, A_NUM)) == -1) {
+				return -1;
+			}
+			c->code[jump].val = (tok == T_OR);		// The value it jumped on
+			c->code[end].arg = c->n;
+			continue;
+		}
+
+		// '**' groups from the right
+		if (parse_binary(c, tok == T_POW ? prec : prec + 1) == -1 ||
+			emit(c, tok) == -1) {		// Tokens match the ops
+			return -1;
+		}
+	}
+	return 0;
+}
+
+// Unary operators: + - ! ~ ++NAME --NAME
+static int parse_unary(struct acomp *c) {
+	int tok = c->tok, i;
+
+	if (c->assign) {
+		return fail(c, "attempted assignment to non-variable");
+	}
+
+	switch (tok) {
+		case T_ADD:
+		case T_SUB:
+		case T_NOT:
+		case T_BNOT:
+			next(c);
+			if (parse_unary(c) == -1) {
+				return -1;
+			}
+			if (tok == T_ADD) {
+				return 0;
+			}
+			return emit(c, tok == T_SUB ? A_NEG : tok == T_NOT ? A_NOT : A_BNOT) == -1 ?
+				-1 : 0;
+		case T_INC:
+		case T_DEC:
+			next(c);
+			if (c->tok != T_NAME) {
+				return fail(c, "variable expected after ++ or --");
+			}
+			if ((i = emit_var(c, A_INC, c->name, c->nlen)) == -1) {
+				return -1;
+			}
+			c->code[i].val = (tok == T_INC) ? 1 : -1;
+			next(c);
+			return 0;
+		default:
+			return parse_primary(c);
+	}
+}
+
+// Numbers, variables, NAME++, NAME-- and ( expression )
+static int parse_primary(struct acomp *c) {
+	int i;
+
+	switch (c->tok) {
+		case T_NUM:
+			if ((i = emit(c, A_NUM)) == -1) {
+				return -1;
+			}
+			c->code[i].val = c->val;
+			next(c);
+			return 0;
+		case T_NAME:
+			if ((i = emit_var(c, A_GET, c->name, c->nlen)) == -1) {
+				return -1;
+			}
+			next(c);
+			if (c->tok == T_INC || c->tok == T_DEC) {
+				c->code[i].op = A_POSTINC;
+				c->code[i].val = (c->tok == T_INC) ? 1 : -1;
+				next(c);
+			}
+			return 0;
+		case T_LP:
+			next(c);
+			if (parse_comma(c) == -1) {
+				return -1;
+			}
+			if (c->tok != T_RP) {
+				return fail(c, "missing `)'");
+			}
+			next(c);
+			return 0;
+		default:
+			return fail(c, "syntax error: operand expected");
+	}
+}
+
+// Keeps the first error of an expression. Returns -1.
+static int fail(struct acomp *c, const char *err) {
+	if (c->err == NULL) {
+		c->err = err;
+	}
+	return -1;
+}
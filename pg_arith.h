@@ -0,0 +1,14 @@
+#ifndef PG_ARITH_H
+#define PG_ARITH_H
+
+#include <stddef.h>
+#include "pg_builtin.h"
+
+// Function Prototypes
+
+int arith_eval(const char *text, size_t len, long long *value);
+void arith_clear(void);
+
+int bi_let(int argc, char **argv, struct bi_ctx *ctx);
+
+#endif
@@ -0,0 +1,343 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Commands built into the shell. A builtin that is a command of its own runs in
+ * the shell process, with its redirections resolved to descriptors instead of
+ * being applied, so it costs no fork. A builtin inside a pipeline runs in a
+ * thread of the shell, connected to neighbouring builtins by rings and to
+ * external commands by pipes. Builtins only do I/O through the bi_ functions.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <unistd.h>
+#include "pg_error.h"
+#include "pg_file.h"
+#include "pg_plan.h"
+#include "pg_string.h"
+#include "pg_ring.h"
+#include "processes.h"
+#include "pg_builtin.h"
+#include "pg_var.h"		// bi_export(), bi_unset()
+#include "pg_arith.h"	// bi_let()
+#include "pg_alias.h"	// bi_alias(), bi_unalias()
+#include "pg_stat.h"	// bi_pgstat()
+
+// Static Function Prototypes //
+static int write_all(struct bi_ctx *ctx, int fd, const void *buf, size_t len);
+
+// Builtins, sorted by name
+static const struct builtin builtins[] = {
+	{ "affinity",	bi_affinity,	NULL,					BI_PROCESS },
+	{ "alias",		bi_alias,		NULL,					BI_PROCESS },
+	{ "cat",		bi_cat,			bi_cat_accepts,			0 },
+	{ "deadline",	bi_deadline,	NULL,					BI_PROCESS },
+	{ "export",		bi_export,		NULL,					BI_PROCESS },
+	{ "grep",		bi_grep,		bi_grep_accepts,		0 },
+	{ "head",		bi_head,		bi_head_accepts,		0 },
+	{ "let",		bi_let,			NULL,					BI_PROCESS },
+	{ "limit",		bi_limit,		NULL,					BI_PROCESS },
+	{ "parallel",	bi_parallel,	bi_parallel_accepts,	0 },
+	{ "pgstat",		bi_pgstat,		NULL,					BI_PROCESS },
+	{ "pipesize",	bi_pipesize,	NULL,					BI_PROCESS },
+	{ "pipestat",	bi_pipestat,	NULL,					0 },
+	{ "tail",		bi_tail,		bi_tail_accepts,		0 },
+	{ "timeout",	bi_timeout,		bi_timeout_accepts,		BI_PROCESS },
+	{ "tr",			bi_tr,			bi_tr_accepts,			0 },
+	{ "unalias",	bi_unalias,		NULL,					BI_PROCESS },
+	{ "unset",		bi_unset,		NULL,					BI_PROCESS },
+	{ "wc",			bi_wc,			bi_wc_accepts,			0 },
+	{ "xargs",		bi_xargs,		bi_xargs_accepts,		0 }
+};
+
+#define NBUILTINS (int)(sizeof(builtins) / sizeof(builtins[0]))
+
+/* Description: Finds a builtin by its name.
+ *
+ * Arguments:	name:	Command name
+ *
+ * Returns:		- If it is a builtin, the builtin
+ * 				- Otherwise, NULL
+ */
+const struct builtin * builtin_find(const char *name) {
+	int low = 0, high = NBUILTINS - 1, mid, cmp;
+	
+	if (name == NULL) {
+		return NULL;
+	}
+	
+	while (low <= high) {
+		mid = (low + high) / 2;
+		cmp = strcmp(name, builtins[mid].name);
+		if (cmp == 0) {
+			return &builtins[mid];
+		}
+		if (cmp < 0) {
+			high = mid - 1;
+		} else {
+			low = mid + 1;
+		}
+	}
+	
+	return NULL;
+}
+
+/* Description: Finds the builtin that runs a planned command.
+ *
+ * Arguments:	cmd:	Planned command
+ *
+ * Returns:		- If a builtin handles the command and its arguments, the builtin
+ * 				- Otherwise, NULL (the command is external)
+ */
+const struct builtin * builtin_for(const struct plan_cmd *cmd) {
+	const struct builtin *bi;
+	
+	if (cmd->argc == 0 || (bi = builtin_find(cmd->argv[0])) == NULL) {
+		return NULL;
+	}
+	if (bi->accepts != NULL && !bi->accepts(cmd->argc, cmd->argv)) {
+		return NULL;
+	}
+	return bi;
+}
+
+/* Description: Runs a builtin command inside the shell.
+ *
+ * Arguments:	bi:		Builtin
+ *				cmd:	Planned command
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EFCHLD: The builtin returned a non zero status
+ *						# EOPEN : A redirection file could not be opened
+ *
+ * Notes:		The exit status is stored to pg_status.
+ */
+int builtin_exec(const struct builtin *bi, const struct plan_cmd *cmd) {
+	struct bi_ctx ctx;
+	int fds[3] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+	int opened[FD_OPS_MAX];
+	int nopened;
+	
+	if (fd_resolve(cmd->redirs, cmd->nredirs, fds, opened, &nopened) == -1) {
+		pg_status = 1;
+		return -1;
+	}
+	
+	ctx.in = fds[0];
+	ctx.out = fds[1];
+	ctx.err = fds[2];
+	ctx.rin = NULL;
+	ctx.rout = NULL;
+	ctx.broken = 0;
+	ctx.name = cmd->argv[0];
+	
+	pg_status = bi->func(cmd->argc, cmd->argv, &ctx);
+	
+	while (nopened > 0) {
+		close(opened[--nopened]);
+	}
+	
+	if (pg_status != 0) {
+		pg_errno = EFCHLD;
+		return -1;
+	}
+	return 0;
+}
+
+/* Description: Runs a builtin command in a child whose descriptors are already
+ *				set up.
+ *
+ * Arguments:	bi:		Builtin
+ *				cmd:	Planned command
+ *
+ * Returns:		The exit status of the builtin
+ */
+int builtin_child(const struct builtin *bi, const struct plan_cmd *cmd) {
+	struct bi_ctx ctx;
+	
+	ctx.in = STDIN_FILENO;
+	ctx.out = STDOUT_FILENO;
+	ctx.err = STDERR_FILENO;
+	ctx.rin = NULL;
+	ctx.rout = NULL;
+	ctx.broken = 0;
+	ctx.name = cmd->argv[0];
+	
+	return bi->func(cmd->argc, cmd->argv, &ctx);
+}
+
+/* Description: Reads the standard input of a builtin.
+ *
+ * Returns:		- On success, number of bytes read (0 at end of input)
+ * 				- On failure, -1 (check errno)
+ */
+ssize_t bi_read(struct bi_ctx *ctx, void *buf, size_t len) {
+	ssize_t n;
+	
+	if (ctx->in == BI_RING_IN) {
+		return ring_read(ctx->rin, buf, len);
+	}
+	
+	do {
+		n = read(ctx->in, buf, len);
+	} while (n == -1 && errno == EINTR);
+	
+	return n;
+}
+
+/* Description: Writes all the given bytes to the standard output of a builtin.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (check errno)
+ */
+int bi_write(struct bi_ctx *ctx, const void *buf, size_t len) {
+	if (write_all(ctx, ctx->out, buf, len) == -1) {
+		if (errno == EPIPE) {
+			ctx->broken = 1;	// Like a process killed by SIGPIPE
+		}
+		return -1;
+	}
+	return 0;
+}
+
+// Writes all the bytes to a descriptor of a builtin, which may be a ring
+static int write_all(struct bi_ctx *ctx, int fd, const void *buf, size_t len) {
+	const char *p = (const char *)buf;
+	ssize_t n;
+	
+	if (fd == BI_RING_OUT) {
+		return ring_write(ctx->rout, buf, len) == -1 ? -1 : 0;
+	}
+	
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		p += n;
+		len -= n;
+	}
+	
+	return 0;
+}
+
+/* Description: Formatted output to the standard output of a builtin.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+int bi_printf(struct bi_ctx *ctx, const char *format, ...) {
+	char buf[1024];
+	va_list args;
+	int len;
+	
+	va_start(args, format);
+	len = vsnprintf(buf, sizeof(buf), format, args);
+	va_end(args);
+	
+	if (len < 0) {
+		return -1;
+	}
+	if (len >= (int)sizeof(buf)) {
+		len = sizeof(buf) - 1;
+	}
+	
+	return bi_write(ctx, buf, len);
+}
+
+/* Description: Reports an error of a builtin to its standard error, prefixed by
+ *				the builtin's name.
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		Nothing is reported once the output reader is gone.
+ */
+void bi_error(struct bi_ctx *ctx, const char *format, ...) {
+	char buf[1024];
+	va_list args;
+	int len;
+	
+	len = snprintf(buf, sizeof(buf), "%s: ", ctx->name);
+	va_start(args, format);
+	vsnprintf(buf + len, sizeof(buf) - len - 1, format, args);
+	va_end(args);
+	strcat(buf, "\n");
+	
+	if (!ctx->broken && ctx->err != -1) {
+		write_all(ctx, ctx->err, buf, strlen(buf));
+	}
+}
+
+/* Description: pipesize [SIZE]
+ *				Shows or sets the buffer size of the pipes created for pipelines.
+ *				SIZE takes a K, M or G suffix and 0 restores the kernel default.
+ *				A single pipe is sized with the "|{SIZE}" operator instead.
+ */
+int bi_pipesize(int argc, char **argv, struct bi_ctx *ctx) {
+	long size;
+	
+	if (argc > 2) {
+		bi_error(ctx, "usage: pipesize [SIZE]");
+		return 2;
+	}
+	
+	if (argc == 1) {
+		if (pg_pipe_size == 0) {
+			return bi_printf(ctx, "default\n") == -1 ? 1 : 0;
+		}
+		return bi_printf(ctx, "%ld\n", pg_pipe_size) == -1 ? 1 : 0;
+	}
+	
+	if (strtosize(argv[1], &size) == -1) {
+		bi_error(ctx, "%s: invalid size", argv[1]);
+		return 2;
+	}
+	pg_pipe_size = size;
+	
+	return 0;
+}
+
+/* Description: pipestat
+ *				Shows the context switches and CPU time of every stage of the
+ *				last pipeline, along with the size of the pipe (or ring) it
+ *				wrote to. Builtin stages are shown as threads.
+ */
+int bi_pipestat(int argc, char **argv, struct bi_ctx *ctx) {
+	const struct stage_stat *st;
+	long vcsw = 0, ivcsw = 0;
+	int n, i;
+	
+	(void)argv;
+	if (argc > 1) {
+		bi_error(ctx, "usage: pipestat");
+		return 2;
+	}
+	
+	st = pipe_stats(&n);
+	if (n == 0) {
+		return 0;
+	}
+	
+	bi_printf(ctx, "%-8s %10s %10s %10s %9s %9s  %s\n", "PID", "PIPE", "VCSW",
+		"IVCSW", "USER(ms)", "SYS(ms)", "COMMAND");
+	for (i = 0; i < n; ++i) {
+		if (st[i].pid > 0) {
+			bi_printf(ctx, "%-8d ", (int)st[i].pid);
+		} else {
+			bi_printf(ctx, "%-8s ", "thread");
+		}
+		bi_printf(ctx, "%10ld %10ld %10ld %9ld %9ld  %s\n", st[i].pipesize,
+			st[i].vcsw, st[i].ivcsw, st[i].utime, st[i].stime, st[i].name);
+		vcsw += st[i].vcsw;
+		ivcsw += st[i].ivcsw;
+	}
+	
+	return bi_printf(ctx, "%-8s %10s %10ld %10ld\n", "total", "", vcsw, ivcsw)
+		== -1 ? 1 : 0;
+}
@@ -0,0 +1,73 @@
+#ifndef PG_BUILTIN_H
+#define PG_BUILTIN_H
+
+#include <sys/types.h>
+
+struct plan_cmd;
+struct ring;
+
+// Descriptor values of a builtin stage connected to a ring instead of a pipe
+#define BI_RING_IN	(-2)	// Standard input is the ring rin
+#define BI_RING_OUT	(-3)	// Standard output (or error) is the ring rout
+
+// Standard descriptors of a running builtin
+struct bi_ctx {
+	int in;				// Standard input
+	int out;			// Standard output
+	int err;			// Standard error
+	struct ring *rin;	// Input ring (BI_RING_IN)
+	struct ring *rout;	// Output ring (BI_RING_OUT)
+	int broken;			// Output reader is gone, errors are not reported
+	const char *name;	// Name the builtin was called with
+};
+
+// Builtin command, returns its exit status
+typedef int (*builtin_func)(int argc, char **argv, struct bi_ctx *ctx);
+
+// Flags of a builtin
+#define BI_PROCESS	1	// Runs as a process, not a thread, in a pipeline
+
+struct builtin {
+	const char *name;
+	builtin_func func;
+	int (*accepts)(int argc, char **argv);	// Arguments it handles (NULL: all)
+	int flags;
+};
+
+// Function Prototypes
+
+const struct builtin * builtin_find(const char *name);
+const struct builtin * builtin_for(const struct plan_cmd *cmd);
+int builtin_exec(const struct builtin *bi, const struct plan_cmd *cmd);
+int builtin_child(const struct builtin *bi, const struct plan_cmd *cmd);
+ssize_t bi_read(struct bi_ctx *ctx, void *buf, size_t len);
+int bi_write(struct bi_ctx *ctx, const void *buf, size_t len);
+int bi_printf(struct bi_ctx *ctx, const char *format, ...);
+void bi_error(struct bi_ctx *ctx, const char *format, ...);
+
+// Builtins
+int bi_affinity(int argc, char **argv, struct bi_ctx *ctx);
+int bi_cat(int argc, char **argv, struct bi_ctx *ctx);
+int bi_cat_accepts(int argc, char **argv);
+int bi_deadline(int argc, char **argv, struct bi_ctx *ctx);
+int bi_grep(int argc, char **argv, struct bi_ctx *ctx);
+int bi_grep_accepts(int argc, char **argv);
+int bi_head(int argc, char **argv, struct bi_ctx *ctx);
+int bi_head_accepts(int argc, char **argv);
+int bi_limit(int argc, char **argv, struct bi_ctx *ctx);
+int bi_parallel(int argc, char **argv, struct bi_ctx *ctx);
+int bi_parallel_accepts(int argc, char **argv);
+int bi_pipesize(int argc, char **argv, struct bi_ctx *ctx);
+int bi_pipestat(int argc, char **argv, struct bi_ctx *ctx);
+int bi_tail(int argc, char **argv, struct bi_ctx *ctx);
+int bi_tail_accepts(int argc, char **argv);
+int bi_timeout(int argc, char **argv, struct bi_ctx *ctx);
+int bi_timeout_accepts(int argc, char **argv);
+int bi_tr(int argc, char **argv, struct bi_ctx *ctx);
+int bi_tr_accepts(int argc, char **argv);
+int bi_wc(int argc, char **argv, struct bi_ctx *ctx);
+int bi_wc_accepts(int argc, char **argv);
+int bi_xargs(int argc, char **argv, struct bi_ctx *ctx);
+int bi_xargs_accepts(int argc, char **argv);
+
+#endif
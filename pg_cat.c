@@ -0,0 +1,269 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * The cat builtin. Data is moved between descriptors by the kernel whenever the
+ * descriptor types allow it: copy_file_range between regular files, sendfile
+ * from a regular file and splice to or from a pipe. Other descriptors, and any
+ * case the kernel refuses, fall back to read and write through one buffer.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE		// copy_file_range(), splice()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include "pg_error.h"
+#include "pg_builtin.h"
+#include "pg_cat.h"
+
+#define COPY_BUFSIZE	(128 * 1024)	// Buffer of the read and write fallback
+#define COPY_CHUNK		(1L << 30)		// Bytes asked from the kernel per call
+
+// Ways of moving data, fastest first
+enum CopyMethod {
+	CP_RANGE,		// copy_file_range, file to file
+	CP_SENDFILE,	// sendfile, file to anything
+	CP_SPLICE,		// splice, to or from a pipe
+	CP_RW			// read and write
+};
+
+// Static Function Prototypes //
+static ssize_t copy_kernel(int in, int out, enum CopyMethod method);
+static ssize_t copy_rw(int in, int out);
+static int cat_fd(struct bi_ctx *ctx, int fd);
+
+/* Description: Copies everything from one descriptor to another.
+ *
+ * Arguments:	in:		Input descriptor, read till end of file
+ *				out:	Output descriptor
+ *
+ * Returns:		- On success, number of bytes copied
+ * 				- On failure, -1 (check errno)
+ *
+ * Notes:		The fastest method the descriptor types allow is tried first and
+ *				the next one is used if the kernel refuses it before anything
+ *				was copied.
+ */
+ssize_t copy_fd(int in, int out) {
+	struct stat ist, ost;
+	enum CopyMethod method = CP_RW;
+	ssize_t copied;
+	
+	if (fstat(in, &ist) == -1 || fstat(out, &ost) == -1) {
+		return -1;
+	}
+	
+#ifdef __linux__
+	if (S_ISREG(ist.st_mode) && S_ISREG(ost.st_mode)) {
+		method = CP_RANGE;
+	} else if (S_ISREG(ist.st_mode) && !S_ISFIFO(ost.st_mode)) {
+		method = CP_SENDFILE;
+	} else if (S_ISFIFO(ist.st_mode) || S_ISFIFO(ost.st_mode)) {
+		method = CP_SPLICE;
+	}
+	
+	for (; method != CP_RW; ++method) {
+		copied = copy_kernel(in, out, method);
+		if (copied != -2) {
+			return copied;
+		}
+		// A pipe is written with splice when sendfile is refused
+		if (method == CP_SENDFILE && !S_ISFIFO(ist.st_mode) &&
+			!S_ISFIFO(ost.st_mode)) {
+			break;
+		}
+	}
+#endif
+	
+	return copy_rw(in, out);
+}
+
+/* Description: Copies with a kernel method.
+ *
+ * Returns:		- On success, number of bytes copied
+ * 				- If the method is not supported for these descriptors, -2
+ * 				- On failure, -1 (check errno)
+ */
+static ssize_t copy_kernel(int in, int out, enum CopyMethod method) {
+#ifdef __linux__
+	ssize_t total = 0;
+	ssize_t n;
+	
+	for (;;) {
+		switch (method) {
+			case CP_RANGE:
+				n = copy_file_range(in, NULL, out, NULL, COPY_CHUNK, 0);
+				break;
+			case CP_SENDFILE:
+				n = sendfile(out, in, NULL, COPY_CHUNK);
+				break;
+			case CP_SPLICE:
+				n = splice(in, NULL, out, NULL, COPY_CHUNK, SPLICE_F_MOVE |
+					SPLICE_F_MORE);
+				break;
+			default:
+				return -2;
+		}
+		
+		if (n == 0) {
+			return total;
+		}
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (total == 0 && (errno == EINVAL || errno == ENOSYS ||
+				errno == EXDEV || errno == EBADF || errno == EOPNOTSUPP)) {
+				return -2;	// Try the next method
+			}
+			return -1;
+		}
+		total += n;
+	}
+#else
+	(void)in;
+	(void)out;
+	(void)method;
+	return -2;
+#endif
+}
+
+// Copies through a userspace buffer
+static ssize_t copy_rw(int in, int out) {
+	static char *buf;
+	ssize_t total = 0;
+	ssize_t n, w, off;
+	
+	if (buf == NULL && (buf = (char *)malloc(COPY_BUFSIZE)) == NULL) {
+		return -1;
+	}
+	
+	for (;;) {
+		n = read(in, buf, COPY_BUFSIZE);
+		if (n == 0) {
+			return total;
+		}
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		for (off = 0; off < n; off += w) {
+			w = write(out, buf + off, n - off);
+			if (w == -1) {
+				if (errno == EINTR) {
+					w = 0;
+					continue;
+				}
+				return -1;
+			}
+		}
+		total += n;
+	}
+}
+
+/* Description: cat [FILE]...
+ *				Concatenates files ("-" or none is the standard input) to the
+ *				standard output.
+ */
+int bi_cat(int argc, char **argv, struct bi_ctx *ctx) {
+	struct stat ost, ist;
+	int status = 0;
+	int i, fd;
+	int outreg;		// Output is a regular file
+	const char *name;
+	
+	outreg = ctx->out >= 0 && fstat(ctx->out, &ost) == 0 && S_ISREG(ost.st_mode);
+	
+	for (i = 1; i < argc || i == 1; ++i) {
+		name = (i < argc) ? argv[i] : "-";
+		if (strcmp(name, "-") == 0) {
+			fd = ctx->in;
+		} else if ((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1) {
+			bi_error(ctx, "%s: %s", name, strerror(errno));
+			status = 1;
+			continue;
+		}
+		
+		// Copying a non empty file to itself never ends
+		if (outreg && fd >= 0 && fstat(fd, &ist) == 0 && ist.st_dev == ost.st_dev &&
+			ist.st_ino == ost.st_ino && ist.st_size > 0) {
+			bi_error(ctx, "%s: input file is output file", name);
+			status = 1;
+		} else if (cat_fd(ctx, fd) == -1) {
+			if (errno == EPIPE) {
+				ctx->broken = 1;	// Reader is gone, stop quietly
+			}
+			bi_error(ctx, "%s: %s", name, strerror(errno));
+			status = 1;
+		}
+		
+		if (fd != ctx->in) {
+			close(fd);
+		}
+		if (ctx->broken) {
+			break;
+		}
+	}
+	
+	return status;
+}
+
+/* Description: Checks if the cat builtin handles the arguments. Options are left
+ *				to the external cat.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_cat_accepts(int argc, char **argv) {
+	int i;
+	
+	for (i = 1; i < argc; ++i) {
+		if (argv[i][0] == '-' && argv[i][1] != '\0') {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* Description: Copies a descriptor of cat to its output. Rings, which have no
+ *				descriptor, are copied through a buffer.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (check errno)
+ */
+static int cat_fd(struct bi_ctx *ctx, int fd) {
+	char buf[COPY_BUFSIZE / 4];
+	ssize_t n;
+	
+	if (fd >= 0 && ctx->out >= 0) {
+		return copy_fd(fd, ctx->out) == -1 ? -1 : 0;
+	}
+	
+	for (;;) {
+		if (fd == ctx->in) {
+			n = bi_read(ctx, buf, sizeof(buf));
+		} else {
+			n = read(fd, buf, sizeof(buf));
+		}
+		if (n == 0) {
+			return 0;
+		}
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			return -1;
+		}
+		if (bi_write(ctx, buf, n) == -1) {
+			return -1;
+		}
+	}
+}
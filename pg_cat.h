@@ -0,0 +1,10 @@
+#ifndef PG_CAT_H
+#define PG_CAT_H
+
+#include <sys/types.h>
+
+// Function Prototypes
+
+ssize_t copy_fd(int in, int out);
+
+#endif
@@ -0,0 +1,678 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Tab completion of command names and file paths.
+ *
+ * Command names come from a trie built from the directories of $PATH. The trie
+ * is built once and rebuilt only when $PATH or one of its directories changes
+ * (the directory listings are taken from the directory cache, so a changed
+ * directory is noticed through its modification time). File paths are completed
+ * from the cached listing of the directory being completed.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "pg_error.h"
+#include "pg_dircache.h"
+#include "pg_complete.h"
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+#define DEFAULT_PATH	"/bin:/usr/bin"
+#define ESCAPED_CHARS	" \t\\'\"|&;<>()$`*?[]#!{}"	// Characters escaped on insertion
+
+// Trie node, children are kept in a sorted sibling list
+struct tnode {
+	int child;		// First child (-1 if none)
+	int sibling;	// Next sibling (-1 if none)
+	int words;		// Number of words in this subtree
+	char c;			// Character of this node
+	char term;		// A word ends in this node
+};
+
+// Growable string used to build the inserted text
+struct sbuf {
+	char *s;
+	size_t len, cap;
+};
+
+static struct tnode *trie;			// Command trie (node 0 is the root)
+static int tnodes, tcap;			// Used and allocated trie nodes
+static char *trie_path;				// $PATH the trie was built from
+static unsigned long *trie_gens;	// Listing generation of every $PATH directory
+static int trie_ndirs;				// Number of $PATH directories
+
+// Shell commands that are not found in $PATH
+static const char * const shell_cmds[] = { "cd", "exit", NULL };
+
+// Static Function Prototypes //
+static int trie_refresh(void);
+static int trie_build(const char *path, struct dirlist **lists, int ndirs);
+static int trie_node(char c);
+static int trie_find(const char *prefix, size_t len);
+static void trie_collect(int node, char *buf, size_t len, size_t max,
+	struct completion *cmpl);
+static int path_lists(const char *path, struct dirlist ***lists);
+static int complete_cmd(const char *prefix, struct completion *cmpl);
+static int complete_file(const char *prefix, char quote, struct completion *cmpl);
+static size_t scan_word(const char *line, size_t pos, int *cmdpos, char *quote);
+static char * unescape(const char *s, size_t n);
+static int sbuf_add(struct sbuf *sb, const char *s, size_t n, char quote);
+static int strptrcmp(const void *a, const void *b);
+
+/* Description: Completes the word that ends at the given cursor position.
+ *
+ * Arguments:	line:	Command line typed so far
+ *				pos:	Cursor position inside the line
+ *				cmpl:	Stores the completion result
+ *
+ * Returns:		- On success, number of candidates found (0 if none)
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *
+ * Notes:		The first word of every command is completed against the command
+ *				names of $PATH, unless it contains a '/'. Every other word is
+ *				completed as a file path. The result must be released with
+ *				completion_free.
+ */
+int complete_line(const char *line, size_t pos, struct completion *cmpl) {
+	char *prefix;
+	char quote;
+	int cmdpos;
+	int status;
+
+	if (line == NULL || cmpl == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+
+	memset(cmpl, 0, sizeof(struct completion));
+	cmpl->start = scan_word(line, pos, &cmdpos, &quote);
+
+	prefix = unescape(line + cmpl->start, pos - cmpl->start);
+	if (prefix == NULL) {
+		return -1;
+	}
+
+	if (cmdpos && strchr(prefix, '/') == NULL) {
+		status = complete_cmd(prefix, cmpl);
+	} else {
+		status = complete_file(prefix, quote, cmpl);
+	}
+
+	free(prefix);
+	return status;
+}
+
+/* Description: Releases the memory held by a completion result.
+ *
+ * Arguments:	cmpl:	Completion result
+ *
+ * Returns:		void: Nothing
+ */
+void completion_free(struct completion *cmpl) {
+	int i;
+
+	if (cmpl == NULL) {
+		return;
+	}
+
+	for (i = 0; i < cmpl->listed; ++i) {
+		free(cmpl->matches[i]);
+	}
+	free(cmpl->matches);
+	free(cmpl->insert);
+	memset(cmpl, 0, sizeof(struct completion));
+}
+
+/* Description: Completes a command name from the command trie.
+ *
+ * Returns:		- On success, number of candidates
+ * 				- On failure, -1
+ */
+static int complete_cmd(const char *prefix, struct completion *cmpl) {
+	struct sbuf ext = { NULL, 0, 0 };
+	char name[PATH_MAX];
+	size_t len = strlen(prefix);
+	int node, next;
+
+	if (trie_refresh() == -1) {
+		return -1;
+	}
+
+	if ((node = trie_find(prefix, len)) == -1) {
+		return 0;
+	}
+	cmpl->count = trie[node].words;
+
+	// Collect the names for listing
+	if (len < sizeof(name)) {
+		memcpy(name, prefix, len);
+		trie_collect(node, name, len, sizeof(name), cmpl);
+	}
+
+	// Extend the prefix while there is a single way to go
+	while (!trie[node].term && (next = trie[node].child) != -1 &&
+		trie[next].sibling == -1) {
+		if (sbuf_add(&ext, &trie[next].c, 1, 0) == -1) {
+			return -1;
+		}
+		node = next;
+	}
+
+	if (cmpl->count == 1 && sbuf_add(&ext, " ", 1, '\'') == -1) {
+		return -1;
+	}
+
+	cmpl->insert = ext.s;
+	return cmpl->count;
+}
+
+/* Description: Completes a file path from the cached listing of its directory.
+ *
+ * Returns:		- On success, number of candidates
+ * 				- On failure, -1
+ */
+static int complete_file(const char *prefix, char quote, struct completion *cmpl) {
+	char dir[PATH_MAX];
+	const char *base;
+	const char *home;
+	const char *match = NULL;	// First candidate
+	struct sbuf ext = { NULL, 0, 0 };
+	struct dirlist *dl;
+	struct stat st;
+	size_t blen, lcp = 0, n;
+	int first, total, i, status;
+	int isdir = 0;
+
+	// Split the prefix to directory and base name
+	base = strrchr(prefix, '/');
+	if (base != NULL) {
+		++base;
+		n = base - prefix;
+		if (prefix[0] == '~' && prefix[1] == '/' &&
+			(home = getenv("HOME")) != NULL) {
+			if (strlen(home) + n >= sizeof(dir)) {
+				return 0;
+			}
+			sprintf(dir, "%s%.*s", home, (int)n - 1, prefix + 1);
+		} else {
+			if (n >= sizeof(dir)) {
+				return 0;
+			}
+			memcpy(dir, prefix, n);
+			dir[n] = '\0';
+		}
+	} else {
+		base = prefix;
+		dir[0] = '\0';
+	}
+	blen = strlen(base);
+
+	if ((dl = dircache_get(dir)) == NULL) {
+		pg_errno = EOK;		// Nothing to complete in a missing directory
+		return 0;
+	}
+
+	total = dirlist_prefix(dl, base, blen, &first);
+	for (i = first; i < first + total; ++i) {
+		const char *name = dl->ents[i].name;
+
+		// Hidden files are completed only when asked for
+		if (blen == 0 && name[0] == '.') {
+			continue;
+		}
+
+		if (match == NULL) {
+			match = name;
+			lcp = strlen(name);
+		} else {
+			for (n = blen; n < lcp && name[n] == match[n]; ++n);
+			lcp = n;
+		}
+
+		if (cmpl->listed < COMPLETE_LIST_MAX) {
+			if (cmpl->matches == NULL) {
+				cmpl->matches = (char **)malloc(COMPLETE_LIST_MAX * sizeof(char *));
+				if (cmpl->matches == NULL) {
+					perror("malloc");
+					return -1;
+				}
+			}
+			if ((cmpl->matches[cmpl->listed] = strdup(name)) != NULL) {
+				++cmpl->listed;
+			}
+		}
+		++cmpl->count;
+
+		if (cmpl->count == 1) {
+			isdir = dl->ents[i].type == DT_DIR;
+			if (dl->ents[i].type == DT_LNK || dl->ents[i].type == DT_UNKNOWN) {
+				char full[PATH_MAX];
+				snprintf(full, sizeof(full), "%s%s", dir, name);
+				isdir = stat(full, &st) == 0 && S_ISDIR(st.st_mode);
+			}
+		}
+	}
+
+	if (match == NULL) {
+		return 0;
+	}
+
+	if (sbuf_add(&ext, match + blen, lcp - blen, quote) == -1) {
+		return -1;
+	}
+	if (cmpl->count == 1) {
+		if (isdir) {
+			status = sbuf_add(&ext, "/", 1, quote);
+		} else if (quote) {
+			char close[3] = { quote, ' ', '\0' };
+			status = sbuf_add(&ext, close, 2, '\'');
+		} else {
+			status = sbuf_add(&ext, " ", 1, '\'');
+		}
+		if (status == -1) {
+			return -1;
+		}
+	}
+
+	cmpl->insert = ext.s;
+	return cmpl->count;
+}
+
+/* Description: Rebuilds the command trie if $PATH or any of its directories
+ *				changed since the last build.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int trie_refresh(void) {
+	struct dirlist **lists;
+	const char *path;
+	int ndirs, i, changed;
+
+	if ((path = getenv("PATH")) == NULL) {
+		path = DEFAULT_PATH;
+	}
+
+	if ((ndirs = path_lists(path, &lists)) == -1) {
+		return -1;
+	}
+
+	changed = trie == NULL || trie_path == NULL || strcmp(path, trie_path) != 0 ||
+		ndirs != trie_ndirs;
+	for (i = 0; !changed && i < ndirs; ++i) {
+		changed = (lists[i] ? lists[i]->gen : 0) != trie_gens[i];
+	}
+
+	if (changed && trie_build(path, lists, ndirs) == -1) {
+		free(lists);
+		return -1;
+	}
+
+	free(lists);
+	return 0;
+}
+
+/* Description: Builds the command trie out of the listings of the $PATH
+ *				directories.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ *
+ * Notes:		The names are sorted first, so every word is added as the last
+ *				child of the path shared with the previous word and no sibling
+ *				list has to be searched.
+ */
+static int trie_build(const char *path, struct dirlist **lists, int ndirs) {
+	const char **names;
+	const char *prev = NULL;
+	int *stack = NULL;		// Nodes of the previous word, stack[0] is the root
+	int scap = 0;
+	int count = 0, total = 0;
+	int i, j, node, lcp;
+	size_t len;
+
+	for (i = 0; i < ndirs; ++i) {
+		total += lists[i] ? lists[i]->count : 0;
+	}
+	for (i = 0; shell_cmds[i] != NULL; ++i, ++total);
+
+	names = (const char **)malloc((total + 1) * sizeof(char *));
+	if (names == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0; i < ndirs; ++i) {
+		if (lists[i] == NULL) {
+			continue;
+		}
+		for (j = 0; j < lists[i]->count; ++j) {
+			if (lists[i]->ents[j].type != DT_DIR) {
+				names[count++] = lists[i]->ents[j].name;
+			}
+		}
+	}
+	for (i = 0; shell_cmds[i] != NULL; ++i) {
+		names[count++] = shell_cmds[i];
+	}
+	qsort(names, count, sizeof(char *), strptrcmp);
+
+	tnodes = 0;
+	if (trie_node('\0') == -1) {	// Root
+		free(names);
+		return -1;
+	}
+	trie[0].words = 0;
+
+	for (i = 0; i < count; ++i) {
+		if (names[i][0] == '\0' || (prev != NULL && strcmp(prev, names[i]) == 0)) {
+			continue;
+		}
+
+		len = strlen(names[i]);
+		if ((int)len + 1 > scap) {
+			scap = len + 64;
+			if ((stack = (int *)realloc(stack, scap * sizeof(int))) == NULL) {
+				perror("realloc");
+				free(names);
+				return -1;
+			}
+		}
+
+		// Length of the prefix shared with the previous word
+		lcp = 0;
+		if (prev != NULL) {
+			while (prev[lcp] != '\0' && prev[lcp] == names[i][lcp]) {
+				++lcp;
+			}
+		}
+
+		stack[0] = 0;
+		for (j = 0; j <= lcp; ++j) {
+			++trie[stack[j]].words;
+		}
+
+		for (j = lcp; j < (int)len; ++j) {
+			if ((node = trie_node(names[i][j])) == -1) {
+				free(stack);
+				free(names);
+				return -1;
+			}
+			// The previous word's node on this level is the last child
+			if (j == lcp && prev != NULL && prev[lcp] != '\0') {
+				trie[stack[j + 1]].sibling = node;
+			} else {
+				trie[stack[j]].child = node;
+			}
+			stack[j + 1] = node;
+		}
+		trie[stack[len]].term = 1;
+		prev = names[i];
+	}
+
+	free(stack);
+	free(names);
+
+	// Remember what the trie was built from
+	free(trie_path);
+	free(trie_gens);
+	trie_path = strdup(path);
+	trie_gens = (unsigned long *)malloc((ndirs + 1) * sizeof(unsigned long));
+	if (trie_path == NULL || trie_gens == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	for (i = 0; i < ndirs; ++i) {
+		trie_gens[i] = lists[i] ? lists[i]->gen : 0;
+	}
+	trie_ndirs = ndirs;
+
+	return 0;
+}
+
+/* Description: Allocates a new trie node.
+ *
+ * Returns:		- On success, index of the new node
+ * 				- On failure, -1
+ */
+static int trie_node(char c) {
+	struct tnode *tmp;
+
+	if (tnodes == tcap) {
+		tcap = (tcap == 0) ? 4096 : tcap * 2;
+		if ((tmp = (struct tnode *)realloc(trie, tcap * sizeof(struct tnode))) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		trie = tmp;
+	}
+
+	trie[tnodes].child = -1;
+	trie[tnodes].sibling = -1;
+	trie[tnodes].words = 1;
+	trie[tnodes].c = c;
+	trie[tnodes].term = 0;
+
+	return tnodes++;
+}
+
+/* Description: Finds the trie node of the given prefix.
+ *
+ * Returns:		- On success, index of the node
+ * 				- On failure, -1 (no word with this prefix)
+ */
+static int trie_find(const char *prefix, size_t len) {
+	int node = 0;
+	size_t i;
+
+	if (tnodes == 0 || trie[0].words == 0) {
+		return -1;
+	}
+
+	for (i = 0; i < len; ++i) {
+		for (node = trie[node].child; node != -1 && trie[node].c != prefix[i];
+			node = trie[node].sibling);
+		if (node == -1) {
+			return -1;
+		}
+	}
+
+	return node;
+}
+
+/* Description: Collects the words of a trie subtree in sorted order, till the
+ *				listing limit is reached.
+ */
+static void trie_collect(int node, char *buf, size_t len, size_t max,
+	struct completion *cmpl) {
+	int child;
+
+	if (cmpl->listed >= COMPLETE_LIST_MAX) {
+		return;
+	}
+
+	if (trie[node].term) {
+		if (cmpl->matches == NULL) {
+			cmpl->matches = (char **)malloc(COMPLETE_LIST_MAX * sizeof(char *));
+			if (cmpl->matches == NULL) {
+				return;
+			}
+		}
+		buf[len] = '\0';
+		if ((cmpl->matches[cmpl->listed] = strdup(buf)) != NULL) {
+			++cmpl->listed;
+		}
+	}
+
+	if (len + 1 >= max) {
+		return;
+	}
+	for (child = trie[node].child; child != -1; child = trie[child].sibling) {
+		buf[len] = trie[child].c;
+		trie_collect(child, buf, len + 1, max, cmpl);
+	}
+}
+
+/* Description: Gets the cached listing of every directory of the given path.
+ *
+ * Returns:		- On success, number of directories (missing ones are NULL)
+ * 				- On failure, -1
+ */
+static int path_lists(const char *path, struct dirlist ***lists) {
+	char dir[PATH_MAX];
+	const char *start, *end;
+	int ndirs = 1, i;
+
+	for (start = path; *start; ++start) {
+		ndirs += *start == ':';
+	}
+
+	*lists = (struct dirlist **)malloc(ndirs * sizeof(struct dirlist *));
+	if (*lists == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	for (i = 0, start = path; i < ndirs; ++i, start = end + 1) {
+		if ((end = strchr(start, ':')) == NULL) {
+			end = start + strlen(start);
+		}
+		(*lists)[i] = NULL;
+		if ((size_t)(end - start) < sizeof(dir)) {
+			memcpy(dir, start, end - start);
+			dir[end - start] = '\0';	// Empty entry is the current directory
+			(*lists)[i] = dircache_get(dir);
+		}
+	}
+	pg_errno = EOK;
+
+	return ndirs;
+}
+
+/* Description: Finds the start of the word that ends at the cursor, skipping
+ *				quoted and escaped characters.
+ *
+ * Arguments:	line:	Command line
+ *				pos:	Cursor position
+ *				cmdpos:	Set to true if the word is in a command position
+ *				quote:	Set to the quote left open at the cursor ('\0' if none)
+ *
+ * Returns:		Offset of the word's first character
+ */
+static size_t scan_word(const char *line, size_t pos, int *cmdpos, char *quote) {
+	size_t i, start = 0;
+	char q = '\0';
+	int j;
+
+	for (i = 0; i < pos; ++i) {
+		if (q) {
+			if (line[i] == q) {
+				q = '\0';
+			} else if (q == '"' && line[i] == '\\' && i + 1 < pos) {
+				++i;
+			}
+		} else if (line[i] == '\\') {
+			if (i + 1 < pos) {
+				++i;
+			}
+		} else if (line[i] == '\'' || line[i] == '"') {
+			q = line[i];
+		} else if (isspace((unsigned char)line[i]) || strchr("|;&<>()", line[i])) {
+			start = i + 1;
+		}
+	}
+
+	// Command position: first word of the line or after a command separator
+	for (j = (int)start - 1; j >= 0 && isspace((unsigned char)line[j]); --j);
+	*cmdpos = j < 0 || (strchr("|;&(", line[j]) != NULL &&
+		!(line[j] == '&' && j > 0 && (line[j-1] == '>' || line[j-1] == '<')));
+	*quote = q;
+
+	return start;
+}
+
+/* Description: Removes the quotes and escapes of a partially typed word.
+ *
+ * Returns:		- On success, the unescaped word (must be freed)
+ * 				- On failure, NULL
+ */
+static char * unescape(const char *s, size_t n) {
+	char *word;
+	size_t i, j = 0;
+	char q = '\0';
+
+	if ((word = (char *)malloc(n + 1)) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+
+	for (i = 0; i < n; ++i) {
+		if (q) {
+			if (s[i] == q) {
+				q = '\0';
+				continue;
+			}
+			if (q == '"' && s[i] == '\\' && i + 1 < n && strchr("\\\"$`", s[i+1])) {
+				++i;
+			}
+		} else if (s[i] == '\\') {
+			if (++i == n) {
+				break;
+			}
+		} else if (s[i] == '\'' || s[i] == '"') {
+			q = s[i];
+			continue;
+		}
+		word[j++] = s[i];
+	}
+	word[j] = '\0';
+
+	return word;
+}
+
+/* Description: Appends characters to a growable string, escaping the characters
+ *				that are special to the shell. Inside single quotes nothing is
+ *				escaped and inside double quotes only \ " $ and ` are.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int sbuf_add(struct sbuf *sb, const char *s, size_t n, char quote) {
+	char *tmp;
+	size_t i;
+
+	for (i = 0; i < n; ++i) {
+		if (sb->len + 3 > sb->cap) {
+			sb->cap = (sb->cap == 0) ? 64 : sb->cap * 2;
+			if ((tmp = (char *)realloc(sb->s, sb->cap)) == NULL) {
+				perror("realloc");
+				return -1;
+			}
+			sb->s = tmp;
+		}
+		if ((quote == '\0' && strchr(ESCAPED_CHARS, s[i]) != NULL) ||
+			(quote == '"' && strchr("\\\"$`", s[i]) != NULL)) {
+			sb->s[sb->len++] = '\\';
+		}
+		sb->s[sb->len++] = s[i];
+	}
+
+	if (sb->s != NULL) {
+		sb->s[sb->len] = '\0';
+	}
+	return 0;
+}
+
+// Compares two string pointers (qsort callback)
+static int strptrcmp(const void *a, const void *b) {
+	return strcmp(*(const char * const *)a, *(const char * const *)b);
+}
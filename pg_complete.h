@@ -0,0 +1,22 @@
+#ifndef PG_COMPLETE_H
+#define PG_COMPLETE_H
+
+#include <stddef.h>
+
+#define COMPLETE_LIST_MAX	256		// Maximum number of candidates kept for listing
+
+// Result of a completion request
+struct completion {
+	size_t start;		// Offset of the completed word inside the line
+	char *insert;		// Text to insert at the cursor (already escaped)
+	char **matches;		// Candidate names kept for listing
+	int listed;			// Number of names stored in matches
+	int count;			// Total number of candidates
+};
+
+// Function Prototypes
+
+int complete_line(const char *line, size_t pos, struct completion *cmpl);
+void completion_free(struct completion *cmpl);
+
+#endif
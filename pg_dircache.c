@@ -0,0 +1,376 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Cache of directory listings. Every listing is identified by the directory's
+ * device, inode and modification time, so a listing is read again only when the
+ * directory actually changed. On Linux the entries are read with getdents64 in
+ * large batches which keeps huge directories to a handful of system calls.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
+#include "pg_error.h"
+#include "pg_dircache.h"
+
+#define DIRCACHE_BUCKETS	64			// Hash table buckets
+#define DIRCACHE_MAX		128			// Maximum number of cached directories
+#define DENTS_BUFSZ			(256*1024)	// getdents64 batch size
+
+#ifdef __linux__
+// Layout of the records returned by getdents64
+struct linux_dirent64 {
+	unsigned long long d_ino;
+	long long d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+#endif
+
+static struct dirlist *buckets[DIRCACHE_BUCKETS];
+static int cached;				// Number of cached listings
+static unsigned long tick;		// Use counter, used for eviction
+static unsigned long next_gen=1;	// Next listing generation
+
+// Static Function Prototypes //
+static int fill_list(struct dirlist *dl, int fd);
+static int pool_add(struct dirlist *dl, size_t *used, size_t *cap, int **offs,
+	int *ocap, const char *name, unsigned char type, unsigned char **types);
+static int entcmp(const void *a, const void *b);
+static void evict_lru(void);
+static void free_list(struct dirlist *dl);
+
+/* Description: Returns the listing of the given directory. The cached listing is
+ *				reused as long as the directory's modification time has not changed.
+ *
+ * Arguments:	path:	Directory path
+ *
+ * Returns:		- On success, the directory listing (owned by the cache)
+ * 				- On failure, NULL and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *						# EOPEN : Directory could not be opened or read
+ *
+ * Notes:		The returned listing stays valid till the next call of dircache_get
+ *				or dircache_clear.
+ */
+struct dirlist * dircache_get(const char *path) {
+	struct stat st;
+	struct dirlist *dl;
+	int fd;
+	unsigned int h;
+
+	if (path == NULL) {
+		pg_errno = ENULL;
+		return NULL;
+	}
+
+	fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1 || fstat(fd, &st) == -1) {
+		if (fd != -1) {
+			close(fd);
+		}
+		pg_errno = EOPEN;
+		return NULL;
+	}
+
+	h = (unsigned int)(st.st_dev * 31 + st.st_ino) % DIRCACHE_BUCKETS;
+	for (dl = buckets[h]; dl != NULL; dl = dl->next) {
+		if (dl->dev == st.st_dev && dl->ino == st.st_ino) {
+			break;
+		}
+	}
+
+	if (dl != NULL) {
+		dl->used = ++tick;
+		if (dl->mtime.tv_sec == st.st_mtim.tv_sec &&
+			dl->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			close(fd);
+			return dl;		// Directory did not change
+		}
+	} else {
+		if (cached >= DIRCACHE_MAX) {
+			evict_lru();
+		}
+		dl = (struct dirlist *)calloc(1, sizeof(struct dirlist));
+		if (dl == NULL) {
+			perror("calloc");
+			close(fd);
+			return NULL;
+		}
+		dl->dev = st.st_dev;
+		dl->ino = st.st_ino;
+		dl->used = ++tick;
+		dl->next = buckets[h];
+		buckets[h] = dl;
+		++cached;
+	}
+
+	// The time is taken before reading, so a change during the read is noticed
+	// on the next lookup
+	dl->mtime = st.st_mtim;
+	if (fill_list(dl, fd) == -1) {
+		dl->mtime.tv_sec = dl->mtime.tv_nsec = 0;	// Force a reload next time
+		close(fd);
+		pg_errno = EOPEN;
+		return NULL;
+	}
+	close(fd);
+
+	return dl;
+}
+
+/* Description: Finds the range of entries starting with the given prefix.
+ *
+ * Arguments:	dl:		Directory listing
+ *				prefix:	Prefix to search
+ *				len:	Length of the prefix
+ *				first:	Stores the index of the first matching entry
+ *
+ * Returns:		Number of matching entries (0 if none).
+ *
+ * Notes:		Entries are sorted, so the matches are consecutive.
+ */
+int dirlist_prefix(const struct dirlist *dl, const char *prefix, size_t len,
+	int *first) {
+	int lo, hi, mid;
+	int start;
+
+	if (dl == NULL || prefix == NULL) {
+		return 0;
+	}
+
+	// Lower bound of prefix
+	lo = 0;
+	hi = dl->count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(dl->ents[mid].name, prefix, len) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	start = lo;
+
+	// Upper bound of prefix
+	hi = dl->count;
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (strncmp(dl->ents[mid].name, prefix, len) <= 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	if (first != NULL) {
+		*first = start;
+	}
+	return lo - start;
+}
+
+/* Description: Drops all the cached directory listings.
+ *
+ * Arguments:	void: Nothing
+ *
+ * Returns:		void: Nothing
+ */
+void dircache_clear(void) {
+	struct dirlist *dl, *next;
+	int i;
+
+	for (i = 0; i < DIRCACHE_BUCKETS; ++i) {
+		for (dl = buckets[i]; dl != NULL; dl = next) {
+			next = dl->next;
+			free_list(dl);
+		}
+		buckets[i] = NULL;
+	}
+	cached = 0;
+}
+
+/* Description: Reads all the entries of an open directory into the listing and
+ *				sorts them by name.
+ *
+ * Arguments:	dl:	Listing to be filled
+ *				fd:	Open directory file descriptor
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int fill_list(struct dirlist *dl, int fd) {
+	char *pool = NULL;
+	int *offs = NULL;			// Name offsets (the pool moves while growing)
+	unsigned char *types = NULL;
+	size_t used = 0, cap = 0;
+	int ocap = 0;
+	int count, i;
+
+	free(dl->pool);
+	free(dl->ents);
+	dl->pool = NULL;
+	dl->ents = NULL;
+	dl->count = 0;
+
+#ifdef __linux__
+	static char *dents;		// Shared getdents64 buffer
+	long nread, bpos;
+	struct linux_dirent64 *d;
+
+	if (dents == NULL && (dents = (char *)malloc(DENTS_BUFSZ)) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	while ((nread = syscall(SYS_getdents64, fd, dents, DENTS_BUFSZ)) > 0) {
+		for (bpos = 0; bpos < nread; bpos += d->d_reclen) {
+			d = (struct linux_dirent64 *)(dents + bpos);
+			if (d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+				(d->d_name[1] == '.' && d->d_name[2] == '\0'))) {
+				continue;	// Skip . and ..
+			}
+			if (pool_add(dl, &used, &cap, &offs, &ocap, d->d_name, d->d_type,
+				&types) == -1) {
+				goto fail;
+			}
+		}
+	}
+	if (nread == -1) {
+		goto fail;
+	}
+#else
+	DIR *dir;
+	struct dirent *d;
+	int dfd;
+
+	if ((dfd = dup(fd)) == -1 || (dir = fdopendir(dfd)) == NULL) {
+		goto fail;
+	}
+	while ((d = readdir(dir)) != NULL) {
+		if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+			continue;
+		}
+		if (pool_add(dl, &used, &cap, &offs, &ocap, d->d_name, DT_UNKNOWN,
+			&types) == -1) {
+			closedir(dir);
+			goto fail;
+		}
+	}
+	closedir(dir);
+#endif
+
+	pool = dl->pool;
+	count = dl->count;
+	dl->ents = (struct dirent_rec *)malloc((count + 1) * sizeof(struct dirent_rec));
+	if (dl->ents == NULL) {
+		perror("malloc");
+		goto fail;
+	}
+	for (i = 0; i < count; ++i) {
+		dl->ents[i].name = pool + offs[i];
+		dl->ents[i].type = types[i];
+	}
+	qsort(dl->ents, count, sizeof(struct dirent_rec), entcmp);
+
+	free(offs);
+	free(types);
+	dl->gen = next_gen++;
+	return 0;
+
+fail:
+	free(offs);
+	free(types);
+	free(dl->pool);
+	dl->pool = NULL;
+	dl->count = 0;
+	return -1;
+}
+
+/* Description: Appends an entry name to the listing's name pool.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (allocation error)
+ */
+static int pool_add(struct dirlist *dl, size_t *used, size_t *cap, int **offs,
+	int *ocap, const char *name, unsigned char type, unsigned char **types) {
+	size_t len = strlen(name) + 1;
+	void *tmp;
+
+	if (*used + len > *cap) {
+		*cap = (*cap == 0) ? 4096 : *cap * 2;
+		while (*used + len > *cap) {
+			*cap *= 2;
+		}
+		if ((tmp = realloc(dl->pool, *cap)) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		dl->pool = (char *)tmp;
+	}
+
+	if (dl->count == *ocap) {
+		*ocap = (*ocap == 0) ? 256 : *ocap * 2;
+		if ((tmp = realloc(*offs, *ocap * sizeof(int))) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		*offs = (int *)tmp;
+		if ((tmp = realloc(*types, *ocap)) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		*types = (unsigned char *)tmp;
+	}
+
+	memcpy(dl->pool + *used, name, len);
+	(*offs)[dl->count] = (int)*used;
+	(*types)[dl->count] = type;
+	*used += len;
+	++dl->count;
+
+	return 0;
+}
+
+// Compares two entries by name (qsort callback)
+static int entcmp(const void *a, const void *b) {
+	return strcmp(((const struct dirent_rec *)a)->name,
+		((const struct dirent_rec *)b)->name);
+}
+
+// Removes the least recently used listing from the cache
+static void evict_lru(void) {
+	struct dirlist **pp, **victim = NULL;
+	struct dirlist *dl;
+	int i;
+
+	for (i = 0; i < DIRCACHE_BUCKETS; ++i) {
+		for (pp = &buckets[i]; *pp != NULL; pp = &(*pp)->next) {
+			if (victim == NULL || (*pp)->used < (*victim)->used) {
+				victim = pp;
+			}
+		}
+	}
+
+	if (victim != NULL) {
+		dl = *victim;
+		*victim = dl->next;
+		free_list(dl);
+		--cached;
+	}
+}
+
+// Frees a listing and its entries
+static void free_list(struct dirlist *dl) {
+	free(dl->pool);
+	free(dl->ents);
+	free(dl);
+}
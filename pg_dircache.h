@@ -0,0 +1,33 @@
+#ifndef PG_DIRCACHE_H
+#define PG_DIRCACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+// One cached directory entry
+struct dirent_rec {
+	const char *name;		// Entry name (points into the listing's name pool)
+	unsigned char type;		// d_type of the entry (DT_DIR, DT_REG, ...)
+};
+
+// Cached listing of one directory, identified by (dev, inode, mtime)
+struct dirlist {
+	dev_t dev;				// Device of the directory
+	ino_t ino;				// Inode of the directory
+	struct timespec mtime;	// Modification time when the listing was read
+	char *pool;				// NUL separated entry names
+	struct dirent_rec *ents;	// Entries sorted by name
+	int count;				// Number of entries
+	unsigned long gen;		// Generation, changes every time the list is refilled
+	unsigned long used;		// Last use tick (for eviction)
+	struct dirlist *next;	// Hash chain
+};
+
+// Function Prototypes
+
+struct dirlist * dircache_get(const char *path);
+int dirlist_prefix(const struct dirlist *dl, const char *prefix, size_t len,
+	int *first);
+void dircache_clear(void);
+
+#endif
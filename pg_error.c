@@ -17,10 +17,14 @@ const char * const error_messages[ERROR_CODES] = {
 	"Cannot open file",						// EOPEN	12
 	"Wrong arguments passed",				// EARG		13
 	"Wrong syntax",							// ESYNTAX	14
-	"Write permission denied"				// EWPERM	15
-	"File does not exist"					// ENOFILE	16
-	"Cannot change directory"				// ECHDIR	17
-	"No such environment variable"			// ENOENV	18
+	"Write permission denied",				// EWPERM	15
+	"File does not exist",					// ENOFILE	16
+	"Cannot change directory",				// ECHDIR	17
+	"No such environment variable",			// ENOENV	18
+	"Bad redirection",						// EREDIR	19
+	"Here-document not terminated",			// EHEREDOC	20
+	"Arithmetic error",						// EARITH	21
+	"Unexpected end of input"				// EINCOMPLETE 22
 };
 
 
@@ -1,7 +1,7 @@
 #ifndef PG_ERROR_H
 #define PG_ERROR_H
 
-#define ERROR_CODES 19	// Number of error codes
+#define ERROR_CODES 23	// Number of error codes
 
 // Definition of ErrorType data type
 enum ErrorType {
@@ -23,7 +23,11 @@ enum ErrorType {
 	EWPERM,
 	ENOFILE,
 	ECHDIR,
-	ENOENV
+	ENOENV,
+	EREDIR,
+	EHEREDOC,
+	EARITH,
+	EINCOMPLETE
 };
 
 // MAIN_FILE macro must be defined to the main source file, before including this one !
@@ -0,0 +1,664 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Word expansion. The lexer leaves every parameter and every "$(list)" and
+ * "`list`" of a word as its text between markers, and the word is expanded when
+ * its command runs, as the plan of the command is cached and variables change.
+ * Parameters are looked up in the variable store and copied, as it changes,
+ * and arithmetic is evaluated in the shell (see pg_arith.c), once the
+ * parameters and lists in its text are expanded.
+ * Fields with unquoted glob characters are then matched (see pg_glob.c).
+ * The output of the list goes to a memory file that is mapped once it is done,
+ * so it is never read in pieces and copied. Trailing newlines are removed and,
+ * unless it was in double quotes, the output is split to fields on blanks and
+ * newlines in place: a field ends with a NUL written over the blank after it
+ * and only fields joined with other text are copied.
+ * A list that is a single pipeline runs in the shell through pipe_chain like
+ * any other, anything else runs in a child of the shell.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "pg_error.h"
+#include "pg_parse.h"
+#include "pg_plan.h"
+#include "pg_file.h"
+#include "pg_subst.h"
+#include "pg_var.h"
+#include "pg_glob.h"
+#include "pg_arith.h"
+#include "processes.h"
+#include "pgsh.h"
+#include "pg_expand.h"
+
+#define FIELD_MIN	64		// Smallest copy of a field
+
+// Modes of expand_word
+#define WORD_SINGLE		0	// A single field, glob characters are literal
+#define WORD_FIELDS		1	// Split to fields and match the patterns
+#define WORD_PATTERN	2	// A single field, glob characters stay marked
+
+// Field being built
+struct field {
+	char *s;		// Text, in a captured output or a copy
+	size_t len;
+	size_t cap;		// Size of the copy, 0 while the text is in place
+	int open;		// The field exists, even if it is empty
+	int glob;		// Holds glob characters, 1 to match them, -1 if literal
+};
+
+// Growable list of fields, NULL terminated once done
+struct fields {
+	char **v;
+	int n;
+	int cap;
+};
+
+// Static Function Prototypes //
+static int expand_word(const char *word, int mode, struct fields *out,
+	struct expansion *exp);
+static int param(const char *text, size_t tlen, char *num, const char **val,
+	size_t *vlen);
+static int capture(const char *list, struct expansion *exp, char **buf,
+	size_t *len);
+static const char * arith_text(const char *text, size_t *len,
+	struct expansion *exp);
+static int run_list(const char *list, int fd);
+static int field_add(struct field *f, const char *s, size_t len, int inplace);
+static int field_split(struct field *f, const char *s, size_t len, int inplace,
+	struct fields *out, struct expansion *exp);
+static int field_end(struct field *f, struct fields *out, struct expansion *exp);
+static int fields_add(struct fields *out, char *s);
+static int exp_keep(struct expansion *exp, void *addr, size_t len);
+
+/* Description: Expands the parameters and command substitutions of a command.
+ *				The argument vector is replaced with the fields of the words,
+ *				every redirection target and assignment with its single
+ *				expanded field.
+ *
+ * Arguments:	cmd:	Copy of a planned command, changed in place
+ *				exp:	Keeps the memory of the expansion
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EOPEN : The output could not be kept
+ *						# EFORK : fork error
+ *						# EWAIT : Error while waiting a list
+ *						# ENOENV: A ${NAME:?word} failed (reported)
+ *						# ESYNTAX: Bad ${...} (reported)
+ *						# EARITH: Bad arithmetic expression (reported)
+ *
+ * Notes:		Words without expansions are kept as they are. The exit
+ *				status of the last list is left in pg_status, and a command
+ *				of assignments only without lists exits with 0. Everything
+ *				is freed with expand_free once the command has run.
+ */
+int expand_cmd(struct plan_cmd *cmd, struct expansion *exp) {
+	struct fields out;
+	int i, n;
+	int lists = exp->nlists;
+
+	// Assignments are single fields too
+	memset(&out, 0, sizeof(out));
+	for (i = 0; i < cmd->nassigns; ++i) {
+		if (expand_word(cmd->assigns[i], WORD_SINGLE, &out, exp) == -1) {
+			free(out.v);
+			return -1;
+		}
+	}
+	if (cmd->nassigns > 0) {
+		if (exp_keep(exp, out.v, 0) == -1) {
+			free(out.v);
+			return -1;
+		}
+		cmd->assigns = out.v;
+		if (cmd->argc == 0 && exp->nlists == lists) {
+			pg_status = 0;
+		}
+	}
+
+	memset(&out, 0, sizeof(out));
+	for (i = 0; i < cmd->argc; ++i) {
+		if (expand_word(cmd->argv[i], WORD_FIELDS, &out, exp) == -1) {
+			free(out.v);
+			return -1;
+		}
+	}
+	n = out.n;
+
+	// A target is a single field, taken back from the end of the list
+	for (i = 0; i < cmd->nredirs; ++i) {
+		if (cmd->redirs[i].path == NULL ||
+			strpbrk(cmd->redirs[i].path, EXP_ANY) == NULL) {
+			continue;
+		}
+		if (expand_word(cmd->redirs[i].path, WORD_SINGLE, &out, exp) == -1) {
+			free(out.v);
+			return -1;
+		}
+		cmd->redirs[i].path = out.v[n];
+		out.n = n;
+	}
+
+	if (fields_add(&out, NULL) == -1 || exp_keep(exp, out.v, 0) == -1) {
+		free(out.v);
+		return -1;
+	}
+	cmd->argv = out.v;
+	cmd->argc = n;
+
+	return 0;
+}
+
+/* Description: Expands a word to a single field, as the word of a case
+ *				command and its patterns are.
+ *
+ * Arguments:	word:		Word, with its expansions marked
+ *				pattern:	Glob characters stay marked, to match the field
+ *							with glob_match, else they are removed
+ *				exp:		Keeps the memory of the expansion
+ *
+ * Returns:		- On success, the field
+ * 				- On failure, NULL and sets pg_errno as expand_cmd does
+ *
+ * Notes:		The field lives till the expansion is freed with expand_free.
+ */
+char * expand_text(const char *word, int pattern, struct expansion *exp) {
+	struct fields out;
+	char *field;
+
+	memset(&out, 0, sizeof(out));
+	if (expand_word(word, pattern ? WORD_PATTERN : WORD_SINGLE, &out, exp) == -1) {
+		free(out.v);
+		return NULL;
+	}
+	field = out.v[0];
+	free(out.v);
+
+	return field;
+}
+
+/* Description: Frees the memory of the expanded commands of a pipeline.
+ *
+ * Arguments:	exp:	Expansion, from expand_cmd
+ *
+ * Returns:		void: Nothing
+ */
+void expand_free(struct expansion *exp) {
+	int i;
+
+	for (i = 0; i < exp->nmem; ++i) {
+		if (exp->mem[i].len > 0) {
+			munmap(exp->mem[i].addr, exp->mem[i].len);
+		} else {
+			free(exp->mem[i].addr);
+		}
+	}
+	free(exp->mem);
+	memset(exp, 0, sizeof(struct expansion));
+}
+
+// Adds the fields of a word to a list. Unquoted parameters and lists are split
+// and "$@" is a field for every positional parameter in the WORD_FIELDS mode.
+// Returns -1 on failure.
+static int expand_word(const char *word, int mode, struct fields *out,
+	struct expansion *exp) {
+	struct field f;
+	const char *p = word, *end, *val;
+	char *list, *buf;
+	char **args;
+	char num[24];		// Value of a numeric parameter
+	long long value;
+	size_t len;
+	int quoted, nargs, i;
+	int failed = 0;
+
+	if (strpbrk(word, EXP_ANY) == NULL) {
+		return fields_add(out, (char *)word);
+	}
+
+	memset(&f, 0, sizeof(f));
+	while (*p != '\0' && !failed) {
+		if (strchr(EXP_MARKS, *p) == NULL) {
+			len = strcspn(p, EXP_MARKS);		// Text around the expansions
+			if (memchr(p, EXP_GLOB, len) != NULL && mode != WORD_PATTERN) {
+				f.glob = (mode == WORD_FIELDS) ? 1 : -1;
+			}
+			failed = field_add(&f, p, len, 0);
+			p += len;
+			continue;
+		}
+
+		quoted = (*p == EXP_QSUB || *p == EXP_QVAR || mode != WORD_FIELDS);
+		end = strchr(p, EXP_END);
+		if (*p == EXP_ARITH) {
+			val = p + 1;
+			len = end - p - 1;
+			if (memchr(val, '$', len) != NULL || memchr(val, '`', len) != NULL) {
+				val = arith_text(val, &len, exp);
+			}
+			if (val == NULL) {
+				failed = -1;
+			} else if ((failed = arith_eval(val, len, &value)) == 0) {
+				snprintf(num, sizeof(num), "%lld", value);
+				failed = field_add(&f, num, strlen(num), 0);
+			}
+			p = end + 1;
+			continue;
+		}
+		if (*p == EXP_QVAR && end == p + 2 && p[1] == '@' && mode == WORD_FIELDS) {
+			args = var_args_get(&nargs);
+			for (i = 0; i < nargs && !failed; ++i) {
+				if (i > 0) {
+					failed = field_end(&f, out, exp);
+				}
+				if (!failed) {
+					failed = field_add(&f, args[i], strlen(args[i]), 0);
+				}
+			}
+			p = end + 1;
+			continue;
+		}
+		if (*p == EXP_VAR || *p == EXP_QVAR) {
+			failed = param(p + 1, end - p - 1, num, &val, &len);
+			p = end + 1;
+			if (!failed) {
+				failed = quoted ? field_add(&f, val, len, 0) :
+					field_split(&f, val, len, 0, out, exp);
+			}
+			continue;
+		}
+
+		if ((list = strndup(p + 1, end - p - 1)) == NULL) {
+			perror("strndup");
+			failed = -1;
+			break;
+		}
+		p = end + 1;
+		failed = capture(list, exp, &buf, &len);
+		free(list);
+		if (!failed) {
+			failed = quoted ? field_add(&f, buf, len, 1) :
+				field_split(&f, buf, len, 1, out, exp);
+		}
+	}
+
+	if (failed || field_end(&f, out, exp) == -1) {
+		if (f.cap > 0) {
+			free(f.s);
+		}
+		return -1;
+	}
+	return 0;
+}
+
+// Finds the value of a parameter from its text: NAME, a special parameter,
+// #NAME (length of the value) or NAME followed by one of :- - := = :+ + :? ?
+// and a word, taken as it is written. The value is not NUL terminated. num is
+// space for a number. Returns -1 if the parameter is bad or a ? failed.
+static int param(const char *text, size_t tlen, char *num, const char **val,
+	size_t *vlen) {
+	const char *name = text, *op, *word, *value;
+	size_t nlen, wlen;
+	char *copy;
+	int colon, unset;
+
+	if (tlen > 1 && text[0] == '#') {
+		++name;		// Length, of the value of NAME
+	}
+	if ((nlen = var_name_len(name)) == 0) {
+		nlen = 1;	// Special parameter
+	}
+	value = var_param(name, nlen, num);
+	op = name + nlen;
+
+	if (name != text) {
+		if (op != text + tlen) {
+			fprintf(stderr, "pgsh: ${%.*s}: bad substitution\n", (int)tlen, text);
+			pg_errno = ESYNTAX;
+			return -1;
+		}
+		snprintf(num, 24, "%zu", (value != NULL) ? strlen(value) : 0);
+		*val = num;
+		*vlen = strlen(num);
+		return 0;
+	}
+
+	*val = (value != NULL) ? value : "";
+	*vlen = strlen(*val);
+	if (op == text + tlen) {
+		return 0;
+	}
+
+	colon = (*op == ':');
+	op += colon;
+	word = op + 1;
+	wlen = (op < text + tlen) ? (size_t)(text + tlen - word) : 0;
+	unset = (value == NULL || (colon && *value == '\0'));
+	switch (op < text + tlen ? *op : '\0') {
+		case '-':
+			if (unset) {
+				*val = word;
+				*vlen = wlen;
+			}
+			return 0;
+		case '=':
+			if (unset) {
+				if ((copy = strndup(word, wlen)) == NULL) {
+					perror("strndup");
+					return -1;
+				}
+				if (var_set(name, nlen, copy, 0) == -1) {
+					fprintf(stderr, "pgsh: $%.*s: cannot assign\n", (int)nlen, name);
+					free(copy);
+					return -1;
+				}
+				free(copy);
+				*val = word;
+				*vlen = wlen;
+			}
+			return 0;
+		case '+':
+			*val = unset ? "" : word;
+			*vlen = unset ? 0 : wlen;
+			return 0;
+		case '?':
+			if (unset) {
+				if (wlen == 0) {
+					word = "parameter not set";
+					wlen = strlen(word);
+				}
+				fprintf(stderr, "pgsh: %.*s: %.*s\n", (int)nlen, name, (int)wlen,
+					word);
+				pg_errno = ENOENV;
+				return -1;
+			}
+			return 0;
+		default:
+			fprintf(stderr, "pgsh: ${%.*s}: bad substitution\n", (int)tlen, text);
+			pg_errno = ESYNTAX;
+			return -1;
+	}
+}
+
+// Expands the parameters and lists of an arithmetic expression, as if it was
+// in double quotes. Returns the expanded text and stores its length to len,
+// or returns NULL on failure.
+static const char * arith_text(const char *text, size_t *len,
+	struct expansion *exp) {
+	struct token *tokens;
+	const char *word = NULL;
+	char *line;
+	int ntokens;
+
+	if ((line = (char *)malloc(*len + 3)) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	line[0] = '"';
+	memcpy(line + 1, text, *len);
+	line[*len + 1] = '"';
+	line[*len + 2] = '\0';
+	tokens = lex_line(line, &ntokens);
+	free(line);
+	if (tokens == NULL) {
+		return NULL;		// Reported by the lexer
+	}
+
+	// The word itself may be the expansion, kept with the expansion's memory
+	if (ntokens != 2 || tokens[0].type != TK_WORD) {
+		fprintf(stderr, "pgsh: %.*s: bad arithmetic expression\n", (int)*len, text);
+		pg_errno = EARITH;
+	} else if (exp_keep(exp, tokens[0].text, 0) == 0) {
+		word = expand_text(tokens[0].text, 0, exp);
+		tokens[0].text = NULL;
+	}
+	tokens_free(tokens, ntokens);
+
+	if (word != NULL) {
+		*len = strlen(word);
+	}
+	return word;
+}
+
+// Runs a list with its output in a memory file and maps the output, without
+// its trailing newlines. The mapping has a spare byte after the output.
+// Returns -1 on failure.
+static int capture(const char *list, struct expansion *exp, char **buf,
+	size_t *len) {
+	struct stat st;
+	void *addr;
+	int fd;
+
+	if ((fd = fd_memfile("subst")) == -1) {
+		pg_errno = EOPEN;
+		return -1;
+	}
+	if (run_list(list, fd) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	if (fstat(fd, &st) == -1 || ftruncate(fd, st.st_size + 1) == -1 ||
+		(addr = mmap(NULL, st.st_size + 1, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		fd, 0)) == MAP_FAILED) {
+		close(fd);
+		pg_errno = EOPEN;
+		return -1;
+	}
+	close(fd);
+	++exp->nlists;
+	if (exp_keep(exp, addr, st.st_size + 1) == -1) {
+		munmap(addr, st.st_size + 1);
+		return -1;
+	}
+
+	*buf = (char *)addr;
+	*len = st.st_size;
+	while (*len > 0 && (*buf)[*len - 1] == '\n') {
+		--*len;
+	}
+	return 0;
+}
+
+// Runs a list with its standard output on fd and stores its exit status to
+// pg_status. Returns -1 if it could not run.
+static int run_list(const char *list, int fd) {
+	struct plan *plan;
+	const struct plan_cmd *cmd;
+	struct subst_run run;
+	char *line;
+	pid_t pid;
+	int status;
+
+	// A single pipeline, but not exit or cd, runs in the shell
+	plan = plan_get(list);
+	if (plan != NULL && plan->code[0].op == OP_RUN && plan->code[1].op == OP_END) {
+		cmd = &plan->pipes[0].cmds[0];
+		if (plan->pipes[0].ncmds > 1 || (cmd->argc > 0 &&
+			special_cmd_id(cmd->argv[0]) == NOSP)) {
+			if (subst_begin(&plan->pipes[0], &run) == 0) {
+				if (pipe_chain(&run.pipe, STDIN_FILENO, fd) == -1 &&
+					pg_errno != EFCHLD) {	// Failed children already reported
+					pg_perror("pipe_chain");
+				}
+				subst_end(&run);
+			} else {
+				pg_perror("substitution");
+				pg_status = 1;
+			}
+			plan_put(plan);
+			pg_errno = EOK;
+			return 0;
+		}
+	}
+	plan_put(plan);
+	pg_errno = EOK;		// Errors of the line are reported by the child
+
+	fflush(stdout);		// Not to be written twice
+	if ((pid = fork()) == 0) {
+		if (dup2(fd, STDOUT_FILENO) == -1 || (line = strdup(list)) == NULL) {
+			_exit(EXIT_FAILURE);
+		}
+		handle_cmd_line(line);
+		fflush(stdout);
+		_exit(pg_status);
+	} else if (pid == -1) {
+		pg_errno = EFORK;
+		return -1;
+	}
+
+	if ((status = wait_argv(pid, NULL)) == -1) {
+		return -1;
+	}
+	pg_status = status;
+	return 0;
+}
+
+// Adds text to a field. Text in place starts a field that stays in place,
+// anything else is copied. Returns -1 on failure.
+static int field_add(struct field *f, const char *s, size_t len, int inplace) {
+	size_t cap;
+	char *copy;
+
+	if (!f->open && inplace) {
+		f->s = (char *)s;		// Captured outputs are writable
+		f->len = len;
+		f->cap = 0;
+		f->open = 1;
+		return 0;
+	}
+
+	if (f->len + len + 1 > f->cap) {
+		for (cap = (f->cap > 0) ? f->cap : FIELD_MIN; cap < f->len + len + 1; )
+			cap *= 2;
+		if (f->cap > 0) {
+			copy = (char *)realloc(f->s, cap);
+		} else if ((copy = (char *)malloc(cap)) != NULL && f->open) {
+			memcpy(copy, f->s, f->len);
+		}
+		if (copy == NULL) {
+			perror("malloc");
+			return -1;
+		}
+		f->s = copy;
+		f->cap = cap;
+	}
+	memcpy(f->s + f->len, s, len);
+	f->len += len;
+	f->open = 1;
+
+	return 0;
+}
+
+// Adds text to the fields of a list, split on blanks and newlines. Returns -1
+// on failure.
+static int field_split(struct field *f, const char *s, size_t len, int inplace,
+	struct fields *out, struct expansion *exp) {
+	size_t i = 0, start;
+
+	while (i < len) {
+		if (s[i] == ' ' || s[i] == '\t' || s[i] == '\n') {
+			if (field_end(f, out, exp) == -1) {
+				return -1;
+			}
+			++i;
+			continue;
+		}
+		for (start = i; i < len && s[i] != ' ' && s[i] != '\t' && s[i] != '\n'; ++i)
+			;
+		if (field_add(f, s + start, i - start, inplace) == -1) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Ends a field and adds it to a list. A field in place is ended over the
+// blank (or spare byte) after it. A pattern is replaced with the paths it
+// matches and kept as it is if there are none. Returns -1 on failure.
+static int field_end(struct field *f, struct fields *out, struct expansion *exp) {
+	struct glob_res res;
+	int i, status = 0;
+
+	if (!f->open) {
+		return 0;
+	}
+
+	f->s[f->len] = '\0';
+	if (f->glob == 1) {			// Patterns hold literal text, always a copy
+		if (glob_run(f->s, &res) == -1) {
+			return -1;
+		}
+		if (res.n > 0) {
+			if (exp_keep(exp, res.pool, 0) == -1) {
+				free(res.pool);
+				free(res.offs);
+				return -1;
+			}
+			for (i = 0; i < res.n && status == 0; ++i) {
+				status = fields_add(out, res.pool + res.offs[i]);
+			}
+			free(res.offs);
+			free(f->s);
+			memset(f, 0, sizeof(struct field));
+			return status;
+		}
+	}
+	if (f->glob != 0) {
+		glob_strip(f->s);
+	}
+
+	if (f->cap > 0 && exp_keep(exp, f->s, 0) == -1) {
+		return -1;
+	}
+	f->open = 0;
+	f->cap = 0;
+	f->len = 0;
+	f->glob = 0;
+
+	return fields_add(out, f->s);
+}
+
+// Appends a field to a list. Returns -1 on failure.
+static int fields_add(struct fields *out, char *s) {
+	char **tmp;
+
+	if (out->n == out->cap) {
+		out->cap = (out->cap == 0) ? 8 : out->cap * 2;
+		if ((tmp = (char **)realloc(out->v, out->cap * sizeof(char *))) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		out->v = tmp;
+	}
+	out->v[out->n++] = s;
+
+	return 0;
+}
+
+// Keeps a block to free (len 0) or a mapping to unmap. Returns -1 on failure.
+static int exp_keep(struct expansion *exp, void *addr, size_t len) {
+	struct exp_mem *tmp;
+
+	if (exp->nmem == exp->cap) {
+		exp->cap = (exp->cap == 0) ? 8 : exp->cap * 2;
+		tmp = (struct exp_mem *)realloc(exp->mem, exp->cap * sizeof(struct exp_mem));
+		if (tmp == NULL) {
+			perror("realloc");
+			pg_errno = EOPEN;
+			return -1;
+		}
+		exp->mem = tmp;
+	}
+	exp->mem[exp->nmem].addr = addr;
+	exp->mem[exp->nmem].len = len;
+	++exp->nmem;
+
+	return 0;
+}
@@ -0,0 +1,28 @@
+#ifndef PG_EXPAND_H
+#define PG_EXPAND_H
+
+#include <stddef.h>
+#include "pg_plan.h"
+
+// Memory block of an expansion, a mapping if len is not 0
+struct exp_mem {
+	void *addr;
+	size_t len;
+};
+
+// Memory of the expanded commands of a pipeline. Fields point into the output
+// of the lists where they can, so it is only freed once the pipeline has run.
+struct expansion {
+	struct exp_mem *mem;	// Captured outputs, copied fields and argument vectors
+	int nmem;
+	int cap;
+	int nlists;				// Command substitutions run
+};
+
+// Function Prototypes
+
+int expand_cmd(struct plan_cmd *cmd, struct expansion *exp);
+char * expand_text(const char *word, int pattern, struct expansion *exp);
+void expand_free(struct expansion *exp);
+
+#endif
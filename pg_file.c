@@ -1,87 +1,569 @@
+#define _GNU_SOURCE	// pipe2(), memfd_create()
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#include <sys/mman.h>
+#include <dirent.h>
 #include "pg_file.h"
 #include "pg_error.h"
 
-/* Description: Redirects the input and or the output of the current process.		
+static int shared[FD_SHARED_MAX];	// Descriptors marked with fd_share
+static int nshared;
+
+// Static Function Prototypes //
+static int fd_dead(const struct fd_op *ops, int n, int i);
+static int fd_inherited(int fd);
+static int fd_shared(int fd);
+static long pipe_max_size(void);
+
+/* Description: Checks a list of file descriptor operations before it is applied.
  *
- * Arguments:	input: 		Input redirection file
- *				output:		Output redirection file
- *				append:		Append data(TRUE) or Overwrite them(FALSE).
+ * Arguments:	ops:	Operations, in the order they are applied
+ *				n:		Number of operations
  * 		
- * Returns:		- On success, backup file descriptor of the original standard output
- * 				- On failure, -1
- *						# ENULL: Both input and output are NULL
- *						# EOPEN: Error while opening files
- *						# EDUP : Error while duplicating file descriptors
- *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *						# EREDIR: Too many operations, descriptor out of range,
+ *								  missing filename or copy of a descriptor the
+ *								  list itself closed
  *
- * Notes:		- If NULL is given to either input or output, the file descriptor
- *				  for that remains the same.
- *				- If the output file does not exit, it is created automatically.
- *				
+ * Notes:		Operations are validated once, when the command is compiled, so
+ *				fd_apply does not check them again.
  */
-
-int redirect(char *input, char *output, int append) {
-	int inFd, outFd;	// Input and output file descriptor
-	int backOutFd;		// Backup stdout file descriptor
-	int openFlag;
+int fd_validate(const struct fd_op *ops, int n) {
+	static long open_max;	// Highest descriptor number plus one
+	int i, j;
 	
-	if (input == NULL && output == NULL) {
+	if (ops == NULL && n > 0) {
 		pg_errno = ENULL;
 		return -1;
 	}
 	
-	if (input != NULL) {
+	if (n > FD_OPS_MAX) {
+		pg_errno = EREDIR;
+		return -1;
+	}
+	
+	if (open_max == 0 && (open_max = sysconf(_SC_OPEN_MAX)) <= 0) {
+		open_max = 1024;
+	}
 	
-		// Open input file
-		inFd = open(input, O_RDONLY);
-		if(inFd==-1) {	
-			pg_errno = EOPEN;
+	for (i = 0; i < n; ++i) {
+		if (ops[i].fd < 0 || ops[i].fd >= open_max) {
+			pg_errno = EREDIR;
 			return -1;
 		}
+		
+		switch (ops[i].type) {
+			case FD_OPEN:
+				if (ops[i].path == NULL || ops[i].path[0] == '\0') {
+					pg_errno = EREDIR;
+					return -1;
+				}
+				break;
+			case FD_DUP:
+				if (ops[i].src < 0 || ops[i].src >= open_max) {
+					pg_errno = EREDIR;
+					return -1;
+				}
+				// The last operation on src must not have closed it
+				for (j = i - 1; j >= 0 && ops[j].fd != ops[i].src; --j);
+				if (j >= 0 && ops[j].type == FD_CLOSE) {
+					pg_errno = EREDIR;
+					return -1;
+				}
+				break;
+			case FD_CLOSE:
+				break;
+			case FD_DATA:
+				if (ops[i].path == NULL) {
+					pg_errno = EREDIR;
+					return -1;
+				}
+				break;
+			default:
+				pg_errno = EREDIR;
+				return -1;
+		}
+	}
 	
-		// Redirect input file
-		if (dup2(inFd, STDIN_FILENO) == -1) {
-			pg_errno = EDUP;
-			return -1;
+	return 0;
+}
+
+/* Description: Applies a list of file descriptor operations to the current process.
+ *
+ * Arguments:	ops:	Operations, in the order they are applied
+ *				n:		Number of operations
+ * 		
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EOPEN: Error while opening a file or creating the
+ *								 descriptor of a here-document
+ *						# EDUP : Error while duplicating a file descriptor
+ *
+ * Notes:		- The failing operation is reported to stderr, as the caller is
+ *				  normally a child that exits right after.
+ *				- Operations whose descriptor is replaced later, before anything
+ *				  copies it, are skipped. Files are still opened (and truncated
+ *				  or created) but are never dup2()ed into place.
+ *				- A file opened straight on its target descriptor is not moved.
+ */
+int fd_apply(const struct fd_op *ops, int n) {
+	int i;
+	int fd;
+	int dead;
+	
+	for (i = 0; i < n; ++i) {
+		dead = fd_dead(ops, n, i);
+		
+		switch (ops[i].type) {
+			case FD_OPEN:
+			case FD_DATA:
+				if (ops[i].type == FD_OPEN) {
+					fd = open(ops[i].path, ops[i].flags, 0644);
+				} else {
+					fd = fd_data(ops[i].path, strlen(ops[i].path));
+				}
+				if (fd == -1) {
+					perror(ops[i].type == FD_OPEN ? ops[i].path : "here-document");
+					pg_errno = EOPEN;
+					return -1;
+				}
+				if (fd == ops[i].fd) {		// Already in place
+					if (ops[i].type == FD_DATA && fcntl(fd, F_SETFD, 0) == -1) {
+						perror("fcntl");	// fd_data gives a close-on-exec fd
+						pg_errno = EDUP;
+						return -1;
+					}
+					break;
+				}
+				if (!dead && dup2(fd, ops[i].fd) == -1) {
+					fprintf(stderr, "pgsh: %d: ", ops[i].fd);
+					perror("dup2");
+					close(fd);
+					pg_errno = EDUP;
+					return -1;
+				}
+				close(fd);
+				break;
+			case FD_DUP:
+				if (dead) {
+					break;
+				}
+				if (dup2(ops[i].src, ops[i].fd) == -1) {
+					fprintf(stderr, "pgsh: %d: ", ops[i].src);
+					perror("dup2");
+					pg_errno = EDUP;
+					return -1;
+				}
+				break;
+			case FD_CLOSE:
+				if (!dead) {
+					close(ops[i].fd);
+				}
+				break;
 		}
-		close(inFd);
+	}
 	
+	return 0;
+}
+
+/* Description: Checks if the result of an operation is never seen, because a
+ *				later operation replaces its descriptor before any operation
+ *				copies it.
+ *
+ * Returns:		- If the operation can be skipped, 1
+ * 				- Otherwise, 0
+ */
+static int fd_dead(const struct fd_op *ops, int n, int i) {
+	int j;
+	
+	for (j = i + 1; j < n; ++j) {
+		if (ops[j].type == FD_DUP && ops[j].src == ops[i].fd) {
+			return 0;
+		}
+		if (ops[j].fd == ops[i].fd) {
+			return 1;
+		}
 	}
 	
-	// Backup original stdout file descriptor
-	backOutFd = dup(STDOUT_FILENO);
+	return 0;
+}
+
+/* Description: Resolves a list of file descriptor operations for code that runs
+ *				inside the shell. The shell's descriptors are not changed, instead
+ *				fds[0..2] are set to the descriptors that play the role of the
+ *				standard input, output and error.
+ *
+ * Arguments:	ops:		Operations, in the order they are applied
+ *				n:			Number of operations
+ *				fds:		Standard descriptors, updated in place
+ *				opened:		Stores the files opened, at least FD_OPS_MAX
+ *				nopened:	Stores the number of files opened
+ *
+ * Returns:		- On success,  0. The files opened must be closed by the caller.
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EOPEN: Error while opening a file or creating the
+ *								 descriptor of a here-document
+ *
+ * Notes:		Operations on descriptors above 2 only have their side effects
+ *				(files are created or truncated). A closed descriptor is -1.
+ */
+int fd_resolve(const struct fd_op *ops, int n, int fds[3], int *opened, int *nopened) {
+	int i;
+	int fd;
 	
-	//write(backOutFd, "Not printed !", 13);
-	if (backOutFd == -1) return -2;
+	*nopened = 0;
 	
-	if (output != NULL) {
-		
-		// Configure open flag argument
-		openFlag = O_WRONLY | O_CREAT;
-		if (append) {
-			openFlag |= O_APPEND; // Add append flag
-		} else {
-			openFlag |= O_TRUNC;  // Add truncate flag (delete previous contents)
+	for (i = 0; i < n; ++i) {
+		switch (ops[i].type) {
+			case FD_OPEN:
+			case FD_DATA:
+				if (ops[i].type == FD_OPEN) {
+					fd = open(ops[i].path, ops[i].flags | O_CLOEXEC, 0644);
+				} else {
+					fd = fd_data(ops[i].path, strlen(ops[i].path));
+				}
+				if (fd == -1) {
+					perror(ops[i].type == FD_OPEN ? ops[i].path : "here-document");
+					while (*nopened > 0) {
+						close(opened[--*nopened]);
+					}
+					pg_errno = EOPEN;
+					return -1;
+				}
+				if (ops[i].fd > 2) {
+					close(fd);
+					break;
+				}
+				opened[(*nopened)++] = fd;
+				fds[ops[i].fd] = fd;
+				break;
+			case FD_DUP:
+				if (ops[i].fd <= 2) {
+					fds[ops[i].fd] = (ops[i].src <= 2) ? fds[ops[i].src] : ops[i].src;
+				}
+				break;
+			case FD_CLOSE:
+				if (ops[i].fd <= 2) {
+					fds[ops[i].fd] = -1;
+				}
+				break;
+		}
+	}
+	
+	return 0;
+}
+
+/* Description: Marks a descriptor close-on-exec, so that children never inherit it.
+ *
+ * Arguments:	fd:		File descriptor
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (check errno)
+ */
+int fd_cloexec(int fd) {
+	int flags = fcntl(fd, F_GETFD);
+	
+	if (flags == -1 || fcntl(fd, F_SETFD, flags | FD_CLOEXEC) == -1) {
+		return -1;
+	}
+	
+	return 0;
+}
+
+/* Description: Creates a pipe whose both ends are close-on-exec.
+ *
+ * Arguments:	fds:	Stores the read (fds[0]) and write (fds[1]) end
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EPIPEF: Error creating pipe (check errno)
+ *
+ * Notes:		A child only gets the ends that are dup2()ed to its standard
+ *				descriptors, because dup2 clears close-on-exec on the copy.
+ */
+int fd_pipe(int fds[2]) {
+#ifdef __linux__
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		pg_errno = EPIPEF;
+		return -1;
+	}
+#else
+	if (pipe(fds) == -1) {
+		pg_errno = EPIPEF;
+		return -1;
+	}
+	fd_cloexec(fds[0]);
+	fd_cloexec(fds[1]);
+#endif
+	return 0;
+}
+
+/* Description: Creates a file that lives in memory only.
+ *
+ * Arguments:	name:	Name of the file, shown in /proc/PID/fd
+ *
+ * Returns:		- On success, the close-on-exec file descriptor
+ * 				- On failure, -1 (check errno)
+ *
+ * Notes:		Without memfds an unlinked temporary file does the same.
+ */
+int fd_memfile(const char *name) {
+	char path[] = "/tmp/pgsh-XXXXXX";
+	int fd;
+
+#ifdef MFD_CLOEXEC
+	if ((fd = memfd_create(name, MFD_CLOEXEC)) != -1) {
+		return fd;
+	}
+#endif
+	if ((fd = mkstemp(path)) == -1) {
+		return -1;
+	}
+	unlink(path);
+	fd_cloexec(fd);
+	return fd;
+}
+
+/* Description: Creates a descriptor to read a text from, for here-documents
+ *				and here-strings.
+ *
+ * Arguments:	data:	Text
+ *				len:	Length of the text
+ *
+ * Returns:		- On success, the close-on-exec descriptor, at the start of
+ *				  the text
+ * 				- On failure, -1 (check errno)
+ *
+ * Notes:		A text that fits in a pipe is written to one, and the writer
+ *				never blocks. A longer one goes to a sealed memory file, which
+ *				the reader can map. Nothing is written to disk, unless there
+ *				are no memfds.
+ */
+int fd_data(const char *data, size_t len) {
+	int fds[2];
+	int fd = -1;
+	ssize_t n;
+	size_t done;
+
+	if (len <= PIPE_BUF) {
+		if (fd_pipe(fds) == -1) {
+			return -1;
+		}
+		if (len > 0 && write(fds[1], data, len) != (ssize_t)len) {
+			close(fds[0]);
+			close(fds[1]);
+			return -1;
+		}
+		close(fds[1]);
+		return fds[0];
+	}
+
+#ifdef MFD_ALLOW_SEALING
+	fd = memfd_create("heredoc", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+#endif
+	if (fd == -1 && (fd = fd_memfile("heredoc")) == -1) {
+		return -1;
+	}
+	for (done = 0; done < len; done += n) {
+		if ((n = write(fd, data + done, len - done)) == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			close(fd);
+			return -1;
 		}
+	}
+#ifdef F_ADD_SEALS
+	// Fails where sealing is not allowed, the text is the same
+	fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+#endif
+	if (lseek(fd, 0, SEEK_SET) == -1) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/* Description: Changes the buffer size of a pipe.
+ *
+ * Arguments:	fd:		Either end of the pipe
+ *				size:	Requested size in bytes, 0 to keep the current size
+ *
+ * Returns:		- On success, the size of the pipe
+ * 				- On failure, -1 (check errno)
+ *
+ * Notes:		The size is limited to /proc/sys/fs/pipe-max-size and rounded up
+ *				by the kernel to a power of two pages. Where pipes cannot be
+ *				resized the size is left unchanged.
+ */
+long fd_pipe_size(int fd, long size) {
+#ifdef F_SETPIPE_SZ
+	long max;
 	
-		// Open output file
-		outFd = open(output, openFlag, 0644);
-		if(outFd==-1) {
+	if (size > 0) {
+		max = pipe_max_size();
+		if (max > 0 && size > max) {
+			size = max;
+		}
+		if (fcntl(fd, F_SETPIPE_SZ, (int)size) == -1) {
 			return -1;
 		}
+	}
+	return fcntl(fd, F_GETPIPE_SZ);
+#else
+	(void)fd;
+	(void)size;
+	return 0;
+#endif
+}
+
+/* Description: Marks a descriptor that children inherit on purpose, such as
+ *				the pipe of a process substitution, so fd_report does not
+ *				count it as stray.
+ *
+ * Arguments:	fd:		Descriptor
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		Past FD_SHARED_MAX descriptors the others are reported.
+ */
+void fd_share(int fd) {
+	if (nshared < FD_SHARED_MAX) {
+		shared[nshared++] = fd;
+	}
+}
+
+/* Description: Forgets a descriptor marked with fd_share, before it is closed.
+ *
+ * Arguments:	fd:		Descriptor
+ *
+ * Returns:		void: Nothing
+ */
+void fd_unshare(int fd) {
+	int i;
+	
+	for (i = 0; i < nshared; ++i) {
+		if (shared[i] == fd) {
+			shared[i] = shared[--nshared];
+			return;
+		}
+	}
+}
+
+/* Description: Lists to stderr the descriptors that survive exec, if the
+ *				FD_DEBUG_ENV environment variable is set.
+ *
+ * Arguments:	name:	Name of the command about to be executed
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		It is called by children right before exec, or by the shell
+ *				right before posix_spawn, as the command inherits the same
+ *				descriptors (the pid is then the shell's). Descriptors other
+ *				than 0, 1 and 2 are reported as stray, unless they were
+ *				marked with fd_share.
+ */
+void fd_report(const char *name) {
+	char list[512];
+	size_t len = 0;
+	int stray = 0;
+	int fd;
+#ifdef __linux__
+	DIR *dir;
+	struct dirent *ent;
+#else
+	long max;
+#endif
+	
+	if (getenv(FD_DEBUG_ENV) == NULL) {
+		return;
+	}
+	
+	list[0] = '\0';
+	
+#ifdef __linux__
+	if ((dir = opendir("/proc/self/fd")) == NULL) {
+		return;
+	}
+	while ((ent = readdir(dir)) != NULL) {
+		if (ent->d_name[0] == '.') {
+			continue;
+		}
+		fd = atoi(ent->d_name);
+		if (fd == dirfd(dir) || !fd_inherited(fd)) {
+			continue;
+		}
+#else
+	max = sysconf(_SC_OPEN_MAX);
+	if (max <= 0 || max > 4096) {
+		max = 4096;
+	}
+	for (fd = 0; fd < max; ++fd) {
+		if (!fd_inherited(fd)) {
+			continue;
+		}
+#endif
+		if (len < sizeof(list) - 16) {
+			len += snprintf(list + len, sizeof(list) - len, " %d", fd);
+		}
+		stray += (fd > 2 && !fd_shared(fd));
+	}
+#ifdef __linux__
+	closedir(dir);
+#endif
 	
-		// Redirect output file
-		if(dup2(outFd, STDOUT_FILENO) == -1) {
-			return -2;
+	if (stray > 0) {
+		fprintf(stderr, "pgsh: [%d] %s inherits fds:%s (%d stray)\n", (int)getpid(),
+			name, list, stray);
+	} else {
+		fprintf(stderr, "pgsh: [%d] %s inherits fds:%s\n", (int)getpid(), name,
+			list);
+	}
+}
+
+// Checks if a descriptor was marked with fd_share
+static int fd_shared(int fd) {
+	int i;
+	
+	for (i = 0; i < nshared; ++i) {
+		if (shared[i] == fd) {
+			return 1;
 		}
-		close(outFd);
 	}
+	return 0;
+}
+
+// Checks if a descriptor is open and not close-on-exec
+static int fd_inherited(int fd) {
+	int flags = fcntl(fd, F_GETFD);
+	
+	return flags != -1 && !(flags & FD_CLOEXEC);
+}
+
+// Reads the largest pipe size an unprivileged process may set (read only once)
+static long pipe_max_size(void) {
+	static long max = -1;
+	FILE *fp;
 	
-	return backOutFd;
+	if (max == -1) {
+		max = 0;
+		if ((fp = fopen("/proc/sys/fs/pipe-max-size", "re")) != NULL) {
+			if (fscanf(fp, "%ld", &max) != 1) {
+				max = 0;
+			}
+			fclose(fp);
+		}
+	}
 	
+	return max;
 }
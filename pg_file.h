@@ -1,6 +1,42 @@
 #ifndef PG_FILE_H
 #define PG_FILE_H
 
-int redirect(char *input, char *output, int append);
+#include <stddef.h>
+
+#define FD_OPS_MAX	32		// Maximum number of redirections of a command
+#define FD_DEBUG_ENV	"PGSH_FDDEBUG"	// Set to list the fds every child inherits
+#define FD_SHARED_MAX	64		// Descriptors inherited on purpose fd_report knows
+
+// Enumerations
+
+enum FdOpType {
+	FD_OPEN,	// Open path with flags on fd
+	FD_DUP,		// Make fd a copy of src
+	FD_CLOSE,	// Close fd
+	FD_DATA		// Read the text in path from fd (here-documents)
+};
+
+// File descriptor operation of a redirection
+struct fd_op {
+	enum FdOpType type;
+	int fd;				// Descriptor changed
+	int src;			// Copied descriptor (FD_DUP)
+	int flags;			// open flags (FD_OPEN)
+	const char *path;	// Opened file (FD_OPEN) or text (FD_DATA)
+};
+
+// Function Prototypes
+
+int fd_validate(const struct fd_op *ops, int n);
+int fd_apply(const struct fd_op *ops, int n);
+int fd_resolve(const struct fd_op *ops, int n, int fds[3], int *opened, int *nopened);
+int fd_cloexec(int fd);
+int fd_pipe(int fds[2]);
+long fd_pipe_size(int fd, long size);
+int fd_memfile(const char *name);
+int fd_data(const char *data, size_t len);
+void fd_share(int fd);
+void fd_unshare(int fd);
+void fd_report(const char *name);
 
 #endif
@@ -0,0 +1,1123 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Text filter builtins: wc, head, tail, fixed string grep and tr. They read big
+ * blocks and hand them to the vectorized kernels of pg_simd.c instead of going
+ * through the input a line at a time. tail maps a regular file and searches it
+ * backwards from the end, so only the part it prints is ever read. Arguments a
+ * builtin does not handle (regular expressions, uncommon options) leave the
+ * command to the external program.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE		// memrchr()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "pg_error.h"
+#include "pg_string.h"
+#include "pg_simd.h"
+#include "pg_builtin.h"
+
+#define FILTER_BUFSIZE	(128 * 1024)	// Bytes read at a time
+#define OUT_BUFSIZE		(64 * 1024)		// Output gathered before it is written
+#define TAIL_KEEP		(1024 * 1024)	// Input tail keeps before trimming
+#define TR_SET_MAX		1024			// Bytes of an expanded tr set
+
+// Output of a filter, gathered to few writes
+struct outbuf {
+	struct bi_ctx *ctx;
+	size_t len;
+	char data[OUT_BUFSIZE];
+};
+
+// Growing input buffer
+struct linebuf {
+	char *data;
+	size_t len;
+	size_t cap;
+};
+
+// Options of head and tail
+struct count_opts {
+	int bytes;		// Count bytes instead of lines
+	int from;		// tail: count from the start (+N)
+	size_t count;
+	int first;		// Index of the first file argument
+};
+
+// Options of grep
+struct grep_opts {
+	int invert, count, quiet, number;
+	const char *pat;
+	size_t plen;
+	int first;		// Index of the first file argument
+	int names;		// Prefix lines with the file name
+};
+
+// State of grep while it goes through a file
+struct grep_state {
+	const struct grep_opts *o;
+	struct outbuf *ob;
+	const char *name;
+	long long lineno;	// Lines before the current block
+	long long count;	// Selected lines
+};
+
+// Options of wc
+struct wc_opts {
+	int lines, words, bytes;
+	int first;		// Index of the first file argument
+};
+
+struct wc_counts {
+	long long lines, words, bytes;
+};
+
+// Static Function Prototypes //
+static int out_put(struct outbuf *ob, const char *p, size_t n);
+static int out_flush(struct outbuf *ob);
+static int lb_reserve(struct linebuf *lb, size_t room);
+static int in_open(struct bi_ctx *ctx, const char *name);
+static ssize_t in_read(struct bi_ctx *ctx, int fd, char *buf, size_t len);
+static void in_close(struct bi_ctx *ctx, int fd);
+static const char * in_name(const char *name);
+static int print_header(struct outbuf *ob, const char *name, int blank);
+static int get_count_opts(int argc, char **argv, struct count_opts *o, int tail);
+static int head_fd(struct bi_ctx *ctx, int fd, const struct count_opts *o,
+	struct outbuf *ob);
+static int tail_fd(struct bi_ctx *ctx, int fd, const struct count_opts *o,
+	struct outbuf *ob);
+static int tail_map(int fd, off_t off, off_t size, const struct count_opts *o,
+	struct outbuf *ob);
+static int tail_stream(struct bi_ctx *ctx, int fd, const struct count_opts *o,
+	struct outbuf *ob);
+static size_t tail_start(const char *p, size_t len, const struct count_opts *o);
+static int get_grep_opts(int argc, char **argv, struct grep_opts *o);
+static int grep_fd(struct bi_ctx *ctx, int fd, struct grep_state *g);
+static int grep_block(struct grep_state *g, const char *p, size_t n);
+static int grep_run(struct grep_state *g, const char *a, const char *b, int sel);
+static int get_wc_opts(int argc, char **argv, struct wc_opts *o);
+static int wc_fd(struct bi_ctx *ctx, int fd, const struct wc_opts *o,
+	struct wc_counts *c);
+static int wc_print(struct outbuf *ob, const struct wc_opts *o,
+	const struct wc_counts *c, int width, const char *name);
+static int get_tr_opts(int argc, char **argv, int *delete);
+static int tr_set(const char *str, unsigned char *set);
+
+/* Description: wc [-lwc] [FILE]...
+ *				Counts the lines, words and bytes of files ("-" or none is the
+ *				standard input). The byte count of a regular file is its size.
+ */
+int bi_wc(int argc, char **argv, struct bi_ctx *ctx) {
+	struct outbuf ob;
+	struct wc_opts o;
+	struct wc_counts c, total = { 0, 0, 0 };
+	struct stat st;
+	long long size = 0;
+	int status = 0;
+	int width, ninputs, fields, i, fd, regular = 1;
+	const char *name;
+
+	if (get_wc_opts(argc, argv, &o) == -1) {
+		bi_error(ctx, "usage: wc [-lwc] [FILE]...");
+		return 2;
+	}
+	ob.ctx = ctx;
+	ob.len = 0;
+	ninputs = (argc > o.first) ? argc - o.first : 1;
+	fields = o.lines + o.words + o.bytes;
+
+	// Numbers are as wide as the total size, or 7 wide if it cannot be known
+	for (i = o.first; i < argc || i == o.first; ++i) {
+		name = (i < argc) ? argv[i] : "-";
+		if (strcmp(name, "-") == 0 && ctx->in < 0) {
+			regular = 0;	// Ring
+			continue;
+		}
+		if (strcmp(name, "-") == 0 ? fstat(ctx->in, &st) == -1 :
+			stat(name, &st) == -1) {
+			continue;
+		}
+		if (!S_ISREG(st.st_mode)) {
+			regular = 0;
+		}
+		size += st.st_size;
+	}
+	if (fields == 1 && ninputs == 1) {
+		width = 1;
+	} else if (!regular) {
+		width = 7;
+	} else {
+		for (width = 1; size >= 10; size /= 10) {
+			++width;
+		}
+	}
+
+	for (i = o.first; i < argc || i == o.first; ++i) {
+		name = (i < argc) ? argv[i] : NULL;
+		if ((fd = in_open(ctx, name ? name : "-")) == -1) {
+			status = 1;
+			continue;
+		}
+		if (wc_fd(ctx, fd, &o, &c) == -1) {
+			bi_error(ctx, "%s: %s", in_name(name), strerror(errno));
+			status = 1;
+		} else {
+			wc_print(&ob, &o, &c, width, name);
+			total.lines += c.lines;
+			total.words += c.words;
+			total.bytes += c.bytes;
+		}
+		in_close(ctx, fd);
+	}
+	if (ninputs > 1) {
+		wc_print(&ob, &o, &total, width, "total");
+	}
+
+	if (out_flush(&ob) == -1) {
+		return 1;
+	}
+	return status;
+}
+
+/* Description: Checks if the wc builtin handles the arguments.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_wc_accepts(int argc, char **argv) {
+	struct wc_opts o;
+
+	return get_wc_opts(argc, argv, &o) == 0;
+}
+
+/* Description: head [-n N | -c N | -N] [FILE]...
+ *				Prints the first N (10) lines or bytes of files. A seekable input
+ *				is left right after the part printed.
+ */
+int bi_head(int argc, char **argv, struct bi_ctx *ctx) {
+	struct outbuf ob;
+	struct count_opts o;
+	int status = 0;
+	int i, fd, headers;
+	const char *name;
+
+	if (get_count_opts(argc, argv, &o, 0) == -1) {
+		bi_error(ctx, "usage: head [-n N | -c N] [FILE]...");
+		return 2;
+	}
+	ob.ctx = ctx;
+	ob.len = 0;
+	headers = argc - o.first > 1;
+
+	for (i = o.first; i < argc || i == o.first; ++i) {
+		name = (i < argc) ? argv[i] : "-";
+		if ((fd = in_open(ctx, name)) == -1) {
+			status = 1;
+			continue;
+		}
+		if (headers) {
+			print_header(&ob, in_name(name), i > o.first);
+		}
+		if (head_fd(ctx, fd, &o, &ob) == -1) {
+			bi_error(ctx, "%s: %s", in_name(name), strerror(errno));
+			status = 1;
+		}
+		in_close(ctx, fd);
+		if (ctx->broken) {
+			return 1;
+		}
+	}
+
+	if (out_flush(&ob) == -1) {
+		return 1;
+	}
+	return status;
+}
+
+/* Description: Checks if the head builtin handles the arguments.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_head_accepts(int argc, char **argv) {
+	struct count_opts o;
+
+	return get_count_opts(argc, argv, &o, 0) == 0;
+}
+
+/* Description: tail [-n [+]N | -c [+]N | -N] [FILE]...
+ *				Prints the last N (10) lines or bytes of files, or everything
+ *				from line or byte N on with +N. A regular file is mapped and
+ *				searched backwards from its end.
+ */
+int bi_tail(int argc, char **argv, struct bi_ctx *ctx) {
+	struct outbuf ob;
+	struct count_opts o;
+	int status = 0;
+	int i, fd, headers;
+	const char *name;
+
+	if (get_count_opts(argc, argv, &o, 1) == -1) {
+		bi_error(ctx, "usage: tail [-n [+]N | -c [+]N] [FILE]...");
+		return 2;
+	}
+	ob.ctx = ctx;
+	ob.len = 0;
+	headers = argc - o.first > 1;
+
+	for (i = o.first; i < argc || i == o.first; ++i) {
+		name = (i < argc) ? argv[i] : "-";
+		if ((fd = in_open(ctx, name)) == -1) {
+			status = 1;
+			continue;
+		}
+		if (headers) {
+			print_header(&ob, in_name(name), i > o.first);
+		}
+		if (tail_fd(ctx, fd, &o, &ob) == -1) {
+			bi_error(ctx, "%s: %s", in_name(name), strerror(errno));
+			status = 1;
+		}
+		in_close(ctx, fd);
+		if (ctx->broken) {
+			return 1;
+		}
+	}
+
+	if (out_flush(&ob) == -1) {
+		return 1;
+	}
+	return status;
+}
+
+/* Description: Checks if the tail builtin handles the arguments. Following a
+ *				file (-f) is left to the external tail.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_tail_accepts(int argc, char **argv) {
+	struct count_opts o;
+
+	return get_count_opts(argc, argv, &o, 1) == 0;
+}
+
+/* Description: grep [-Fvcqn] PATTERN [FILE]...
+ *				Prints the lines of files that contain the fixed string PATTERN.
+ *				Each block read is searched as a whole and only the lines around
+ *				a match are looked at. Exits with 0 if a line was selected, 1 if
+ *				none was and 2 on errors.
+ */
+int bi_grep(int argc, char **argv, struct bi_ctx *ctx) {
+	struct outbuf ob;
+	struct grep_opts o;
+	struct grep_state g;
+	char num[32];
+	int error = 0, selected = 0;
+	int i, fd, len;
+	const char *name;
+
+	if (get_grep_opts(argc, argv, &o) == -1) {
+		bi_error(ctx, "usage: grep [-Fvcqn] PATTERN [FILE]...");
+		return 2;
+	}
+	ob.ctx = ctx;
+	ob.len = 0;
+
+	for (i = o.first; i < argc || i == o.first; ++i) {
+		name = (i < argc) ? argv[i] : "-";
+		if ((fd = in_open(ctx, name)) == -1) {
+			error = 1;
+			continue;
+		}
+		g.o = &o;
+		g.ob = &ob;
+		g.name = in_name(name);
+		g.lineno = 0;
+		g.count = 0;
+		if (grep_fd(ctx, fd, &g) == -1) {
+			bi_error(ctx, "%s: %s", g.name, strerror(errno));
+			error = 1;
+		} else if (o.count && !o.quiet) {
+			if (o.names) {
+				out_put(&ob, g.name, strlen(g.name));
+				out_put(&ob, ":", 1);
+			}
+			len = snprintf(num, sizeof(num), "%lld\n", g.count);
+			out_put(&ob, num, len);
+		}
+		in_close(ctx, fd);
+		selected |= g.count > 0;
+		if (ctx->broken || (o.quiet && selected)) {
+			break;
+		}
+	}
+
+	if (out_flush(&ob) == -1) {
+		return 2;
+	}
+	if (o.quiet && selected) {
+		return 0;
+	}
+	return error ? 2 : !selected;
+}
+
+/* Description: Checks if the grep builtin handles the arguments. Patterns with
+ *				regular expression characters are left to the external grep,
+ *				unless -F is given.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_grep_accepts(int argc, char **argv) {
+	struct grep_opts o;
+
+	return get_grep_opts(argc, argv, &o) == 0;
+}
+
+/* Description: tr SET1 SET2 | tr -d SET1
+ *				Translates the bytes of SET1 to the bytes of SET2 at the same
+ *				position, or deletes them. Sets take ranges (a-z) and escapes
+ *				(\n, \t, \\, \NNN). Translations made of a few ranges, such as
+ *				a-z to A-Z, are done 16 bytes at a time.
+ */
+int bi_tr(int argc, char **argv, struct bi_ctx *ctx) {
+	struct tr_map map;
+	unsigned char set1[TR_SET_MAX], set2[TR_SET_MAX];
+	unsigned char del[256];
+	char buf[FILTER_BUFSIZE];
+	int n1, n2 = 0, delete, first, c, i;
+	ssize_t n, k, j;
+	const char *run;
+
+	if ((first = get_tr_opts(argc, argv, &delete)) == -1) {
+		bi_error(ctx, "usage: tr SET1 SET2 | tr -d SET1");
+		return 2;
+	}
+	if ((n1 = tr_set(argv[first], set1)) == -1 ||
+		(!delete && (n2 = tr_set(argv[first + 1], set2)) == -1)) {
+		bi_error(ctx, "invalid set");
+		return 1;
+	}
+	if (!delete && n2 == 0 && n1 > 0) {
+		bi_error(ctx, "SET2 must not be empty");
+		return 1;
+	}
+
+	// The last byte of a short SET2 is repeated
+	memset(del, 0, sizeof(del));
+	for (c = 0; c < 256; ++c) {
+		map.table[c] = c;
+	}
+	for (i = 0; i < n1; ++i) {
+		if (delete) {
+			del[set1[i]] = 1;
+		} else {
+			map.table[set1[i]] = set2[i < n2 ? i : n2 - 1];
+		}
+	}
+	tr_map_build(&map);
+
+	for (;;) {
+		n = bi_read(ctx, buf, sizeof(buf));
+		if (n == 0) {
+			return 0;
+		}
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			bi_error(ctx, "-: %s", strerror(errno));
+			return 1;
+		}
+
+		if (!delete) {
+			simd_translate(buf, n, &map);
+		} else if (n1 == 1) {
+			// Runs between the deleted byte are moved with memchr
+			for (k = 0, run = buf; run < buf + n; ) {
+				const char *hit = memchr(run, set1[0], buf + n - run);
+				j = (hit ? hit : buf + n) - run;
+				memmove(buf + k, run, j);
+				k += j;
+				run += j + 1;
+			}
+			n = k;
+		} else {
+			for (k = 0, j = 0; j < n; ++j) {
+				buf[k] = buf[j];
+				k += !del[(unsigned char)buf[j]];
+			}
+			n = k;
+		}
+
+		if (bi_write(ctx, buf, n) == -1) {
+			bi_error(ctx, "%s", strerror(errno));
+			return 1;
+		}
+	}
+}
+
+/* Description: Checks if the tr builtin handles the arguments. Options other
+ *				than -d and character classes are left to the external tr.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_tr_accepts(int argc, char **argv) {
+	int delete;
+
+	return get_tr_opts(argc, argv, &delete) != -1;
+}
+
+// Adds bytes to the output of a filter
+static int out_put(struct outbuf *ob, const char *p, size_t n) {
+	if (ob->len + n > OUT_BUFSIZE) {
+		if (out_flush(ob) == -1) {
+			return -1;
+		}
+		if (n >= OUT_BUFSIZE) {
+			return bi_write(ob->ctx, p, n);		// Big spans are not copied
+		}
+	}
+	memcpy(ob->data + ob->len, p, n);
+	ob->len += n;
+	return 0;
+}
+
+// Writes the gathered output of a filter
+static int out_flush(struct outbuf *ob) {
+	size_t len = ob->len;
+
+	if (len == 0) {
+		return 0;
+	}
+	ob->len = 0;
+	return bi_write(ob->ctx, ob->data, len);
+}
+
+// Makes room for more bytes at the end of an input buffer
+static int lb_reserve(struct linebuf *lb, size_t room) {
+	size_t cap = lb->cap ? lb->cap : FILTER_BUFSIZE;
+	char *data;
+
+	while (cap - lb->len < room) {
+		cap *= 2;
+	}
+	if (cap != lb->cap) {
+		if ((data = (char *)realloc(lb->data, cap)) == NULL) {
+			errno = ENOMEM;
+			return -1;
+		}
+		lb->data = data;
+		lb->cap = cap;
+	}
+	return 0;
+}
+
+// Opens an input of a filter, "-" being the standard input. Errors are reported.
+static int in_open(struct bi_ctx *ctx, const char *name) {
+	int fd;
+
+	if (strcmp(name, "-") == 0) {
+		return ctx->in;
+	}
+	if ((fd = open(name, O_RDONLY | O_CLOEXEC)) == -1) {
+		bi_error(ctx, "%s: %s", name, strerror(errno));
+		return -1;
+	}
+	return fd;
+}
+
+// Reads an input of a filter, which may be the standard input ring
+static ssize_t in_read(struct bi_ctx *ctx, int fd, char *buf, size_t len) {
+	ssize_t n;
+
+	if (fd == ctx->in) {
+		return bi_read(ctx, buf, len);
+	}
+	do {
+		n = read(fd, buf, len);
+	} while (n == -1 && errno == EINTR);
+
+	return n;
+}
+
+// Closes an input of a filter, unless it is the standard input
+static void in_close(struct bi_ctx *ctx, int fd) {
+	if (fd != ctx->in) {
+		close(fd);
+	}
+}
+
+// Name of an input in messages
+static const char * in_name(const char *name) {
+	return (name == NULL || strcmp(name, "-") == 0) ? "standard input" : name;
+}
+
+// Prints the "==> name <==" line that separates the files of head and tail
+static int print_header(struct outbuf *ob, const char *name, int blank) {
+	if ((blank && out_put(ob, "\n", 1) == -1) || out_put(ob, "==> ", 4) == -1 ||
+		out_put(ob, name, strlen(name)) == -1) {
+		return -1;
+	}
+	return out_put(ob, " <==\n", 5);
+}
+
+// Parses the options of head and tail. Returns -1 for unsupported arguments.
+static int get_count_opts(int argc, char **argv, struct count_opts *o, int tail) {
+	const char *value;
+	long count;
+	int i;
+
+	o->bytes = 0;
+	o->from = 0;
+	o->count = 10;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		if (argv[i][1] == 'n' || argv[i][1] == 'c') {
+			o->bytes = argv[i][1] == 'c';
+			if (argv[i][2] != '\0') {
+				value = argv[i] + 2;
+			} else if (++i < argc) {
+				value = argv[i];
+			} else {
+				return -1;
+			}
+		} else if (argv[i][1] >= '0' && argv[i][1] <= '9') {
+			o->bytes = 0;
+			value = argv[i] + 1;
+		} else {
+			return -1;
+		}
+		o->from = 0;
+		if (tail && value[0] == '+') {
+			o->from = 1;
+			++value;
+		}
+		if (strtosize(value, &count) == -1) {
+			return -1;
+		}
+		o->count = count;
+	}
+
+	o->first = i;
+	return 0;
+}
+
+// Copies the first lines or bytes of an input of head
+static int head_fd(struct bi_ctx *ctx, int fd, const struct count_opts *o,
+	struct outbuf *ob) {
+	char buf[FILTER_BUFSIZE];
+	size_t left = o->count;
+	const char *nl;
+	ssize_t n;
+	size_t take;
+
+	while (left > 0) {
+		if ((n = in_read(ctx, fd, buf, sizeof(buf))) <= 0) {
+			return n;
+		}
+
+		if (o->bytes) {
+			take = ((size_t)n < left) ? (size_t)n : left;
+			left -= take;
+		} else if ((nl = simd_find_nth(buf, n, '\n', &left)) != NULL) {
+			take = nl - buf + 1;
+		} else {
+			take = n;
+		}
+
+		if (out_put(ob, buf, take) == -1) {
+			return -1;
+		}
+		// The rest is left to whoever reads the input next
+		if (left == 0 && take < (size_t)n && fd >= 0) {
+			lseek(fd, (off_t)take - n, SEEK_CUR);
+		}
+	}
+
+	return 0;
+}
+
+// Copies the last lines or bytes of an input of tail
+static int tail_fd(struct bi_ctx *ctx, int fd, const struct count_opts *o,
+	struct outbuf *ob) {
+	struct stat st;
+	off_t off;
+	int ret;
+
+	// Files of /proc and the like claim to be empty
+	if (fd >= 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+		(off = lseek(fd, 0, SEEK_CUR)) != -1) {
+		if (off >= st.st_size) {
+			return 0;
+		}
+		if ((ret = tail_map(fd, off, st.st_size, o, ob)) != -2) {
+			return ret;
+		}
+	}
+
+	return tail_stream(ctx, fd, o, ob);
+}
+
+// Tails a regular file through a mapping. Returns -2 if it cannot be mapped.
+static int tail_map(int fd, off_t off, off_t size, const struct count_opts *o,
+	struct outbuf *ob) {
+	char *base;
+	size_t start, len = size - off;
+	int ret;
+
+	base = (char *)mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (base == MAP_FAILED) {
+		return -2;
+	}
+
+	start = tail_start(base + off, len, o);
+	ret = out_put(ob, base + off + start, len - start);
+	if (ret == 0) {
+		ret = out_flush(ob);	// Before the mapping goes away
+	}
+	munmap(base, size);
+	lseek(fd, 0, SEEK_END);
+
+	return ret;
+}
+
+// Tails an input that cannot be mapped, keeping only its end in memory
+static int tail_stream(struct bi_ctx *ctx, int fd, const struct count_opts *o,
+	struct outbuf *ob) {
+	struct linebuf lb = { NULL, 0, 0 };
+	size_t skip = o->count > 0 ? o->count - 1 : 0;	// +N skips N - 1
+	size_t start;
+	const char *nl;
+	ssize_t n;
+	int ret = 0;
+
+	for (;;) {
+		if (lb_reserve(&lb, FILTER_BUFSIZE) == -1) {
+			ret = -1;
+			break;
+		}
+		if ((n = in_read(ctx, fd, lb.data + lb.len, FILTER_BUFSIZE)) <= 0) {
+			ret = n;
+			break;
+		}
+
+		if (o->from) {
+			// Everything after the skipped part is copied as it comes
+			start = 0;
+			if (skip > 0 && o->bytes) {
+				start = ((size_t)n < skip) ? (size_t)n : skip;
+				skip -= start;
+			} else if (skip > 0) {
+				nl = simd_find_nth(lb.data, n, '\n', &skip);
+				start = nl ? (size_t)(nl - lb.data + 1) : (size_t)n;
+			}
+			if (out_put(ob, lb.data + start, n - start) == -1) {
+				ret = -1;
+				break;
+			}
+			continue;
+		}
+
+		lb.len += n;
+		if (lb.len >= TAIL_KEEP) {
+			start = tail_start(lb.data, lb.len, o);
+			if (start >= lb.len / 2) {
+				memmove(lb.data, lb.data + start, lb.len - start);
+				lb.len -= start;
+			}
+		}
+	}
+
+	if (ret == 0 && !o->from) {
+		start = tail_start(lb.data, lb.len, o);
+		ret = out_put(ob, lb.data + start, lb.len - start);
+	}
+	free(lb.data);
+
+	return ret;
+}
+
+// Finds where the part tail prints begins
+static size_t tail_start(const char *p, size_t len, const struct count_opts *o) {
+	size_t k = o->count;
+	const char *nl;
+
+	if (o->from) {
+		if (k <= 1) {
+			return 0;
+		}
+		--k;
+		if (o->bytes) {
+			return k < len ? k : len;
+		}
+		nl = simd_find_nth(p, len, '\n', &k);
+		return nl ? (size_t)(nl - p + 1) : len;
+	}
+
+	if (o->bytes) {
+		return len > k ? len - k : 0;
+	}
+	if (k == 0 || len == 0) {
+		return len;
+	}
+	// The newline ending the last line does not start another one
+	if (p[len - 1] == '\n') {
+		--len;
+	}
+	nl = simd_rfind_nth(p, len, '\n', &k);
+	return nl ? (size_t)(nl - p + 1) : 0;
+}
+
+// Parses the options of grep. Returns -1 for unsupported arguments.
+static int get_grep_opts(int argc, char **argv, struct grep_opts *o) {
+	const char *opt;
+	int fixed = 0;
+	int i;
+
+	o->invert = o->count = o->quiet = o->number = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		for (opt = argv[i] + 1; *opt; ++opt) {
+			switch (*opt) {
+				case 'F': fixed = 1; break;
+				case 'v': o->invert = 1; break;
+				case 'c': o->count = 1; break;
+				case 'q': o->quiet = 1; break;
+				case 'n': o->number = 1; break;
+				default: return -1;
+			}
+		}
+	}
+	if (i >= argc) {
+		return -1;
+	}
+
+	o->pat = argv[i++];
+	o->plen = strlen(o->pat);
+	if (strchr(o->pat, '\n') != NULL ||
+		(!fixed && strpbrk(o->pat, ".[]*^$\\+?(){}|") != NULL)) {
+		return -1;
+	}
+
+	o->first = i;
+	o->names = argc - i > 1;
+	return 0;
+}
+
+// Greps an input. The lines of a block are searched together.
+static int grep_fd(struct bi_ctx *ctx, int fd, struct grep_state *g) {
+	struct linebuf lb = { NULL, 0, 0 };
+	const char *last;
+	size_t done;
+	ssize_t n;
+	int ret = 0;
+
+	for (;;) {
+		if (lb_reserve(&lb, FILTER_BUFSIZE) == -1) {
+			ret = -1;
+			break;
+		}
+		if ((n = in_read(ctx, fd, lb.data + lb.len, FILTER_BUFSIZE)) <= 0) {
+			// A last line without newline
+			if (n == 0 && lb.len > 0) {
+				ret = grep_block(g, lb.data, lb.len);
+			} else {
+				ret = n;
+			}
+			break;
+		}
+		lb.len += n;
+
+		// Complete lines are searched, the partial one waits for more input
+		if ((last = memrchr(lb.data, '\n', lb.len)) == NULL) {
+			continue;
+		}
+		done = last - lb.data + 1;
+		if (grep_block(g, lb.data, done) == -1) {
+			ret = -1;
+			break;
+		}
+		memmove(lb.data, lb.data + done, lb.len - done);
+		lb.len -= done;
+
+		if (g->o->quiet && g->count > 0) {
+			break;
+		}
+	}
+
+	free(lb.data);
+	return ret;
+}
+
+// Greps a block of whole lines, the last one may lack its newline
+static int grep_block(struct grep_state *g, const char *p, size_t n) {
+	const char *end = p + n, *pos = p;
+	const char *m, *ls, *le;
+
+	while (pos < end) {
+		m = simd_memmem(pos, end - pos, g->o->pat, g->o->plen);
+		if (m == NULL) {
+			ls = le = end;
+		} else {
+			ls = memrchr(pos, '\n', m - pos);
+			ls = ls ? ls + 1 : pos;
+			le = memchr(m, '\n', end - m);
+			le = le ? le + 1 : end;
+		}
+
+		// Lines before the matching one, then the matching one
+		if (grep_run(g, pos, ls, g->o->invert) == -1) {
+			return -1;
+		}
+		if (m == NULL) {
+			break;
+		}
+		if (grep_run(g, ls, le, !g->o->invert) == -1) {
+			return -1;
+		}
+		pos = le;
+
+		if (g->o->quiet && g->count > 0) {
+			break;
+		}
+	}
+
+	return 0;
+}
+
+// Handles a run of lines that are all selected or all not
+static int grep_run(struct grep_state *g, const char *a, const char *b, int sel) {
+	const struct grep_opts *o = g->o;
+	const char *le;
+	char num[32];
+	long long nlines;
+	int len;
+
+	if (a == b) {
+		return 0;
+	}
+	nlines = simd_count_byte(a, b - a, '\n') + (b[-1] != '\n');
+
+	if (!sel || o->count || o->quiet) {
+		g->lineno += nlines;
+		g->count += sel ? nlines : 0;
+		return 0;
+	}
+	g->count += nlines;
+
+	// Without prefixes the run is copied as a whole
+	if (!o->names && !o->number) {
+		g->lineno += nlines;
+		if (out_put(g->ob, a, b - a) == -1) {
+			return -1;
+		}
+		return b[-1] != '\n' ? out_put(g->ob, "\n", 1) : 0;
+	}
+
+	for (; a < b; a = le) {
+		le = memchr(a, '\n', b - a);
+		le = le ? le + 1 : b;
+		++g->lineno;
+		if (o->names && (out_put(g->ob, g->name, strlen(g->name)) == -1 ||
+			out_put(g->ob, ":", 1) == -1)) {
+			return -1;
+		}
+		if (o->number) {
+			len = snprintf(num, sizeof(num), "%lld:", g->lineno);
+			if (out_put(g->ob, num, len) == -1) {
+				return -1;
+			}
+		}
+		if (out_put(g->ob, a, le - a) == -1 ||
+			(le[-1] != '\n' && out_put(g->ob, "\n", 1) == -1)) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Parses the options of wc. Returns -1 for unsupported arguments.
+static int get_wc_opts(int argc, char **argv, struct wc_opts *o) {
+	const char *opt;
+	int i;
+
+	o->lines = o->words = o->bytes = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		for (opt = argv[i] + 1; *opt; ++opt) {
+			switch (*opt) {
+				case 'l': o->lines = 1; break;
+				case 'w': o->words = 1; break;
+				case 'c': o->bytes = 1; break;
+				default: return -1;
+			}
+		}
+	}
+	if (!o->lines && !o->words && !o->bytes) {
+		o->lines = o->words = o->bytes = 1;
+	}
+
+	o->first = i;
+	return 0;
+}
+
+// Counts an input of wc
+static int wc_fd(struct bi_ctx *ctx, int fd, const struct wc_opts *o,
+	struct wc_counts *c) {
+	char buf[FILTER_BUFSIZE];
+	struct stat st;
+	off_t off;
+	ssize_t n;
+	int inword = 0;
+
+	c->lines = c->words = c->bytes = 0;
+
+	// Bytes alone of a regular file need no reading
+	if (!o->lines && !o->words && fd >= 0 && fstat(fd, &st) == 0 &&
+		S_ISREG(st.st_mode) && st.st_size > 0 &&
+		(off = lseek(fd, 0, SEEK_CUR)) != -1) {
+		c->bytes = (off < st.st_size) ? st.st_size - off : 0;
+		lseek(fd, 0, SEEK_END);
+		return 0;
+	}
+
+	while ((n = in_read(ctx, fd, buf, sizeof(buf))) > 0) {
+		if (o->lines) {
+			c->lines += simd_count_byte(buf, n, '\n');
+		}
+		if (o->words) {
+			c->words += simd_count_words(buf, n, &inword);
+		}
+		c->bytes += n;
+	}
+
+	return n == 0 ? 0 : -1;
+}
+
+// Prints the counts of wc
+static int wc_print(struct outbuf *ob, const struct wc_opts *o,
+	const struct wc_counts *c, int width, const char *name) {
+	char line[128];
+	int len = 0;
+
+	if (o->lines) {
+		len += snprintf(line + len, sizeof(line) - len, " %*lld", width, c->lines);
+	}
+	if (o->words) {
+		len += snprintf(line + len, sizeof(line) - len, " %*lld", width, c->words);
+	}
+	if (o->bytes) {
+		len += snprintf(line + len, sizeof(line) - len, " %*lld", width, c->bytes);
+	}
+
+	// The first number has no leading space
+	if (out_put(ob, line + 1, len - 1) == -1) {
+		return -1;
+	}
+	if (name != NULL && (out_put(ob, " ", 1) == -1 ||
+		out_put(ob, name, strlen(name)) == -1)) {
+		return -1;
+	}
+	return out_put(ob, "\n", 1);
+}
+
+// Parses the options of tr. Returns the index of SET1, -1 for unsupported ones.
+static int get_tr_opts(int argc, char **argv, int *delete) {
+	int i;
+
+	*delete = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		if (strcmp(argv[i], "-d") != 0) {
+			return -1;
+		}
+		*delete = 1;
+	}
+
+	// Classes, equivalences and repeats are left to the external tr
+	if (argc - i != 2 - *delete || strchr(argv[i], '[') != NULL ||
+		(!*delete && strchr(argv[i + 1], '[') != NULL)) {
+		return -1;
+	}
+	return i;
+}
+
+// Expands the ranges and escapes of a tr set. Returns its length or -1.
+static int tr_set(const char *str, unsigned char *set) {
+	const unsigned char *s = (const unsigned char *)str;
+	int n = 0, c, last, digits;
+
+	while (*s) {
+		c = *s++;
+		if (c == '\\' && *s) {
+			c = *s++;
+			switch (c) {
+				case 'a': c = '\a'; break;
+				case 'b': c = '\b'; break;
+				case 'f': c = '\f'; break;
+				case 'n': c = '\n'; break;
+				case 'r': c = '\r'; break;
+				case 't': c = '\t'; break;
+				case 'v': c = '\v'; break;
+				default:
+					if (c >= '0' && c <= '7') {
+						c -= '0';
+						for (digits = 1; digits < 3 && *s >= '0' && *s <= '7';
+							++digits) {
+							c = c * 8 + (*s++ - '0');
+						}
+						if (c > 255) {
+							return -1;
+						}
+					}
+					break;
+			}
+		}
+
+		// A range, unless the '-' is the last byte
+		if (*s == '-' && s[1] != '\0') {
+			last = s[1];
+			s += 2;
+			if (last < c || n + last - c + 1 > TR_SET_MAX) {
+				return -1;
+			}
+			while (c <= last) {
+				set[n++] = c++;
+			}
+			continue;
+		}
+
+		if (n == TR_SET_MAX) {
+			return -1;
+		}
+		set[n++] = c;
+	}
+
+	return n;
+}
@@ -0,0 +1,122 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Shell functions. A function is the plan of the line that defined it and the
+ * first instruction of its body in that plan (see pg_plan.c), so a call runs
+ * the compiled body and never parses it again. The plan is held while the
+ * function is defined. Functions are kept sorted by name and found with a
+ * binary search, like builtins.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pg_error.h"
+#include "pg_plan.h"
+#include "pg_func.h"
+
+static struct func *funcs;		// Functions, sorted by name
+static int nfuncs, cap;
+
+// Static Function Prototypes //
+static int func_pos(const char *name, int *found);
+
+/* Description: Defines a function, or replaces the body of a defined one.
+ *
+ * Arguments:	name:	Function name
+ *				plan:	Plan holding the body
+ *				pc:		First instruction of the body
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *						# EUNKNOWN : Allocation error
+ *
+ * Notes:		The plan is held with plan_hold, and the plan of a replaced
+ *				body is given back.
+ */
+int func_define(const char *name, struct plan *plan, int pc) {
+	struct func *tmp;
+	struct plan *old;
+	char *copy;
+	int i, found;
+
+	if (name == NULL || plan == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+
+	i = func_pos(name, &found);
+	if (found) {
+		old = funcs[i].plan;
+		plan_hold(plan);		// Before the old one goes, it may be the same
+		funcs[i].plan = plan;
+		funcs[i].pc = pc;
+		plan_put(old);
+		return 0;
+	}
+
+	if (nfuncs == cap) {
+		cap = (cap == 0) ? 16 : cap * 2;
+		if ((tmp = (struct func *)realloc(funcs, cap * sizeof(struct func))) == NULL) {
+			perror("realloc");
+			pg_errno = EUNKNOWN;
+			return -1;
+		}
+		funcs = tmp;
+	}
+	if ((copy = strdup(name)) == NULL) {
+		perror("strdup");
+		pg_errno = EUNKNOWN;
+		return -1;
+	}
+
+	memmove(&funcs[i + 1], &funcs[i], (nfuncs - i) * sizeof(struct func));
+	funcs[i].name = copy;
+	funcs[i].plan = plan;
+	funcs[i].pc = pc;
+	++nfuncs;
+	plan_hold(plan);
+
+	return 0;
+}
+
+/* Description: Finds a function by its name.
+ *
+ * Arguments:	name:	Command name
+ *
+ * Returns:		- If it is a function, the function
+ * 				- Otherwise, NULL
+ *
+ * Notes:		The function is only valid till the next func_define.
+ */
+const struct func * func_find(const char *name) {
+	int i, found;
+
+	if (nfuncs == 0 || name == NULL) {
+		return NULL;
+	}
+	i = func_pos(name, &found);
+	return found ? &funcs[i] : NULL;
+}
+
+// Finds the position of a name in the sorted functions and sets found if a
+// function has it
+static int func_pos(const char *name, int *found) {
+	int low = 0, high = nfuncs - 1, mid, cmp;
+
+	*found = 0;
+	while (low <= high) {
+		mid = (low + high) / 2;
+		cmp = strcmp(name, funcs[mid].name);
+		if (cmp == 0) {
+			*found = 1;
+			return mid;
+		}
+		if (cmp < 0) {
+			high = mid - 1;
+		} else {
+			low = mid + 1;
+		}
+	}
+	return low;
+}
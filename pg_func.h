@@ -0,0 +1,18 @@
+#ifndef PG_FUNC_H
+#define PG_FUNC_H
+
+#include "pg_plan.h"
+
+// Shell function, its body is in the plan of the line that defined it
+struct func {
+	char *name;
+	struct plan *plan;		// Held while the function is defined
+	int pc;					// First instruction of the body
+};
+
+// Function Prototypes
+
+int func_define(const char *name, struct plan *plan, int pc);
+const struct func * func_find(const char *name);
+
+#endif
@@ -0,0 +1,592 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Pathname expansion. A pattern is split to its segments between slashes and
+ * every segment with glob characters is compiled once to a list of steps:
+ * literal runs, '?', '*' and bracket sets kept as 256 bit maps. The steps are
+ * run against the directory listings of pg_dircache.c, so a directory is only
+ * read again when it changed, and a leading literal run narrows the entries
+ * to the range of names starting with it, as listings are sorted.
+ * A '**' segment matches any number of directories, without following
+ * symbolic links. Only the characters the lexer marked with EXP_GLOB are
+ * special, the rest of the pattern is literal.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <ctype.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "pg_error.h"
+#include "pg_parse.h"
+#include "pg_dircache.h"
+#include "pg_glob.h"
+
+// Kinds of steps of a segment
+enum GlobStep {
+	GS_LIT,		// Literal text
+	GS_ANY,		// '?', any character
+	GS_STAR,	// '*', any text
+	GS_SET		// '[...]', a character of a set
+};
+
+// Compiled piece of a segment
+struct gstep {
+	enum GlobStep type;
+	const char *lit;		// GS_LIT: text, in the pattern
+	size_t len;				// GS_LIT: length of the text
+	unsigned char set[32];	// GS_SET: bit map of the characters it matches
+};
+
+// Segment of a pattern, between slashes
+struct gseg {
+	char *text;				// Segment, NUL terminated
+	struct gstep *steps;	// NULL for a literal segment
+	int nsteps;
+	int any;				// '**', any number of directories
+	int dot;				// Starts with a literal '.', matches hidden names
+};
+
+// Pattern being matched
+struct gpat {
+	struct gseg *segs;
+	int nsegs;
+	int first;				// First segment after the starting directory
+	int dirs;				// Ends with '/', only directories match
+	struct glob_res *res;
+	char path[PATH_MAX];	// Directory of the current segment, "" or ending in '/'
+};
+
+// Character classes of bracket sets
+static const struct {
+	const char *name;
+	int (*fn)(int);
+} classes[] = {
+	{ "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+	{ "digit", isdigit }, { "lower", islower }, { "punct", ispunct },
+	{ "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+	{ NULL, NULL }
+};
+
+static const char *sort_pool;	// Pool of the paths being sorted
+
+// Static Function Prototypes //
+static int glob_compile(struct gpat *gp, char *pattern);
+static int seg_compile(struct gseg *seg);
+static int step_set(struct gstep *st, const char *p, const char **end);
+static int seg_match(const struct gseg *seg, const char *s);
+static int step_match(const struct gstep *st, const char **s);
+static int glob_walk(struct gpat *gp, size_t plen, int i);
+static int is_dir(const char *path, unsigned char type, int follow);
+static int res_add(struct glob_res *res, const char *path, int slash);
+static int pathcmp(const void *a, const void *b);
+
+/* Description: Expands a pattern to the paths it matches, sorted.
+ *
+ * Arguments:	pattern:	Word with its glob characters marked with EXP_GLOB
+ *				res:		Stores the paths, res->n is 0 if none matched
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (allocation error)
+ *
+ * Notes:		Names starting with '.' only match a '.' written in the
+ *				pattern. Directories that cannot be read have no matches.
+ *				The pool and offsets of res are freed by the caller.
+ */
+int glob_run(const char *pattern, struct glob_res *res) {
+	struct gpat *gp;
+	char *copy;
+	int status = -1, i;
+
+	memset(res, 0, sizeof(struct glob_res));
+	if ((gp = (struct gpat *)calloc(1, sizeof(struct gpat))) == NULL) {
+		perror("calloc");
+		return -1;
+	}
+	if ((copy = strdup(pattern)) == NULL) {
+		perror("strdup");
+		free(gp);
+		return -1;
+	}
+	gp->res = res;
+
+	// A pattern without a glob character that works is only a word
+	if (glob_compile(gp, copy) == 0) {
+		for (i = 0; i < gp->nsegs && gp->segs[i].steps == NULL &&
+			!gp->segs[i].any; ++i)
+			;
+		status = (i < gp->nsegs && gp->first < gp->nsegs) ?
+			glob_walk(gp, strlen(gp->path), gp->first) : 0;
+	}
+	if (status == 0 && res->n > 1) {
+		sort_pool = res->pool;
+		qsort(res->offs, res->n, sizeof(size_t), pathcmp);
+	}
+
+	for (i = 0; i < gp->nsegs; ++i) {
+		free(gp->segs[i].steps);
+	}
+	free(gp->segs);
+	free(gp);
+	free(copy);
+	if (status == -1) {
+		free(res->pool);
+		free(res->offs);
+		memset(res, 0, sizeof(struct glob_res));
+	}
+
+	return status;
+}
+
+/* Description: Removes the glob markers of a word, for a pattern that
+ *				matched nothing or a word that is not matched.
+ *
+ * Arguments:	word:	Word, changed in place
+ *
+ * Returns:		void: Nothing
+ */
+void glob_strip(char *word) {
+	char *out = word;
+
+	for (; *word != '\0'; ++word) {
+		if (*word != EXP_GLOB) {
+			*out++ = *word;
+		}
+	}
+	*out = '\0';
+}
+
+/* Description: Matches a text against a whole pattern, as case does: '*'
+ *				and '?' match '/' and a leading '.' too.
+ *
+ * Arguments:	pattern:	Pattern with its glob characters marked with EXP_GLOB
+ *				s:			Text
+ *
+ * Returns:		- If the text matches, 1
+ * 				- If it does not, 0
+ * 				- On failure, -1 (allocation error)
+ */
+int glob_match(const char *pattern, const char *s) {
+	struct gseg seg;
+	int match;
+
+	memset(&seg, 0, sizeof(seg));
+	if ((seg.text = strdup(pattern)) == NULL) {
+		perror("strdup");
+		return -1;
+	}
+	if (seg_compile(&seg) == -1) {
+		free(seg.text);
+		return -1;
+	}
+
+	if (seg.any) {				// "**"
+		match = 1;
+	} else if (seg.steps == NULL) {
+		match = (strcmp(seg.text, s) == 0);
+	} else {
+		seg.dot = 1;
+		match = seg_match(&seg, s);
+	}
+
+	free(seg.steps);
+	free(seg.text);
+	return match;
+}
+
+// Splits a pattern to its segments and compiles them. Leading literal
+// segments become the starting directory. Returns -1 on failure.
+static int glob_compile(struct gpat *gp, char *pattern) {
+	char *p = pattern, *slash;
+	size_t len, plen = 0;
+	int n = 1;
+
+	for (slash = pattern; *slash != '\0'; ++slash) {
+		n += (*slash == '/');
+	}
+	if ((gp->segs = (struct gseg *)calloc(n, sizeof(struct gseg))) == NULL) {
+		perror("calloc");
+		return -1;
+	}
+
+	len = strlen(pattern);
+	gp->dirs = (len > 1 && pattern[len - 1] == '/');
+	if (*p == '/') {
+		gp->path[plen++] = '/';
+	}
+	for (;;) {
+		while (*p == '/') {
+			++p;
+		}
+		if (*p == '\0') {
+			break;
+		}
+		if ((slash = strchr(p, '/')) != NULL) {
+			*slash = '\0';
+		}
+		gp->segs[gp->nsegs].text = p;
+		if (seg_compile(&gp->segs[gp->nsegs++]) == -1) {
+			return -1;
+		}
+		if (slash == NULL) {
+			break;
+		}
+		p = slash + 1;
+	}
+
+	// Literal directories are not listed, they are the place to start
+	for (gp->first = 0; gp->first < gp->nsegs - 1; ++gp->first) {
+		if (gp->segs[gp->first].steps != NULL || gp->segs[gp->first].any) {
+			break;
+		}
+		len = strlen(gp->segs[gp->first].text);
+		if (plen + len + 2 > PATH_MAX) {
+			gp->first = gp->nsegs;		// Too long to match anything
+			break;
+		}
+		memcpy(gp->path + plen, gp->segs[gp->first].text, len);
+		plen += len;
+		gp->path[plen++] = '/';
+	}
+	gp->path[plen] = '\0';
+
+	return 0;
+}
+
+// Compiles a segment to its steps, or leaves it literal (steps NULL) with
+// its markers removed. Returns -1 on failure.
+static int seg_compile(struct gseg *seg) {
+	struct gstep *st;
+	const char *p = seg->text, *end;
+	int n = 0, magic = 0;
+
+	if (p[0] == EXP_GLOB && p[1] == '*' && p[2] == EXP_GLOB && p[3] == '*' &&
+		p[4] == '\0') {
+		seg->any = 1;
+		return 0;
+	}
+	st = (struct gstep *)malloc((strlen(p) + 1) * sizeof(struct gstep));
+	if (st == NULL) {
+		perror("malloc");
+		return -1;
+	}
+
+	while (*p != '\0') {
+		if (*p == EXP_GLOB && p[1] == '*') {
+			if (n == 0 || st[n - 1].type != GS_STAR) {
+				st[n++].type = GS_STAR;
+			}
+			p += 2;
+			magic = 1;
+		} else if (*p == EXP_GLOB && p[1] == '?') {
+			st[n++].type = GS_ANY;
+			p += 2;
+			magic = 1;
+		} else if (*p == EXP_GLOB && p[1] == '[' &&
+			step_set(&st[n], p + 2, &end) == 0) {
+			++n;
+			p = end;
+			magic = 1;
+		} else {
+			if (*p == EXP_GLOB) {
+				++p;		// A '[' without its ']'
+			}
+			if (n > 0 && st[n - 1].type == GS_LIT &&
+				st[n - 1].lit + st[n - 1].len == p) {
+				++st[n - 1].len;
+			} else {
+				st[n].type = GS_LIT;
+				st[n].lit = p;
+				st[n++].len = 1;
+			}
+			++p;
+		}
+	}
+
+	if (!magic) {
+		free(st);
+		glob_strip(seg->text);
+		return 0;
+	}
+	seg->steps = st;
+	seg->nsteps = n;
+	seg->dot = (st[0].type == GS_LIT && st[0].lit[0] == '.');
+	return 0;
+}
+
+// Compiles a bracket set, p is after the '['. Stores the position after the
+// closing ']' to end. Returns -1 if the set is not closed.
+static int step_set(struct gstep *st, const char *p, const char **end) {
+	int neg = 0, first = 1, c, hi, i;
+	size_t len;
+
+	memset(st->set, 0, sizeof(st->set));
+	if (*p == '!' || *p == '^') {
+		neg = 1;
+		++p;
+	}
+
+	for (;; first = 0) {
+		if (*p == EXP_GLOB) {
+			++p;
+		}
+		if (*p == '\0') {
+			return -1;
+		}
+		if (*p == ']' && !first) {
+			break;
+		}
+
+		// Character class, "[:name:]"
+		if (*p == '[' && p[1] == ':') {
+			for (i = 0; classes[i].name != NULL; ++i) {
+				len = strlen(classes[i].name);
+				if (strncmp(p + 2, classes[i].name, len) == 0 &&
+					p[len + 2] == ':' && p[len + 3] == ']') {
+					break;
+				}
+			}
+			if (classes[i].name != NULL) {
+				for (c = 1; c < 256; ++c) {
+					if (classes[i].fn(c)) {
+						st->set[c >> 3] |= 1 << (c & 7);
+					}
+				}
+				p += len + 4;
+				continue;
+			}
+		}
+
+		c = hi = (unsigned char)*p++;
+		if (*p == '-' && p[1] != ']' && p[1] != '\0') {
+			p += (p[1] == EXP_GLOB) ? 2 : 1;
+			if (*p == '\0') {
+				return -1;
+			}
+			hi = (unsigned char)*p++;
+		}
+		for (; c <= hi; ++c) {
+			st->set[c >> 3] |= 1 << (c & 7);
+		}
+	}
+
+	if (neg) {
+		for (i = 0; i < 32; ++i) {
+			st->set[i] = ~st->set[i];
+		}
+	}
+	st->type = GS_SET;
+	*end = p + 1;
+	return 0;
+}
+
+// Matches a name against the steps of a segment. A '*' takes the shortest
+// text first and grows when the rest fails.
+static int seg_match(const struct gseg *seg, const char *s) {
+	const char *mark = NULL;	// Where the text of the last '*' ends
+	int i = 0, star = -1;		// Step after the last '*'
+
+	if (s[0] == '.' && !seg->dot) {
+		return 0;		// Hidden
+	}
+
+	for (;;) {
+		if (i < seg->nsteps && seg->steps[i].type == GS_STAR) {
+			star = ++i;
+			mark = s;
+			if (star == seg->nsteps) {
+				return 1;		// A trailing '*' takes the rest
+			}
+			continue;
+		}
+		if (i < seg->nsteps && *s != '\0' && step_match(&seg->steps[i], &s)) {
+			++i;
+			continue;
+		}
+		if (i == seg->nsteps && *s == '\0') {
+			return 1;
+		}
+		if (star == -1 || *mark == '\0') {
+			return 0;
+		}
+		s = ++mark;
+		i = star;
+	}
+}
+
+// Matches a step at the start of a text and moves after it
+static int step_match(const struct gstep *st, const char **s) {
+	unsigned char c = (unsigned char)**s;
+
+	switch (st->type) {
+		case GS_LIT:
+			if (strncmp(*s, st->lit, st->len) != 0) {
+				return 0;
+			}
+			*s += st->len;
+			return 1;
+		case GS_SET:
+			if (!(st->set[c >> 3] & (1 << (c & 7)))) {
+				return 0;
+			}
+			++*s;
+			return 1;
+		default:		// GS_ANY
+			++*s;
+			return 1;
+	}
+}
+
+// Matches segment i and the rest of the pattern in the directory path, of
+// length plen. Returns -1 on failure.
+static int glob_walk(struct gpat *gp, size_t plen, int i) {
+	const struct gseg *seg = &gp->segs[i];
+	struct dirlist *dl;
+	struct stat st;
+	char *names = NULL;		// Directories to go on in
+	size_t nlen, used = 0, cap = 0, off;
+	int last = (i == gp->nsegs - 1);
+	int first = 0, count, k, dir;
+	int status = 0;
+	void *tmp;
+
+	if (seg->steps == NULL && !seg->any) {		// Literal
+		nlen = strlen(seg->text);
+		if (plen + nlen + 2 > PATH_MAX) {
+			return 0;
+		}
+		memcpy(gp->path + plen, seg->text, nlen + 1);
+		if (!last) {
+			gp->path[plen + nlen] = '/';
+			gp->path[plen + nlen + 1] = '\0';
+			return glob_walk(gp, plen + nlen + 1, i + 1);
+		}
+		if ((gp->dirs ? stat(gp->path, &st) : lstat(gp->path, &st)) == 0 &&
+			(!gp->dirs || S_ISDIR(st.st_mode))) {
+			return res_add(gp->res, gp->path, gp->dirs);
+		}
+		return 0;
+	}
+
+	// '**' matching no directory at all
+	if (seg->any && !last && glob_walk(gp, plen, i + 1) == -1) {
+		return -1;
+	}
+
+	gp->path[plen] = '\0';
+	if ((dl = dircache_get(gp->path)) == NULL) {
+		pg_errno = EOK;		// Not a directory or not readable, no matches
+		return 0;
+	}
+
+	count = dl->count;
+	if (!seg->any && seg->steps[0].type == GS_LIT) {
+		count = dirlist_prefix(dl, seg->steps[0].lit, seg->steps[0].len, &first);
+	}
+
+	for (k = first; k < first + count && status == 0; ++k) {
+		if (seg->any ? dl->ents[k].name[0] == '.' :
+			!seg_match(seg, dl->ents[k].name)) {
+			continue;
+		}
+		nlen = strlen(dl->ents[k].name);
+		if (plen + nlen + 2 > PATH_MAX) {
+			continue;
+		}
+		memcpy(gp->path + plen, dl->ents[k].name, nlen + 1);
+
+		dir = (!last || seg->any || gp->dirs) &&
+			is_dir(gp->path, dl->ents[k].type, !seg->any);
+		if (last && (dir || !gp->dirs)) {
+			status = res_add(gp->res, gp->path, gp->dirs);
+		}
+
+		// Kept aside, the listing may be gone once another one is read
+		if (dir && (!last || seg->any)) {
+			if (used + nlen + 1 > cap) {
+				cap = (cap == 0) ? 1024 : cap * 2;
+				while (used + nlen + 1 > cap) {
+					cap *= 2;
+				}
+				if ((tmp = realloc(names, cap)) == NULL) {
+					perror("realloc");
+					status = -1;
+					break;
+				}
+				names = (char *)tmp;
+			}
+			memcpy(names + used, dl->ents[k].name, nlen + 1);
+			used += nlen + 1;
+		}
+	}
+
+	for (off = 0; off < used && status == 0; off += nlen + 1) {
+		nlen = strlen(names + off);
+		memcpy(gp->path + plen, names + off, nlen);
+		gp->path[plen + nlen] = '/';
+		gp->path[plen + nlen + 1] = '\0';
+		status = glob_walk(gp, plen + nlen + 1, seg->any ? i : i + 1);
+	}
+	free(names);
+
+	return status;
+}
+
+// Checks if an entry is a directory, from its d_type when it is known.
+// Symbolic links are followed if follow is set.
+static int is_dir(const char *path, unsigned char type, int follow) {
+	struct stat st;
+
+	if (type == DT_DIR) {
+		return 1;
+	}
+	if (type != DT_UNKNOWN && (type != DT_LNK || !follow)) {
+		return 0;
+	}
+	return (follow ? stat(path, &st) : lstat(path, &st)) == 0 &&
+		S_ISDIR(st.st_mode);
+}
+
+// Adds a path to the results, with a '/' after it if slash is set. Returns
+// -1 on failure.
+static int res_add(struct glob_res *res, const char *path, int slash) {
+	size_t len = strlen(path);
+	void *tmp;
+
+	if (res->len + len + 2 > res->cap) {
+		res->cap = (res->cap == 0) ? 4096 : res->cap * 2;
+		while (res->len + len + 2 > res->cap) {
+			res->cap *= 2;
+		}
+		if ((tmp = realloc(res->pool, res->cap)) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		res->pool = (char *)tmp;
+	}
+	if (res->n == res->ocap) {
+		res->ocap = (res->ocap == 0) ? 64 : res->ocap * 2;
+		if ((tmp = realloc(res->offs, res->ocap * sizeof(size_t))) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		res->offs = (size_t *)tmp;
+	}
+
+	res->offs[res->n++] = res->len;
+	memcpy(res->pool + res->len, path, len);
+	res->len += len;
+	if (slash) {
+		res->pool[res->len++] = '/';
+	}
+	res->pool[res->len++] = '\0';
+
+	return 0;
+}
+
+// Compares two paths of the pool being sorted (qsort callback)
+static int pathcmp(const void *a, const void *b) {
+	return strcmp(sort_pool + *(const size_t *)a, sort_pool + *(const size_t *)b);
+}
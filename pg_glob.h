@@ -0,0 +1,22 @@
+#ifndef PG_GLOB_H
+#define PG_GLOB_H
+
+#include <stddef.h>
+
+// Paths matched by a pattern, NUL terminated one after the other in a pool
+struct glob_res {
+	char *pool;
+	size_t len;
+	size_t cap;
+	size_t *offs;		// Start of every path in the pool
+	int n;
+	int ocap;
+};
+
+// Function Prototypes
+
+int glob_run(const char *pattern, struct glob_res *res);
+void glob_strip(char *word);
+int glob_match(const char *pattern, const char *s);
+
+#endif
@@ -0,0 +1,693 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Resource limits of commands. Limits are set with setrlimit in the child,
+ * before exec. Memory and CPU bandwidth are limits of the whole pipeline
+ * instead, when a cgroup v2 can be created under the shell's own: every
+ * pipeline then runs in a cgroup of its own with memory.max and cpu.max, and
+ * the peak usage is read from it when the pipeline ends. Without a cgroup,
+ * mem falls back to RLIMIT_AS of every process and cpus is not enforced.
+ * The limit builtin sets the limits of the session or runs one command.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "pg_error.h"
+#include "pg_string.h"
+#include "processes.h"
+#include "pg_builtin.h"
+#include "pg_limit.h"
+
+#define CPU_PERIOD	100000	// Period of cpu.max (us)
+
+// What the child of the limit builtin applies
+struct limit_child {
+	const struct lgroup *g;
+	const struct limits *l;
+};
+
+struct limits pg_limits = { { LIMIT_NONE, LIMIT_NONE, LIMIT_NONE, LIMIT_NONE,
+	LIMIT_NONE, LIMIT_NONE } };
+
+// Names and resources of the limits, in the order of enum LimitKey
+static const struct {
+	const char *name;
+	int resource;		// setrlimit resource, -1 for a cgroup only limit
+} keys[NLIMITS] = {
+	{ "cpu",	RLIMIT_CPU },
+	{ "cpus",	-1 },
+	{ "fsize",	RLIMIT_FSIZE },
+	{ "mem",	RLIMIT_AS },
+	{ "nofile",	RLIMIT_NOFILE },
+	{ "nproc",	RLIMIT_NPROC }
+};
+
+static char cgroot[PATH_MAX];	// Mount point of cgroup v2
+static int cgrootState;			// 0: not searched, 1: found, -1: none
+static unsigned groupSeq;		// Names the cgroups of the shell
+
+static struct lgroup pipeGroup = { -1, -1, 0, "" };	// Of the running pipeline
+static struct lusage lastUsage = { -1, -1, 0 };		// Of the last one
+static int warned;				// The cgroup fallback was reported
+
+// Static Function Prototypes //
+static const char * cgroup_root(void);
+static int cgroup_self(char *path, size_t size);
+static int cg_write(int dir, const char *file, const char *value);
+static long cg_read(int dir, const char *file, const char *key);
+static int cg_limit(int parent, int dir, const char *file, const char *value,
+		const char *controller);
+static int limit_value(int key, const char *str, long *value);
+static void size_text(char *buf, size_t size, long bytes);
+static void usage_report(struct bi_ctx *ctx, const struct lusage *u);
+static int limit_setup(void *arg);
+
+/* Description: Removes all the limits.
+ *
+ * Arguments:	l:	Limits
+ *
+ * Returns:		void: Nothing
+ */
+void limits_clear(struct limits *l) {
+	int i;
+
+	for (i = 0; i < NLIMITS; ++i) {
+		l->v[i] = LIMIT_NONE;
+	}
+}
+
+/* Description: Checks if any resource is limited.
+ *
+ * Returns:		- If one is, 1
+ * 				- Otherwise, 0
+ */
+int limits_any(const struct limits *l) {
+	int i;
+
+	for (i = 0; i < NLIMITS; ++i) {
+		if (l->v[i] != LIMIT_NONE) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/* Description: Sets a limit from a KEY=VALUE string, e.g. "mem=2G", "cpu=60s",
+ *				"cpus=1.5" or "nofile=4096". VALUE "off" removes the limit.
+ *
+ * Arguments:	l:		Limits
+ *				spec:	KEY=VALUE
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG: Unknown key or invalid value
+ */
+int limits_set(struct limits *l, const char *spec) {
+	const char *eq = strchr(spec, '=');
+	size_t len;
+	long value;
+	int i;
+
+	if (eq == NULL) {
+		pg_errno = EARG;
+		return -1;
+	}
+	len = eq - spec;
+
+	for (i = 0; i < NLIMITS; ++i) {
+		if (strlen(keys[i].name) == len && strncmp(spec, keys[i].name, len) == 0) {
+			break;
+		}
+	}
+	if (i == NLIMITS) {
+		pg_errno = EARG;
+		return -1;
+	}
+
+	if (strcmp(eq + 1, "off") == 0) {
+		l->v[i] = LIMIT_NONE;
+		return 0;
+	}
+	if (limit_value(i, eq + 1, &value) == -1) {
+		pg_errno = EARG;
+		return -1;
+	}
+	l->v[i] = value;
+
+	return 0;
+}
+
+// Converts the value of a limit. Sizes take a K, M or G suffix, cpu is a
+// duration and cpus a number of CPUs with up to three decimals.
+static int limit_value(int key, const char *str, long *value) {
+	long ms;
+
+	switch (key) {
+		case LIM_MEM:
+		case LIM_FSIZE:
+			if (strtosize(str, value) == -1) {
+				return -1;
+			}
+			break;
+		case LIM_CPU:
+			if (strtoms(str, &ms) == -1) {
+				return -1;
+			}
+			*value = (ms + 999) / 1000;	// RLIMIT_CPU counts whole seconds
+			break;
+		case LIM_CPUS:		// A duration in seconds reads as thousandths
+			if (str[0] == '\0' || strchr("smhd", str[strlen(str) - 1]) != NULL ||
+				strtoms(str, value) == -1) {
+				return -1;
+			}
+			break;
+		default:
+			if (strtosize(str, value) == -1) {
+				return -1;
+			}
+	}
+
+	return *value > 0 ? 0 : -1;
+}
+
+/* Description: Writes the limits as KEY=VALUE words, as limits_set reads them.
+ *
+ * Arguments:	l:		Limits
+ *				buf:	Buffer
+ *				size:	Size of the buffer
+ *
+ * Returns:		Length of the string, as snprintf
+ */
+int limits_format(const struct limits *l, char *buf, size_t size) {
+	size_t len = 0;
+	long v;
+	int i;
+
+	buf[0] = '\0';
+	for (i = 0; i < NLIMITS && len < size; ++i) {
+		if ((v = l->v[i]) == LIMIT_NONE) {
+			continue;
+		}
+		len += snprintf(buf + len, size - len, "%s%s=", len > 0 ? " " : "",
+			keys[i].name);
+		if (len >= size) {
+			break;
+		}
+
+		if (i == LIM_CPU) {
+			len += snprintf(buf + len, size - len, "%lds", v);
+		} else if (i == LIM_CPUS) {
+			len += snprintf(buf + len, size - len, "%ld.%03ld", v / 1000, v % 1000);
+		} else if ((i == LIM_MEM || i == LIM_FSIZE) && v % (1L << 30) == 0) {
+			len += snprintf(buf + len, size - len, "%ldG", v >> 30);
+		} else if ((i == LIM_MEM || i == LIM_FSIZE) && v % (1L << 20) == 0) {
+			len += snprintf(buf + len, size - len, "%ldM", v >> 20);
+		} else {
+			len += snprintf(buf + len, size - len, "%ld", v);
+		}
+	}
+
+	return (int)len;
+}
+
+/* Description: Creates the cgroup of a pipeline, under the cgroup of the shell,
+ *				with the memory and CPU bandwidth limits set.
+ *
+ * Arguments:	g:	Stores the cgroup
+ *				l:	Limits
+ *
+ * Returns:		- On success, or if neither mem nor cpus is limited,  0
+ * 				- On failure, -1 (check errno) and sets pg_errno to:
+ *						# EOPEN: No cgroup v2, or the limits cannot be set
+ *
+ * Notes:		On failure g has no cgroup, and lgroup_enter falls back to
+ *				RLIMIT_AS for mem.
+ */
+int lgroup_open(struct lgroup *g, const struct limits *l) {
+	char path[PATH_MAX], value[64];
+	int parent;
+
+	g->dir = -1;
+	g->procs = -1;
+	g->memory = 0;
+	g->name[0] = '\0';
+
+	if (l->v[LIM_MEM] == LIMIT_NONE && l->v[LIM_CPUS] == LIMIT_NONE) {
+		return 0;
+	}
+
+	if (cgroup_self(path, sizeof(path)) == -1 ||
+		(parent = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		pg_errno = EOPEN;
+		return -1;
+	}
+
+	snprintf(g->name, sizeof(g->name), "pgsh.%d.%u", (int)getpid(), ++groupSeq);
+	if (mkdirat(parent, g->name, 0755) == -1) {
+		close(parent);
+		pg_errno = EOPEN;
+		return -1;
+	}
+	if ((g->dir = openat(parent, g->name, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		goto fail;
+	}
+
+	if (l->v[LIM_MEM] != LIMIT_NONE) {
+		snprintf(value, sizeof(value), "%ld", l->v[LIM_MEM]);
+		if (cg_limit(parent, g->dir, "memory.max", value, "+memory") == -1) {
+			goto fail;
+		}
+		cg_write(g->dir, "memory.swap.max", "0");	// Not there without swap
+		g->memory = 1;
+	}
+	if (l->v[LIM_CPUS] != LIMIT_NONE) {
+		snprintf(value, sizeof(value), "%ld %d",
+			l->v[LIM_CPUS] * (CPU_PERIOD / 1000), CPU_PERIOD);
+		if (cg_limit(parent, g->dir, "cpu.max", value, "+cpu") == -1) {
+			goto fail;
+		}
+	}
+
+	if ((g->procs = openat(g->dir, "cgroup.procs", O_WRONLY | O_CLOEXEC)) == -1) {
+		goto fail;
+	}
+
+	close(parent);
+	return 0;
+
+fail:
+	if (g->dir != -1) {
+		close(g->dir);
+	}
+	unlinkat(parent, g->name, AT_REMOVEDIR);
+	close(parent);
+	g->dir = -1;
+	g->memory = 0;
+	pg_errno = EOPEN;
+	return -1;
+}
+
+// Sets a limit of a cgroup, enabling its controller in the parent if needed
+static int cg_limit(int parent, int dir, const char *file, const char *value,
+		const char *controller) {
+	if (cg_write(dir, file, value) == 0) {
+		return 0;
+	}
+	if (errno != ENOENT || cg_write(parent, "cgroup.subtree_control", controller) == -1) {
+		return -1;
+	}
+	return cg_write(dir, file, value);
+}
+
+/* Description: Puts the calling process into a cgroup and sets its limits.
+ *				It is called by the child, after fork and before exec.
+ *
+ * Arguments:	g:	cgroup, from lgroup_open
+ *				l:	Limits
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (check errno)
+ *
+ * Notes:		Only async signal safe calls are made.
+ */
+int lgroup_enter(const struct lgroup *g, const struct limits *l) {
+	struct rlimit rl;
+	int i;
+
+	if (g != NULL && g->procs != -1 && write(g->procs, "0", 1) == -1) {
+		return -1;
+	}
+
+	for (i = 0; i < NLIMITS; ++i) {
+		if (l->v[i] == LIMIT_NONE || keys[i].resource == -1) {
+			continue;
+		}
+		if (i == LIM_MEM && g != NULL && g->memory) {
+			continue;	// The cgroup limits the pipeline instead
+		}
+		rl.rlim_cur = l->v[i];
+		rl.rlim_max = l->v[i];
+		if (i == LIM_CPU) {
+			rl.rlim_max += 5;	// SIGXCPU first, SIGKILL a little later
+		}
+		if (setrlimit(keys[i].resource, &rl) == -1) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Description: Reads the resources the processes of a cgroup used.
+ *
+ * Returns:		- On success,  0
+ * 				- If g has no cgroup, -1
+ */
+int lgroup_usage(const struct lgroup *g, struct lusage *u) {
+	long usec;
+
+	if (g->dir == -1) {
+		return -1;
+	}
+
+	u->peak = cg_read(g->dir, "memory.peak", NULL);	// Linux 5.19
+	usec = cg_read(g->dir, "cpu.stat", "usage_usec");
+	u->cpu = usec < 0 ? -1 : usec / 1000;
+	u->oomKills = cg_read(g->dir, "memory.events", "oom_kill");
+	if (u->oomKills < 0) {
+		u->oomKills = 0;
+	}
+
+	return 0;
+}
+
+/* Description: Removes the cgroup of a pipeline, whose processes have ended.
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		A cgroup still holding processes (e.g. started in the background
+ *				by the pipeline) stays until they end.
+ */
+void lgroup_close(struct lgroup *g) {
+	char path[PATH_MAX];
+	size_t len;
+
+	if (g->dir == -1) {
+		return;
+	}
+	close(g->dir);
+	close(g->procs);
+	g->dir = -1;
+	g->procs = -1;
+
+	if (cgroup_self(path, sizeof(path)) == 0 &&
+		(len = strlen(path)) + strlen(g->name) + 2 <= sizeof(path)) {
+		path[len] = '/';
+		strcpy(path + len + 1, g->name);
+		rmdir(path);
+	}
+}
+
+/* Description: Creates the cgroup of the pipeline about to start, for the
+ *				session limits (pg_limits).
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		When no cgroup can be created, it is reported once and the
+ *				pipeline runs with setrlimit limits only.
+ */
+void limits_begin(void) {
+	if (!limits_any(&pg_limits)) {
+		return;
+	}
+	if (lgroup_open(&pipeGroup, &pg_limits) == -1 && !warned) {
+		fprintf(stderr, "pgsh: limit: no writable cgroup v2, %s\n",
+			pg_limits.v[LIM_CPUS] != LIMIT_NONE ? "cpus is not enforced" :
+			"mem limits every process");
+		warned = 1;
+	}
+}
+
+/* Description: Applies the session limits in a child of the pipeline started
+ *				by limits_begin.
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		The child exits if a limit cannot be set.
+ */
+void limits_enter(void) {
+	if (limits_any(&pg_limits) && lgroup_enter(&pipeGroup, &pg_limits) == -1) {
+		perror("pgsh: limit");
+		_exit(EXIT_FAILURE);
+	}
+}
+
+/* Description: Ends the pipeline started by limits_begin. Its usage is kept for
+ *				limits_last, and processes killed by the memory limit are
+ *				reported.
+ *
+ * Returns:		void: Nothing
+ */
+void limits_end(void) {
+	if (lgroup_usage(&pipeGroup, &lastUsage) == 0 && lastUsage.oomKills > 0) {
+		fprintf(stderr, "pgsh: limit: memory limit reached, %ld process%s killed\n",
+			lastUsage.oomKills, lastUsage.oomKills > 1 ? "es" : "");
+	}
+	lgroup_close(&pipeGroup);
+}
+
+/* Description: Gives the resources the last pipeline run in a cgroup used.
+ *
+ * Returns:		- If there was one, its usage
+ * 				- Otherwise, NULL
+ */
+const struct lusage * limits_last(void) {
+	return lastUsage.cpu == -1 && lastUsage.peak == -1 ? NULL : &lastUsage;
+}
+
+/* Description: limit [-q] [KEY=VALUE]... [--] [COMMAND [ARG]...]
+ *				With a COMMAND, runs it with the session limits and the given
+ *				ones and reports its peak memory and CPU time (-q does not).
+ *				Without, sets the limits of every following pipeline. "limit"
+ *				alone shows them and "limit off" removes them all.
+ *				Keys: mem (2G), cpus (1.5), cpu (60s), nofile, nproc, fsize.
+ *				mem and cpus limit the whole pipeline through a cgroup v2.
+ */
+int bi_limit(int argc, char **argv, struct bi_ctx *ctx) {
+	struct limits l = pg_limits;
+	struct lgroup g;
+	struct lusage u;
+	struct rusage usage;
+	char buf[256];
+	struct limit_child child;
+	int i = 1, quiet = 0, status;
+	pid_t pid;
+
+	if (argc == 1) {
+		limits_format(&pg_limits, buf, sizeof(buf));
+		if (bi_printf(ctx, "%s\n", buf[0] != '\0' ? buf : "off") == -1) {
+			return 1;
+		}
+		if (limits_last() != NULL) {
+			usage_report(ctx, limits_last());
+		}
+		return 0;
+	}
+	if (argc == 2 && strcmp(argv[1], "off") == 0) {
+		limits_clear(&pg_limits);
+		return 0;
+	}
+
+	if (strcmp(argv[i], "-q") == 0) {
+		quiet = 1;
+		++i;
+	}
+	for (; i < argc && strchr(argv[i], '=') != NULL; ++i) {
+		if (limits_set(&l, argv[i]) == -1) {
+			bi_error(ctx, "%s: invalid limit", argv[i]);
+			return 2;
+		}
+	}
+	if (i < argc && strcmp(argv[i], "--") == 0) {
+		++i;
+	}
+
+	if (i == argc) {		// Limits of the session
+		pg_limits = l;
+		return 0;
+	}
+	if (ctx->in < 0 || ctx->out < 0 || ctx->err < 0) {
+		bi_error(ctx, "cannot run a command connected to a ring");
+		return 1;
+	}
+
+	if (lgroup_open(&g, &l) == -1 && l.v[LIM_CPUS] != LIMIT_NONE) {
+		bi_error(ctx, "no writable cgroup v2, cpus is not enforced");
+	}
+
+	child.g = &g;
+	child.l = &l;
+	if ((pid = fork_argv(argv + i, ctx->in, ctx->out, ctx->err, limit_setup,
+		&child)) == -1) {
+		bi_error(ctx, "fork: %s", strerror(errno));
+		lgroup_close(&g);
+		return 1;
+	}
+	if ((status = wait_argv(pid, &usage)) == -1) {
+		bi_error(ctx, "wait: %s", strerror(errno));
+		lgroup_close(&g);
+		return 1;
+	}
+
+	// The cgroup counts every process of the command, rusage the biggest one
+	if (lgroup_usage(&g, &u) == -1) {
+		u.peak = u.cpu = -1;
+		u.oomKills = 0;
+	}
+	if (u.peak == -1) {
+		u.peak = usage.ru_maxrss * 1024L;
+	}
+	if (u.cpu == -1) {
+		u.cpu = (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000L +
+			(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+	}
+	lgroup_close(&g);
+	if (!quiet || u.oomKills > 0) {
+		usage_report(ctx, &u);
+	}
+
+	return status;
+}
+
+// Applies the limits in the child of bi_limit
+static int limit_setup(void *arg) {
+	struct limit_child *child = (struct limit_child *)arg;
+
+	return lgroup_enter(child->g, child->l);
+}
+
+// Reports the usage of a limited command or pipeline to the standard error
+static void usage_report(struct bi_ctx *ctx, const struct lusage *u) {
+	char peak[32];
+
+	if (u->peak >= 0) {
+		size_text(peak, sizeof(peak), u->peak);
+	} else {
+		strcpy(peak, "unknown");
+	}
+	bi_error(ctx, "peak memory %s, cpu %ld.%03lds%s", peak, u->cpu / 1000,
+		u->cpu % 1000, u->oomKills > 0 ? ", killed by the memory limit" : "");
+}
+
+// Writes a size in bytes with a K, M or G unit
+static void size_text(char *buf, size_t size, long bytes) {
+	if (bytes >= (1L << 30)) {
+		snprintf(buf, size, "%.1fG", bytes / (double)(1L << 30));
+	} else if (bytes >= (1L << 20)) {
+		snprintf(buf, size, "%.1fM", bytes / (double)(1L << 20));
+	} else {
+		snprintf(buf, size, "%.1fK", bytes / 1024.0);
+	}
+}
+
+// Finds where cgroup v2 is mounted. Returns NULL if it is not.
+static const char * cgroup_root(void) {
+	char line[4096];
+	char *mnt, *end;
+	FILE *fp;
+	int i;
+
+	if (cgrootState != 0) {
+		return cgrootState == 1 ? cgroot : NULL;
+	}
+
+	cgrootState = -1;
+	if ((fp = fopen("/proc/self/mountinfo", "re")) == NULL) {
+		return NULL;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strstr(line, " - cgroup2 ") == NULL) {
+			continue;
+		}
+		// ID, parent ID, device, root, then the mount point
+		for (mnt = line, i = 0; i < 4 && mnt != NULL; ++i) {
+			if ((mnt = strchr(mnt, ' ')) != NULL) {
+				++mnt;
+			}
+		}
+		if (mnt != NULL && (end = strchr(mnt, ' ')) != NULL &&
+			(size_t)(end - mnt) < sizeof(cgroot)) {
+			memcpy(cgroot, mnt, end - mnt);
+			cgroot[end - mnt] = '\0';
+			cgrootState = 1;
+			break;
+		}
+	}
+	fclose(fp);
+
+	return cgrootState == 1 ? cgroot : NULL;
+}
+
+// Gets the path of the cgroup v2 of the calling process. Returns -1 on failure.
+static int cgroup_self(char *path, size_t size) {
+	const char *root = cgroup_root();
+	char line[PATH_MAX];
+	FILE *fp;
+	int found = -1;
+
+	if (root == NULL || (fp = fopen("/proc/self/cgroup", "re")) == NULL) {
+		return -1;
+	}
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		if (strncmp(line, "0::", 3) == 0) {
+			line[strcspn(line, "\n")] = '\0';
+			if (snprintf(path, size, "%s%s", root, line + 3) < (int)size) {
+				found = 0;
+			}
+			break;
+		}
+	}
+	fclose(fp);
+
+	return found;
+}
+
+// Writes a cgroup file. Returns -1 on failure (check errno).
+static int cg_write(int dir, const char *file, const char *value) {
+	size_t len = strlen(value);
+	ssize_t n;
+	int fd, err;
+
+	if ((fd = openat(dir, file, O_WRONLY | O_CLOEXEC)) == -1) {
+		return -1;
+	}
+	n = write(fd, value, len);
+	err = errno;
+	close(fd);
+	errno = err;
+
+	return n == (ssize_t)len ? 0 : -1;
+}
+
+// Reads a number from a cgroup file: the whole file, or the value of a key of a
+// flat keyed file. Returns -1 if there is none.
+static long cg_read(int dir, const char *file, const char *key) {
+	char buf[1024];
+	char *p;
+	size_t klen;
+	ssize_t n;
+	int fd;
+
+	if ((fd = openat(dir, file, O_RDONLY | O_CLOEXEC)) == -1) {
+		return -1;
+	}
+	n = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (n <= 0) {
+		return -1;
+	}
+	buf[n] = '\0';
+
+	if (key == NULL) {
+		return (buf[0] >= '0' && buf[0] <= '9') ? strtol(buf, NULL, 10) : -1;
+	}
+
+	klen = strlen(key);
+	for (p = buf; *p != '\0'; ++p) {
+		if (strncmp(p, key, klen) == 0 && p[klen] == ' ') {
+			return strtol(p + klen + 1, NULL, 10);
+		}
+		if ((p = strchr(p, '\n')) == NULL) {
+			break;
+		}
+	}
+	return -1;
+}
@@ -0,0 +1,54 @@
+#ifndef PG_LIMIT_H
+#define PG_LIMIT_H
+
+#include <stddef.h>
+
+#define LIMIT_NONE	(-1L)	// The resource is not limited
+
+// Limited resources, indexes of struct limits
+enum LimitKey {
+	LIM_CPU,		// CPU time (s): RLIMIT_CPU
+	LIM_CPUS,		// CPU bandwidth (1/1000 CPU): cpu.max
+	LIM_FSIZE,		// File size (bytes): RLIMIT_FSIZE
+	LIM_MEM,		// Memory (bytes): memory.max, RLIMIT_AS without a cgroup
+	LIM_NOFILE,		// Open files: RLIMIT_NOFILE
+	LIM_NPROC,		// Processes of the user: RLIMIT_NPROC
+	NLIMITS
+};
+
+// Resource limits of commands
+struct limits {
+	long v[NLIMITS];	// LIMIT_NONE or the limit
+};
+
+// cgroup v2 that a limited pipeline runs in
+struct lgroup {
+	int dir;		// The cgroup directory, -1 for none
+	int procs;		// Its cgroup.procs, which the children join through
+	int memory;		// memory.max is set, so mem needs no RLIMIT_AS
+	char name[64];	// Name under the parent cgroup
+};
+
+// Resources a limited pipeline used
+struct lusage {
+	long peak;		// Peak memory (bytes), -1 if unknown
+	long cpu;		// CPU time (ms)
+	long oomKills;	// Processes killed by the memory limit
+};
+
+extern struct limits pg_limits;	// Limits of every pipeline of the session
+
+void limits_clear(struct limits *l);
+int limits_any(const struct limits *l);
+int limits_set(struct limits *l, const char *spec);
+int limits_format(const struct limits *l, char *buf, size_t size);
+int lgroup_open(struct lgroup *g, const struct limits *l);
+int lgroup_enter(const struct lgroup *g, const struct limits *l);
+int lgroup_usage(const struct lgroup *g, struct lusage *u);
+void lgroup_close(struct lgroup *g);
+void limits_begin(void);
+void limits_enter(void);
+void limits_end(void);
+const struct lusage * limits_last(void);
+
+#endif
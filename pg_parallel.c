@@ -0,0 +1,576 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * The parallel builtin. A command template is run for every input line (or
+ * every argument after :::) by a bounded pool of workers. The standard output
+ * and error of every job go to memory files of their own, so jobs never mix
+ * their output. A finished job is emitted in input order, or as soon as it is
+ * done if completion order is asked for. Job ends are seen through pidfds and
+ * every job can be timed in a job log.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE		// memfd_create()
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include "pg_error.h"
+#include "pg_string.h"
+#include "pg_file.h"
+#include "pg_cat.h"
+#include "processes.h"
+#include "pg_builtin.h"
+
+#define PAR_BUFSIZE		(64 * 1024)		// Input and output copied at a time
+#define PAR_BACKLOG		4				// Jobs kept per worker, waiting for their turn
+#define PAR_MAX_FAILED	101				// Highest exit status
+
+// Options of parallel
+struct par_opts {
+	int jobs;			// Workers (-j)
+	int completion;		// Emit jobs as they finish (--completion)
+	const char *joblog;	// Job log file (--joblog)
+	int first;			// Index of the command
+	int nargs;			// Index of ":::", or argc
+};
+
+// Job of parallel
+struct job {
+	long seq;				// Input order, from 1
+	pid_t pid;
+	int pidfd;
+	int out, err;			// Memory files of the job's output
+	int done;
+	int status;				// Wait status
+	struct timespec start;	// Wall clock start
+	struct timespec mstart;	// Monotonic start, for the run time
+	double runtime;
+	char *cmd;				// Command line, for the job log
+};
+
+// Running parallel
+struct parallel {
+	struct bi_ctx *ctx;
+	const struct par_opts *o;
+	char **tmpl;			// Command template
+	int ntmpl;
+	int append;				// The template has no {}, the line is appended
+	struct job *jobs;		// Jobs running or waiting for their turn
+	int njobs, cap;
+	pid_t *pids;			// Scratch for wait_any
+	int *pidfds;
+	int *index;
+	int running;
+	long seq;				// Jobs started
+	long next;				// Next job to emit in input order
+	FILE *log;
+	int failed;				// Jobs that failed
+	int stop;
+};
+
+// Static Function Prototypes //
+static int get_par_opts(int argc, char **argv, struct par_opts *o);
+static int job_start(struct parallel *p, const char *line);
+static int job_grow(struct parallel *p);
+static int job_reap(struct parallel *p);
+static void job_emit(struct parallel *p, struct job *job);
+static void job_log(struct parallel *p, const struct job *job);
+static char * expand(const char *tmpl, const char *line, long seq);
+static int emit_fd(struct bi_ctx *ctx, int fd, int to);
+static int read_lines(struct parallel *p);
+
+/* Description: parallel [-j N] [--completion] [--joblog FILE] COMMAND [ARG]...
+ *						[::: ITEM...]
+ *				Runs COMMAND for every line of the input, or every ITEM, with
+ *				up to N (one per processor) jobs at the same time. In the
+ *				arguments {} is the line, {.} the line without its extension,
+ *				{/} its last path component and {#} the job number. Without
+ *				any of them the line is appended. Output of every job is kept
+ *				apart and printed in input order, or in completion order with
+ *				--completion. The job log has a tab separated line per job.
+ *				Exits with the number of failed jobs (at most 101).
+ */
+int bi_parallel(int argc, char **argv, struct bi_ctx *ctx) {
+	struct par_opts o;
+	struct parallel p;
+	const char *s;
+	int i, fd;
+
+	if (get_par_opts(argc, argv, &o) == -1) {
+		bi_error(ctx, "usage: parallel [-j N] [--completion] [--joblog FILE] "
+			"COMMAND [ARG]... [::: ITEM...]");
+		return 255;
+	}
+
+	memset(&p, 0, sizeof(p));
+	p.ctx = ctx;
+	p.o = &o;
+	p.tmpl = argv + o.first;
+	p.ntmpl = o.nargs - o.first;
+	p.next = 1;
+	p.append = 1;
+	for (i = 0; i < p.ntmpl; ++i) {
+		for (s = p.tmpl[i]; (s = strchr(s, '{')) != NULL; ++s) {
+			if (strncmp(s, "{}", 2) == 0 || strncmp(s, "{.}", 3) == 0 ||
+				strncmp(s, "{/}", 3) == 0) {
+				p.append = 0;
+			}
+		}
+	}
+
+	if (o.joblog != NULL) {
+		if ((fd = open(o.joblog, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666))
+			== -1 || (p.log = fdopen(fd, "w")) == NULL) {
+			bi_error(ctx, "%s: %s", o.joblog, strerror(errno));
+			if (fd != -1) {
+				close(fd);
+			}
+			return 255;
+		}
+		fprintf(p.log, "Seq\tHost\tStarttime\tJobRuntime\tSend\tReceive\t"
+			"Exitval\tSignal\tCommand\n");
+	}
+
+	// Items after ::: or else the lines of the input
+	if (o.nargs < argc) {
+		for (i = o.nargs + 1; i < argc && !p.stop; ++i) {
+			job_start(&p, argv[i]);
+		}
+	} else {
+		read_lines(&p);
+	}
+
+	while (p.njobs > 0) {
+		if (job_reap(&p) == -1) {
+			break;
+		}
+	}
+
+	if (p.log != NULL) {
+		fclose(p.log);
+	}
+	free(p.jobs);
+	free(p.pids);
+	free(p.pidfds);
+	free(p.index);
+
+	if (p.stop && p.failed == 0) {
+		return 255;
+	}
+	return (p.failed > PAR_MAX_FAILED) ? PAR_MAX_FAILED : p.failed;
+}
+
+/* Description: Checks if the parallel builtin handles the arguments.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_parallel_accepts(int argc, char **argv) {
+	struct par_opts o;
+
+	return get_par_opts(argc, argv, &o) == 0;
+}
+
+// Parses the options of parallel. Returns -1 for unsupported arguments.
+static int get_par_opts(int argc, char **argv, struct par_opts *o) {
+	const char *value;
+	long num;
+	int i;
+
+	o->jobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	o->completion = 0;
+	o->joblog = NULL;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		if (strcmp(argv[i], "--completion") == 0) {
+			o->completion = 1;
+			continue;
+		}
+		if (strcmp(argv[i], "-k") == 0) {		// Input order is the default
+			o->completion = 0;
+			continue;
+		}
+		if (strcmp(argv[i], "--joblog") == 0) {
+			if (++i == argc) {
+				return -1;
+			}
+			o->joblog = argv[i];
+			continue;
+		}
+		if (strncmp(argv[i], "-j", 2) != 0) {
+			return -1;
+		}
+
+		if (argv[i][2] != '\0') {
+			value = argv[i] + 2;
+		} else if (++i < argc) {
+			value = argv[i];
+		} else {
+			return -1;
+		}
+		if (strtosize(value, &num) == -1 || num > 0xFFFF) {
+			return -1;
+		}
+		if (num > 0) {
+			o->jobs = (int)num;
+		}
+	}
+	if (o->jobs <= 0) {
+		o->jobs = 1;
+	}
+
+	o->first = i;
+	for (o->nargs = i; o->nargs < argc; ++o->nargs) {
+		if (strcmp(argv[o->nargs], ":::") == 0) {
+			break;
+		}
+	}
+
+	return (o->nargs > o->first) ? 0 : -1;	// A command is needed
+}
+
+// Runs a job for every line of the input
+static int read_lines(struct parallel *p) {
+	char buf[PAR_BUFSIZE];
+	char *line = NULL, *tmp;
+	size_t len = 0, cap = 0, chunk;
+	const char *s, *nl, *end;
+	ssize_t n;
+
+	while (!p->stop) {
+		if ((n = bi_read(p->ctx, buf, sizeof(buf))) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			bi_error(p->ctx, "%s", strerror(errno));
+			break;
+		}
+		if (n == 0) {
+			if (len > 0) {		// Last line without newline
+				job_start(p, line);
+			}
+			break;
+		}
+
+		for (s = buf, end = buf + n; s < end && !p->stop; s = nl + 1) {
+			nl = memchr(s, '\n', end - s);
+			chunk = (nl ? nl : end) - s;
+
+			// A line may span reads, the partial one is kept
+			if (len + chunk + 1 > cap) {
+				cap = 2 * (len + chunk + 1);
+				if ((tmp = (char *)realloc(line, cap)) == NULL) {
+					bi_error(p->ctx, "%s", strerror(ENOMEM));
+					p->stop = 1;
+					break;
+				}
+				line = tmp;
+			}
+			memcpy(line + len, s, chunk);
+			len += chunk;
+			line[len] = '\0';
+
+			if (nl == NULL) {
+				break;
+			}
+			job_start(p, line);
+			len = 0;
+		}
+	}
+
+	free(line);
+	return p->stop ? -1 : 0;
+}
+
+// Starts the job of a line, once a worker is free
+static int job_start(struct parallel *p, const char *line) {
+	struct job *job;
+	char **argv;
+	size_t cmdlen = 0;
+	int i, n;
+
+	// Jobs that wait for their turn keep memory files open, so they are bounded
+	while (p->running >= p->o->jobs || p->njobs >= PAR_BACKLOG * p->o->jobs) {
+		if (job_reap(p) == -1) {
+			return -1;
+		}
+	}
+	if (p->stop) {
+		return -1;
+	}
+
+	if (p->njobs == p->cap && job_grow(p) == -1) {
+		bi_error(p->ctx, "%s", strerror(ENOMEM));
+		p->stop = 1;
+		return -1;
+	}
+
+	n = p->ntmpl + p->append;
+	if ((argv = (char **)calloc(n + 1, sizeof(char *))) == NULL) {
+		bi_error(p->ctx, "%s", strerror(ENOMEM));
+		p->stop = 1;
+		return -1;
+	}
+
+	job = &p->jobs[p->njobs];
+	memset(job, 0, sizeof(struct job));
+	job->seq = ++p->seq;
+	job->out = job->err = job->pidfd = -1;
+
+	for (i = 0; i < p->ntmpl; ++i) {
+		argv[i] = expand(p->tmpl[i], line, job->seq);
+	}
+	if (p->append) {
+		argv[i] = strdup(line);
+	}
+	for (i = 0; i < n; ++i) {
+		if (argv[i] == NULL) {
+			break;
+		}
+		cmdlen += strlen(argv[i]) + 1;
+	}
+
+	if (i < n || (job->out = fd_memfile("parallel")) == -1 ||
+		(job->err = fd_memfile("parallel")) == -1) {
+		bi_error(p->ctx, "%s", strerror(i < n ? ENOMEM : errno));
+		p->stop = 1;
+	} else if ((job->cmd = (char *)malloc(cmdlen)) != NULL) {
+		// Arguments joined with blanks, for the job log
+		job->cmd[0] = '\0';
+		for (i = 0; i < n; ++i) {
+			strcat(job->cmd, argv[i]);
+			if (i < n - 1) {
+				strcat(job->cmd, " ");
+			}
+		}
+	}
+
+	if (!p->stop) {
+		clock_gettime(CLOCK_REALTIME, &job->start);
+		clock_gettime(CLOCK_MONOTONIC, &job->mstart);
+		job->pid = spawn_argv(argv, -1, job->out, job->err, 0);
+		if (job->pid == -1) {
+			bi_error(p->ctx, "%s: %s", argv[0], strerror(errno));
+			p->stop = 1;
+		}
+	}
+
+	for (i = 0; i < n; ++i) {
+		free(argv[i]);
+	}
+	free(argv);
+
+	if (p->stop) {
+		if (job->out != -1) {
+			close(job->out);
+		}
+		if (job->err != -1) {
+			close(job->err);
+		}
+		free(job->cmd);
+		return -1;
+	}
+
+	job->pidfd = pid_open(job->pid);
+	++p->njobs;
+	++p->running;
+	return 0;
+}
+
+// Makes room for more jobs
+static int job_grow(struct parallel *p) {
+	int cap = p->cap ? 2 * p->cap : 2 * p->o->jobs;
+	void *tmp;
+
+	if ((tmp = realloc(p->jobs, cap * sizeof(struct job))) == NULL) {
+		return -1;
+	}
+	p->jobs = (struct job *)tmp;
+	if ((tmp = realloc(p->pids, cap * sizeof(pid_t))) == NULL) {
+		return -1;
+	}
+	p->pids = (pid_t *)tmp;
+	if ((tmp = realloc(p->pidfds, cap * sizeof(int))) == NULL) {
+		return -1;
+	}
+	p->pidfds = (int *)tmp;
+	if ((tmp = realloc(p->index, cap * sizeof(int))) == NULL) {
+		return -1;
+	}
+	p->index = (int *)tmp;
+
+	p->cap = cap;
+	return 0;
+}
+
+// Waits for a job, then prints the jobs whose turn it is
+static int job_reap(struct parallel *p) {
+	struct job *job;
+	struct timespec now;
+	int status, i, k, n = 0;
+
+	if (p->running > 0) {
+		for (i = 0; i < p->njobs; ++i) {
+			if (!p->jobs[i].done) {
+				p->pids[n] = p->jobs[i].pid;
+				p->pidfds[n] = p->jobs[i].pidfd;
+				p->index[n++] = i;
+			}
+		}
+		if ((k = wait_any(p->pids, p->pidfds, n, &status)) == -1) {
+			bi_error(p->ctx, "wait: %s", strerror(errno));
+			p->running = 0;
+			p->stop = 1;
+			return -1;
+		}
+
+		job = &p->jobs[p->index[k]];
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		job->runtime = (now.tv_sec - job->mstart.tv_sec) +
+			(now.tv_nsec - job->mstart.tv_nsec) / 1e9;
+		job->status = status;
+		job->done = 1;
+		if (job->pidfd != -1) {
+			close(job->pidfd);
+		}
+		--p->running;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+			++p->failed;
+		}
+		job_log(p, job);
+	}
+
+	// Completed jobs in turn, or all of them in completion order
+	for (i = 0; i < p->njobs; ) {
+		job = &p->jobs[i];
+		if (job->done && (p->o->completion || job->seq == p->next)) {
+			job_emit(p, job);
+			++p->next;
+			p->jobs[i] = p->jobs[--p->njobs];
+			i = 0;
+		} else {
+			++i;
+		}
+	}
+
+	return 0;
+}
+
+// Prints the output of a job and frees it
+static void job_emit(struct parallel *p, struct job *job) {
+	if (emit_fd(p->ctx, job->out, p->ctx->out) == -1 ||
+		emit_fd(p->ctx, job->err, p->ctx->err) == -1) {
+		if (p->ctx->broken) {
+			p->stop = 1;	// Nobody reads the output any more
+		}
+	}
+	close(job->out);
+	close(job->err);
+	free(job->cmd);
+}
+
+// Copies a memory file of a job to a descriptor of the builtin
+static int emit_fd(struct bi_ctx *ctx, int fd, int to) {
+	char buf[PAR_BUFSIZE];
+	ssize_t n;
+
+	if (lseek(fd, 0, SEEK_SET) == -1) {
+		return -1;
+	}
+	if (to >= 0) {
+		return copy_fd(fd, to) == -1 ? -1 : 0;
+	}
+
+	// Rings are written through a buffer
+	while ((n = read(fd, buf, sizeof(buf))) > 0) {
+		if (bi_write(ctx, buf, n) == -1) {
+			return -1;
+		}
+	}
+	return (n == 0) ? 0 : -1;
+}
+
+// Writes the job log line of a finished job
+static void job_log(struct parallel *p, const struct job *job) {
+	struct stat st;
+	long received = 0;
+
+	if (p->log == NULL) {
+		return;
+	}
+	if (fstat(job->out, &st) == 0) {
+		received = st.st_size;
+	}
+
+	fprintf(p->log, "%ld\t:\t%ld.%03ld\t%8.3f\t0\t%ld\t%d\t%d\t%s\n", job->seq,
+		(long)job->start.tv_sec, job->start.tv_nsec / 1000000L, job->runtime,
+		received, WIFEXITED(job->status) ? WEXITSTATUS(job->status) : -1,
+		WIFSIGNALED(job->status) ? WTERMSIG(job->status) : 0,
+		job->cmd ? job->cmd : "");
+	fflush(p->log);
+}
+
+// Replaces the replacement strings of a template argument
+static char * expand(const char *tmpl, const char *line, long seq) {
+	const char *s, *base, *dot, *rep;
+	char num[24];
+	char *res, *r;
+	size_t len, size, baselen;
+
+	base = strrchr(line, '/');
+	base = base ? base + 1 : line;
+	baselen = strlen(base);
+	dot = strrchr(base, '.');
+	dot = (dot != NULL && dot != base) ? dot : line + strlen(line);
+	snprintf(num, sizeof(num), "%ld", seq);
+
+	// Every replacement is at most as long as the line or the number
+	size = strlen(tmpl) + 1;
+	for (s = tmpl; (s = strchr(s, '{')) != NULL; ++s) {
+		size += strlen(line) + strlen(num);
+	}
+	if ((res = (char *)malloc(size)) == NULL) {
+		return NULL;
+	}
+
+	for (s = tmpl, r = res; *s; ) {
+		rep = NULL;
+		if (strncmp(s, "{}", 2) == 0) {
+			rep = line;
+			len = strlen(line);
+			s += 2;
+		} else if (strncmp(s, "{.}", 3) == 0) {
+			rep = line;
+			len = dot - line;
+			s += 3;
+		} else if (strncmp(s, "{/}", 3) == 0) {
+			rep = base;
+			len = baselen;
+			s += 3;
+		} else if (strncmp(s, "{#}", 3) == 0) {
+			rep = num;
+			len = strlen(num);
+			s += 3;
+		}
+		if (rep != NULL) {
+			memcpy(r, rep, len);
+			r += len;
+		} else {
+			*r++ = *s++;
+		}
+	}
+	*r = '\0';
+
+	return res;
+}
@@ -0,0 +1,1845 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Lexer and recursive descent parser of the pgsh command language. A command
+ * line is first split to tokens, honouring single quotes, double quotes and
+ * backslash escapes, and then parsed to an abstract syntax tree:
+ *
+ *		list		:= and_or ( ( ';' | newline ) and_or )*
+ *		and_or		:= pipeline ( ( '&&' | '||' ) pipeline )*
+ *		pipeline	:= command ( ( '|' | '|{' size '}' ) command )*
+ *					 | compound
+ *		command		:= ( word | procsub | redirection )+
+ *		compound	:= 'if' list 'then' list ( 'elif' list 'then' list )*
+ *						[ 'else' list ] 'fi'
+ *					 | ( 'while' | 'until' ) list 'do' list 'done'
+ *					 | 'for' name [ 'in' word* ] ( ';' | newline ) 'do' list 'done'
+ *					 | 'case' word 'in' ( [ '(' ] word ( '|' word )* ')'
+ *						[ list ] ';;' )* 'esac'
+ *					 | '{' list '}'
+ *					 | name '(' ')' compound
+ *		procsub		:= ( '<(' | '>(' ) list ')'
+ *		redirection	:= [ io_number ] ( '<' | '>' | '>>' | '<>' | '<&' | '>&' ) target
+ *					 | ( '&>' | '&>>' ) target
+ *					 | [ io_number ] ( '<<' | '<<-' | '<<<' ) word
+ *		target		:= word | procsub
+ *
+ * An io_number is a word of digits written right before the operator, as in
+ * "2>&1". The word after '<&' and '>&' is a descriptor number or '-'. The word
+ * after '<<' and '<<-' is the delimiter of a here-document, whose body is read
+ * from the lines after the current one and replaces the word. The list
+ * of a process substitution is kept as text and parsed when it runs, and so is
+ * the list of a command substitution, "$(list)" or "`list`", inside a word.
+ * Parameters, "$NAME" and "${...}", are kept the same way, and unquoted glob
+ * characters, '*', '?' and '[', are marked so that quoted ones stay literal.
+ * Words with an unquoted NAME= before the first command word are variable
+ * assignments: they set shell variables if there is no command, else only its
+ * environment.
+ * Reserved words are only recognised unquoted and in the place of a command
+ * name, so "echo if" is a simple command. Lists of compound commands may span
+ * lines and a line that ends inside one is not complete (see line_open).
+ * Aliases are spliced into the tokens before they are parsed: a plain word in
+ * the place of a command name that names an alias is replaced with copies of
+ * the tokens of its body, lexed when the alias was defined, and the words of
+ * the body are checked again, except for aliases being spliced already.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include "pg_error.h"
+#include "pg_string.h"
+#include "pg_parse.h"
+#include "pg_var.h"
+#include "pg_alias.h"
+
+// Parser state
+struct parser {
+	struct token *tokens;	// Tokens of the line
+	int ntokens;			// Number of tokens
+	int pos;				// Current token
+	int quiet;				// Syntax errors are not reported
+};
+
+// Tokens of a line with its aliases spliced
+struct splice {
+	struct token *tokens;
+	int ntokens;
+	int cap;
+	int cmd;				// The next word is in the place of a command name
+	int target;				// The next word is the target of a redirection
+};
+
+static int lex_quiet;		// Lexing errors are not reported (see line_open)
+
+// Printable names of the tokens, used in syntax error messages
+static const char * const token_names[] = {
+	"word", "|", "&&", "||", ";", ";;", "newline", "<", ">", ">>", "<>", "<&",
+	">&", "&>", "&>>", "<<", "<<-", "<<<", "number", "<(", "&", "(", ")",
+	"end of line"
+};
+
+// Reserved words that start a compound command
+static const char * const openers[] = {
+	"if", "while", "until", "for", "case", "{", NULL
+};
+
+// Reserved words that end the list of a compound command
+static const char * const closers[] = {
+	"then", "elif", "else", "fi", "do", "done", "esac", "}", NULL
+};
+
+// Reserved words followed by a command
+static const char * const leaders[] = {
+	"if", "then", "elif", "else", "while", "until", "do", "{", NULL
+};
+
+// Static Function Prototypes //
+static int lex_word(const char **src, char *buf, struct token *tok);
+static int lex_procsub(const char **src, struct token *tok);
+static int lex_expand(const char **src, char *buf, size_t *len, int quoted);
+static int lex_heredoc(const char **src, char *buf, struct token *tok, int strip);
+static int is_heredoc(const struct token *tokens, int i);
+static void unclosed(const char *what);
+static const char * match_paren(const char *p);
+static int push_token(struct token **tokens, int *ntokens, int *cap,
+	enum TokenType type, char *text, int flags);
+static int splice_aliases(struct token **tokens, int *ntokens);
+static int splice_alias(struct splice *sp, struct alias *a);
+static struct alias * alias_at(const struct splice *sp, const struct token *tok,
+	const struct token *next);
+static void splice_state(struct splice *sp, const struct token *tok);
+static struct node * parse_all(struct parser *ps);
+static struct node * parse_list(struct parser *ps);
+static struct node * parse_and_or(struct parser *ps);
+static struct node * parse_pipeline(struct parser *ps);
+static struct node * parse_command(struct parser *ps);
+static struct node * parse_stage(struct parser *ps, struct node *body);
+static struct node * parse_if(struct parser *ps);
+static struct node * parse_loop(struct parser *ps, enum NodeType type);
+static struct node * parse_for(struct parser *ps);
+static struct node * parse_case(struct parser *ps);
+static struct node * parse_func(struct parser *ps);
+static struct node * parse_block(struct parser *ps);
+static struct node * parse_do(struct parser *ps);
+static int add_word(struct node *node, struct token *tok, int *wcap);
+static int is_word(const struct parser *ps, const char *word);
+static int is_closer(const struct parser *ps);
+static int is_compound(const struct parser *ps);
+static int expect(struct parser *ps, const char *word);
+static int parse_redirect(struct parser *ps, struct node *node, int *rcap);
+static int add_procsub(struct node *node, int word, int redir, int output);
+static struct node * new_node(enum NodeType type, struct node *left,
+	struct node *right);
+static void skip_newlines(struct parser *ps);
+static void syntax_error(struct parser *ps);
+static void unexpected(struct parser *ps);
+static size_t pipe_size_len(const char *p);
+
+/* Description: Splits a command line to tokens.
+ *
+ * Arguments:	line:		Command line
+ *				ntokens:	Stores the number of tokens (including TK_EOF)
+ *
+ * Returns:		- On success, the tokens array terminated with a TK_EOF token
+ * 				- On failure, NULL and sets pg_errno to:
+ *						# ENULL  : NULL pointer passed as an argument
+ *						# EPARSE : A quote was not closed
+ *
+ * Notes:		Quotes and escapes are removed from the words. A '#' at the start
+ *				of a word starts a comment till the end of the line.
+ */
+struct token * lex_line(const char *line, int *ntokens) {
+	struct token *tokens = NULL;
+	struct token word;
+	const char *p = line;
+	const char *start;	// Start of the current word
+	char *buf;			// Scratch buffer, marking expansions can make a word longer
+						// than its text, never twice as long
+	size_t size;
+	int cap = 0;
+	int status = 0;
+	int body = 0;		// First token whose here-document body is not read yet
+	int i;
+
+	if (line == NULL || ntokens == NULL) {
+		pg_errno = ENULL;
+		return NULL;
+	}
+	*ntokens = 0;
+
+	if ((buf = (char *)malloc(2 * strlen(line) + 1)) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+
+	while (status != -1) {
+		while (*p == ' ' || *p == '\t') {
+			++p;
+		}
+
+		switch (*p) {
+			case '\0':
+				for (i = body; i < *ntokens - 1 && !is_heredoc(tokens, i); ++i)
+					;
+				if (i < *ntokens - 1) {		// More lines may follow
+					pg_errno = EHEREDOC;
+					status = -1;
+					break;
+				}
+				status = push_token(&tokens, ntokens, &cap, TK_EOF, NULL, 0);
+				free(buf);
+				return status == -1 ? NULL : tokens;
+			case '#':		// Comment
+				while (*p != '\0' && *p != '\n') {
+					++p;
+				}
+				break;
+			case '\n':
+				status = push_token(&tokens, ntokens, &cap, TK_NEWLINE, NULL, 0);
+				++p;
+				// Bodies of the here-documents of the line follow it, in order
+				for (i = body; i < *ntokens - 1 && status == 0; ++i) {
+					if (is_heredoc(tokens, i)) {
+						status = lex_heredoc(&p, buf, &tokens[i + 1],
+							tokens[i].type == TK_DLESSDASH);
+					}
+				}
+				body = *ntokens;
+				break;
+			case '|':
+				if (p[1] == '|') {
+					status = push_token(&tokens, ntokens, &cap, TK_OR, NULL, 0);
+					p += 2;
+				} else if (p[1] == '{' && (size = pipe_size_len(p + 2)) > 0) {
+					// Sized pipe "|{1M}", the size is kept as the token text
+					if ((word.text = strndup(p + 2, size)) == NULL) {
+						perror("strndup");
+						status = -1;
+						break;
+					}
+					status = push_token(&tokens, ntokens, &cap, TK_PIPE, word.text, 0);
+					if (status == -1) {
+						free(word.text);
+					}
+					p += size + 3;
+				} else {
+					status = push_token(&tokens, ntokens, &cap, TK_PIPE, NULL, 0);
+					++p;
+				}
+				break;
+			case '&':
+				if (p[1] == '&') {
+					status = push_token(&tokens, ntokens, &cap, TK_AND, NULL, 0);
+					p += 2;
+				} else if (p[1] == '>' && p[2] == '>') {
+					status = push_token(&tokens, ntokens, &cap, TK_ANDDGREAT, NULL, 0);
+					p += 3;
+				} else if (p[1] == '>') {
+					status = push_token(&tokens, ntokens, &cap, TK_ANDGREAT, NULL, 0);
+					p += 2;
+				} else {
+					status = push_token(&tokens, ntokens, &cap, TK_AMP, NULL, 0);
+					++p;
+				}
+				break;
+			case ';':
+				status = push_token(&tokens, ntokens, &cap,
+					p[1] == ';' ? TK_DSEMI : TK_SEMI, NULL, 0);
+				p += (p[1] == ';') ? 2 : 1;
+				break;
+			case '<':
+				if (p[1] == '(') {
+					if ((status = lex_procsub(&p, &word)) == 0) {
+						status = push_token(&tokens, ntokens, &cap, TK_PROCSUB,
+							word.text, 0);
+						if (status == -1) {
+							free(word.text);
+						}
+					}
+				} else if (p[1] == '<' && p[2] == '<') {
+					status = push_token(&tokens, ntokens, &cap, TK_TLESS, NULL, 0);
+					p += 3;
+				} else if (p[1] == '<') {
+					status = push_token(&tokens, ntokens, &cap,
+						p[2] == '-' ? TK_DLESSDASH : TK_DLESS, NULL, 0);
+					p += (p[2] == '-') ? 3 : 2;
+				} else if (p[1] == '>') {
+					status = push_token(&tokens, ntokens, &cap, TK_LESSGREAT, NULL, 0);
+					p += 2;
+				} else if (p[1] == '&') {
+					status = push_token(&tokens, ntokens, &cap, TK_LESSAND, NULL, 0);
+					p += 2;
+				} else {
+					status = push_token(&tokens, ntokens, &cap, TK_LESS, NULL, 0);
+					++p;
+				}
+				break;
+			case '>':
+				if (p[1] == '(') {
+					if ((status = lex_procsub(&p, &word)) == 0) {
+						status = push_token(&tokens, ntokens, &cap, TK_PROCSUB,
+							word.text, TF_OUTPUT);
+						if (status == -1) {
+							free(word.text);
+						}
+					}
+				} else if (p[1] == '>') {
+					status = push_token(&tokens, ntokens, &cap, TK_DGREAT, NULL, 0);
+					p += 2;
+				} else if (p[1] == '&') {
+					status = push_token(&tokens, ntokens, &cap, TK_GREATAND, NULL, 0);
+					p += 2;
+				} else {
+					status = push_token(&tokens, ntokens, &cap, TK_GREAT, NULL, 0);
+					++p;
+				}
+				break;
+			case '(':
+				status = push_token(&tokens, ntokens, &cap, TK_LPAREN, NULL, 0);
+				++p;
+				break;
+			case ')':
+				status = push_token(&tokens, ntokens, &cap, TK_RPAREN, NULL, 0);
+				++p;
+				break;
+			default:
+				start = p;
+				if ((status = lex_word(&p, buf, &word)) == -1) {
+					break;
+				}
+				if (word.text == NULL) {	// Only an escaped newline
+					break;
+				}
+				// Plain digits right before '<' or '>' name a descriptor
+				if ((*p == '<' || *p == '>') && (size_t)(p - start) ==
+					strspn(start, "0123456789")) {
+					word.type = TK_IONUMBER;
+				}
+				status = push_token(&tokens, ntokens, &cap, word.type, word.text,
+					word.flags);
+				if (status == -1) {
+					free(word.text);
+				}
+				break;
+		}
+	}
+
+	free(buf);
+	tokens_free(tokens, *ntokens);
+	*ntokens = 0;
+	return NULL;
+}
+
+/* Description: Frees a tokens array.
+ *
+ * Arguments:	tokens:		Tokens array
+ *				ntokens:	Number of tokens
+ *
+ * Returns:		void: Nothing
+ */
+void tokens_free(struct token *tokens, int ntokens) {
+	int i;
+
+	if (tokens == NULL) {
+		return;
+	}
+
+	for (i = 0; i < ntokens; ++i) {
+		free(tokens[i].text);
+	}
+	free(tokens);
+}
+
+/* Description: Checks if a command line is not complete, so more lines must
+ *				be read before it can run: it ends inside a here-document or a
+ *				compound command, or after an operator that needs a command.
+ *
+ * Arguments:	line:	Command line
+ *
+ * Returns:		- If the line is not complete, 1
+ * 				- Otherwise, 0 (errors are left for the parser to report)
+ */
+int line_open(const char *line) {
+	static const char * const marks[] = {
+		"<<", "|", "&&", "{", "(", "if", "while", "until", "for", "case", NULL
+	};
+	struct parser ps;
+	struct node *root;
+	int open, i;
+
+	if (line == NULL) {
+		return 0;
+	}
+
+	// Most lines cannot go on and are not lexed twice
+	for (i = 0; marks[i] != NULL && strstr(line, marks[i]) == NULL; ++i)
+		;
+	if (marks[i] == NULL) {
+		return 0;
+	}
+
+	lex_quiet = 1;		// The parse of the whole line reports the errors
+	ps.tokens = lex_line(line, &ps.ntokens);
+	lex_quiet = 0;
+	if (ps.tokens == NULL) {
+		open = (pg_errno == EHEREDOC);
+		pg_errno = EOK;
+		return open;
+	}
+	ps.pos = 0;
+	ps.quiet = 1;
+
+	root = parse_all(&ps);
+	open = (root == NULL && pg_errno == EINCOMPLETE);
+	node_free(root);
+	tokens_free(ps.tokens, ps.ntokens);
+	pg_errno = EOK;
+
+	return open;
+}
+
+/* Description: Parses a command line to an abstract syntax tree.
+ *
+ * Arguments:	line:	Command line
+ *
+ * Returns:		- On success, the root of the syntax tree
+ * 				- On failure, NULL and sets pg_errno to:
+ *						# ENULL       : NULL pointer passed as an argument
+ *						# ENOTOKEN    : The line has no commands
+ *						# EPARSE      : A quote was not closed
+ *						# ESYNTAX     : Syntax error
+ *						# EINCOMPLETE : The line ended inside a command
+ *
+ * Notes:		Syntax errors are reported to stderr. The tree must be freed
+ *				with node_free.
+ */
+struct node * parse_line(const char *line) {
+	struct parser ps;
+	struct node *root;
+
+	if ((ps.tokens = lex_line(line, &ps.ntokens)) == NULL) {
+		return NULL;
+	}
+	if (splice_aliases(&ps.tokens, &ps.ntokens) == -1) {
+		tokens_free(ps.tokens, ps.ntokens);
+		return NULL;
+	}
+	ps.pos = 0;
+	ps.quiet = 0;
+
+	root = parse_all(&ps);
+
+	tokens_free(ps.tokens, ps.ntokens);
+	return root;
+}
+
+/* Description: Frees a syntax tree.
+ *
+ * Arguments:	node:	Root of the tree
+ *
+ * Returns:		void: Nothing
+ */
+void node_free(struct node *node) {
+	int i;
+
+	if (node == NULL) {
+		return;
+	}
+
+	node_free(node->left);
+	node_free(node->right);
+	node_free(node->other);
+
+	for (i = 0; i < node->nwords; ++i) {
+		free(node->words[i]);
+	}
+	free(node->words);
+
+	for (i = 0; i < node->nassigns; ++i) {
+		free(node->assigns[i]);
+	}
+	free(node->assigns);
+
+	for (i = 0; i < node->nredirs; ++i) {
+		free(node->redirs[i].target);
+	}
+	free(node->redirs);
+	free(node->psubs);
+
+	free(node);
+}
+
+/* Description: Reads a word, removing its quotes and escapes.
+ *
+ * Arguments:	src:	Position in the line, moved after the word
+ *				buf:	Scratch buffer twice as long as the line
+ *				tok:	Stores the word token (text is NULL if the word was
+ *						only an escaped newline)
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (unterminated quote or allocation error)
+ */
+static int lex_word(const char **src, char *buf, struct token *tok) {
+	const char *p = *src;
+	size_t len = 0;
+	char quote;
+	int status;
+
+	tok->type = TK_WORD;
+	tok->text = NULL;
+	tok->flags = 0;
+
+	// NAME=... sets a variable, unless the name is quoted
+	if ((len = var_name_len(p)) > 0 && p[len] == '=') {
+		tok->flags |= TF_ASSIGN;
+	}
+	len = 0;
+
+	while (*p != '\0' && strchr(" \t\n|&;<>()", *p) == NULL) {
+		switch (*p) {
+			case '\\':
+				if (p[1] == '\n') {			// Line continuation
+					p += 2;
+				} else if (p[1] != '\0') {
+					tok->flags |= TF_QUOTED;
+					buf[len++] = p[1];
+					p += 2;
+				} else {
+					++p;
+				}
+				break;
+			case '\'':
+			case '"':
+				tok->flags |= TF_QUOTED;
+				quote = *p++;
+				while (*p != quote) {
+					if (*p == '\0') {
+						unclosed(quote == '"' ? "\"" : "'");
+						pg_errno = EPARSE;
+						return -1;
+					}
+					// Inside double quotes backslash escapes only \ " $ ` newline
+					if (quote == '"' && *p == '\\' && strchr("\\\"$`\n", p[1]) != NULL
+						&& p[1] != '\0') {
+						if (p[1] != '\n') {
+							buf[len++] = p[1];
+						}
+						p += 2;
+					} else if (quote == '"' &&
+						(status = lex_expand(&p, buf, &len, 1)) != 0) {
+						if (status == -1) {
+							return -1;
+						}
+						tok->flags |= TF_EXPAND;
+					} else {
+						buf[len++] = *p++;
+					}
+				}
+				++p;	// Closing quote
+				break;
+			case '$':
+			case '`':
+				if ((status = lex_expand(&p, buf, &len, 0)) == -1) {
+					return -1;
+				} else if (status == 0) {		// A plain '$'
+					buf[len++] = *p++;
+				} else {
+					tok->flags |= TF_EXPAND;
+				}
+				break;
+			case '*':
+			case '?':
+			case '[':
+				buf[len++] = EXP_GLOB;		// Pattern, matched when it runs
+				buf[len++] = *p++;
+				tok->flags |= TF_EXPAND;
+				break;
+			default:
+				buf[len++] = *p++;
+				break;
+		}
+	}
+	*src = p;
+
+	if (len == 0 && !(tok->flags & TF_QUOTED)) {
+		return 0;		// Escaped newline, no word
+	}
+
+	buf[len] = '\0';
+	if ((tok->text = strdup(buf)) == NULL) {
+		perror("strdup");
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Description: Reads a process substitution, "<(list)" or ">(list)", keeping
+ *				the list as it was written. Parentheses are matched outside of
+ *				quotes, so lists may hold process substitutions themselves.
+ *
+ * Arguments:	src:	Position of the '<' or '>', moved after the ')'
+ *				tok:	Stores the text of the list
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 (unmatched parenthesis or allocation error)
+ */
+static int lex_procsub(const char **src, struct token *tok) {
+	const char *start = *src + 2;
+	const char *end;
+
+	if ((end = match_paren(start)) == NULL) {
+		return -1;
+	}
+	*src = end + 1;
+
+	if ((tok->text = strndup(start, end - start)) == NULL) {
+		perror("strndup");
+		return -1;
+	}
+	return 0;
+}
+
+/* Description: Reads an expansion and adds it to a word as a marker, its text
+ *				and EXP_END. The expansions are command substitutions, "$(list)"
+ *				and "`list`", parameters, "$NAME", "${...}" and the special
+ *				parameters "$?", "$$", "$#", "$!" and "$0" to "$9", and
+ *				arithmetic, "$((expression))". Inside backquotes a backslash
+ *				escapes only \\, ` and $.
+ *
+ * Arguments:	src:	Position of the '$' or '`', moved after the expansion
+ *				buf:	Word being read
+ *				len:	Length of the word, updated
+ *				quoted:	The expansion is inside double quotes
+ *
+ * Returns:		- If an expansion was read, 1
+ * 				- If there is none (a '$' that is just a character), 0
+ * 				- On failure, -1 (unterminated expansion)
+ *
+ * Notes:		A marked expansion is at most half as long again as its text
+ *				("$X" takes three bytes), so words fit in a buffer twice as
+ *				long as the line.
+ */
+static int lex_expand(const char **src, char *buf, size_t *len, int quoted) {
+	const char *p = *src;
+	const char *end;
+	char mark;
+	int closed = 0;		// The expansion ends with a ')' or '}'
+
+	// "$((expression))", unless the inner parenthesis closes before the end
+	if (*p == '$' && p[1] == '(' && p[2] == '(') {
+		if ((end = match_paren(p + 3)) == NULL) {
+			return -1;
+		}
+		if (end[1] == ')') {
+			buf[(*len)++] = EXP_ARITH;
+			memcpy(buf + *len, p + 3, end - p - 3);
+			*len += end - p - 3;
+			buf[(*len)++] = EXP_END;
+			*src = end + 2;
+			return 1;
+		}
+	}
+
+	if (*p == '$' && p[1] == '(') {
+		if ((end = match_paren(p + 2)) == NULL) {
+			return -1;
+		}
+		p += 2;
+		mark = quoted ? EXP_QSUB : EXP_SUB;
+		closed = 1;
+	} else if (*p == '$' && p[1] == '{') {
+		if ((end = strchr(p + 2, '}')) == NULL) {
+			unclosed("}");
+			pg_errno = EPARSE;
+			return -1;
+		}
+		p += 2;
+		mark = quoted ? EXP_QVAR : EXP_VAR;
+		closed = 1;
+	} else if (*p == '$' && (var_name_len(p + 1) > 0 ||
+		(p[1] != '\0' && strchr("?$#!@*0123456789", p[1]) != NULL))) {
+		++p;
+		end = p + ((*p >= '0' && *p <= '9') ? 1 : var_name_len(p));
+		end = (end == p) ? p + 1 : end;		// Special parameter
+		mark = quoted ? EXP_QVAR : EXP_VAR;
+	} else if (*p == '`') {
+		buf[(*len)++] = quoted ? EXP_QSUB : EXP_SUB;
+		for (end = p + 1; *end != '`'; ++end) {
+			if (*end == '\0') {
+				unclosed("`");
+				pg_errno = EPARSE;
+				return -1;
+			}
+			if (*end == '\\' && strchr("\\`$", end[1]) != NULL && end[1] != '\0') {
+				++end;
+			}
+			buf[(*len)++] = *end;
+		}
+		buf[(*len)++] = EXP_END;
+		*src = end + 1;
+		return 1;
+	} else {
+		return 0;
+	}
+
+	buf[(*len)++] = mark;
+	memcpy(buf + *len, p, end - p);
+	*len += end - p;
+	buf[(*len)++] = EXP_END;
+	*src = end + closed;
+
+	return 1;
+}
+
+/* Description: Reads the body of a here-document, the lines up to its
+ *				delimiter. Unless the delimiter was quoted, a backslash escapes
+ *				\\, $, ` and newline in the body and expansions are marked as
+ *				in double quotes.
+ *
+ * Arguments:	src:	Start of the body, moved after the delimiter line
+ *				buf:	Scratch buffer twice as long as the line
+ *				tok:	Delimiter word, its text is replaced with the body
+ *				strip:	Leading tabs are removed from the lines (<<-)
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to EHEREDOC if the line
+ *				  ends before the delimiter
+ */
+static int lex_heredoc(const char **src, char *buf, struct token *tok, int strip) {
+	const char *p = *src;
+	const char *end;
+	size_t len = 0, dlen, i;
+	int quoted = tok->flags & TF_QUOTED;
+	int status;
+	char *body;
+
+	// Glob characters of the delimiter are literal
+	for (i = 0, dlen = 0; tok->text[i] != '\0'; ++i) {
+		if (tok->text[i] != EXP_GLOB) {
+			tok->text[dlen++] = tok->text[i];
+		}
+	}
+	tok->text[dlen] = '\0';
+	tok->flags &= ~TF_EXPAND;
+
+	for (;;) {
+		if (*p == '\0') {
+			pg_errno = EHEREDOC;
+			return -1;
+		}
+		while (strip && *p == '\t') {
+			++p;
+		}
+		end = p + strcspn(p, "\n");
+		if ((size_t)(end - p) == dlen && strncmp(p, tok->text, dlen) == 0) {
+			p = (*end == '\n') ? end + 1 : end;
+			break;
+		}
+
+		while (p < end) {
+			if (quoted) {
+				buf[len++] = *p++;
+			} else if (*p == '\\' && strchr("\\$`\n", p[1]) != NULL) {
+				if (p[1] != '\n') {
+					buf[len++] = p[1];
+				}
+				p += 2;
+			} else if ((status = lex_expand(&p, buf, &len, 1)) != 0) {
+				if (status == -1) {
+					return -1;
+				}
+				tok->flags |= TF_EXPAND;
+			} else {
+				buf[len++] = *p++;
+			}
+		}
+		// A substitution may go on to the next lines
+		if (p == end && *p == '\n') {
+			buf[len++] = *p++;
+		}
+	}
+	*src = p;
+
+	buf[len] = '\0';
+	if ((body = strdup(buf)) == NULL) {
+		perror("strdup");
+		return -1;
+	}
+	free(tok->text);
+	tok->text = body;
+	return 0;
+}
+
+// Checks if token i is a here-document operator followed by its delimiter
+static int is_heredoc(const struct token *tokens, int i) {
+	return (tokens[i].type == TK_DLESS || tokens[i].type == TK_DLESSDASH) &&
+		tokens[i + 1].type == TK_WORD;
+}
+
+// Reports the end of the line inside a quote or an expansion
+static void unclosed(const char *what) {
+	if (!lex_quiet) {
+		fprintf(stderr, "pgsh: unexpected end of line while looking for "
+			"matching `%s'\n", what);
+	}
+}
+
+/* Description: Finds the parenthesis that closes a list. Parentheses are
+ *				matched outside of quotes, so lists may hold substitutions
+ *				themselves.
+ *
+ * Arguments:	p:	Start of the list, right after the opening parenthesis
+ *
+ * Returns:		- On success, the closing parenthesis
+ * 				- On failure, NULL and sets pg_errno to EPARSE
+ */
+static const char * match_paren(const char *p) {
+	int depth = 1;
+	char quote;
+
+	for (;;) {
+		switch (*p) {
+			case '\0':
+				unclosed(")");
+				pg_errno = EPARSE;
+				return NULL;
+			case '\\':
+				if (p[1] != '\0') {
+					++p;
+				}
+				break;
+			case '\'':
+			case '"':
+				quote = *p;
+				while (p[1] != '\0' && p[1] != quote) {
+					if (quote == '"' && p[1] == '\\' && p[2] != '\0') {
+						++p;
+					}
+					++p;
+				}
+				if (p[1] != '\0') {
+					++p;	// Closing quote
+				}
+				break;
+			case '(':
+				++depth;
+				break;
+			case ')':
+				if (--depth == 0) {
+					return p;
+				}
+				break;
+		}
+		++p;
+	}
+}
+
+/* Description: Appends a token to a growable tokens array.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int push_token(struct token **tokens, int *ntokens, int *cap,
+	enum TokenType type, char *text, int flags) {
+	struct token *tmp;
+
+	if (*ntokens == *cap) {
+		*cap = (*cap == 0) ? 16 : *cap * 2;
+		if ((tmp = (struct token *)realloc(*tokens, *cap * sizeof(struct token)))
+			== NULL) {
+			perror("realloc");
+			return -1;
+		}
+		*tokens = tmp;
+	}
+
+	(*tokens)[*ntokens].type = type;
+	(*tokens)[*ntokens].text = text;
+	(*tokens)[*ntokens].flags = flags;
+	++*ntokens;
+
+	return 0;
+}
+
+/* Description: Replaces the words of a line that name aliases, in the place
+ *				of a command name, with the tokens of their bodies.
+ *
+ * Arguments:	tokens:		Tokens of the line, replaced if an alias is found
+ *				ntokens:	Number of tokens, updated
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to EUNKNOWN (the tokens
+ *				  are left to the caller to free)
+ *
+ * Notes:		Lines without aliases are not copied. The texts of the tokens
+ *				of the line are moved and the ones of the bodies copied.
+ */
+static int splice_aliases(struct token **tokens, int *ntokens) {
+	struct splice sp = { NULL, 0, 0, 1, 0 };
+	struct token *tok;
+	struct alias *a;
+	int i, j, spliced = 0;
+
+	for (i = 0; i < *ntokens; ++i) {
+		tok = &(*tokens)[i];
+		if (tok->type != TK_EOF && (a = alias_at(&sp, tok, tok + 1)) != NULL) {
+			for (j = spliced ? i : 0; j < i; ++j) {
+				if (push_token(&sp.tokens, &sp.ntokens, &sp.cap, (*tokens)[j].type,
+					(*tokens)[j].text, (*tokens)[j].flags) == -1) {
+					goto fail;
+				}
+				(*tokens)[j].text = NULL;
+			}
+			free(tok->text);
+			tok->text = NULL;
+			spliced = 1;
+			if (splice_alias(&sp, a) == -1) {
+				goto fail;
+			}
+			continue;
+		}
+
+		splice_state(&sp, tok);
+		if (spliced) {
+			if (push_token(&sp.tokens, &sp.ntokens, &sp.cap, tok->type, tok->text,
+				tok->flags) == -1) {
+				goto fail;
+			}
+			tok->text = NULL;
+		}
+	}
+
+	if (spliced) {
+		tokens_free(*tokens, *ntokens);
+		*tokens = sp.tokens;
+		*ntokens = sp.ntokens;
+	}
+	return 0;
+
+fail:
+	tokens_free(sp.tokens, sp.ntokens);
+	pg_errno = EUNKNOWN;
+	return -1;
+}
+
+// Appends copies of the tokens of an alias body, splicing the aliases in it
+// but not the alias itself. Returns -1 on failure.
+static int splice_alias(struct splice *sp, struct alias *a) {
+	struct token *tok, *next;
+	struct alias *inner;
+	char *text;
+	int i, ret = 0;
+
+	++alias_splices;
+	a->active = 1;
+	for (i = 0; i < a->ntokens && ret == 0; ++i) {
+		tok = &a->tokens[i];
+		next = (i + 1 < a->ntokens) ? tok + 1 : NULL;
+		if ((inner = alias_at(sp, tok, next)) != NULL) {
+			ret = splice_alias(sp, inner);
+			continue;
+		}
+
+		text = NULL;
+		if (tok->text != NULL && (text = strdup(tok->text)) == NULL) {
+			perror("strdup");
+			ret = -1;
+		} else if (push_token(&sp->tokens, &sp->ntokens, &sp->cap, tok->type, text,
+			tok->flags) == -1) {
+			free(text);
+			ret = -1;
+		}
+		splice_state(sp, tok);
+	}
+	a->active = 0;
+
+	if (a->blank) {
+		sp->cmd = 1;		// "alias sudo='sudo '" checks the next word too
+	}
+	return ret;
+}
+
+// Returns the alias a token is spliced with, or NULL if it is not a plain word
+// in the place of a command name, names no alias or the alias is being
+// spliced. A word before '(' or ')' is a function name or a case pattern.
+static struct alias * alias_at(const struct splice *sp, const struct token *tok,
+	const struct token *next) {
+	struct alias *a;
+
+	if (!sp->cmd || sp->target || tok->type != TK_WORD ||
+		(tok->flags & (TF_QUOTED | TF_EXPAND | TF_ASSIGN)) ||
+		(next != NULL && (next->type == TK_LPAREN || next->type == TK_RPAREN)) ||
+		(a = alias_find(tok->text)) == NULL || a->active) {
+		return NULL;
+	}
+	return a;
+}
+
+// Moves the command name position past a token
+static void splice_state(struct splice *sp, const struct token *tok) {
+	int i;
+
+	if (tok->type == TK_WORD || tok->type == TK_PROCSUB) {
+		if (sp->target) {
+			sp->target = 0;
+		} else if (!sp->cmd || !(tok->flags & TF_ASSIGN)) {
+			for (i = 0; leaders[i] != NULL && (tok->type != TK_WORD ||
+				(tok->flags & (TF_QUOTED | TF_EXPAND)) ||
+				strcmp(tok->text, leaders[i]) != 0); ++i)
+				;
+			sp->cmd = (sp->cmd && leaders[i] != NULL);
+		}
+	} else if (tok->type >= TK_LESS && tok->type <= TK_TLESS) {
+		sp->target = 1;
+	} else if (tok->type == TK_LPAREN) {
+		sp->cmd = 0;
+	} else if (tok->type != TK_IONUMBER) {
+		sp->cmd = 1;		// An operator, the next word is a command
+		sp->target = 0;
+	}
+}
+
+/* Description: Parses the tokens of a whole line.
+ *
+ * Returns:		- On success, the root of the syntax tree
+ * 				- On failure, NULL (see parse_line)
+ */
+static struct node * parse_all(struct parser *ps) {
+	struct node *root;
+
+	skip_newlines(ps);
+	if (ps->tokens[ps->pos].type == TK_EOF) {
+		pg_errno = ENOTOKEN;
+		return NULL;
+	}
+
+	root = parse_list(ps);
+	if (root != NULL && ps->tokens[ps->pos].type != TK_EOF) {
+		syntax_error(ps);
+		node_free(root);
+		root = NULL;
+	}
+
+	return root;
+}
+
+/* Description: Parses a list of and-or lists separated by ';' or newlines.
+ *				The list ends at the end of the line, at a ';;' or at a
+ *				reserved word that closes a compound command.
+ *
+ * Returns:		- On success, the list node
+ * 				- On failure, NULL
+ */
+static struct node * parse_list(struct parser *ps) {
+	struct node *node, *right, *list;
+	enum TokenType type;
+
+	if ((node = parse_and_or(ps)) == NULL) {
+		return NULL;
+	}
+
+	while ((type = ps->tokens[ps->pos].type) == TK_SEMI || type == TK_NEWLINE) {
+		++ps->pos;
+		skip_newlines(ps);
+		if ((type = ps->tokens[ps->pos].type) == TK_EOF || type == TK_DSEMI ||
+			is_closer(ps)) {
+			break;		// Trailing separator
+		}
+
+		if ((right = parse_and_or(ps)) == NULL ||
+			(list = new_node(N_LIST, node, right)) == NULL) {
+			node_free(node);
+			node_free(right);
+			return NULL;
+		}
+		node = list;
+	}
+
+	return node;
+}
+
+/* Description: Parses pipelines connected with '&&' or '||'.
+ *
+ * Returns:		- On success, the and-or node
+ * 				- On failure, NULL
+ */
+static struct node * parse_and_or(struct parser *ps) {
+	struct node *node, *right, *andor;
+	enum TokenType type;
+
+	if ((node = parse_pipeline(ps)) == NULL) {
+		return NULL;
+	}
+
+	while ((type = ps->tokens[ps->pos].type) == TK_AND || type == TK_OR) {
+		++ps->pos;
+		skip_newlines(ps);
+
+		if ((right = parse_pipeline(ps)) == NULL ||
+			(andor = new_node(type == TK_AND ? N_AND : N_OR, node, right)) == NULL) {
+			node_free(node);
+			node_free(right);
+			return NULL;
+		}
+		node = andor;
+	}
+
+	return node;
+}
+
+/* Description: Parses commands connected with '|'. A compound command
+ *				connected to others becomes a command of its own (see
+ *				parse_stage), a function definition is not connected.
+ *
+ * Returns:		- On success, the pipeline node
+ * 				- On failure, NULL
+ */
+static struct node * parse_pipeline(struct parser *ps) {
+	struct node *node, *right, *pipe;
+	long size;			// Buffer size of a sized pipe
+
+	if ((node = parse_command(ps)) == NULL) {
+		return NULL;
+	}
+
+	while (ps->tokens[ps->pos].type == TK_PIPE) {
+		if (node->type == N_FUNC) {
+			syntax_error(ps);
+			node_free(node);
+			return NULL;
+		}
+		if (node->type != N_CMD && node->type != N_PIPE &&
+			(node = parse_stage(ps, node)) == NULL) {
+			return NULL;
+		}
+		size = 0;
+		if (ps->tokens[ps->pos].text != NULL &&
+			strtosize(ps->tokens[ps->pos].text, &size) == -1) {
+			if (!ps->quiet) {
+				fprintf(stderr, "pgsh: %s: invalid pipe size\n",
+					ps->tokens[ps->pos].text);
+			}
+			pg_errno = ESYNTAX;
+			node_free(node);
+			return NULL;
+		}
+		++ps->pos;
+		skip_newlines(ps);
+
+		if ((right = parse_command(ps)) == NULL) {
+			node_free(node);
+			return NULL;
+		}
+		if (right->type == N_FUNC) {
+			syntax_error(ps);
+			node_free(node);
+			node_free(right);
+			return NULL;
+		}
+		if ((right->type != N_CMD && right->type != N_PIPE &&
+			(right = parse_stage(ps, right)) == NULL) ||
+			(pipe = new_node(N_PIPE, node, right)) == NULL) {
+			node_free(node);
+			node_free(right);
+			return NULL;
+		}
+		pipe->pipesize = size;
+		node = pipe;
+	}
+
+	return node;
+}
+
+/* Description: Parses a simple command, its words and redirections, or a
+ *				compound command and the redirections that follow it.
+ *
+ * Returns:		- On success, the command node
+ * 				- On failure, NULL
+ */
+static struct node * parse_command(struct parser *ps) {
+	struct node *node;
+	struct token *tok = &ps->tokens[ps->pos];
+	void *tmp;
+	int wcap = 0, rcap = 0, acap = 0;
+
+	if (is_compound(ps)) {
+		if (is_word(ps, "if")) {
+			node = parse_if(ps);
+		} else if (is_word(ps, "while")) {
+			node = parse_loop(ps, N_WHILE);
+		} else if (is_word(ps, "until")) {
+			node = parse_loop(ps, N_UNTIL);
+		} else if (is_word(ps, "for")) {
+			node = parse_for(ps);
+		} else if (is_word(ps, "case")) {
+			node = parse_case(ps);
+		} else {		// "{"
+			++ps->pos;
+			if ((node = parse_block(ps)) != NULL && expect(ps, "}") == -1) {
+				node_free(node);
+				return NULL;
+			}
+		}
+		tok = &ps->tokens[ps->pos];
+		if (node != NULL && (tok->type == TK_IONUMBER ||
+			(tok->type >= TK_LESS && tok->type <= TK_TLESS))) {
+			node = parse_stage(ps, node);
+		}
+		return node;
+	} else if (tok->type == TK_WORD && !(tok->flags & (TF_QUOTED | TF_EXPAND)) &&
+		tok[1].type == TK_LPAREN && tok[2].type == TK_RPAREN) {
+		return parse_func(ps);
+	} else if (is_closer(ps)) {
+		syntax_error(ps);
+		return NULL;
+	}
+
+	if ((node = new_node(N_CMD, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+
+	for (;;) {
+		tok = &ps->tokens[ps->pos];
+
+		if (tok->type == TK_WORD && (tok->flags & TF_ASSIGN) && node->nwords == 0) {
+			// Leading NAME=VALUE words, kept apart from the command words
+			if (node->nassigns == acap) {
+				acap = (acap == 0) ? 4 : acap * 2;
+				if ((tmp = realloc(node->assigns, acap * sizeof(char *))) == NULL) {
+					perror("realloc");
+					node_free(node);
+					return NULL;
+				}
+				node->assigns = (char **)tmp;
+			}
+			if (tok->flags & TF_EXPAND) {
+				node->expand = 1;
+			}
+			node->assigns[node->nassigns++] = tok->text;	// Take over the text
+			tok->text = NULL;
+			++ps->pos;
+
+		} else if (tok->type == TK_WORD || tok->type == TK_PROCSUB) {
+			if ((tok->type == TK_PROCSUB &&
+				add_procsub(node, node->nwords, -1, tok->flags & TF_OUTPUT) == -1) ||
+				add_word(node, tok, &wcap) == -1) {
+				node_free(node);
+				return NULL;
+			}
+			++ps->pos;
+
+		} else if (tok->type == TK_IONUMBER ||
+			(tok->type >= TK_LESS && tok->type <= TK_TLESS)) {
+			if (parse_redirect(ps, node, &rcap) == -1) {
+				node_free(node);
+				return NULL;
+			}
+
+		} else {
+			break;
+		}
+	}
+
+	if (node->nwords == 0 && node->nredirs == 0 && node->nassigns == 0) {
+		unexpected(ps);
+		node_free(node);
+		return NULL;
+	}
+
+	return node;
+}
+
+/* Description: Makes a compound command a command without words, with the
+ *				compound command as its left node, so it can be a stage of a
+ *				pipeline. Adds the redirections that follow it.
+ *
+ * Arguments:	body:	Compound command, freed on failure
+ *
+ * Returns:		- On success, the command node
+ * 				- On failure, NULL
+ */
+static struct node * parse_stage(struct parser *ps, struct node *body) {
+	struct node *node;
+	struct token *tok;
+	int rcap = 0;
+
+	if ((node = new_node(N_CMD, body, NULL)) == NULL) {
+		node_free(body);
+		return NULL;
+	}
+
+	for (;;) {
+		tok = &ps->tokens[ps->pos];
+		if (tok->type != TK_IONUMBER &&
+			(tok->type < TK_LESS || tok->type > TK_TLESS)) {
+			break;
+		}
+		if (parse_redirect(ps, node, &rcap) == -1) {
+			node_free(node);
+			return NULL;
+		}
+	}
+
+	return node;
+}
+
+/* Description: Parses an if command, or the rest of one from an elif on.
+ *
+ * Returns:		- On success, the N_IF node
+ * 				- On failure, NULL
+ */
+static struct node * parse_if(struct parser *ps) {
+	struct node *node;
+
+	++ps->pos;		// "if" or "elif"
+	if ((node = new_node(N_IF, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+
+	if ((node->left = parse_block(ps)) == NULL || expect(ps, "then") == -1 ||
+		(node->right = parse_block(ps)) == NULL) {
+		node_free(node);
+		return NULL;
+	}
+
+	if (is_word(ps, "elif")) {		// Ends with the same fi
+		if ((node->other = parse_if(ps)) == NULL) {
+			node_free(node);
+			return NULL;
+		}
+		return node;
+	}
+
+	if (is_word(ps, "else")) {
+		++ps->pos;
+		if ((node->other = parse_block(ps)) == NULL) {
+			node_free(node);
+			return NULL;
+		}
+	}
+
+	if (expect(ps, "fi") == -1) {
+		node_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+/* Description: Parses a while or until loop.
+ *
+ * Returns:		- On success, the loop node
+ * 				- On failure, NULL
+ */
+static struct node * parse_loop(struct parser *ps, enum NodeType type) {
+	struct node *node;
+
+	++ps->pos;		// "while" or "until"
+	if ((node = new_node(type, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+
+	if ((node->left = parse_block(ps)) == NULL ||
+		(node->right = parse_do(ps)) == NULL) {
+		node_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+/* Description: Parses a for loop. The name of the variable is the first word
+ *				of the node and the words of the list follow it. Without a
+ *				list the loop goes over the positional parameters, "$@".
+ *
+ * Returns:		- On success, the N_FOR node
+ * 				- On failure, NULL
+ */
+static struct node * parse_for(struct parser *ps) {
+	static const char all[] = { EXP_QVAR, '@', EXP_END, '\0' };
+	struct node *node;
+	struct token *tok, params;
+	enum TokenType type;
+	int wcap = 0;
+
+	++ps->pos;		// "for"
+	tok = &ps->tokens[ps->pos];
+	if (tok->type != TK_WORD || (tok->flags & (TF_QUOTED | TF_EXPAND)) ||
+		var_name_len(tok->text) != strlen(tok->text)) {
+		unexpected(ps);
+		return NULL;
+	}
+	if ((node = new_node(N_FOR, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+	if (add_word(node, tok, &wcap) == -1) {
+		node_free(node);
+		return NULL;
+	}
+	++ps->pos;
+	skip_newlines(ps);
+
+	if (is_word(ps, "in")) {
+		for (++ps->pos; ps->tokens[ps->pos].type == TK_WORD; ++ps->pos) {
+			if (add_word(node, &ps->tokens[ps->pos], &wcap) == -1) {
+				node_free(node);
+				return NULL;
+			}
+		}
+		if ((type = ps->tokens[ps->pos].type) != TK_SEMI && type != TK_NEWLINE) {
+			unexpected(ps);
+			node_free(node);
+			return NULL;
+		}
+		++ps->pos;
+	} else {
+		params.flags = TF_EXPAND;
+		if ((params.text = strdup(all)) == NULL || add_word(node, &params, &wcap) == -1) {
+			free(params.text);
+			node_free(node);
+			return NULL;
+		}
+		if (ps->tokens[ps->pos].type == TK_SEMI) {
+			++ps->pos;
+		}
+	}
+
+	if ((node->right = parse_do(ps)) == NULL) {
+		node_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+/* Description: Parses a case command. The word is the first word of the
+ *				node, and every item is an N_ITEM node with its patterns as
+ *				words and its list, if any, on the right.
+ *
+ * Returns:		- On success, the N_CASE node
+ * 				- On failure, NULL
+ */
+static struct node * parse_case(struct parser *ps) {
+	struct node *node, *item, **next;
+	struct token *tok;
+	int wcap = 0;
+
+	++ps->pos;		// "case"
+	tok = &ps->tokens[ps->pos];
+	if (tok->type != TK_WORD) {
+		unexpected(ps);
+		return NULL;
+	}
+	if ((node = new_node(N_CASE, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+	if (add_word(node, tok, &wcap) == -1) {
+		node_free(node);
+		return NULL;
+	}
+	++ps->pos;
+	skip_newlines(ps);
+	if (expect(ps, "in") == -1) {
+		node_free(node);
+		return NULL;
+	}
+	skip_newlines(ps);
+
+	for (next = &node->other; !is_word(ps, "esac"); next = &item->other) {
+		if ((item = *next = new_node(N_ITEM, NULL, NULL)) == NULL) {
+			node_free(node);
+			return NULL;
+		}
+		if (ps->tokens[ps->pos].type == TK_LPAREN) {
+			++ps->pos;
+		}
+
+		// Patterns, separated by plain '|'
+		for (wcap = 0; ; ++ps->pos) {
+			tok = &ps->tokens[ps->pos];
+			if (tok->type != TK_WORD) {
+				unexpected(ps);
+				node_free(node);
+				return NULL;
+			}
+			if (add_word(item, tok, &wcap) == -1) {
+				node_free(node);
+				return NULL;
+			}
+			if (tok[1].type != TK_PIPE || tok[1].text != NULL) {
+				break;
+			}
+			++ps->pos;
+		}
+		++ps->pos;
+		if (ps->tokens[ps->pos].type != TK_RPAREN) {
+			unexpected(ps);
+			node_free(node);
+			return NULL;
+		}
+		++ps->pos;
+		skip_newlines(ps);
+
+		if (ps->tokens[ps->pos].type != TK_DSEMI && !is_word(ps, "esac") &&
+			(item->right = parse_list(ps)) == NULL) {
+			node_free(node);
+			return NULL;
+		}
+		if (ps->tokens[ps->pos].type == TK_DSEMI) {
+			++ps->pos;
+			skip_newlines(ps);
+		} else if (!is_word(ps, "esac")) {
+			unexpected(ps);
+			node_free(node);
+			return NULL;
+		}
+	}
+	++ps->pos;		// "esac"
+
+	return node;
+}
+
+/* Description: Parses a function definition, "name() compound".
+ *
+ * Returns:		- On success, the N_FUNC node
+ * 				- On failure, NULL
+ */
+static struct node * parse_func(struct parser *ps) {
+	struct node *node;
+	int wcap = 0;
+
+	if ((node = new_node(N_FUNC, NULL, NULL)) == NULL) {
+		return NULL;
+	}
+	if (add_word(node, &ps->tokens[ps->pos], &wcap) == -1) {
+		node_free(node);
+		return NULL;
+	}
+	ps->pos += 3;		// name ( )
+	skip_newlines(ps);
+
+	if (!is_compound(ps)) {
+		unexpected(ps);
+		node_free(node);
+		return NULL;
+	}
+	if ((node->right = parse_command(ps)) == NULL) {
+		node_free(node);
+		return NULL;
+	}
+	return node;
+}
+
+// Parses the list of a compound command, which may start on a new line
+static struct node * parse_block(struct parser *ps) {
+	skip_newlines(ps);
+	return parse_list(ps);
+}
+
+// Parses "do list done", the body of a loop
+static struct node * parse_do(struct parser *ps) {
+	struct node *body;
+
+	skip_newlines(ps);
+	if (expect(ps, "do") == -1 || (body = parse_block(ps)) == NULL) {
+		return NULL;
+	}
+	if (expect(ps, "done") == -1) {
+		node_free(body);
+		return NULL;
+	}
+	return body;
+}
+
+/* Description: Parses a redirection and adds it to a command. '&>' and '>&'
+ *				followed by a filename add two redirections, stdout to the file
+ *				and stderr to stdout.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int parse_redirect(struct parser *ps, struct node *node, int *rcap) {
+	struct token *tok = &ps->tokens[ps->pos];
+	struct redirection *r;
+	const char *word;
+	void *tmp;
+	long num;
+	int fd = -1;		// Descriptor written before the operator
+	int both = 0;		// Redirect both stdout and stderr
+
+	if (tok->type == TK_IONUMBER) {
+		num = strtol(tok->text, NULL, 10);
+		fd = (num > INT_MAX) ? INT_MAX : (int)num;	// Range checked by the plan
+		++tok;
+		++ps->pos;
+	}
+
+	if (tok->type == TK_IONUMBER || tok->type < TK_LESS || tok->type > TK_TLESS ||
+		(tok[1].type != TK_WORD && tok[1].type != TK_PROCSUB)) {
+		++ps->pos;
+		syntax_error(ps);
+		return -1;
+	}
+	word = tok[1].text;
+
+	if (node->nredirs + 2 > *rcap) {
+		*rcap = (*rcap == 0) ? 4 : *rcap * 2;
+		if ((tmp = realloc(node->redirs, *rcap * sizeof(struct redirection)))
+			== NULL) {
+			perror("realloc");
+			return -1;
+		}
+		node->redirs = (struct redirection *)tmp;
+	}
+
+	r = &node->redirs[node->nredirs];
+	r->src = -1;
+	r->target = NULL;
+
+	// Only a file name can be a process substitution
+	if (tok[1].type == TK_PROCSUB) {
+		if (tok->type == TK_LESSAND || tok->type == TK_GREATAND ||
+			tok->type >= TK_DLESS ||
+			add_procsub(node, -1, node->nredirs, tok[1].flags & TF_OUTPUT) == -1) {
+			++ps->pos;
+			syntax_error(ps);
+			return -1;
+		}
+	}
+
+	switch (tok->type) {
+		case TK_LESS:
+			r->type = REDIN;
+			r->fd = (fd == -1) ? 0 : fd;
+			break;
+		case TK_GREAT:
+			r->type = REDOUT;
+			r->fd = (fd == -1) ? 1 : fd;
+			break;
+		case TK_DGREAT:
+			r->type = REDOUTA;
+			r->fd = (fd == -1) ? 1 : fd;
+			break;
+		case TK_LESSGREAT:
+			r->type = REDRW;
+			r->fd = (fd == -1) ? 0 : fd;
+			break;
+		case TK_LESSAND:
+		case TK_GREATAND:
+			r->fd = (fd != -1) ? fd : (tok->type == TK_LESSAND) ? 0 : 1;
+			if (strcmp(word, "-") == 0) {
+				r->type = REDCLOSE;
+			} else if (word[0] != '\0' && word[strspn(word, "0123456789")] == '\0') {
+				r->type = REDDUP;
+				num = strtol(word, NULL, 10);
+				r->src = (num > INT_MAX) ? INT_MAX : (int)num;
+			} else if (tok->type == TK_GREATAND && fd == -1) {
+				r->type = REDOUT;		// >&file is the same as &>file
+				both = 1;
+			} else {
+				fprintf(stderr, "pgsh: %s: ambiguous redirect\n", word);
+				pg_errno = ESYNTAX;
+				return -1;
+			}
+			break;
+		case TK_ANDGREAT:
+		case TK_ANDDGREAT:
+			r->type = (tok->type == TK_ANDGREAT) ? REDOUT : REDOUTA;
+			r->fd = 1;
+			both = 1;
+			break;
+		case TK_DLESS:		// The lexer replaced the delimiter with the body
+		case TK_DLESSDASH:
+			r->type = REDHERE;
+			r->fd = (fd == -1) ? 0 : fd;
+			break;
+		case TK_TLESS:		// The word is a line of input
+			r->type = REDHERE;
+			r->fd = (fd == -1) ? 0 : fd;
+			if ((tmp = realloc(tok[1].text, strlen(tok[1].text) + 2)) == NULL) {
+				perror("realloc");
+				return -1;
+			}
+			tok[1].text = strcat((char *)tmp, "\n");
+			break;
+		default:
+			break;
+	}
+
+	if (r->type != REDDUP && r->type != REDCLOSE) {
+		if (tok[1].flags & TF_EXPAND) {
+			node->expand = 1;
+		}
+		r->target = tok[1].text;	// Take over the text
+		tok[1].text = NULL;
+	}
+	++node->nredirs;
+
+	if (both) {
+		++r;
+		r->type = REDDUP;
+		r->fd = 2;
+		r->src = 1;
+		r->target = NULL;
+		++node->nredirs;
+	}
+
+	ps->pos += 2;
+	return 0;
+}
+
+/* Description: Adds a process substitution to a command.
+ *
+ * Arguments:	node:	Command
+ *				word:	Index of the word it is, or -1
+ *				redir:	Index of the redirection it is the target of, or -1
+ *				output:	It is a >(list)
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int add_procsub(struct node *node, int word, int redir, int output) {
+	struct procsub *tmp;
+
+	tmp = (struct procsub *)realloc(node->psubs,
+		(node->npsubs + 1) * sizeof(struct procsub));
+	if (tmp == NULL) {
+		perror("realloc");
+		return -1;
+	}
+	node->psubs = tmp;
+
+	tmp[node->npsubs].word = word;
+	tmp[node->npsubs].redir = redir;
+	tmp[node->npsubs].output = output != 0;
+	++node->npsubs;
+
+	return 0;
+}
+
+/* Description: Allocates a syntax tree node.
+ *
+ * Returns:		- On success, the new node
+ * 				- On failure, NULL
+ */
+static struct node * new_node(enum NodeType type, struct node *left,
+	struct node *right) {
+	struct node *node;
+
+	if ((node = (struct node *)calloc(1, sizeof(struct node))) == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+
+	node->type = type;
+	node->left = left;
+	node->right = right;
+
+	return node;
+}
+
+// Adds a word to a node, taking over the text of its token. Returns -1 on
+// failure.
+static int add_word(struct node *node, struct token *tok, int *wcap) {
+	void *tmp;
+
+	if (node->nwords + 1 >= *wcap) {
+		*wcap = (*wcap == 0) ? 8 : *wcap * 2;
+		if ((tmp = realloc(node->words, *wcap * sizeof(char *))) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		node->words = (char **)tmp;
+	}
+	if (tok->flags & TF_EXPAND) {
+		node->expand = 1;
+	}
+	node->words[node->nwords++] = tok->text;
+	node->words[node->nwords] = NULL;
+	tok->text = NULL;
+
+	return 0;
+}
+
+// Checks if the current token is the reserved word, unquoted
+static int is_word(const struct parser *ps, const char *word) {
+	const struct token *tok = &ps->tokens[ps->pos];
+
+	return tok->type == TK_WORD && !(tok->flags & (TF_QUOTED | TF_EXPAND)) &&
+		strcmp(tok->text, word) == 0;
+}
+
+// Checks if the current token is a reserved word that ends a list
+static int is_closer(const struct parser *ps) {
+	int i;
+
+	for (i = 0; closers[i] != NULL && !is_word(ps, closers[i]); ++i)
+		;
+	return closers[i] != NULL;
+}
+
+// Checks if the current token is a reserved word that starts a compound command
+static int is_compound(const struct parser *ps) {
+	int i;
+
+	for (i = 0; openers[i] != NULL && !is_word(ps, openers[i]); ++i)
+		;
+	return openers[i] != NULL;
+}
+
+// Moves past a reserved word, or reports that it is missing. Returns -1 if
+// it is missing.
+static int expect(struct parser *ps, const char *word) {
+	if (!is_word(ps, word)) {
+		unexpected(ps);
+		return -1;
+	}
+	++ps->pos;
+	return 0;
+}
+
+// Skips newline tokens
+static void skip_newlines(struct parser *ps) {
+	while (ps->tokens[ps->pos].type == TK_NEWLINE) {
+		++ps->pos;
+	}
+}
+
+// Reports a syntax error at the current token
+static void syntax_error(struct parser *ps) {
+	struct token *tok = &ps->tokens[ps->pos];
+
+	pg_errno = ESYNTAX;
+	if (ps->quiet) {
+		return;
+	} else if (tok->type == TK_WORD) {
+		fprintf(stderr, "pgsh: syntax error near unexpected word `%s'\n", tok->text);
+	} else {
+		fprintf(stderr, "pgsh: syntax error near unexpected token `%s'\n",
+			token_names[tok->type]);
+	}
+}
+
+// Reports a syntax error at the current token, or only sets EINCOMPLETE if
+// the line ended where a command or a reserved word must follow, so that
+// more lines may complete it
+static void unexpected(struct parser *ps) {
+	if (ps->tokens[ps->pos].type == TK_EOF) {
+		pg_errno = EINCOMPLETE;
+		return;
+	}
+	syntax_error(ps);
+}
+
+// Returns the length of the size of a sized pipe "|{size}", or 0 if p does not
+// start with a size and a closing brace
+static size_t pipe_size_len(const char *p) {
+	size_t len = strspn(p, "0123456789");
+
+	if (len == 0) {
+		return 0;
+	}
+	if (p[len] != '\0' && strchr("kKmMgG", p[len]) != NULL) {
+		++len;
+	}
+	return (p[len] == '}') ? len : 0;
+}
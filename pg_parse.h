@@ -0,0 +1,129 @@
+#ifndef PG_PARSE_H
+#define PG_PARSE_H
+
+// Enumerations
+
+enum RedirectType {
+	REDIN,		// Input redirection
+	REDOUT,		// Output redirection
+	REDOUTA,	// Output redirection with append
+	REDRW,		// Read and write redirection
+	REDDUP,		// Copy of another descriptor
+	REDCLOSE,	// Closed descriptor
+	REDHERE		// Here-document or here-string, the target is the text
+};
+
+enum TokenType {
+	TK_WORD,	// Word (command name, argument or filename)
+	TK_PIPE,	// | (text is the size of a sized pipe "|{1M}", or NULL)
+	TK_AND,		// &&
+	TK_OR,		// ||
+	TK_SEMI,	// ;
+	TK_DSEMI,	// ;; (end of a case item)
+	TK_NEWLINE,	// End of line
+	TK_LESS,	// <
+	TK_GREAT,	// >
+	TK_DGREAT,	// >>
+	TK_LESSGREAT,	// <>
+	TK_LESSAND,		// <&
+	TK_GREATAND,	// >&
+	TK_ANDGREAT,	// &>
+	TK_ANDDGREAT,	// &>>
+	TK_DLESS,		// << (here-document)
+	TK_DLESSDASH,	// <<- (here-document, leading tabs removed)
+	TK_TLESS,		// <<< (here-string)
+	TK_IONUMBER,	// Descriptor number just before a redirection operator
+	TK_PROCSUB,		// <(list) or >(list) (text is the list)
+	TK_AMP,		// & (not supported)
+	TK_LPAREN,	// ( (function definitions and case patterns only)
+	TK_RPAREN,	// ) (function definitions and case patterns only)
+	TK_EOF		// End of input
+};
+
+enum NodeType {
+	N_LIST,		// left ; right
+	N_AND,		// left && right
+	N_OR,		// left || right
+	N_PIPE,		// left | right
+	N_CMD,		// Simple command, or a compound command (left) with redirections
+				// or in a pipeline
+	N_IF,		// if left; then right; else other; fi (other is an N_IF for elif)
+	N_WHILE,	// while left; do right; done
+	N_UNTIL,	// until left; do right; done
+	N_FOR,		// for words[0] in words[1]...; do right; done
+	N_CASE,		// case words[0] in items... esac, the first item is other
+	N_ITEM,		// Case item "words...) right ;;", the next item is other
+	N_FUNC		// Function words[0], the body is right
+};
+
+// Token flags
+#define TF_QUOTED	0x01	// Word contained quotes or escapes
+#define TF_OUTPUT	0x02	// Process substitution >(list)
+#define TF_EXPAND	0x04	// Word holds expansions
+#define TF_ASSIGN	0x08	// Word starts with NAME=
+
+// Markers of the expansions of a word, kept as text between a start marker and
+// EXP_END and expanded when the command runs: command substitutions, "$(list)"
+// or "`list`", parameters, "$NAME" or "${NAME...}" (the text is NAME...), and
+// arithmetic, "$((expression))"
+#define EXP_SUB		'\001'	// Start of an unquoted list, its output is split
+#define EXP_QSUB	'\002'	// Start of a list in double quotes, not split
+#define EXP_END		'\003'	// End of the expansion
+#define EXP_VAR		'\004'	// Start of an unquoted parameter, its value is split
+#define EXP_QVAR	'\005'	// Start of a parameter in double quotes, not split
+#define EXP_GLOB	'\006'	// Before an unquoted *, ? or [ of a word, a pattern
+#define EXP_ARITH	'\007'	// Start of an arithmetic expression, "$((...))"
+#define EXP_MARKS	"\001\002\004\005\007"			// Start of an expansion
+#define EXP_ANY		"\001\002\004\005\006\007"		// Anything to expand
+
+// Lexical token
+struct token {
+	enum TokenType type;
+	char *text;			// Word with quotes removed (NULL for operators)
+	int flags;			// Token flags
+};
+
+// Redirection of a simple command
+struct redirection {
+	enum RedirectType type;
+	int fd;				// Redirected file descriptor
+	int src;			// Copied file descriptor (REDDUP)
+	char *target;		// Filename or text (NULL for REDDUP and REDCLOSE)
+};
+
+// Process substitution of a simple command. The word or redirection target
+// it replaces holds the text of its list.
+struct procsub {
+	int word;			// Index of the word, or -1
+	int redir;			// Index of the redirection, or -1
+	int output;			// >(list), the command writes to the list
+};
+
+// Abstract syntax tree node
+struct node {
+	enum NodeType type;
+	struct node *left;		// Left operand, or condition of a compound command
+	struct node *right;		// Right operand, or body of a compound command
+	struct node *other;		// Else part (N_IF), next item (N_CASE, N_ITEM)
+	char **words;			// Command words, NULL terminated (N_CMD), or the
+							// words of a compound command (see NodeType)
+	int nwords;				// Number of words
+	struct redirection *redirs;	// Redirections (N_CMD)
+	int nredirs;				// Number of redirections (N_CMD)
+	struct procsub *psubs;		// Process substitutions (N_CMD)
+	int npsubs;					// Number of process substitutions (N_CMD)
+	char **assigns;				// Variable assignments, NAME=VALUE (N_CMD)
+	int nassigns;				// Number of assignments (N_CMD)
+	int expand;					// Words or targets to expand (N_CMD)
+	long pipesize;				// Pipe buffer size, 0 for the default (N_PIPE)
+};
+
+// Function Prototypes
+
+struct token * lex_line(const char *line, int *ntokens);
+void tokens_free(struct token *tokens, int ntokens);
+int line_open(const char *line);
+struct node * parse_line(const char *line);
+void node_free(struct node *node);
+
+#endif
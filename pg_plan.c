@@ -0,0 +1,973 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Compiles syntax trees to flat execution plans. A plan is a single memory block
+ * holding the pipelines, commands, argument vectors and strings of a command line
+ * plus a short list of instructions that runs the pipelines and implements '&&'
+ * and '||'. Plans do not point to the syntax tree, so they are kept in a small
+ * cache keyed by the command line text and run again without parsing.
+ * Compound commands are lowered to the same instructions, so the body of a loop
+ * is never lexed or parsed again while it runs: conditions are jumps on the
+ * last status, loops and case commands open frames while they run, and break
+ * and continue are jumps that close the frames inside their loop. The body of
+ * a function stays in the plan that defines it, which is held while the
+ * function is defined.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include "pg_error.h"
+#include "pg_parse.h"
+#include "pg_plan.h"
+#include "pg_stat.h"
+
+#define PLAN_CACHE_SIZE	32		// Number of cached plans
+
+// Cached plan
+struct cache_entry {
+	char *line;				// Command line (NULL if the entry is empty)
+	unsigned long hash;		// Hash of the command line
+	struct plan *plan;		// Compiled plan
+	int busy;				// Number of plan_get calls not yet put back
+	unsigned long used;		// Last use tick
+};
+
+// Loop being emitted, the target of its break and continue commands
+struct loop {
+	struct loop *outer;
+	int depth;			// Frames open outside the loop
+	int breaks;			// OP_BREAK to the end, chained through arg (-1 ends)
+	int conts;			// OP_BREAK to OP_AGAIN, chained through arg (-1 ends)
+};
+
+// Scope of the instructions being emitted
+struct scope {
+	struct loop *loop;	// Innermost loop, NULL outside loops
+	int depth;			// Frames open
+};
+
+static struct cache_entry cache[PLAN_CACHE_SIZE];
+static unsigned long tick;
+
+// Static Function Prototypes //
+static void measure(const struct node *node, struct plan *sz);
+static void measure_cmds(const struct node *node, struct plan *sz);
+static void emit(const struct node *node, struct plan *plan, struct scope *sc);
+static void emit_loop(const struct node *node, struct plan *plan,
+	struct scope *sc);
+static void emit_case(const struct node *node, struct plan *plan,
+	struct scope *sc);
+static void emit_jump(const struct node *node, struct plan *plan,
+	struct scope *sc, int kind);
+static void emit_bodies(const struct node *node, struct plan *plan,
+	struct plan_cmd **cmd);
+static int emit_insn(struct plan *plan, enum PlanOp op, int arg, int aux);
+static int emit_pipe(const struct node *node, struct plan *plan);
+static void emit_cmds(const struct node *node, struct plan *plan,
+	struct plan_pipe *pipe);
+static void patch(struct plan *plan, int chain, int target);
+static int jump_cmd(const struct node *node);
+static char * add_string(struct plan *plan, const char *str);
+static unsigned long hash_line(const char *line);
+static void * rebase(const void *p, uintptr_t from, char *to);
+static int in_block(const struct plan *plan, const void *p, size_t n, size_t elem);
+static int in_array(const void *p, long n, const void *base, size_t nbase, size_t elem);
+static int insn_ok(const struct plan *plan, const struct plan_insn *insn);
+static int marks_ok(const char *word);
+
+/* Description: Compiles a syntax tree to an execution plan.
+ *
+ * Arguments:	ast:	Root of the syntax tree
+ *
+ * Returns:		- On success, the plan
+ * 				- On failure, NULL and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *						# EREDIR: A command has an invalid redirection
+ *
+ * Notes:		The plan is a single allocation and must be freed with plan_free.
+ *				The syntax tree is not needed by the plan and can be freed.
+ */
+struct plan * plan_compile(const struct node *ast) {
+	struct plan sz;		// Sizes of the plan's arrays
+	struct plan *plan;
+	struct scope sc = { NULL, 0 };
+	char *block;
+	int i;
+
+	if (ast == NULL) {
+		pg_errno = ENULL;
+		return NULL;
+	}
+
+	// First pass, measure the tree
+	memset(&sz, 0, sizeof(struct plan));
+	sz.ncode = 1;		// OP_END
+	measure(ast, &sz);
+
+	// Pointer aligned arrays first, strings last
+	sz.size = sizeof(struct plan) +
+		sz.ncmds * sizeof(struct plan_cmd) +
+		sz.npipes * sizeof(struct plan_pipe) +
+		sz.nredirs * sizeof(struct fd_op) +
+		sz.nargs * sizeof(char *) +
+		sz.ncode * sizeof(struct plan_insn) +
+		sz.npsubs * sizeof(struct procsub) +
+		sz.strsize;
+
+	if ((block = (char *)malloc(sz.size)) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+
+	plan = (struct plan *)block;
+	memset(plan, 0, sizeof(struct plan));
+	plan->size = sz.size;
+	block += sizeof(struct plan);
+	plan->cmds = (struct plan_cmd *)block;
+	block += sz.ncmds * sizeof(struct plan_cmd);
+	plan->pipes = (struct plan_pipe *)block;
+	block += sz.npipes * sizeof(struct plan_pipe);
+	plan->redirs = (struct fd_op *)block;
+	block += sz.nredirs * sizeof(struct fd_op);
+	plan->args = (char **)block;
+	block += sz.nargs * sizeof(char *);
+	plan->code = (struct plan_insn *)block;
+	block += sz.ncode * sizeof(struct plan_insn);
+	plan->psubs = (struct procsub *)block;
+	block += sz.npsubs * sizeof(struct procsub);
+	plan->strings = block;
+
+	// Second pass, fill the plan
+	emit(ast, plan, &sc);
+	emit_insn(plan, OP_END, 0, 0);
+
+	// Redirections are checked once here and not every time they are applied
+	for (i = 0; i < plan->ncmds; ++i) {
+		if (fd_validate(plan->cmds[i].redirs, plan->cmds[i].nredirs) == -1) {
+			plan_free(plan);
+			return NULL;
+		}
+	}
+
+	return plan;
+}
+
+/* Description: Returns the plan of a command line, parsing and compiling it only
+ *				if it is not already cached.
+ *
+ * Arguments:	line:	Command line
+ *
+ * Returns:		- On success, the plan
+ * 				- On failure, NULL and sets pg_errno as parse_line does
+ *
+ * Notes:		The plan belongs to the cache and must be given back with
+ *				plan_put once it is not used any more.
+ */
+struct plan * plan_get(const char *line) {
+	struct cache_entry *entry, *victim = NULL;
+	struct node *ast;
+	struct plan *plan;
+	unsigned long hash;
+	int i;
+	STAT_VAR(t);
+
+	if (line == NULL) {
+		pg_errno = ENULL;
+		return NULL;
+	}
+
+	hash = hash_line(line);
+	for (i = 0; i < PLAN_CACHE_SIZE; ++i) {
+		entry = &cache[i];
+		if (entry->line != NULL && entry->hash == hash &&
+			strcmp(entry->line, line) == 0) {
+			entry->used = ++tick;
+			++entry->busy;
+			return entry->plan;
+		}
+		// Empty entry, or else the least recently used one that is not running
+		if (victim == NULL || victim->line != NULL) {
+			if (entry->line == NULL || (entry->busy == 0 &&
+				(victim == NULL || entry->used < victim->used))) {
+				victim = entry;
+			}
+		}
+	}
+
+	STAT_START(t);
+	ast = parse_line(line);
+	STAT_STOP(ST_PARSE, t);
+	if (ast == NULL) {
+		return NULL;
+	}
+	STAT_START(t);
+	plan = plan_compile(ast);
+	node_free(ast);
+	STAT_STOP(ST_COMPILE, t);
+	if (plan == NULL) {
+		return NULL;
+	}
+
+	// Cache the plan, unless every entry is running
+	if (victim != NULL) {
+		if (victim->line != NULL) {
+			free(victim->line);
+			plan_free(victim->plan);
+		}
+		if ((victim->line = strdup(line)) == NULL) {
+			return plan;	// Not cached, freed by plan_put
+		}
+		victim->hash = hash;
+		victim->plan = plan;
+		victim->busy = 1;
+		victim->used = ++tick;
+	}
+
+	return plan;
+}
+
+/* Description: Gives back a plan taken with plan_get.
+ *
+ * Arguments:	plan:	Plan to give back
+ *
+ * Returns:		void: Nothing
+ */
+void plan_put(struct plan *plan) {
+	int i;
+
+	if (plan == NULL) {
+		return;
+	}
+
+	for (i = 0; i < PLAN_CACHE_SIZE; ++i) {
+		if (cache[i].line != NULL && cache[i].plan == plan) {
+			--cache[i].busy;
+			return;
+		}
+	}
+
+	// Plan was not cached
+	if (plan->holds > 0) {
+		--plan->holds;
+	} else {
+		plan_free(plan);
+	}
+}
+
+/* Description: Takes one more reference to a plan from plan_get, so that it
+ *				outlives the line that made it (it holds a function).
+ *
+ * Arguments:	plan:	Plan taken with plan_get
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		Every reference is given back with plan_put. A held plan in
+ *				the cache is never evicted.
+ */
+void plan_hold(struct plan *plan) {
+	int i;
+
+	if (plan == NULL) {
+		return;
+	}
+
+	for (i = 0; i < PLAN_CACHE_SIZE; ++i) {
+		if (cache[i].line != NULL && cache[i].plan == plan) {
+			++cache[i].busy;
+			return;
+		}
+	}
+	++plan->holds;
+}
+
+/* Description: Drops every cached plan, when command lines may not mean what
+ *				they meant when their plans were made (an alias changed).
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		Plans still in use leave the cache and are freed by the
+ *				plan_put that gives back their last reference.
+ */
+void plan_flush(void) {
+	int i;
+
+	for (i = 0; i < PLAN_CACHE_SIZE; ++i) {
+		if (cache[i].line == NULL) {
+			continue;
+		}
+		if (cache[i].busy > 0) {
+			cache[i].plan->holds += cache[i].busy - 1;
+		} else {
+			plan_free(cache[i].plan);
+		}
+		free(cache[i].line);
+		cache[i].line = NULL;
+	}
+}
+
+/* Description: Makes a copy of a plan block usable at its new address, for
+ *				plans saved to a file and read back (see pg_rc.c).
+ *
+ * Arguments:	plan:	Copy of the block, plan->size bytes
+ *				from:	Address of the block the copy was made from
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG  : An array, pointer or index of the copy is
+ *								  outside the block or the plan
+ *						# EREDIR: A redirection is invalid
+ *
+ * Notes:		Every pointer of a plan points inside its block, so they all
+ *				move by the same distance. The copy is not held. A copy that
+ *				fails is left half moved and must only be freed.
+ */
+int plan_rebase(struct plan *plan, uintptr_t from) {
+	char *to = (char *)plan;
+	struct plan_cmd *cmd;
+	int i, j;
+
+	plan->code = (struct plan_insn *)rebase(plan->code, from, to);
+	plan->pipes = (struct plan_pipe *)rebase(plan->pipes, from, to);
+	plan->cmds = (struct plan_cmd *)rebase(plan->cmds, from, to);
+	plan->redirs = (struct fd_op *)rebase(plan->redirs, from, to);
+	plan->args = (char **)rebase(plan->args, from, to);
+	plan->psubs = (struct procsub *)rebase(plan->psubs, from, to);
+	plan->strings = (char *)rebase(plan->strings, from, to);
+	plan->holds = 0;
+
+	// The arrays must lie in the block, and the words in the strings
+	if (plan->size < sizeof(struct plan) || plan->ncode < 1 || plan->npipes < 0 ||
+		plan->ncmds < 0 || plan->nredirs < 0 || plan->nargs < 0 ||
+		plan->npsubs < 0 || plan->depth < 0 ||
+		!in_block(plan, plan->code, plan->ncode, sizeof(struct plan_insn)) ||
+		!in_block(plan, plan->pipes, plan->npipes, sizeof(struct plan_pipe)) ||
+		!in_block(plan, plan->cmds, plan->ncmds, sizeof(struct plan_cmd)) ||
+		!in_block(plan, plan->redirs, plan->nredirs, sizeof(struct fd_op)) ||
+		!in_block(plan, plan->args, plan->nargs, sizeof(char *)) ||
+		!in_block(plan, plan->psubs, plan->npsubs, sizeof(struct procsub)) ||
+		!in_block(plan, plan->strings, plan->strsize, 1) ||
+		(plan->strsize > 0 && plan->strings[plan->strsize - 1] != '\0')) {
+		pg_errno = EARG;
+		return -1;
+	}
+
+	for (i = 0; i < plan->nargs; ++i) {
+		plan->args[i] = (char *)rebase(plan->args[i], from, to);
+		if (plan->args[i] != NULL &&
+			!in_array(plan->args[i], 1, plan->strings, plan->strsize, 1)) {
+			pg_errno = EARG;
+			return -1;
+		}
+	}
+	for (i = 0; i < plan->nredirs; ++i) {
+		plan->redirs[i].path = (const char *)rebase(plan->redirs[i].path, from, to);
+		if (plan->redirs[i].path != NULL &&
+			!in_array(plan->redirs[i].path, 1, plan->strings, plan->strsize, 1)) {
+			pg_errno = EARG;
+			return -1;
+		}
+	}
+	for (i = 0; i < plan->ncmds; ++i) {
+		cmd = &plan->cmds[i];
+		cmd->argv = (char **)rebase(cmd->argv, from, to);
+		cmd->redirs = (struct fd_op *)rebase(cmd->redirs, from, to);
+		cmd->psubs = (const struct procsub *)rebase(cmd->psubs, from, to);
+		cmd->assigns = (char **)rebase(cmd->assigns, from, to);
+		cmd->plan = (struct plan *)rebase(cmd->plan, from, to);
+		if (cmd->argc < 0 || cmd->argv == NULL ||
+			(cmd->plan != NULL && (cmd->plan != plan || cmd->pc < 0 ||
+			cmd->pc >= plan->ncode)) ||
+			!in_array(cmd->argv, (long)cmd->argc + 1, plan->args, plan->nargs,
+				sizeof(char *)) || cmd->argv[cmd->argc] != NULL ||
+			!in_array(cmd->redirs, cmd->nredirs, plan->redirs, plan->nredirs,
+				sizeof(struct fd_op)) ||
+			!in_array(cmd->psubs, cmd->npsubs, plan->psubs, plan->npsubs,
+				sizeof(struct procsub)) ||
+			!in_array(cmd->assigns, cmd->nassigns, plan->args, plan->nargs,
+				sizeof(char *))) {
+			pg_errno = EARG;
+			return -1;
+		}
+		for (j = 0; j < cmd->argc; ++j) {
+			if (cmd->argv[j] == NULL || !marks_ok(cmd->argv[j])) {
+				pg_errno = EARG;
+				return -1;
+			}
+		}
+		for (j = 0; j < cmd->nassigns; ++j) {
+			if (cmd->assigns[j] == NULL || !marks_ok(cmd->assigns[j])) {
+				pg_errno = EARG;
+				return -1;
+			}
+		}
+		for (j = 0; j < cmd->nredirs; ++j) {
+			if (cmd->redirs[j].path != NULL && !marks_ok(cmd->redirs[j].path)) {
+				pg_errno = EARG;
+				return -1;
+			}
+		}
+		for (j = 0; j < cmd->npsubs; ++j) {		// A word or a redirection
+			if ((cmd->psubs[j].word == -1) == (cmd->psubs[j].redir == -1) ||
+				cmd->psubs[j].word < -1 || cmd->psubs[j].word >= cmd->argc ||
+				cmd->psubs[j].redir < -1 || cmd->psubs[j].redir >= cmd->nredirs) {
+				pg_errno = EARG;
+				return -1;
+			}
+		}
+		if (fd_validate(cmd->redirs, cmd->nredirs) == -1) {
+			return -1;		// pg_errno set by fd_validate
+		}
+	}
+	for (i = 0; i < plan->npipes; ++i) {
+		plan->pipes[i].cmds = (struct plan_cmd *)rebase(plan->pipes[i].cmds, from, to);
+		if (plan->pipes[i].ncmds < 1 || !in_array(plan->pipes[i].cmds,
+			plan->pipes[i].ncmds, plan->cmds, plan->ncmds, sizeof(struct plan_cmd))) {
+			pg_errno = EARG;
+			return -1;
+		}
+	}
+
+	// Jumps stay in the code and pipelines in the plan
+	for (i = 0; i < plan->ncode; ++i) {
+		if (!insn_ok(plan, &plan->code[i])) {
+			pg_errno = EARG;
+			return -1;
+		}
+	}
+	if (plan->code[plan->ncode - 1].op != OP_END) {
+		pg_errno = EARG;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Description: Frees an execution plan.
+ *
+ * Arguments:	plan:	Plan to be freed
+ *
+ * Returns:		void: Nothing
+ */
+void plan_free(struct plan *plan) {
+	free(plan);		// The plan is a single block
+}
+
+// Counts the instructions, pipelines, commands and bytes the tree needs
+static void measure(const struct node *node, struct plan *sz) {
+	const struct node *item;
+
+	switch (node->type) {
+		case N_LIST:
+			measure(node->left, sz);
+			measure(node->right, sz);
+			break;
+		case N_AND:
+		case N_OR:
+			measure(node->left, sz);
+			measure(node->right, sz);
+			++sz->ncode;		// Conditional jump
+			break;
+		case N_IF:
+			measure(node->left, sz);
+			measure(node->right, sz);
+			if (node->other != NULL) {
+				measure(node->other, sz);
+			} else {
+				++sz->ncode;	// OP_STATUS
+			}
+			sz->ncode += 2;		// Conditional jump, OP_JMP
+			break;
+		case N_WHILE:
+		case N_UNTIL:
+			measure(node->left, sz);
+			measure(node->right, sz);
+			sz->ncode += 4;		// OP_LOOP, conditional jump, OP_AGAIN, OP_DONE
+			break;
+		case N_FOR:
+			measure(node->right, sz);
+			sz->ncode += 4;		// OP_FOR, OP_NEXT, OP_AGAIN, OP_DONE
+			++sz->npipes;
+			measure_cmds(node, sz);
+			break;
+		case N_CASE:
+			sz->ncode += 3;		// OP_CASE, OP_STATUS, OP_ESAC
+			++sz->npipes;
+			measure_cmds(node, sz);
+			for (item = node->other; item != NULL; item = item->other) {
+				if (item->right != NULL) {
+					measure(item->right, sz);
+				} else {
+					++sz->ncode;	// OP_STATUS
+				}
+				sz->ncode += 2;		// OP_MATCH, OP_JMP
+				++sz->npipes;
+				measure_cmds(item, sz);
+			}
+			break;
+		case N_FUNC:
+			measure(node->right, sz);
+			sz->ncode += 2;		// OP_DEFUN, OP_RETURN
+			++sz->npipes;
+			measure_cmds(node, sz);
+			break;
+		case N_PIPE:
+		case N_CMD:
+			++sz->ncode;		// OP_RUN, or the jump of break, continue or return
+			if (jump_cmd(node) == 0 || (jump_cmd(node) == 'r' && node->nwords > 1)) {
+				++sz->npipes;
+				measure_cmds(node, sz);
+			}
+			break;
+		case N_ITEM:		// Measured with its case
+			break;
+	}
+}
+
+// Counts the commands of a pipeline and the bytes they need
+static void measure_cmds(const struct node *node, struct plan *sz) {
+	int i;
+
+	switch (node->type) {
+		case N_PIPE:
+			measure_cmds(node->left, sz);
+			measure_cmds(node->right, sz);
+			break;
+		default:
+			if (node->type == N_CMD && node->left != NULL) {	// Compound command
+				measure(node->left, sz);
+				sz->ncode += 2;		// OP_JMP, OP_RETURN
+			}
+			++sz->ncmds;
+			sz->nargs += node->nwords + 1 + node->nassigns;
+			for (i = 0; i < node->nwords; ++i) {
+				sz->strsize += strlen(node->words[i]) + 1;
+			}
+			for (i = 0; i < node->nassigns; ++i) {
+				sz->strsize += strlen(node->assigns[i]) + 1;
+			}
+			sz->nredirs += node->nredirs;
+			sz->npsubs += node->npsubs;
+			for (i = 0; i < node->nredirs; ++i) {
+				if (node->redirs[i].target != NULL) {
+					sz->strsize += strlen(node->redirs[i].target) + 1;
+				}
+			}
+			break;
+	}
+}
+
+// Emits the instructions and data of the tree
+static void emit(const struct node *node, struct plan *plan, struct scope *sc) {
+	struct scope body = { NULL, 0 };	// Functions run in a plan of their own
+	struct plan_cmd *cmd;
+	int jump, end, kind, run;
+
+	switch (node->type) {
+		case N_LIST:
+			emit(node->left, plan, sc);
+			emit(node->right, plan, sc);
+			break;
+		case N_AND:		// Right side runs only if the left side succeeded
+		case N_OR:		// Right side runs only if the left side failed
+			emit(node->left, plan, sc);
+			jump = emit_insn(plan, (node->type == N_AND) ? OP_JMPNZ : OP_JMPZ, 0, 0);
+			emit(node->right, plan, sc);
+			plan->code[jump].arg = plan->ncode;
+			break;
+		case N_IF:		// Without an else part a false condition sets status 0
+			emit(node->left, plan, sc);
+			jump = emit_insn(plan, OP_JMPNZ, 0, 0);
+			emit(node->right, plan, sc);
+			end = emit_insn(plan, OP_JMP, 0, 0);
+			plan->code[jump].arg = plan->ncode;
+			if (node->other != NULL) {
+				emit(node->other, plan, sc);
+			} else {
+				emit_insn(plan, OP_STATUS, 0, 0);
+			}
+			plan->code[end].arg = plan->ncode;
+			break;
+		case N_WHILE:
+		case N_UNTIL:
+		case N_FOR:
+			emit_loop(node, plan, sc);
+			break;
+		case N_CASE:
+			emit_case(node, plan, sc);
+			break;
+		case N_FUNC:	// Defined when it runs, the body is jumped over
+			jump = emit_insn(plan, OP_DEFUN, 0, emit_pipe(node, plan));
+			emit(node->right, plan, &body);
+			emit_insn(plan, OP_RETURN, -1, 0);
+			plan->code[jump].arg = plan->ncode;
+			break;
+		case N_PIPE:
+		case N_CMD:
+			if ((kind = jump_cmd(node)) != 0) {
+				emit_jump(node, plan, sc, kind);
+			} else {
+				run = emit_pipe(node, plan);
+				cmd = plan->pipes[run].cmds;
+				emit_bodies(node, plan, &cmd);
+				emit_insn(plan, OP_RUN, run, 0);
+			}
+			break;
+		case N_ITEM:	// Emitted with its case
+			break;
+	}
+}
+
+// Emits a loop. The condition of a while loop, or the OP_NEXT of a for loop,
+// jumps to OP_DONE when the loop ends, and the body ends with OP_AGAIN, which
+// keeps the status of the body and jumps back.
+static void emit_loop(const struct node *node, struct plan *plan,
+	struct scope *sc) {
+	struct loop loop;
+	int top, done;
+
+	if (node->type == N_FOR) {
+		emit_insn(plan, OP_FOR, 0, emit_pipe(node, plan));
+	} else {
+		emit_insn(plan, OP_LOOP, 0, 0);
+	}
+	loop.outer = sc->loop;
+	loop.depth = sc->depth;
+	loop.breaks = loop.conts = -1;
+	sc->loop = &loop;
+	if (++sc->depth > plan->depth) {
+		plan->depth = sc->depth;
+	}
+
+	top = plan->ncode;
+	if (node->type == N_FOR) {
+		done = emit_insn(plan, OP_NEXT, 0, 0);
+	} else {
+		emit(node->left, plan, sc);
+		done = emit_insn(plan, (node->type == N_WHILE) ? OP_JMPNZ : OP_JMPZ, 0, 0);
+	}
+	emit(node->right, plan, sc);
+
+	patch(plan, loop.conts, plan->ncode);
+	emit_insn(plan, OP_AGAIN, top, 0);
+	plan->code[done].arg = plan->ncode;
+	emit_insn(plan, OP_DONE, 0, 0);
+	patch(plan, loop.breaks, plan->ncode);
+
+	sc->loop = loop.outer;
+	--sc->depth;
+}
+
+// Emits a case command. Every item starts with an OP_MATCH that jumps to the
+// next item if none of its patterns matches, and ends with a jump to OP_ESAC.
+static void emit_case(const struct node *node, struct plan *plan,
+	struct scope *sc) {
+	const struct node *item;
+	int match, ends = -1;
+
+	emit_insn(plan, OP_CASE, 0, emit_pipe(node, plan));
+	if (++sc->depth > plan->depth) {
+		plan->depth = sc->depth;
+	}
+
+	for (item = node->other; item != NULL; item = item->other) {
+		match = emit_insn(plan, OP_MATCH, 0, emit_pipe(item, plan));
+		if (item->right != NULL) {
+			emit(item->right, plan, sc);
+		} else {
+			emit_insn(plan, OP_STATUS, 0, 0);
+		}
+		ends = emit_insn(plan, OP_JMP, ends, 0);
+		plan->code[match].arg = plan->ncode;
+	}
+	emit_insn(plan, OP_STATUS, 0, 0);	// No item matched
+	patch(plan, ends, plan->ncode);
+	emit_insn(plan, OP_ESAC, 0, 0);
+
+	--sc->depth;
+}
+
+// Emits break ('b') or continue ('c') as an OP_BREAK out of the loop the
+// count selects, or return ('r') as an OP_RETURN. Outside of loops break and
+// continue only set the status to 0.
+static void emit_jump(const struct node *node, struct plan *plan,
+	struct scope *sc, int kind) {
+	struct loop *loop = sc->loop;
+	int n;
+
+	if (kind == 'r') {
+		emit_insn(plan, OP_RETURN, (node->nwords > 1) ? emit_pipe(node, plan) : -1, 0);
+		return;
+	}
+
+	n = (node->nwords > 1) ? atoi(node->words[1]) : 1;
+	while (loop != NULL && --n > 0 && loop->outer != NULL) {
+		loop = loop->outer;
+	}
+
+	if (loop == NULL) {
+		emit_insn(plan, OP_STATUS, 0, 0);
+	} else if (kind == 'b') {
+		loop->breaks = emit_insn(plan, OP_BREAK, loop->breaks, loop->depth);
+	} else {
+		loop->conts = emit_insn(plan, OP_BREAK, loop->conts, loop->depth + 1);
+	}
+}
+
+// Emits the compound commands of a pipeline, from left to right. Each one is
+// jumped over and ends with OP_RETURN, like a function body, and runs in the
+// child of its stage. cmd is the command of the next stage.
+static void emit_bodies(const struct node *node, struct plan *plan,
+	struct plan_cmd **cmd) {
+	struct scope body = { NULL, 0 };	// The child runs it apart from any loop
+	int jump;
+
+	if (node->type == N_PIPE) {
+		emit_bodies(node->left, plan, cmd);
+		emit_bodies(node->right, plan, cmd);
+		return;
+	}
+
+	if (node->left != NULL) {
+		jump = emit_insn(plan, OP_JMP, 0, 0);
+		(*cmd)->plan = plan;
+		(*cmd)->pc = plan->ncode;
+		emit(node->left, plan, &body);
+		emit_insn(plan, OP_RETURN, -1, 0);
+		plan->code[jump].arg = plan->ncode;
+	}
+	++*cmd;
+}
+
+// Appends an instruction. Returns its index.
+static int emit_insn(struct plan *plan, enum PlanOp op, int arg, int aux) {
+	struct plan_insn *insn = &plan->code[plan->ncode];
+
+	insn->op = op;
+	insn->arg = arg;
+	insn->aux = aux;
+	return plan->ncode++;
+}
+
+// Adds a pipeline with the commands of a node. Returns its index.
+static int emit_pipe(const struct node *node, struct plan *plan) {
+	struct plan_pipe *pipe = &plan->pipes[plan->npipes];
+
+	pipe->cmds = &plan->cmds[plan->ncmds];
+	pipe->ncmds = 0;
+	emit_cmds(node, plan, pipe);
+	return plan->npipes++;
+}
+
+// Adds the commands of a pipeline, from left to right
+static void emit_cmds(const struct node *node, struct plan *plan,
+	struct plan_pipe *pipe) {
+	struct plan_cmd *cmd;
+	struct fd_op *op;
+	int i;
+
+	if (node->type == N_PIPE) {
+		emit_cmds(node->left, plan, pipe);
+		plan->cmds[plan->ncmds - 1].pipesize = node->pipesize;
+		emit_cmds(node->right, plan, pipe);
+		return;
+	}
+
+	cmd = &plan->cmds[plan->ncmds++];
+	++pipe->ncmds;
+	cmd->pipesize = 0;
+	cmd->plan = NULL;		// Set by emit_bodies for a compound command
+	cmd->pc = 0;
+
+	cmd->argc = node->nwords;
+	cmd->argv = &plan->args[plan->nargs];
+	for (i = 0; i < node->nwords; ++i) {
+		cmd->argv[i] = add_string(plan, node->words[i]);
+	}
+	cmd->argv[i] = NULL;
+	plan->nargs += node->nwords + 1;
+
+	cmd->nassigns = node->nassigns;
+	cmd->assigns = &plan->args[plan->nargs];
+	for (i = 0; i < node->nassigns; ++i) {
+		cmd->assigns[i] = add_string(plan, node->assigns[i]);
+	}
+	plan->nargs += node->nassigns;
+
+	cmd->nredirs = node->nredirs;
+	cmd->redirs = &plan->redirs[plan->nredirs];
+	for (i = 0; i < node->nredirs; ++i) {
+		op = &cmd->redirs[i];
+		op->fd = node->redirs[i].fd;
+		op->src = node->redirs[i].src;
+		op->flags = 0;
+		op->path = NULL;
+		switch (node->redirs[i].type) {
+			case REDIN:
+				op->type = FD_OPEN;
+				op->flags = O_RDONLY;
+				break;
+			case REDOUT:
+				op->type = FD_OPEN;
+				op->flags = O_WRONLY | O_CREAT | O_TRUNC;
+				break;
+			case REDOUTA:
+				op->type = FD_OPEN;
+				op->flags = O_WRONLY | O_CREAT | O_APPEND;
+				break;
+			case REDRW:
+				op->type = FD_OPEN;
+				op->flags = O_RDWR | O_CREAT;
+				break;
+			case REDDUP:
+				op->type = FD_DUP;
+				break;
+			case REDCLOSE:
+				op->type = FD_CLOSE;
+				break;
+			case REDHERE:
+				op->type = FD_DATA;
+				break;
+		}
+		if (op->type == FD_OPEN || op->type == FD_DATA) {
+			op->path = add_string(plan, node->redirs[i].target);
+		}
+	}
+	plan->nredirs += node->nredirs;
+
+	// The word or file name of a process substitution is its list
+	cmd->npsubs = node->npsubs;
+	cmd->psubs = &plan->psubs[plan->npsubs];
+	for (i = 0; i < node->npsubs; ++i) {
+		plan->psubs[plan->npsubs++] = node->psubs[i];
+	}
+	cmd->expand = node->expand;
+}
+
+// Sets the target of a chain of jumps, linked through their arg
+static void patch(struct plan *plan, int chain, int target) {
+	int next;
+
+	for (; chain != -1; chain = next) {
+		next = plan->code[chain].arg;
+		plan->code[chain].arg = target;
+	}
+}
+
+// Checks if a command is break, continue or return, which the plan runs
+// itself: a plain command with at most one argument, a number for break and
+// continue. Returns 'b', 'c' or 'r', or 0 for any other command.
+static int jump_cmd(const struct node *node) {
+	if (node->type != N_CMD || node->nwords == 0 || node->nwords > 2 ||
+		node->nredirs > 0 || node->nassigns > 0 || node->npsubs > 0) {
+		return 0;
+	}
+	if (strcmp(node->words[0], "return") == 0) {
+		return 'r';
+	}
+	if (node->nwords > 1 && (node->words[1][0] == '\0' ||
+		strspn(node->words[1], "0123456789") != strlen(node->words[1]))) {
+		return 0;
+	}
+	if (strcmp(node->words[0], "break") == 0) {
+		return 'b';
+	}
+	return (strcmp(node->words[0], "continue") == 0) ? 'c' : 0;
+}
+
+// Copies a string to the plan's string area
+static char * add_string(struct plan *plan, const char *str) {
+	char *copy = plan->strings + plan->strsize;
+	size_t len = strlen(str) + 1;
+
+	memcpy(copy, str, len);
+	plan->strsize += len;
+
+	return copy;
+}
+
+// Hashes a command line (FNV-1a)
+static unsigned long hash_line(const char *line) {
+	unsigned long hash = 2166136261UL;
+
+	while (*line) {
+		hash = (hash ^ (unsigned char)*line++) * 16777619UL;
+	}
+	return hash;
+}
+
+// Moves a pointer of a plan block made at from to the same place of the block
+// at to. NULL stays NULL.
+static void * rebase(const void *p, uintptr_t from, char *to) {
+	return (p == NULL) ? NULL : to + ((uintptr_t)p - from);
+}
+
+// Checks that an array of n elements of a plan lies inside its block
+static int in_block(const struct plan *plan, const void *p, size_t n, size_t elem) {
+	return n <= plan->size / elem && in_array(p, (long)(n * elem), plan, plan->size, 1);
+}
+
+// Checks that n elements at p are whole elements of the array of nbase
+// elements at base. An empty array may be NULL.
+static int in_array(const void *p, long n, const void *base, size_t nbase, size_t elem) {
+	uintptr_t off;
+
+	if (n < 0) {
+		return 0;
+	}
+	if (p == NULL) {
+		return n == 0;
+	}
+	if ((uintptr_t)p < (uintptr_t)base) {
+		return 0;
+	}
+	off = (uintptr_t)p - (uintptr_t)base;
+	return off % elem == 0 && off / elem <= nbase && (size_t)n <= nbase - off / elem;
+}
+
+// Checks the operands of an instruction of a rebased plan
+static int insn_ok(const struct plan *plan, const struct plan_insn *insn) {
+	int jump = (insn->arg >= 0 && insn->arg < plan->ncode);
+	int aux = (insn->aux >= 0 && insn->aux < plan->npipes);
+
+	switch (insn->op) {
+		case OP_RUN:
+			return insn->arg >= 0 && insn->arg < plan->npipes;
+		case OP_JMPZ:
+		case OP_JMPNZ:
+		case OP_JMP:
+		case OP_NEXT:
+		case OP_AGAIN:
+			return jump;
+		case OP_STATUS:
+		case OP_LOOP:
+		case OP_DONE:
+		case OP_ESAC:
+		case OP_END:
+			return 1;
+		case OP_FOR:
+		case OP_CASE:
+			return aux;
+		case OP_MATCH:
+			return jump && aux;
+		case OP_BREAK:
+			return jump && insn->aux >= 0 && insn->aux <= plan->depth;
+		case OP_DEFUN:
+			return jump && aux && plan->pipes[insn->aux].cmds[0].argc > 0;
+		case OP_RETURN:
+			return insn->arg >= -1 && insn->arg < plan->npipes;
+	}
+	return 0;		// Not an instruction
+}
+
+// Checks that every expansion of a word is closed, as the expander expects
+static int marks_ok(const char *word) {
+	while ((word = strpbrk(word, EXP_MARKS)) != NULL) {
+		if ((word = strchr(word, EXP_END)) == NULL) {
+			return 0;
+		}
+		++word;
+	}
+	return 1;
+}
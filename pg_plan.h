@@ -0,0 +1,97 @@
+#ifndef PG_PLAN_H
+#define PG_PLAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "pg_parse.h"
+#include "pg_file.h"
+
+// Enumerations
+
+enum PlanOp {
+	OP_RUN,		// Run pipeline arg
+	OP_JMPZ,	// Jump to arg if the last status is zero
+	OP_JMPNZ,	// Jump to arg if the last status is not zero
+	OP_JMP,		// Jump to arg
+	OP_STATUS,	// Set the last status to arg
+	OP_LOOP,	// Open the frame of a while or until loop
+	OP_FOR,		// Open the frame of a for loop over the words of pipeline aux
+	OP_NEXT,	// Assign the next word of the for loop, or jump to arg
+	OP_AGAIN,	// Keep the last status as the loop's and jump to arg
+	OP_DONE,	// Close the loop frame, its status becomes the last status
+	OP_BREAK,	// Close frames till aux are open, set the status to 0, jump to arg
+	OP_CASE,	// Open the frame of a case with the word of pipeline aux
+	OP_MATCH,	// Jump to arg unless the word matches a pattern of pipeline aux
+	OP_ESAC,	// Close the case frame
+	OP_DEFUN,	// Define the function of pipeline aux, its body follows, jump to arg
+	OP_RETURN,	// Leave the plan, with the status of pipeline arg, or the last (-1)
+	OP_END		// End of the plan
+};
+
+// Simple command of the plan
+struct plan_cmd {
+	char **argv;			// Arguments, NULL terminated
+	int argc;				// Number of arguments
+	struct fd_op *redirs;	// Redirections, in the order they are applied
+	int nredirs;			// Number of redirections
+	const struct procsub *psubs;	// Process substitutions, in argv and redirs
+	int npsubs;				// Number of process substitutions
+	char **assigns;			// Variable assignments, NAME=VALUE
+	int nassigns;			// Number of assignments
+	int expand;				// Words, targets or assignments hold expansions
+	long pipesize;			// Size of the pipe to the next command, 0 for default
+	struct plan *plan;		// Plan of a compound command run as a stage, or NULL
+	int pc;					// First instruction of the compound command
+};
+
+// Pipeline of the plan
+struct plan_pipe {
+	struct plan_cmd *cmds;	// Commands of the pipeline
+	int ncmds;				// Number of commands
+};
+
+// Instruction of the plan
+struct plan_insn {
+	enum PlanOp op;
+	int arg;
+	int aux;		// Pipeline of words (OP_FOR, OP_CASE, OP_MATCH, OP_DEFUN), or
+					// frames left open (OP_BREAK)
+};
+
+// Flat execution plan of a command line. Everything is stored in one block.
+// Compound commands are lowered to jumps and to frames that loops and case
+// commands open while they run. The words of for loops, case commands and
+// function names are pipelines of one command that never run. A compound
+// command in a pipeline or with redirections is a command without words whose
+// code is jumped over and run by the child of the stage.
+struct plan {
+	struct plan_insn *code;		// Instructions, terminated with OP_END
+	int ncode;
+	struct plan_pipe *pipes;	// Pipelines
+	int npipes;
+	struct plan_cmd *cmds;		// Commands of all the pipelines
+	int ncmds;
+	struct fd_op *redirs;		// Redirections of all the commands
+	int nredirs;
+	char **args;				// Argument vectors of all the commands
+	int nargs;
+	struct procsub *psubs;		// Process substitutions of all the commands
+	int npsubs;
+	char *strings;				// Words and filenames
+	size_t strsize;
+	int depth;					// Most frames open at once
+	int holds;					// References taken with plan_hold, if not cached
+	size_t size;				// Size of the whole block
+};
+
+// Function Prototypes
+
+struct plan * plan_compile(const struct node *ast);
+struct plan * plan_get(const char *line);
+void plan_put(struct plan *plan);
+void plan_hold(struct plan *plan);
+void plan_flush(void);
+int plan_rebase(struct plan *plan, uintptr_t from);
+void plan_free(struct plan *plan);
+
+#endif
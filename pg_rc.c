@@ -0,0 +1,390 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Startup file. The shell runs ~/.pgshrc when it starts, a command line at a
+ * time like lines typed at the prompt. The plans of its lines are saved to a
+ * snapshot next to it (~/.pgshrc.cache), keyed by the path, size and
+ * modification time of the file and by the build of the shell. While the
+ * snapshot matches, the next start maps it and runs the saved plans without
+ * lexing, parsing or compiling the file again.
+ * A saved plan is a copy of the plan block and the address it had, so it is
+ * copied out of the mapping and rebased (see plan_rebase). Lines that could
+ * not be compiled and lines with aliases, whose plans depend on the aliases
+ * defined when they run, are saved as text and handled like typed lines.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "pg_error.h"
+#include "pg_parse.h"
+#include "pg_plan.h"
+#include "pg_alias.h"
+#include "pgsh.h"
+#include "pg_rc.h"
+
+#define RC_MAGIC	"pgshrc2"	// First bytes of a snapshot
+#define RC_BUILD	__DATE__ " " __TIME__	// Build of the shell, plans may differ
+#define RC_ALIGN	8			// Alignment of the records of a snapshot
+
+// Header of a snapshot, followed by the path of the startup file and the
+// records of its lines
+struct rc_head {
+	char magic[8];
+	char build[24];			// RC_BUILD of the shell that saved it
+	size_t plansize;		// sizeof(struct plan)
+	off_t size;				// Size of the startup file
+	struct timespec mtime;	// Modification time of the startup file
+	size_t pathlen;			// Length of the path, with its NUL
+	int nrecs;				// Number of records
+	uint64_t sum;			// Checksum of the records (see rc_sum)
+};
+
+// Record of a command line, followed by its plan block or its text
+struct rc_rec {
+	size_t len;				// Length of the plan block, or of the text with its NUL
+	uint64_t base;			// Address of the plan block when it was saved, 0 for text
+};
+
+// Snapshot being made
+struct rc_snap {
+	char *buf;
+	size_t len;
+	size_t cap;
+	int nrecs;
+	int ok;					// Every line was added
+};
+
+// Static Function Prototypes //
+static int rc_replay(const char *snap, const char *path, const struct stat *st,
+	int *result);
+static int rc_run(const char *path, const char *snap);
+static int rc_line(const char *line, struct rc_snap *sn);
+static void rc_add(struct rc_snap *sn, const void *data, size_t len, uint64_t base);
+static void rc_save(const struct rc_snap *sn, const char *snap, const char *path,
+	const struct stat *st);
+static char * rc_read(const char *path, struct stat *st);
+static size_t rc_pad(size_t len);
+static uint64_t rc_sum(const char *buf, size_t len);
+
+/* Description: Runs a startup file, from its snapshot if it matches the file.
+ *
+ * Arguments:	path:	Startup file
+ *
+ * Returns:		- SPEXIT, if the file ran exit
+ * 				- Otherwise, NOSP (also if there is no such file)
+ *
+ * Notes:		Errors of the lines are reported like the ones of typed lines.
+ *				A snapshot that is missing, damaged or does not match is made
+ *				again.
+ */
+int rc_load(const char *path) {
+	struct stat st;
+	char *snap;
+	int result;
+
+	if (path == NULL || stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+		return NOSP;
+	}
+	if ((snap = (char *)malloc(strlen(path) + sizeof(RC_CACHE))) == NULL) {
+		perror("malloc");
+		return NOSP;
+	}
+	strcpy(snap, path);
+	strcat(snap, RC_CACHE);
+
+	if (rc_replay(snap, path, &st, &result) == -1) {
+		result = rc_run(path, snap);
+	}
+
+	free(snap);
+	return (result == SPEXIT) ? SPEXIT : NOSP;
+}
+
+// Runs the lines saved in a snapshot and stores the result of the last one.
+// Returns -1 without running anything if the snapshot is missing, damaged or
+// does not match the startup file.
+static int rc_replay(const char *snap, const char *path, const struct stat *st,
+	int *result) {
+	const struct rc_head *head;
+	const struct rc_rec *rec;
+	struct stat sst;
+	struct plan **plans;
+	char *map;
+	size_t off, size;
+	int fd, i, n;
+
+	if ((fd = open(snap, O_RDONLY)) == -1) {
+		return -1;
+	}
+	if (fstat(fd, &sst) == -1 || sst.st_size < (off_t)sizeof(struct rc_head) ||
+		(map = (char *)mmap(NULL, sst.st_size, PROT_READ, MAP_PRIVATE, fd, 0))
+		== MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	size = sst.st_size;
+
+	head = (const struct rc_head *)map;
+	off = sizeof(struct rc_head) + rc_pad(head->pathlen);
+	if (memcmp(head->magic, RC_MAGIC, sizeof(RC_MAGIC)) != 0 ||
+		strncmp(head->build, RC_BUILD, sizeof(head->build)) != 0 ||
+		head->plansize != sizeof(struct plan) || head->size != st->st_size ||
+		head->mtime.tv_sec != st->st_mtim.tv_sec ||
+		head->mtime.tv_nsec != st->st_mtim.tv_nsec ||
+		head->pathlen != strlen(path) + 1 || off > size || head->nrecs < 0 ||
+		memcmp(map + sizeof(struct rc_head), path, head->pathlen) != 0 ||
+		rc_sum(map + off, size - off) != head->sum ||
+		(plans = (struct plan **)calloc(head->nrecs + 1, sizeof(struct plan *)))
+		== NULL) {
+		munmap(map, size);
+		return -1;
+	}
+
+	// Every record must be whole and every plan usable before the first
+	// line runs
+	for (i = 0, n = 0; i < head->nrecs; ++i) {
+		rec = (const struct rc_rec *)(map + off);
+		if (off + sizeof(struct rc_rec) > size ||
+			rec->len > size - off - sizeof(struct rc_rec) ||
+			(rec->base == 0 && (rec->len == 0 ||
+			((const char *)(rec + 1))[rec->len - 1] != '\0'))) {
+			break;
+		}
+		off += sizeof(struct rc_rec) + rc_pad(rec->len);
+		if (rec->base == 0) {
+			continue;
+		}
+		if (rec->len < sizeof(struct plan) ||
+			((const struct plan *)(rec + 1))->size != rec->len ||
+			(plans[n] = (struct plan *)malloc(rec->len)) == NULL) {
+			break;
+		}
+		memcpy(plans[n], rec + 1, rec->len);
+		if (plan_rebase(plans[n++], (uintptr_t)rec->base) == -1) {
+			pg_errno = EOK;		// The startup file runs from its text
+			break;
+		}
+	}
+	if (i < head->nrecs) {
+		while (n > 0) {
+			plan_free(plans[--n]);
+		}
+		free(plans);
+		munmap(map, size);
+		return -1;
+	}
+
+	off = sizeof(struct rc_head) + rc_pad(head->pathlen);
+	*result = NOSP;
+	for (i = 0, n = 0; i < head->nrecs; ++i) {
+		rec = (const struct rc_rec *)(map + off);
+		off += sizeof(struct rc_rec) + rc_pad(rec->len);
+
+		if (*result == SPEXIT) {		// The plans left are not run
+			if (rec->base != 0) {
+				plan_free(plans[n++]);
+			}
+		} else if (rec->base == 0) {
+			*result = handle_cmd_line((char *)(rec + 1));
+		} else {
+			*result = handle_plan(plans[n++]);
+		}
+	}
+
+	free(plans);
+	munmap(map, size);
+	return 0;
+}
+
+// Runs the lines of a startup file and saves their plans to a snapshot.
+// Returns the result of the last line.
+static int rc_run(const char *path, const char *snap) {
+	struct rc_snap sn = { NULL, 0, 0, 0, 1 };
+	struct stat st;
+	char *text, *line, *p, *end;
+	int result = NOSP;
+
+	if ((text = rc_read(path, &st)) == NULL) {
+		return NOSP;
+	}
+
+	// A command line goes on over the next lines while it is open, as at
+	// the prompt
+	for (p = text; *p != '\0' && result != SPEXIT; p = end) {
+		end = p;
+		do {
+			end += strcspn(end, "\n");
+			if (*end == '\n') {
+				++end;
+			}
+			if ((line = strndup(p, end - p)) == NULL) {
+				perror("strndup");
+				free(text);
+				free(sn.buf);
+				return result;
+			}
+			if (*end == '\0' || !line_open(line)) {
+				break;
+			}
+			free(line);
+		} while (1);
+
+		result = rc_line(line, &sn);
+		free(line);
+	}
+
+	if (sn.ok) {
+		rc_save(&sn, snap, path, &st);
+	}
+	free(sn.buf);
+	free(text);
+	return result;
+}
+
+// Compiles and runs a command line of a startup file, adding it to the
+// snapshot. Returns the result of handle_cmd_line.
+static int rc_line(const char *line, struct rc_snap *sn) {
+	struct node *ast;
+	struct plan *plan;
+	unsigned long splices = alias_splices;
+
+	if ((ast = parse_line(line)) == NULL) {
+		if (pg_errno != ENOTOKEN) {
+			rc_add(sn, line, strlen(line) + 1, 0);	// Errors are reported again
+		}
+		return plan_failed();
+	}
+	plan = plan_compile(ast);
+	node_free(ast);
+	if (plan == NULL) {
+		rc_add(sn, line, strlen(line) + 1, 0);
+		return plan_failed();
+	}
+
+	if (alias_splices != splices) {
+		rc_add(sn, line, strlen(line) + 1, 0);
+	} else {
+		rc_add(sn, plan, plan->size, (uintptr_t)plan);	// Before it runs
+	}
+	return handle_plan(plan);
+}
+
+// Appends a record to a snapshot, or marks it as failed
+static void rc_add(struct rc_snap *sn, const void *data, size_t len, uint64_t base) {
+	struct rc_rec rec;
+	size_t need = sizeof(struct rc_rec) + rc_pad(len);
+	char *tmp;
+
+	if (!sn->ok) {
+		return;
+	}
+	if (sn->len + need > sn->cap) {
+		sn->cap = (sn->cap == 0) ? 4096 : sn->cap;
+		while (sn->len + need > sn->cap) {
+			sn->cap *= 2;
+		}
+		if ((tmp = (char *)realloc(sn->buf, sn->cap)) == NULL) {
+			perror("realloc");
+			sn->ok = 0;
+			return;
+		}
+		sn->buf = tmp;
+	}
+
+	rec.len = len;
+	rec.base = base;
+	memcpy(sn->buf + sn->len, &rec, sizeof(struct rc_rec));
+	memcpy(sn->buf + sn->len + sizeof(struct rc_rec), data, len);
+	memset(sn->buf + sn->len + sizeof(struct rc_rec) + len, 0, rc_pad(len) - len);
+	sn->len += need;
+	++sn->nrecs;
+}
+
+// Writes a snapshot to a temporary file and renames it over the old one, so
+// a shell starting meanwhile never maps half of it. Failures are silent, the
+// startup file then runs from its text again.
+static void rc_save(const struct rc_snap *sn, const char *snap, const char *path,
+	const struct stat *st) {
+	static const char zeros[RC_ALIGN];
+	struct rc_head head;
+	char tmp[4096];
+	size_t pathlen = strlen(path) + 1;
+	int fd, ok;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", snap, (int)getpid()) >= (int)sizeof(tmp) ||
+		(fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1) {
+		return;
+	}
+
+	memset(&head, 0, sizeof(head));
+	memcpy(head.magic, RC_MAGIC, sizeof(RC_MAGIC));
+	strncpy(head.build, RC_BUILD, sizeof(head.build) - 1);
+	head.plansize = sizeof(struct plan);
+	head.size = st->st_size;
+	head.mtime = st->st_mtim;
+	head.pathlen = pathlen;
+	head.nrecs = sn->nrecs;
+	head.sum = rc_sum(sn->buf, sn->len);
+
+	ok = write(fd, &head, sizeof(head)) == (ssize_t)sizeof(head) &&
+		write(fd, path, pathlen) == (ssize_t)pathlen &&
+		write(fd, zeros, rc_pad(pathlen) - pathlen) ==
+			(ssize_t)(rc_pad(pathlen) - pathlen) &&
+		(sn->len == 0 || write(fd, sn->buf, sn->len) == (ssize_t)sn->len);
+
+	if (close(fd) == -1 || !ok || rename(tmp, snap) == -1) {
+		unlink(tmp);
+	}
+}
+
+// Reads a whole file to a NUL terminated buffer. The file is stated before
+// it is read, so a change while it is read makes the snapshot stale rather
+// than wrong. Returns NULL on failure.
+static char * rc_read(const char *path, struct stat *st) {
+	char *text;
+	size_t len = 0;
+	ssize_t n;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY | O_CLOEXEC)) == -1) {
+		perror(path);
+		return NULL;
+	}
+	if (fstat(fd, st) == -1 || (text = (char *)malloc(st->st_size + 1)) == NULL) {
+		perror(path);
+		close(fd);
+		return NULL;
+	}
+
+	while (len < (size_t)st->st_size &&
+		(n = read(fd, text + len, st->st_size - len)) > 0) {
+		len += n;
+	}
+	close(fd);
+	text[len] = '\0';
+
+	return text;
+}
+
+// Rounds a length up to the alignment of the records
+static size_t rc_pad(size_t len) {
+	return (len + RC_ALIGN - 1) & ~(size_t)(RC_ALIGN - 1);
+}
+
+// Returns the checksum of the records of a snapshot (64-bit FNV-1a), so a
+// damaged snapshot is made again instead of run
+static uint64_t rc_sum(const char *buf, size_t len) {
+	uint64_t sum = 14695981039346656037ULL;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		sum = (sum ^ (unsigned char)buf[i]) * 1099511628211ULL;
+	}
+	return sum;
+}
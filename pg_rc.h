@@ -0,0 +1,11 @@
+#ifndef PG_RC_H
+#define PG_RC_H
+
+#define RC_FILE		".pgshrc"	// Startup file, in the home directory
+#define RC_CACHE	".cache"	// Suffix of the compiled copy of a startup file
+
+// Function Prototypes
+
+int rc_load(const char *path);
+
+#endif
@@ -0,0 +1,501 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * A small line editor for the interactive shell. When the standard input is a
+ * terminal it is switched to raw mode and the line is edited in place with the
+ * usual emacs style keys. Tab completes command names and file paths and the most
+ * recent matching history entry is suggested in grey after the cursor. When the
+ * standard input is not a terminal, the line is read as is.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include "pg_error.h"
+#include "pg_complete.h"
+#include "pg_suggest.h"
+#include "pg_readline.h"
+
+#define DEFAULT_COLS	80
+
+// Keys handled by the editor
+enum KeyCode {
+	KEY_CTRL_A = 1,
+	KEY_CTRL_B = 2,
+	KEY_CTRL_C = 3,
+	KEY_CTRL_D = 4,
+	KEY_CTRL_E = 5,
+	KEY_CTRL_F = 6,
+	KEY_CTRL_H = 8,
+	KEY_TAB = 9,
+	KEY_LF = 10,
+	KEY_CTRL_K = 11,
+	KEY_CTRL_L = 12,
+	KEY_CR = 13,
+	KEY_CTRL_U = 21,
+	KEY_CTRL_W = 23,
+	KEY_ESC = 27,
+	KEY_BACKSPACE = 127
+};
+
+// State of the line being edited
+struct line_state {
+	char *buf;			// Line buffer (always NUL terminated)
+	size_t len;			// Line length
+	size_t pos;			// Cursor position
+	size_t cap;			// Allocated buffer size
+	const char *prompt;	// Prompt printed before the line
+	size_t plen;		// Prompt length
+	int cols;			// Terminal columns
+	size_t dirty;		// First position changed since the last suggestion lookup
+	const char *hint;	// Suggested rest of the line (NULL if none)
+};
+
+static struct termios orig_termios;	// Terminal settings before raw mode
+
+// Static Function Prototypes //
+static char * read_plain(const char *prompt);
+static int raw_mode_on(void);
+static void raw_mode_off(void);
+static int term_cols(void);
+static char * edit_line(const char *prompt);
+static void refresh_line(struct line_state *l);
+static int insert_text(struct line_state *l, const char *text, size_t n);
+static void delete_range(struct line_state *l, size_t from, size_t to);
+static int accept_hint(struct line_state *l);
+static void complete(struct line_state *l, int tabs);
+static void list_matches(struct line_state *l, const struct completion *cmpl);
+
+/* Description: Prints the prompt and reads a command line. On a terminal the line
+ *				can be edited and completed before it is entered.
+ *
+ * Arguments:	prompt:	Prompt to be printed
+ *
+ * Returns:		- On success, the line entered, terminated with '\n'
+ * 				- On failure or end of input, NULL
+ *
+ * Notes:		The returned line is allocated and must be freed by the caller.
+ */
+char * pg_readline(const char *prompt) {
+	char *line;
+
+	if (prompt == NULL) {
+		prompt = "";
+	}
+
+	if (!isatty(STDIN_FILENO)) {
+		return read_plain(prompt);
+	}
+
+	fflush(stdout);
+	if (raw_mode_on() == -1) {
+		return read_plain(prompt);
+	}
+
+	line = edit_line(prompt);
+	raw_mode_off();
+
+	return line;
+}
+
+// Reads a line without editing
+static char * read_plain(const char *prompt) {
+	char *line = NULL;	// indicate that getline will allocate space
+	size_t len = 0;
+
+	printf("%s", prompt);
+	fflush(stdout);
+
+	if (getline(&line, &len, stdin) == -1) {
+		free(line);
+		return NULL;
+	}
+
+	return line;
+}
+
+// Switches the terminal to raw mode
+static int raw_mode_on(void) {
+	struct termios raw;
+
+	if (tcgetattr(STDIN_FILENO, &orig_termios) == -1) {
+		return -1;
+	}
+
+	raw = orig_termios;
+	raw.c_iflag &= ~(BRKINT | ICRNL | INPCK | ISTRIP | IXON);
+	raw.c_oflag &= ~(OPOST);
+	raw.c_cflag |= (CS8);
+	raw.c_lflag &= ~(ECHO | ICANON | IEXTEN | ISIG);
+	raw.c_cc[VMIN] = 1;
+	raw.c_cc[VTIME] = 0;
+
+	return tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+}
+
+// Restores the terminal settings
+static void raw_mode_off(void) {
+	tcsetattr(STDIN_FILENO, TCSAFLUSH, &orig_termios);
+}
+
+// Returns the number of terminal columns
+static int term_cols(void) {
+	struct winsize ws;
+
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == -1 || ws.ws_col == 0) {
+		return DEFAULT_COLS;
+	}
+	return ws.ws_col;
+}
+
+/* Description: Edits a line on a terminal in raw mode till enter is pressed.
+ *
+ * Returns:		- On success, the line entered, terminated with '\n'
+ * 				- On end of input (ctrl-D on an empty line), NULL
+ */
+static char * edit_line(const char *prompt) {
+	struct line_state l;
+	char c, seq[3];
+	int tabs = 0;		// Number of consecutive tab presses
+	ssize_t n;
+	size_t i;
+
+	l.cap = 128;
+	if ((l.buf = (char *)malloc(l.cap)) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+	l.buf[0] = '\0';
+	l.len = l.pos = 0;
+	l.prompt = prompt;
+	l.plen = strlen(prompt);
+	l.cols = term_cols();
+	l.dirty = 0;
+	l.hint = NULL;
+
+	refresh_line(&l);
+
+	for (;;) {
+		n = read(STDIN_FILENO, &c, 1);
+		if (n <= 0) {
+			if (n == -1 && errno == EINTR) {
+				continue;
+			}
+			free(l.buf);
+			return NULL;
+		}
+
+		tabs = (c == KEY_TAB) ? tabs + 1 : 0;
+
+		switch (c) {
+			case KEY_CR:
+			case KEY_LF:
+				goto done;
+			case KEY_CTRL_C:	// Drop the line, an empty command is entered
+				write(STDOUT_FILENO, "^C\r\n", 4);
+				strcpy(l.buf, "\n");
+				return l.buf;
+			case KEY_CTRL_D:
+				if (l.len == 0) {	// End of input
+					write(STDOUT_FILENO, "\r\n", 2);
+					free(l.buf);
+					return NULL;
+				}
+				if (l.pos < l.len) {
+					delete_range(&l, l.pos, l.pos + 1);
+				}
+				break;
+			case KEY_BACKSPACE:
+			case KEY_CTRL_H:
+				if (l.pos > 0) {
+					delete_range(&l, l.pos - 1, l.pos);
+				}
+				break;
+			case KEY_TAB:
+				complete(&l, tabs);
+				break;
+			case KEY_CTRL_A:
+				l.pos = 0;
+				break;
+			case KEY_CTRL_E:
+				if (accept_hint(&l) == -1) {
+					l.pos = l.len;
+				}
+				break;
+			case KEY_CTRL_B:
+				if (l.pos > 0) {
+					--l.pos;
+				}
+				break;
+			case KEY_CTRL_F:
+				if (accept_hint(&l) == -1 && l.pos < l.len) {
+					++l.pos;
+				}
+				break;
+			case KEY_CTRL_K:
+				delete_range(&l, l.pos, l.len);
+				break;
+			case KEY_CTRL_U:
+				delete_range(&l, 0, l.pos);
+				break;
+			case KEY_CTRL_W:	// Delete the previous word
+				for (i = l.pos; i > 0 && l.buf[i-1] == ' '; --i);
+				for (; i > 0 && l.buf[i-1] != ' '; --i);
+				delete_range(&l, i, l.pos);
+				break;
+			case KEY_CTRL_L:
+				write(STDOUT_FILENO, "\x1b[H\x1b[2J", 7);
+				break;
+			case KEY_ESC:	// Escape sequence
+				if (read(STDIN_FILENO, seq, 1) != 1 || read(STDIN_FILENO, seq+1, 1) != 1) {
+					break;
+				}
+				if (seq[0] == '[' && seq[1] >= '0' && seq[1] <= '9') {
+					if (read(STDIN_FILENO, seq+2, 1) == 1 && seq[2] == '~') {
+						if (seq[1] == '3' && l.pos < l.len) {			// Delete
+							delete_range(&l, l.pos, l.pos + 1);
+						} else if (seq[1] == '1' || seq[1] == '7') {	// Home
+							l.pos = 0;
+						} else if ((seq[1] == '4' || seq[1] == '8') &&		// End
+							accept_hint(&l) == -1) {
+							l.pos = l.len;
+						}
+					}
+				} else if (seq[0] == '[' || seq[0] == 'O') {
+					switch (seq[1]) {
+						case 'C':	// Right
+							if (accept_hint(&l) == -1 && l.pos < l.len) {
+								++l.pos;
+							}
+							break;
+						case 'D':	// Left
+							if (l.pos > 0) {
+								--l.pos;
+							}
+							break;
+						case 'H':	// Home
+							l.pos = 0;
+							break;
+						case 'F':	// End
+							if (accept_hint(&l) == -1) {
+								l.pos = l.len;
+							}
+							break;
+					}
+				}
+				break;
+			default:
+				if ((unsigned char)c >= ' ' && insert_text(&l, &c, 1) == -1) {
+					free(l.buf);
+					return NULL;
+				}
+				break;
+		}
+
+		// Suggestions are shown only with the cursor at the end of the line
+		if (l.pos == l.len) {
+			l.hint = suggest_lookup(l.buf, l.len, l.dirty);
+			l.dirty = l.len;
+		} else {
+			l.hint = NULL;
+		}
+
+		refresh_line(&l);
+	}
+
+done:
+	l.pos = l.len;
+	l.hint = NULL;
+	refresh_line(&l);
+	write(STDOUT_FILENO, "\r\n", 2);
+
+	// Terminate the line with '\n' like getline does
+	l.buf[l.len++] = '\n';
+	l.buf[l.len] = '\0';
+
+	return l.buf;
+}
+
+/* Description: Redraws the prompt and the line, scrolling the line horizontally
+ *				when it does not fit in the terminal.
+ */
+static void refresh_line(struct line_state *l) {
+	const char *buf = l->buf;
+	size_t len = l->len;
+	size_t pos = l->pos;
+	size_t plen = l->plen;
+	size_t cols = l->cols;
+	char *out;
+	size_t olen = 0;
+	size_t hlen = 0;
+
+	// Keep the cursor visible
+	while (plen + pos >= cols && pos > 0) {
+		++buf;
+		--len;
+		--pos;
+	}
+	while (plen + len > cols && len > 0) {
+		--len;
+	}
+
+	// Show as much of the suggestion as fits
+	if (l->hint != NULL && plen + len < cols) {
+		hlen = strlen(l->hint);
+		if (plen + len + hlen > cols) {
+			hlen = cols - plen - len;
+		}
+	}
+
+	if ((out = (char *)malloc(plen + len + hlen + 48)) == NULL) {
+		return;
+	}
+
+	out[olen++] = '\r';
+	memcpy(out + olen, l->prompt, plen);
+	olen += plen;
+	memcpy(out + olen, buf, len);
+	olen += len;
+	if (hlen > 0) {		// Suggestion in grey
+		olen += sprintf(out + olen, "\x1b[90m");
+		memcpy(out + olen, l->hint, hlen);
+		olen += hlen;
+		olen += sprintf(out + olen, "\x1b[0m");
+	}
+	olen += sprintf(out + olen, "\x1b[0K\r");		// Erase to the right
+	if (plen + pos > 0) {
+		olen += sprintf(out + olen, "\x1b[%dC", (int)(plen + pos));
+	}
+
+	write(STDOUT_FILENO, out, olen);
+	free(out);
+}
+
+/* Description: Inserts text at the cursor position.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int insert_text(struct line_state *l, const char *text, size_t n) {
+	char *tmp;
+
+	// Keep space for the '\n' and '\0' added when the line is entered
+	if (l->len + n + 2 > l->cap) {
+		while (l->len + n + 2 > l->cap) {
+			l->cap *= 2;
+		}
+		if ((tmp = (char *)realloc(l->buf, l->cap)) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		l->buf = tmp;
+	}
+
+	memmove(l->buf + l->pos + n, l->buf + l->pos, l->len - l->pos + 1);
+	memcpy(l->buf + l->pos, text, n);
+	if (l->pos < l->dirty) {
+		l->dirty = l->pos;
+	}
+	l->pos += n;
+	l->len += n;
+
+	return 0;
+}
+
+// Deletes the characters in [from, to) and moves the cursor to from
+static void delete_range(struct line_state *l, size_t from, size_t to) {
+	if (from >= to) {
+		return;
+	}
+	memmove(l->buf + from, l->buf + to, l->len - to + 1);
+	l->len -= to - from;
+	l->pos = from;
+	if (from < l->dirty) {
+		l->dirty = from;
+	}
+}
+
+/* Description: Accepts the suggestion shown after the cursor.
+ *
+ * Returns:		- On success,  0
+ * 				- If there is no suggestion shown, -1
+ */
+static int accept_hint(struct line_state *l) {
+	const char *hint = l->hint;
+
+	if (hint == NULL || l->pos != l->len) {
+		return -1;
+	}
+
+	l->hint = NULL;
+	return insert_text(l, hint, strlen(hint));
+}
+
+/* Description: Completes the word under the cursor. Ambiguous completions are
+ *				listed on the second consecutive tab press.
+ */
+static void complete(struct line_state *l, int tabs) {
+	struct completion cmpl;
+	int n;
+
+	n = complete_line(l->buf, l->pos, &cmpl);
+	if (n <= 0) {
+		write(STDOUT_FILENO, "\a", 1);
+		completion_free(&cmpl);
+		return;
+	}
+
+	if (cmpl.insert != NULL && cmpl.insert[0] != '\0') {
+		insert_text(l, cmpl.insert, strlen(cmpl.insert));
+	} else if (tabs >= 2) {
+		list_matches(l, &cmpl);
+	} else {
+		write(STDOUT_FILENO, "\a", 1);
+	}
+
+	completion_free(&cmpl);
+}
+
+// Prints the completion candidates in columns below the line
+static void list_matches(struct line_state *l, const struct completion *cmpl) {
+	size_t width = 0, len;
+	int cols, rows, r, c, i;
+	char more[64];
+
+	for (i = 0; i < cmpl->listed; ++i) {
+		if ((len = strlen(cmpl->matches[i])) > width) {
+			width = len;
+		}
+	}
+	width += 2;
+
+	cols = l->cols / width;
+	if (cols < 1) {
+		cols = 1;
+	}
+	rows = (cmpl->listed + cols - 1) / cols;
+
+	write(STDOUT_FILENO, "\r\n", 2);
+	for (r = 0; r < rows; ++r) {
+		for (c = 0; c < cols; ++c) {
+			i = c * rows + r;
+			if (i >= cmpl->listed) {
+				break;
+			}
+			len = strlen(cmpl->matches[i]);
+			write(STDOUT_FILENO, cmpl->matches[i], len);
+			for (; len < width && c + 1 < cols; ++len) {
+				write(STDOUT_FILENO, " ", 1);
+			}
+		}
+		write(STDOUT_FILENO, "\r\n", 2);
+	}
+
+	if (cmpl->count > cmpl->listed) {
+		len = sprintf(more, "... and %d more\r\n", cmpl->count - cmpl->listed);
+		write(STDOUT_FILENO, more, len);
+	}
+}
@@ -0,0 +1,8 @@
+#ifndef PG_READLINE_H
+#define PG_READLINE_H
+
+// Function Prototypes
+
+char * pg_readline(const char *prompt);
+
+#endif
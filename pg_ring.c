@@ -0,0 +1,178 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * In-memory byte ring used instead of a pipe between two builtin stages of a
+ * pipeline, which run as threads of the shell. It has the semantics of a pipe:
+ * reads block until there is data and return 0 once the writer closed its end,
+ * writes block while the ring is full and fail with EPIPE once the reader closed
+ * its end. Head and tail only grow, so full and empty are never ambiguous.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "pg_error.h"
+#include "pg_ring.h"
+
+/* Description: Creates a ring.
+ *
+ * Arguments:	size:	Requested capacity, rounded up to a power of two
+ *						(0 for RING_DEFAULT_SIZE)
+ *
+ * Returns:		- On success, the ring
+ * 				- On failure, NULL
+ */
+struct ring * ring_new(size_t size) {
+	struct ring *r;
+	size_t cap = 4096;
+	
+	if (size == 0) {
+		size = RING_DEFAULT_SIZE;
+	}
+	while (cap < size) {
+		cap <<= 1;
+	}
+	
+	if ((r = (struct ring *)calloc(1, sizeof(struct ring))) == NULL) {
+		perror("calloc");
+		return NULL;
+	}
+	if ((r->buf = (char *)malloc(cap)) == NULL) {
+		perror("malloc");
+		free(r);
+		return NULL;
+	}
+	r->size = cap;
+	
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->readable, NULL);
+	pthread_cond_init(&r->writable, NULL);
+	
+	return r;
+}
+
+/* Description: Reads from a ring, waiting until there is something to read.
+ *
+ * Arguments:	r:		Ring
+ *				buf:	Destination
+ *				len:	Maximum number of bytes
+ *
+ * Returns:		- Number of bytes read
+ *				- At end of file (the writer closed and the ring is empty), 0
+ */
+ssize_t ring_read(struct ring *r, void *buf, size_t len) {
+	size_t avail, off, first;
+	
+	pthread_mutex_lock(&r->lock);
+	
+	while (r->head == r->tail && !r->wclosed) {
+		r->rwait = 1;
+		pthread_cond_wait(&r->readable, &r->lock);
+	}
+	
+	avail = r->head - r->tail;
+	if (len > avail) {
+		len = avail;
+	}
+	
+	// Copy in at most two pieces, the ring may wrap around
+	off = r->tail & (r->size - 1);
+	first = (len < r->size - off) ? len : r->size - off;
+	memcpy(buf, r->buf + off, first);
+	memcpy((char *)buf + first, r->buf, len - first);
+	r->tail += len;
+	
+	if (r->wwait && len > 0) {
+		r->wwait = 0;
+		pthread_cond_signal(&r->writable);
+	}
+	
+	pthread_mutex_unlock(&r->lock);
+	
+	return len;
+}
+
+/* Description: Writes all the given bytes to a ring, waiting while it is full.
+ *
+ * Arguments:	r:		Ring
+ *				buf:	Source
+ *				len:	Number of bytes
+ *
+ * Returns:		- On success, len
+ *				- If the reader closed its end, -1 and sets errno to EPIPE
+ */
+ssize_t ring_write(struct ring *r, const void *buf, size_t len) {
+	const char *p = (const char *)buf;
+	size_t left = len, space, chunk, off, first;
+	
+	pthread_mutex_lock(&r->lock);
+	
+	while (left > 0) {
+		while (r->head - r->tail == r->size && !r->rclosed) {
+			r->wwait = 1;
+			pthread_cond_wait(&r->writable, &r->lock);
+		}
+		if (r->rclosed) {
+			pthread_mutex_unlock(&r->lock);
+			errno = EPIPE;
+			return -1;
+		}
+		
+		space = r->size - (r->head - r->tail);
+		chunk = (left < space) ? left : space;
+		off = r->head & (r->size - 1);
+		first = (chunk < r->size - off) ? chunk : r->size - off;
+		memcpy(r->buf + off, p, first);
+		memcpy(r->buf, p + first, chunk - first);
+		r->head += chunk;
+		p += chunk;
+		left -= chunk;
+		
+		if (r->rwait) {
+			r->rwait = 0;
+			pthread_cond_signal(&r->readable);
+		}
+	}
+	
+	pthread_mutex_unlock(&r->lock);
+	
+	return len;
+}
+
+/* Description: Closes the reading end of a ring. Pending and later writes fail.
+ *
+ * Returns:		void: Nothing
+ */
+void ring_close_read(struct ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->rclosed = 1;
+	pthread_cond_broadcast(&r->writable);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Description: Closes the writing end of a ring. The reader gets end of file
+ *				after the data left in the ring.
+ *
+ * Returns:		void: Nothing
+ */
+void ring_close_write(struct ring *r) {
+	pthread_mutex_lock(&r->lock);
+	r->wclosed = 1;
+	pthread_cond_broadcast(&r->readable);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/* Description: Frees a ring. Both threads must be done with it.
+ *
+ * Returns:		void: Nothing
+ */
+void ring_free(struct ring *r) {
+	if (r == NULL) {
+		return;
+	}
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->readable);
+	pthread_cond_destroy(&r->writable);
+	free(r->buf);
+	free(r);
+}
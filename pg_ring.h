@@ -0,0 +1,33 @@
+#ifndef PG_RING_H
+#define PG_RING_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#define RING_DEFAULT_SIZE	(256 * 1024)	// Threads switch less often than processes
+
+// Byte ring buffer connecting a writer thread to a reader thread
+struct ring {
+	char *buf;
+	size_t size;			// Capacity, a power of two
+	size_t head;			// Bytes written so far
+	size_t tail;			// Bytes read so far
+	int wclosed;			// Writer is done, the reader sees end of file
+	int rclosed;			// Reader is done, writes fail with EPIPE
+	int rwait, wwait;		// A reader or a writer is waiting
+	pthread_mutex_t lock;
+	pthread_cond_t readable;
+	pthread_cond_t writable;
+};
+
+// Function Prototypes
+
+struct ring * ring_new(size_t size);
+ssize_t ring_read(struct ring *r, void *buf, size_t len);
+ssize_t ring_write(struct ring *r, const void *buf, size_t len);
+void ring_close_read(struct ring *r);
+void ring_close_write(struct ring *r);
+void ring_free(struct ring *r);
+
+#endif
@@ -0,0 +1,328 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Vectorized byte kernels of the text filter builtins. Every kernel works on 16
+ * bytes at a time with SSE2 and finishes the tail (or the whole buffer, where
+ * SSE2 is not available) with plain C, so the results never depend on the path.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "pg_simd.h"
+
+// Static Function Prototypes //
+static int is_space(unsigned char c);
+
+/* Description: Counts the occurrences of a byte.
+ *
+ * Arguments:	p:	Buffer
+ *				n:	Buffer length
+ *				c:	Byte counted
+ *
+ * Returns:		Number of occurrences
+ *
+ * Notes:		Matches are summed in byte lanes and the lanes are added up every
+ *				255 blocks, before they can overflow.
+ */
+size_t simd_count_byte(const char *p, size_t n, char c) {
+	size_t count = 0, i = 0;
+#ifdef __SSE2__
+	const __m128i needle = _mm_set1_epi8(c);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i acc, sum;
+	int blocks;
+	
+	while (i + 16 <= n) {
+		acc = zero;
+		for (blocks = 0; blocks < 255 && i + 16 <= n; ++blocks, i += 16) {
+			acc = _mm_sub_epi8(acc, _mm_cmpeq_epi8(
+				_mm_loadu_si128((const __m128i *)(p + i)), needle));
+		}
+		sum = _mm_sad_epu8(acc, zero);
+		count += _mm_cvtsi128_si32(sum) + _mm_extract_epi16(sum, 4);
+	}
+#endif
+	for (; i < n; ++i) {
+		count += (p[i] == c);
+	}
+	return count;
+}
+
+/* Description: Finds the nth occurrence of a byte.
+ *
+ * Arguments:	p:		Buffer
+ *				n:		Buffer length
+ *				c:		Byte searched
+ *				nth:	Occurrence wanted (1 for the first). If it is not found,
+ *						the occurrences seen are subtracted from it.
+ *
+ * Returns:		- If found, pointer to the occurrence
+ *				- Otherwise, NULL
+ */
+const char * simd_find_nth(const char *p, size_t n, char c, size_t *nth) {
+	size_t i = 0;
+	unsigned int mask;
+	size_t k;
+#ifdef __SSE2__
+	const __m128i needle = _mm_set1_epi8(c);
+	
+	for (; i + 16 <= n; i += 16) {
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i)), needle));
+		if (mask == 0) {
+			continue;
+		}
+		k = __builtin_popcount(mask);
+		if (k < *nth) {
+			*nth -= k;
+			continue;
+		}
+		while (--*nth > 0) {		// Drop the matches before the wanted one
+			mask &= mask - 1;
+		}
+		*nth = 0;
+		return p + i + __builtin_ctz(mask);
+	}
+#endif
+	(void)mask;
+	(void)k;
+	for (; i < n; ++i) {
+		if (p[i] == c && --*nth == 0) {
+			return p + i;
+		}
+	}
+	return NULL;
+}
+
+/* Description: Finds the nth occurrence of a byte, counting from the end.
+ *
+ * Arguments:	p:		Buffer
+ *				n:		Buffer length
+ *				c:		Byte searched
+ *				nth:	Occurrence wanted (1 for the last). If it is not found,
+ *						the occurrences seen are subtracted from it.
+ *
+ * Returns:		- If found, pointer to the occurrence
+ *				- Otherwise, NULL
+ */
+const char * simd_rfind_nth(const char *p, size_t n, char c, size_t *nth) {
+	size_t i = n;
+	unsigned int mask;
+	size_t k;
+#ifdef __SSE2__
+	const __m128i needle = _mm_set1_epi8(c);
+	
+	for (; i >= 16; i -= 16) {
+		mask = _mm_movemask_epi8(_mm_cmpeq_epi8(
+			_mm_loadu_si128((const __m128i *)(p + i - 16)), needle));
+		if (mask == 0) {
+			continue;
+		}
+		k = __builtin_popcount(mask);
+		if (k < *nth) {
+			*nth -= k;
+			continue;
+		}
+		while (--*nth > 0) {		// Drop the matches after the wanted one
+			mask &= ~(1u << (31 - __builtin_clz(mask)));
+		}
+		*nth = 0;
+		return p + i - 16 + (31 - __builtin_clz(mask));
+	}
+#endif
+	(void)mask;
+	(void)k;
+	while (i > 0) {
+		--i;
+		if (p[i] == c && --*nth == 0) {
+			return p + i;
+		}
+	}
+	return NULL;
+}
+
+/* Description: Counts the words of a buffer, words being runs of bytes other than
+ *				space, \t, \n, \v, \f and \r.
+ *
+ * Arguments:	p:		Buffer
+ *				n:		Buffer length
+ *				inword:	In: the byte before the buffer was part of a word.
+ *						Out: the last byte of the buffer is part of a word.
+ *
+ * Returns:		Number of words that start in the buffer
+ */
+size_t simd_count_words(const char *p, size_t n, int *inword) {
+	size_t count = 0, i = 0;
+	int in = *inword;
+#ifdef __SSE2__
+	const __m128i blank = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i four = _mm_set1_epi8(4);
+	__m128i x, d, sp;
+	unsigned int space, starts;
+	
+	for (; i + 16 <= n; i += 16) {
+		x = _mm_loadu_si128((const __m128i *)(p + i));
+		d = _mm_sub_epi8(x, tab);		// \t..\r are tab + 0..4
+		sp = _mm_or_si128(_mm_cmpeq_epi8(x, blank),
+			_mm_cmpeq_epi8(_mm_min_epu8(d, four), d));
+		space = _mm_movemask_epi8(sp);
+		// A word starts at a non space byte that follows a space byte
+		starts = ~space & ((space << 1) | !in) & 0xFFFF;
+		count += __builtin_popcount(starts);
+		in = !(space & 0x8000);
+	}
+#endif
+	for (; i < n; ++i) {
+		if (is_space((unsigned char)p[i])) {
+			in = 0;
+		} else {
+			count += !in;
+			in = 1;
+		}
+	}
+	
+	*inword = in;
+	return count;
+}
+
+/* Description: Finds the first occurrence of a string in a buffer.
+ *
+ * Arguments:	h:	Buffer searched
+ *				hn:	Buffer length
+ *				nd:	String searched
+ *				nn:	String length
+ *
+ * Returns:		- If found, pointer to the occurrence
+ *				- Otherwise, NULL
+ *
+ * Notes:		Candidates are positions where both the first and the last byte
+ *				of the string match, 16 positions at a time. Only they are
+ *				compared in full.
+ */
+const char * simd_memmem(const char *h, size_t hn, const char *nd, size_t nn) {
+	size_t i = 0;
+	
+	if (nn == 0) {
+		return h;
+	}
+	if (nn > hn) {
+		return NULL;
+	}
+	if (nn == 1) {
+		return (const char *)memchr(h, nd[0], hn);
+	}
+#ifdef __SSE2__
+	{
+		const __m128i first = _mm_set1_epi8(nd[0]);
+		const __m128i last = _mm_set1_epi8(nd[nn - 1]);
+		unsigned int mask;
+		
+		for (; i + nn - 1 + 16 <= hn; i += 16) {
+			mask = _mm_movemask_epi8(_mm_and_si128(
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(h + i)), first),
+				_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)(h + i + nn - 1)),
+					last)));
+			while (mask != 0) {
+				if (memcmp(h + i + __builtin_ctz(mask) + 1, nd + 1, nn - 2) == 0) {
+					return h + i + __builtin_ctz(mask);
+				}
+				mask &= mask - 1;
+			}
+		}
+	}
+#endif
+	for (; i + nn <= hn; ++i) {
+		if (h[i] == nd[0] && memcmp(h + i + 1, nd + 1, nn - 1) == 0) {
+			return h + i;
+		}
+	}
+	return NULL;
+}
+
+/* Description: Finds the ranges of a translation table, so that the translation
+ *				can be vectorized.
+ *
+ * Arguments:	map:	Translation, with its table filled in
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		A range is a run of consecutive bytes moved by the same delta,
+ *				e.g. a-z to A-Z. With more than TR_MAX_RANGES ranges nranges is
+ *				set to -1 and the table is used.
+ */
+void tr_map_build(struct tr_map *map) {
+	int c;
+	unsigned char delta;
+	
+	map->nranges = 0;
+	
+	for (c = 0; c < 256; ++c) {
+		delta = (unsigned char)(map->table[c] - c);
+		if (delta == 0) {
+			continue;
+		}
+		if (map->nranges > 0 && map->ranges[map->nranges - 1].hi == c - 1 &&
+			map->ranges[map->nranges - 1].delta == delta) {
+			map->ranges[map->nranges - 1].hi = c;	// Extend the range
+			continue;
+		}
+		if (map->nranges == TR_MAX_RANGES) {
+			map->nranges = -1;
+			return;
+		}
+		map->ranges[map->nranges].lo = c;
+		map->ranges[map->nranges].hi = c;
+		map->ranges[map->nranges].delta = delta;
+		++map->nranges;
+	}
+}
+
+/* Description: Translates a buffer in place.
+ *
+ * Arguments:	p:		Buffer
+ *				n:		Buffer length
+ *				map:	Translation built with tr_map_build
+ *
+ * Returns:		void: Nothing
+ */
+void simd_translate(char *p, size_t n, const struct tr_map *map) {
+	size_t i = 0;
+	unsigned char *u = (unsigned char *)p;
+#ifdef __SSE2__
+	__m128i lo[TR_MAX_RANGES], span[TR_MAX_RANGES], delta[TR_MAX_RANGES];
+	__m128i x, r, d, m;
+	int k;
+	
+	if (map->nranges >= 0) {
+		for (k = 0; k < map->nranges; ++k) {
+			lo[k] = _mm_set1_epi8((char)map->ranges[k].lo);
+			span[k] = _mm_set1_epi8((char)(map->ranges[k].hi - map->ranges[k].lo));
+			delta[k] = _mm_set1_epi8((char)map->ranges[k].delta);
+		}
+		for (; i + 16 <= n; i += 16) {
+			x = _mm_loadu_si128((const __m128i *)(p + i));
+			r = x;
+			for (k = 0; k < map->nranges; ++k) {
+				// x - lo <= hi - lo, unsigned
+				d = _mm_sub_epi8(x, lo[k]);
+				m = _mm_cmpeq_epi8(_mm_min_epu8(d, span[k]), d);
+				r = _mm_or_si128(_mm_andnot_si128(m, r),
+					_mm_and_si128(m, _mm_add_epi8(x, delta[k])));
+			}
+			_mm_storeu_si128((__m128i *)(p + i), r);
+		}
+	}
+#endif
+	for (; i < n; ++i) {
+		u[i] = map->table[u[i]];
+	}
+}
+
+// Checks for the bytes that separate words
+static int is_space(unsigned char c) {
+	return c == ' ' || (c >= '\t' && c <= '\r');
+}
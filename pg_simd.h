@@ -0,0 +1,28 @@
+#ifndef PG_SIMD_H
+#define PG_SIMD_H
+
+#include <stddef.h>
+
+#define TR_MAX_RANGES	4	// Ranges a translation can have to be vectorized
+
+// Byte translation. Bytes of a range [lo, hi] are moved by delta.
+struct tr_map {
+	unsigned char table[256];	// Translation of every byte
+	int nranges;				// Number of ranges, -1 if the table is needed
+	struct {
+		unsigned char lo, hi;
+		unsigned char delta;	// Added modulo 256
+	} ranges[TR_MAX_RANGES];
+};
+
+// Function Prototypes
+
+size_t simd_count_byte(const char *p, size_t n, char c);
+const char * simd_find_nth(const char *p, size_t n, char c, size_t *nth);
+const char * simd_rfind_nth(const char *p, size_t n, char c, size_t *nth);
+size_t simd_count_words(const char *p, size_t n, int *inword);
+const char * simd_memmem(const char *h, size_t hn, const char *nd, size_t nn);
+void tr_map_build(struct tr_map *map);
+void simd_translate(char *p, size_t n, const struct tr_map *map);
+
+#endif
@@ -0,0 +1,171 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Timing of the phases of the shell. Probes around the phases (see pg_stat.h)
+ * add their time to a log-linear histogram of the phase: every power of two
+ * of nanoseconds is split into STAT_SUB linear buckets, so a bucket is at
+ * most 1/STAT_SUB of its values wide and percentiles are read from the
+ * counts with that precision, in constant memory. pgstat prints them.
+ * Without PG_STAT the probes are empty and pgstat only says so.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <string.h>
+#include "pg_builtin.h"
+#include "pg_stat.h"
+
+#ifdef PG_STAT
+
+#define STAT_SUB_BITS	3						// Linear buckets of a power of two,
+#define STAT_SUB		(1 << STAT_SUB_BITS)	// as bits and as a count
+#define STAT_BUCKETS	((64 - STAT_SUB_BITS + 1) * STAT_SUB)	// Cover 64 bits
+
+// Histogram of the times of a phase
+struct hist {
+	unsigned long counts[STAT_BUCKETS];
+	unsigned long n;			// Times recorded
+	unsigned long long sum;		// Their sum (ns)
+	unsigned long long max;		// The longest (ns)
+};
+
+static struct hist hists[NPHASES];
+
+// Names of the phases, in the order of enum StatPhase
+static const char * const names[NPHASES] = {
+	"read", "parse", "compile", "expand", "spawn", "builtin", "wait"
+};
+
+// Static Function Prototypes //
+static int bucket_of(unsigned long long ns);
+static unsigned long long bucket_top(int b);
+static unsigned long long percentile(const struct hist *h, int pct);
+static void format_ns(char *buf, size_t size, unsigned long long ns);
+
+/* Description: Adds the time since a probe started to the histogram of a
+ *				phase. Called by STAT_STOP.
+ *
+ * Arguments:	phase:	Timed phase
+ *				start:	Time the probe started (CLOCK_MONOTONIC)
+ *
+ * Returns:		void: Nothing
+ */
+void stat_record(enum StatPhase phase, const struct timespec *start) {
+	struct timespec now;
+	struct hist *h = &hists[phase];
+	unsigned long long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (unsigned long long)(now.tv_sec - start->tv_sec) * 1000000000ULL +
+		now.tv_nsec - start->tv_nsec;
+
+	++h->counts[bucket_of(ns)];
+	++h->n;
+	h->sum += ns;
+	if (ns > h->max) {
+		h->max = ns;
+	}
+}
+
+/* Description: pgstat [-r]
+ *				Shows how many times every phase ran and its median, 99th
+ *				percentile and longest time. -r clears the times.
+ */
+int bi_pgstat(int argc, char **argv, struct bi_ctx *ctx) {
+	char p50[16], p99[16], max[16], avg[16];
+	const struct hist *h;
+	int i;
+
+	if (argc > 2 || (argc == 2 && strcmp(argv[1], "-r") != 0)) {
+		bi_error(ctx, "usage: pgstat [-r]");
+		return 2;
+	}
+	if (argc == 2) {
+		memset(hists, 0, sizeof(hists));
+		return 0;
+	}
+
+	bi_printf(ctx, "%-8s %10s %9s %9s %9s %9s\n", "PHASE", "COUNT", "AVG", "P50",
+		"P99", "MAX");
+	for (i = 0; i < NPHASES; ++i) {
+		h = &hists[i];
+		if (h->n == 0) {
+			continue;
+		}
+		format_ns(avg, sizeof(avg), h->sum / h->n);
+		format_ns(p50, sizeof(p50), percentile(h, 50));
+		format_ns(p99, sizeof(p99), percentile(h, 99));
+		format_ns(max, sizeof(max), h->max);
+		if (bi_printf(ctx, "%-8s %10lu %9s %9s %9s %9s\n", names[i], h->n, avg,
+			p50, p99, max) == -1) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Returns the bucket of a time: below STAT_SUB ns a bucket per nanosecond,
+// then STAT_SUB buckets per power of two
+static int bucket_of(unsigned long long ns) {
+	int e;
+
+	if (ns < STAT_SUB) {
+		return (int)ns;
+	}
+	e = 63 - __builtin_clzll(ns);		// Highest bit, at least STAT_SUB_BITS
+	return (e - STAT_SUB_BITS + 1) * STAT_SUB +
+		(int)((ns >> (e - STAT_SUB_BITS)) & (STAT_SUB - 1));
+}
+
+// Returns the largest time of a bucket
+static unsigned long long bucket_top(int b) {
+	int e = b / STAT_SUB - 1 + STAT_SUB_BITS;	// Highest bit of the bucket
+
+	if (b < STAT_SUB) {
+		return b;
+	}
+	return ((unsigned long long)(STAT_SUB + b % STAT_SUB + 1) << (e - STAT_SUB_BITS)) - 1;
+}
+
+// Returns a percentile of a histogram, the top of the bucket it falls in but
+// never more than the longest time
+static unsigned long long percentile(const struct hist *h, int pct) {
+	unsigned long rank = (h->n * pct + 99) / 100, seen = 0;
+	unsigned long long top;
+	int b;
+
+	for (b = 0; b < STAT_BUCKETS; ++b) {
+		seen += h->counts[b];
+		if (seen >= rank) {
+			break;
+		}
+	}
+	top = bucket_top(b);
+	return (top < h->max) ? top : h->max;
+}
+
+// Formats a time with a unit that keeps it short
+static void format_ns(char *buf, size_t size, unsigned long long ns) {
+	if (ns < 10000ULL) {
+		snprintf(buf, size, "%lluns", ns);
+	} else if (ns < 10000000ULL) {
+		snprintf(buf, size, "%.1fus", ns / 1e3);
+	} else if (ns < 10000000000ULL) {
+		snprintf(buf, size, "%.1fms", ns / 1e6);
+	} else {
+		snprintf(buf, size, "%.1fs", ns / 1e9);
+	}
+}
+
+#else
+
+/* Description: pgstat [-r]
+ *				Without PG_STAT there are no probes, so there is nothing to show.
+ */
+int bi_pgstat(int argc, char **argv, struct bi_ctx *ctx) {
+	(void)argc;
+	(void)argv;
+	bi_error(ctx, "built without probes (compile with -DPG_STAT)");
+	return 1;
+}
+
+#endif
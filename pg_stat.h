@@ -0,0 +1,41 @@
+#ifndef PG_STAT_H
+#define PG_STAT_H
+
+#include "pg_builtin.h"
+
+// Phases of running a command line that are timed
+enum StatPhase {
+	ST_READ,		// Reading a line of input (enter_command)
+	ST_PARSE,		// Lexing and parsing a line, cached plans skip it
+	ST_COMPILE,		// Compiling a syntax tree to a plan
+	ST_EXPAND,		// Expansions and substitutions of a pipeline
+	ST_SPAWN,		// Forking a command, in the shell
+	ST_BUILTIN,		// Running a builtin inside the shell
+	ST_WAIT,		// Waiting for the commands of a pipeline
+	NPHASES
+};
+
+// Probes are only built with -DPG_STAT (see makefile-debug). Without it they
+// are empty and the shell makes no clock calls. A probe is a variable declared
+// with STAT_VAR, after the other declarations, and the STAT_START and
+// STAT_STOP around the timed code. Only the shell's own thread records.
+#ifdef PG_STAT
+#include <time.h>
+#define STAT_VAR(t)				struct timespec t
+#define STAT_START(t)			clock_gettime(CLOCK_MONOTONIC, &(t))
+#define STAT_STOP(phase, t)		stat_record((phase), &(t))
+#else
+#define STAT_VAR(t)
+#define STAT_START(t)			((void)0)
+#define STAT_STOP(phase, t)		((void)0)
+#endif
+
+// Function Prototypes
+
+#ifdef PG_STAT
+void stat_record(enum StatPhase phase, const struct timespec *start);
+#endif
+
+int bi_pgstat(int argc, char **argv, struct bi_ctx *ctx);
+
+#endif
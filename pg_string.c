@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include "pg_error.h"
 #include "pg_string.h"
 
@@ -666,3 +668,104 @@ char * strepclean(char * dirty_str, char dirt) {
 }
 
 
+
+/* Description: Converts a size with an optional K, M or G suffix (powers of
+ *				1024) to a number of bytes, e.g. "64K" or "1M".
+ *
+ * Arguments:	str:	Size string
+ *				size:	Stores the number of bytes
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer given as an argument
+ *						# EARG  : Not a size or size too large
+ *
+ * Notes:		None
+ */
+
+int strtosize(const char *str, long *size) {
+	
+	char *end;
+	long value;
+	int shift = 0;
+	
+	if (str == NULL || size == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+	
+	if (*str < '0' || *str > '9') {		// No sign or blanks
+		pg_errno = EARG;
+		return -1;
+	}
+	
+	errno = 0;
+	value = strtol(str, &end, 10);
+	
+	switch (*end) {
+		case 'k': case 'K': shift = 10; ++end; break;
+		case 'm': case 'M': shift = 20; ++end; break;
+		case 'g': case 'G': shift = 30; ++end; break;
+	}
+	
+	if (errno != 0 || *end != '\0' || value > (LONG_MAX >> shift)) {
+		pg_errno = EARG;
+		return -1;
+	}
+	
+	*size = value << shift;
+	return 0;
+}
+
+/* Description: Converts a duration with an optional s, m, h or d suffix to
+ *				milliseconds, e.g. "10", "1.5s" or "2m". No suffix is seconds.
+ *
+ * Arguments:	str:	Duration string
+ *				ms:		Stores the number of milliseconds
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer given as an argument
+ *						# EARG  : Not a duration or duration too long
+ *
+ * Notes:		A duration shorter than a millisecond but not zero is rounded up
+ *				to one.
+ */
+
+int strtoms(const char *str, long *ms) {
+	
+	char *end;
+	double value;
+	double scale = 1000;
+	
+	if (str == NULL || ms == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+	
+	if ((*str < '0' || *str > '9') && *str != '.') {	// No sign or blanks
+		pg_errno = EARG;
+		return -1;
+	}
+	
+	errno = 0;
+	value = strtod(str, &end);
+	
+	switch (*end) {
+		case 's': ++end; break;
+		case 'm': scale *= 60; ++end; break;
+		case 'h': scale *= 3600; ++end; break;
+		case 'd': scale *= 86400; ++end; break;
+	}
+	
+	if (errno != 0 || *end != '\0' || end == str || value * scale > LONG_MAX / 2) {
+		pg_errno = EARG;
+		return -1;
+	}
+	
+	*ms = (long)(value * scale);
+	if (*ms == 0 && value > 0) {
+		*ms = 1;
+	}
+	return 0;
+}
@@ -13,5 +13,7 @@ int strcnt(const char * str);
 char * astrcat(char ** strarray, char * delim, int start, int end);
 char **ctokenize_pair(char * str, char delim);
 char * strepclean(char * dirty_str, char dirt);
+int strtosize(const char *str, long *size);
+int strtoms(const char *str, long *ms);
 
 #endif
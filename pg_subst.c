@@ -0,0 +1,211 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Process substitution. Every "<(list)" and ">(list)" of a pipeline runs in a
+ * child of the shell connected to a pipe, and the command gets "/dev/fd/N",
+ * the end of the pipe the shell keeps, as an argument or file name. Nothing is
+ * written to disk. Plans are cached and never change, so the commands of the
+ * pipeline are copied with the paths in place of the lists. Commands with
+ * command substitutions are copied too and expanded (see pg_expand.c) once
+ * their process substitutions have started.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "pg_error.h"
+#include "pg_file.h"
+#include "pg_plan.h"
+#include "processes.h"
+#include "pgsh.h"
+#include "pg_subst.h"
+
+// Static Function Prototypes //
+static int subst_start(struct subst_run *run, const char *list, int output,
+		char *path);
+
+/* Description: Starts the process substitutions of a pipeline and expands its
+ *				command substitutions.
+ *
+ * Arguments:	pl:		Planned pipeline
+ *				run:	Stores the pipeline to run, with the paths of the pipes
+ *						in place of the lists and the words expanded
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EPIPEF: A pipe could not be created
+ *						# EFORK : fork error
+ *						# EOPEN : The output of a command substitution could
+ *								  not be kept
+ *						# EWAIT : Error while waiting a command substitution
+ *
+ * Notes:		run->pipe is the pipeline itself if it has no substitutions.
+ *				subst_end must be called once it has run.
+ */
+int subst_begin(const struct plan_pipe *pl, struct subst_run *run) {
+	const struct procsub *ps;
+	struct plan_cmd *cmd;
+	char **argv;
+	struct fd_op *redirs;
+	char *paths, *block;
+	int n = 0, ncopies = 0, nargs = 0, nredirs = 0, i, j;
+
+	run->pipe = *pl;
+	run->block = NULL;
+	run->n = 0;
+	memset(&run->exp, 0, sizeof(struct expansion));
+
+	for (i = 0; i < pl->ncmds; ++i) {
+		if (pl->cmds[i].npsubs > 0 || pl->cmds[i].expand) {
+			n += pl->cmds[i].npsubs;
+			nargs += pl->cmds[i].argc + 1;
+			nredirs += pl->cmds[i].nredirs;
+			++ncopies;
+		}
+	}
+	if (ncopies == 0) {
+		return 0;
+	}
+
+	// Commands, argument vectors and redirections, then the rest
+	block = (char *)malloc(pl->ncmds * sizeof(struct plan_cmd) +
+		nargs * sizeof(char *) + nredirs * sizeof(struct fd_op) +
+		n * (sizeof(pid_t) + sizeof(int) + SUBST_PATH));
+	if (block == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+	run->block = block;
+	run->pipe.cmds = (struct plan_cmd *)block;
+	block += pl->ncmds * sizeof(struct plan_cmd);
+	argv = (char **)block;
+	block += nargs * sizeof(char *);
+	redirs = (struct fd_op *)block;
+	block += nredirs * sizeof(struct fd_op);
+	run->pids = (pid_t *)block;
+	block += n * sizeof(pid_t);
+	run->fds = (int *)block;
+	block += n * sizeof(int);
+	paths = block;
+
+	memcpy(run->pipe.cmds, pl->cmds, pl->ncmds * sizeof(struct plan_cmd));
+	for (i = 0; i < pl->ncmds; ++i) {
+		cmd = &run->pipe.cmds[i];
+		if (cmd->npsubs == 0 && !cmd->expand) {
+			continue;
+		}
+		memcpy(argv, cmd->argv, (cmd->argc + 1) * sizeof(char *));
+		cmd->argv = argv;
+		argv += cmd->argc + 1;
+		memcpy(redirs, cmd->redirs, cmd->nredirs * sizeof(struct fd_op));
+		cmd->redirs = redirs;
+		redirs += cmd->nredirs;
+
+		for (j = 0; j < cmd->npsubs; ++j) {
+			ps = &cmd->psubs[j];
+			if (subst_start(run, ps->word != -1 ? cmd->argv[ps->word] :
+				cmd->redirs[ps->redir].path, ps->output, paths) == -1) {
+				subst_end(run);
+				return -1;
+			}
+			if (ps->word != -1) {
+				cmd->argv[ps->word] = paths;
+			} else {
+				cmd->redirs[ps->redir].path = paths;
+			}
+			paths += SUBST_PATH;
+		}
+
+		if (cmd->expand && expand_cmd(cmd, &run->exp) == -1) {
+			subst_end(run);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/* Description: Ends the substitutions of a pipeline that has run. The shell
+ *				closes its pipe ends, so the lists see the end of their input
+ *				(or a closed output), waits for them and frees the expanded
+ *				words.
+ *
+ * Arguments:	run:	Process substitutions, from subst_begin
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		The exit status of the lists is not used.
+ */
+void subst_end(struct subst_run *run) {
+	int i;
+
+	for (i = 0; i < run->n; ++i) {
+		fd_unshare(run->fds[i]);
+		close(run->fds[i]);
+	}
+	for (i = 0; i < run->n; ++i) {
+		while (waitpid(run->pids[i], NULL, 0) == -1 && errno == EINTR)
+			;
+	}
+
+	expand_free(&run->exp);
+	free(run->block);
+	run->block = NULL;
+	run->n = 0;
+}
+
+// Runs a list in a child connected to a pipe, and writes the path of the end
+// the shell keeps for the command. Returns -1 on failure.
+static int subst_start(struct subst_run *run, const char *list, int output,
+		char *path) {
+	int ends[2];
+	int inner, outer;	// Ends of the list and of the command
+	char *line;
+	pid_t pid;
+	int i;
+
+	if (fd_pipe(ends) == -1) {
+		pg_errno = EPIPEF;
+		return -1;
+	}
+	inner = output ? ends[0] : ends[1];
+	outer = output ? ends[1] : ends[0];
+
+	fflush(stdout);		// Not to be written twice
+	if ((pid = fork()) == 0) {
+		// The ends of the other lists are for the command only
+		for (i = 0; i < run->n; ++i) {
+			fd_unshare(run->fds[i]);
+			close(run->fds[i]);
+		}
+		close(outer);
+		if (dup2(inner, output ? STDIN_FILENO : STDOUT_FILENO) == -1 ||
+			(line = strdup(list)) == NULL) {
+			_exit(EXIT_FAILURE);
+		}
+		handle_cmd_line(line);
+		fflush(stdout);
+		_exit(pg_status);
+	}
+
+	close(inner);
+	if (pid == -1) {
+		close(outer);
+		pg_errno = EFORK;
+		return -1;
+	}
+
+	// Unlike other pipe ends, the command inherits this one
+	fcntl(outer, F_SETFD, 0);
+	fd_share(outer);
+	run->fds[run->n] = outer;
+	run->pids[run->n] = pid;
+	++run->n;
+	snprintf(path, SUBST_PATH, "/dev/fd/%d", outer);
+
+	return 0;
+}
@@ -0,0 +1,23 @@
+#ifndef PG_SUBST_H
+#define PG_SUBST_H
+
+#include <sys/types.h>
+#include "pg_plan.h"
+#include "pg_expand.h"
+
+#define SUBST_PATH	24		// Size of a "/dev/fd/N" path
+
+// Substitutions of a running pipeline
+struct subst_run {
+	struct plan_pipe pipe;	// The pipeline, with /dev/fd paths instead of lists
+	void *block;			// Copies of the commands, NULL if nothing changed
+	int *fds;				// Pipe ends the shell keeps for the commands
+	pid_t *pids;			// Processes running the lists
+	int n;					// Number of lists started
+	struct expansion exp;	// Memory of the expanded words
+};
+
+int subst_begin(const struct plan_pipe *pl, struct subst_run *run);
+void subst_end(struct subst_run *run);
+
+#endif
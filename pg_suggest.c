@@ -0,0 +1,374 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * History based autosuggestions. Every distinct history entry is stored in a radix
+ * trie and every trie node points to the most recent entry of its subtree, so the
+ * suggestion for a prefix is found by walking the prefix. The walk is kept between
+ * keystrokes and only the part of the line that changed is walked again, so typing
+ * or deleting at the end of the line costs O(1) amortised.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pg_error.h"
+#include "pg_suggest.h"
+
+// History entry
+struct hentry {
+	char *text;			// Command without the trailing '\n'
+	size_t len;			// Command length
+};
+
+// Radix trie node
+struct rnode {
+	const char *label;	// Edge label (points into an entry's text)
+	size_t lablen;		// Label length
+	int child;			// First child (-1 if none)
+	int sibling;		// Next sibling (-1 if none)
+	int best;			// Most recent entry of the subtree
+	int term;			// Entry ending in this node (-1 if none)
+};
+
+// Position of the walk after every character of the line
+struct wstep {
+	int node;			// Node reached
+	size_t off;			// Characters of the node's label matched
+};
+
+static struct hentry *entries;
+static int nentries, ecap;
+static struct rnode *nodes;
+static int nnodes, ncap;
+
+static struct wstep *walk;		// walk[i] is the position after i characters
+static size_t wdepth;			// Number of valid walk steps after walk[0]
+static size_t wcap;
+static int wfailed;				// The line left the trie after wdepth characters
+
+// Static Function Prototypes //
+static int new_node(const char *label, size_t lablen, int best, int term);
+static void mark_path(int e);
+static int insert_entry(int e);
+static int step(struct wstep *from, char c, struct wstep *to);
+
+/* Description: Loads the commands of a history file.
+ *
+ * Arguments:	filename: History file
+ *
+ * Returns:		- On success, number of commands loaded
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *						# EOPEN : Error while opening the history file
+ *
+ * Notes:		Later lines of the file are considered more recent.
+ */
+int suggest_load(const char *filename) {
+	FILE *fp;
+	char *data, *line, *end;
+	long size;
+	int count = 0;
+
+	if (filename == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+
+	if ((fp = fopen(filename, "r")) == NULL) {
+		pg_errno = EOPEN;
+		return -1;
+	}
+
+	// The whole file is read at once and split in place
+	if (fseek(fp, 0, SEEK_END) == -1 || (size = ftell(fp)) == -1 ||
+		fseek(fp, 0, SEEK_SET) == -1) {
+		fclose(fp);
+		pg_errno = EOPEN;
+		return -1;
+	}
+	if ((data = (char *)malloc(size + 1)) == NULL) {
+		perror("malloc");
+		fclose(fp);
+		return -1;
+	}
+	size = fread(data, 1, size, fp);
+	data[size] = '\0';
+	fclose(fp);
+
+	for (line = data; line < data + size; line = end + 1) {
+		if ((end = strchr(line, '\n')) == NULL) {
+			end = data + size;
+		}
+		*end = '\0';
+		if (suggest_add(line) == -1) {
+			break;
+		}
+		++count;
+	}
+
+	free(data);
+
+	return count;
+}
+
+/* Description: Adds a command to the suggestions, as the most recent one.
+ *
+ * Arguments:	command: Command entered (a trailing '\n' is ignored)
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# ENULL : NULL pointer passed as an argument
+ *
+ * Notes:		Adding a command that already exists only makes it the most
+ *				recent one.
+ */
+int suggest_add(const char *command) {
+	struct hentry *tmp;
+	size_t len;
+	int e, old;
+
+	if (command == NULL) {
+		pg_errno = ENULL;
+		return -1;
+	}
+
+	len = strlen(command);
+	if (len > 0 && command[len-1] == '\n') {
+		--len;
+	}
+	if (len == 0) {
+		return 0;
+	}
+
+	if (nentries == ecap) {
+		ecap = (ecap == 0) ? 256 : ecap * 2;
+		if ((tmp = (struct hentry *)realloc(entries, ecap * sizeof(struct hentry)))
+			== NULL) {
+			perror("realloc");
+			return -1;
+		}
+		entries = tmp;
+	}
+	if ((entries[nentries].text = (char *)malloc(len + 1)) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	memcpy(entries[nentries].text, command, len);
+	entries[nentries].text[len] = '\0';
+	entries[nentries].len = len;
+	e = nentries++;
+
+	// The trie changed, the walk of the current line starts over
+	wdepth = 0;
+	wfailed = 0;
+
+	if ((old = insert_entry(e)) == -1) {
+		return -1;
+	}
+
+	// Command already known, the trie did not change shape. The path now
+	// points to the new copy, so point it back to the old one.
+	if (old != e) {
+		free(entries[e].text);
+		--nentries;
+		mark_path(old);
+	}
+
+	return 0;
+}
+
+/* Description: Returns the suggested completion of the given line.
+ *
+ * Arguments:	line:		Line typed so far
+ *				len:		Length of the line
+ *				unchanged:	Number of leading characters that did not change
+ *							since the previous call
+ *
+ * Returns:		- On success, the rest of the suggested command
+ * 				- If there is no suggestion, NULL
+ *
+ * Notes:		Only the characters after the unchanged ones are walked, so
+ *				typing at the end of the line is O(1) per keystroke.
+ */
+const char * suggest_lookup(const char *line, size_t len, size_t unchanged) {
+	struct wstep *tmp;
+	const struct hentry *best;
+
+	if (line == NULL || len == 0 || nnodes == 0) {
+		return NULL;
+	}
+
+	// Forget the steps of the characters that changed
+	if (unchanged < wdepth) {
+		wdepth = unchanged;
+		wfailed = 0;
+	}
+
+	if (wcap < len + 1) {
+		wcap = len + 64;
+		if ((tmp = (struct wstep *)realloc(walk, wcap * sizeof(struct wstep))) == NULL) {
+			wcap = 0;
+			wdepth = 0;
+			return NULL;
+		}
+		walk = tmp;
+	}
+
+	walk[0].node = 0;
+	walk[0].off = 0;
+
+	while (!wfailed && wdepth < len) {
+		if (step(&walk[wdepth], line[wdepth], &walk[wdepth + 1]) == -1) {
+			wfailed = 1;
+		} else {
+			++wdepth;
+		}
+	}
+
+	if (wdepth < len) {
+		return NULL;	// No history entry starts with the line
+	}
+
+	best = &entries[nodes[walk[len].node].best];
+	if (best->len <= len) {
+		return NULL;
+	}
+
+	return best->text + len;
+}
+
+/* Description: Moves the walk one character forward.
+ *
+ * Returns:		- On success,  0
+ * 				- If no entry continues with this character, -1
+ */
+static int step(struct wstep *from, char c, struct wstep *to) {
+	int child;
+
+	if (from->off < nodes[from->node].lablen) {
+		if (nodes[from->node].label[from->off] != c) {
+			return -1;
+		}
+		to->node = from->node;
+		to->off = from->off + 1;
+		return 0;
+	}
+
+	for (child = nodes[from->node].child; child != -1; child = nodes[child].sibling) {
+		if (nodes[child].label[0] == c) {
+			to->node = child;
+			to->off = 1;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/* Description: Makes an existing entry the best suggestion of every node on its
+ *				path.
+ */
+static void mark_path(int e) {
+	const char *text = entries[e].text;
+	size_t i = 0;
+	int node = 0;
+
+	nodes[node].best = e;
+	while (i < entries[e].len) {
+		for (node = nodes[node].child; nodes[node].label[0] != text[i];
+			node = nodes[node].sibling);
+		nodes[node].best = e;
+		i += nodes[node].lablen;
+	}
+}
+
+/* Description: Inserts an entry to the trie and makes it the best suggestion of
+ *				every node on its path.
+ *
+ * Returns:		- On success, the entry stored for this text, which is an older
+ *				  entry if the same text was already inserted
+ * 				- On failure, -1
+ */
+static int insert_entry(int e) {
+	const char *text = entries[e].text;
+	size_t len = entries[e].len;
+	size_t i = 0, common;
+	int node, child, prev, mid;
+
+	if (nnodes == 0 && new_node("", 0, e, -1) == -1) {	// Root
+		return -1;
+	}
+
+	node = 0;
+	nodes[node].best = e;
+
+	while (i < len) {
+		prev = -1;
+		for (child = nodes[node].child; child != -1 && nodes[child].label[0] != text[i];
+			prev = child, child = nodes[child].sibling);
+
+		if (child == -1) {		// New leaf
+			if ((child = new_node(text + i, len - i, e, e)) == -1) {
+				return -1;
+			}
+			nodes[child].sibling = nodes[node].child;
+			nodes[node].child = child;
+			return e;
+		}
+
+		for (common = 1; common < nodes[child].lablen && i + common < len &&
+			nodes[child].label[common] == text[i + common]; ++common);
+
+		if (common < nodes[child].lablen) {		// Split the edge
+			if ((mid = new_node(nodes[child].label, common, e, -1)) == -1) {
+				return -1;
+			}
+			nodes[mid].sibling = nodes[child].sibling;
+			nodes[mid].child = child;
+			nodes[child].sibling = -1;
+			nodes[child].label += common;
+			nodes[child].lablen -= common;
+			if (prev == -1) {
+				nodes[node].child = mid;
+			} else {
+				nodes[prev].sibling = mid;
+			}
+			child = mid;
+		}
+
+		nodes[child].best = e;
+		node = child;
+		i += common;
+	}
+
+	if (nodes[node].term == -1) {
+		nodes[node].term = e;
+	}
+	return nodes[node].term;
+}
+
+/* Description: Allocates a new trie node.
+ *
+ * Returns:		- On success, index of the new node
+ * 				- On failure, -1
+ */
+static int new_node(const char *label, size_t lablen, int best, int term) {
+	struct rnode *tmp;
+
+	if (nnodes == ncap) {
+		ncap = (ncap == 0) ? 512 : ncap * 2;
+		if ((tmp = (struct rnode *)realloc(nodes, ncap * sizeof(struct rnode))) == NULL) {
+			perror("realloc");
+			return -1;
+		}
+		nodes = tmp;
+	}
+
+	nodes[nnodes].label = label;
+	nodes[nnodes].lablen = lablen;
+	nodes[nnodes].child = -1;
+	nodes[nnodes].sibling = -1;
+	nodes[nnodes].best = best;
+	nodes[nnodes].term = term;
+
+	return nnodes++;
+}
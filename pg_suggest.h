@@ -0,0 +1,12 @@
+#ifndef PG_SUGGEST_H
+#define PG_SUGGEST_H
+
+#include <stddef.h>
+
+// Function Prototypes
+
+int suggest_load(const char *filename);
+int suggest_add(const char *command);
+const char * suggest_lookup(const char *line, size_t len, size_t unchanged);
+
+#endif
@@ -0,0 +1,236 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Deadlines of commands. The timeout builtin runs a command in a process group
+ * of its own and stops the whole group when the duration passes: first with a
+ * signal (SIGTERM) and, if that is not enough, with SIGKILL after a grace
+ * period. The deadline builtin sets a deadline that applies to every external
+ * command of the session. Both wait with deadline_wait, which polls a timerfd
+ * together with the pidfds of the commands.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "pg_error.h"
+#include "pg_string.h"
+#include "processes.h"
+#include "pg_builtin.h"
+
+#define TIMEOUT_FAILED	125		// timeout itself failed
+#define TIMEOUT_NOEXEC	126		// The command could not be run
+#define TIMEOUT_NOENT	127		// The command was not found
+
+// Options of timeout
+struct timeout_opts {
+	int sig;			// Signal sent at the deadline (-s)
+	long grace;			// Time from sig to SIGKILL (-k)
+	int foreground;		// Only the command is signalled (--foreground)
+	long ms;			// Duration
+	int first;			// Index of the command
+};
+
+// Signals timeout takes by name
+static const struct {
+	const char *name;
+	int sig;
+} signames[] = {
+	{ "HUP", SIGHUP }, { "INT", SIGINT }, { "QUIT", SIGQUIT },
+	{ "KILL", SIGKILL }, { "USR1", SIGUSR1 }, { "USR2", SIGUSR2 },
+	{ "ALRM", SIGALRM }, { "TERM", SIGTERM }
+};
+
+// Static Function Prototypes //
+static int get_timeout_opts(int argc, char **argv, struct timeout_opts *o);
+static int signal_number(const char *name);
+static int print_ms(struct bi_ctx *ctx, const char *what, long ms);
+
+/* Description: timeout [-s SIGNAL] [-k GRACE] [--foreground] DURATION COMMAND
+ *						[ARG]...
+ *				Runs COMMAND and sends SIGNAL (TERM) to its process group if it
+ *				is still running after DURATION, then KILL after GRACE (the
+ *				session grace, see deadline). -k 0 sends no KILL. With
+ *				--foreground the command stays in the shell's process group, so
+ *				it can read the terminal, and only the command is signalled.
+ *				Durations take an s, m, h or d suffix.
+ *				Exits with 124 if the deadline passed (137 if KILL was needed),
+ *				125 if timeout failed, 126 or 127 if COMMAND could not be run
+ *				and with the status of COMMAND otherwise.
+ */
+int bi_timeout(int argc, char **argv, struct bi_ctx *ctx) {
+	struct timeout_opts o;
+	pid_t pid;
+	int status, timedOut = 0;
+
+	if (get_timeout_opts(argc, argv, &o) == -1) {
+		bi_error(ctx, "usage: timeout [-s SIGNAL] [-k GRACE] [--foreground] "
+			"DURATION COMMAND [ARG]...");
+		return TIMEOUT_FAILED;
+	}
+	if (ctx->in < -1 || ctx->out < 0 || ctx->err < 0) {
+		bi_error(ctx, "cannot run a command connected to a ring");
+		return TIMEOUT_FAILED;
+	}
+
+	pid = spawn_argv(argv + o.first, ctx->in, ctx->out, ctx->err,
+		o.foreground ? 0 : SPAWN_PGROUP);
+	if (pid == -1) {
+		bi_error(ctx, "%s: %s", argv[o.first], strerror(errno));
+		return (errno == ENOENT) ? TIMEOUT_NOENT : TIMEOUT_NOEXEC;
+	}
+
+	if (o.ms > 0) {
+		timedOut = deadline_wait(&pid, 1, o.ms, o.grace, o.sig, !o.foreground) == 1;
+	}
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR) {
+			bi_error(ctx, "wait: %s", strerror(errno));
+			return TIMEOUT_FAILED;
+		}
+	}
+
+	if (timedOut) {
+		if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL && o.sig != SIGKILL) {
+			return 128 + SIGKILL;
+		}
+		return TIMEOUT_STATUS;
+	}
+	if (WIFSIGNALED(status)) {
+		return 128 + WTERMSIG(status);
+	}
+	return WEXITSTATUS(status);
+}
+
+/* Description: Checks if the timeout builtin handles the arguments.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_timeout_accepts(int argc, char **argv) {
+	struct timeout_opts o;
+
+	return get_timeout_opts(argc, argv, &o) == 0;
+}
+
+/* Description: deadline [DURATION [GRACE] | off]
+ *				Shows or sets the deadline of every external command of the
+ *				session. A command still running at the deadline is sent TERM,
+ *				and KILL GRACE (5s) later, and its status is 124. When the shell
+ *				does not read a terminal, commands run in process groups of
+ *				their own and everything they started is signalled too.
+ */
+int bi_deadline(int argc, char **argv, struct bi_ctx *ctx) {
+	long ms, grace = pg_grace;
+
+	if (argc > 3) {
+		bi_error(ctx, "usage: deadline [DURATION [GRACE] | off]");
+		return 2;
+	}
+
+	if (argc == 1) {
+		if (pg_deadline == 0) {
+			return bi_printf(ctx, "off\n") == -1 ? 1 : 0;
+		}
+		if (print_ms(ctx, "deadline ", pg_deadline) == -1 ||
+			print_ms(ctx, ", grace ", pg_grace) == -1) {
+			return 1;
+		}
+		return bi_printf(ctx, "\n") == -1 ? 1 : 0;
+	}
+
+	if (strcmp(argv[1], "off") == 0) {
+		pg_deadline = 0;
+		return 0;
+	}
+	if (strtoms(argv[1], &ms) == -1 || (argc == 3 && strtoms(argv[2], &grace) == -1)) {
+		bi_error(ctx, "invalid duration");
+		return 2;
+	}
+	pg_deadline = ms;
+	pg_grace = grace;
+
+	return 0;
+}
+
+// Parses the options of timeout. Returns -1 for unsupported arguments.
+static int get_timeout_opts(int argc, char **argv, struct timeout_opts *o) {
+	const char *value;
+	char opt;
+	int i;
+
+	o->sig = SIGTERM;
+	o->grace = pg_grace;
+	o->foreground = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		if (strcmp(argv[i], "--foreground") == 0) {
+			o->foreground = 1;
+			continue;
+		}
+		opt = argv[i][1];
+		if (opt != 's' && opt != 'k') {
+			return -1;
+		}
+
+		if (argv[i][2] != '\0') {
+			value = argv[i] + 2;
+		} else if (i + 1 < argc) {
+			value = argv[++i];
+		} else {
+			return -1;
+		}
+		if (opt == 's') {
+			if ((o->sig = signal_number(value)) == -1) {
+				return -1;
+			}
+		} else if (strtoms(value, &o->grace) == -1) {
+			return -1;
+		}
+	}
+
+	// Duration and command
+	if (argc - i < 2 || strtoms(argv[i], &o->ms) == -1) {
+		return -1;
+	}
+
+	o->first = i + 1;
+	return 0;
+}
+
+// Converts a signal name (TERM, SIGTERM) or number. Returns -1 if it is neither.
+static int signal_number(const char *name) {
+	char *end;
+	long sig;
+	size_t i;
+
+	if (name[0] >= '0' && name[0] <= '9') {
+		sig = strtol(name, &end, 10);
+		return (*end == '\0' && sig > 0 && sig < NSIG) ? (int)sig : -1;
+	}
+
+	if (strncmp(name, "SIG", 3) == 0) {
+		name += 3;
+	}
+	for (i = 0; i < sizeof(signames) / sizeof(signames[0]); ++i) {
+		if (strcmp(name, signames[i].name) == 0) {
+			return signames[i].sig;
+		}
+	}
+	return -1;
+}
+
+// Prints a duration of the deadline builtin
+static int print_ms(struct bi_ctx *ctx, const char *what, long ms) {
+	if (ms % 1000 == 0) {
+		return bi_printf(ctx, "%s%lds", what, ms / 1000);
+	}
+	return bi_printf(ctx, "%s%ld.%03lds", what, ms / 1000, ms % 1000);
+}
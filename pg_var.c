@@ -0,0 +1,612 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * Shell variables. Variables live in an open addressing hash table (linear
+ * probing) and every one is kept as a single "NAME=VALUE" string, so exported
+ * variables go to the environment of commands as they are. The environment
+ * array is only built again when an exported variable has changed since it
+ * was last built: every change bumps a generation counter and var_environ
+ * compares it with the generation of the array.
+ * The environment of the shell is imported at startup and environ always
+ * points to the last array built, so getenv still works.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE		// environ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "pg_error.h"
+#include "pg_builtin.h"
+#include "pg_var.h"
+#include "processes.h"
+
+#define VAR_SLOTS_MIN	64		// Initial size of the table, a power of two
+
+// Variable of the table
+struct var {
+	char *str;			// "NAME=VALUE", or "NAME" if it has no value yet
+	size_t nlen;		// Length of the name
+	unsigned long hash;
+	int flags;
+};
+
+static struct var *slots;		// Hash table
+static size_t nslots;			// Size of the table, a power of two
+static size_t nused;			// Slots that are not empty, deleted ones too
+static char deleted[] = "";		// str of a deleted variable
+
+static unsigned long gen = 1;	// Generation of the exported variables
+static unsigned long built;		// Generation of envp
+static char **envp;				// Environment of commands
+
+static pid_t shell_pid;			// Value of $$, the same in subshells
+
+static char **retired;			// Strings envp may still point to
+static size_t nretired, retiredcap;
+
+static struct var_args args;	// Positional parameters of the running function
+static char *joined;			// "$*", built when it is first used
+static size_t joinedcap;
+static int joinedok;			// joined holds the current parameters
+
+// Static Function Prototypes //
+static struct var * var_find(const char *name, size_t len, unsigned long hash);
+static int var_grow(void);
+static void var_retire(struct var *v);
+static unsigned long hash_name(const char *name, size_t len);
+static const char * args_join(void);
+
+/* Description: Imports the environment of the shell as exported variables.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ *
+ * Notes:		Entries of the environment that are not "NAME=VALUE" with a
+ *				valid name are left out.
+ */
+int var_init(void) {
+	char **e;
+	size_t len;
+
+	shell_pid = getpid();
+	for (e = environ; e != NULL && *e != NULL; ++e) {
+		len = var_name_len(*e);
+		if (len > 0 && (*e)[len] == '=' &&
+			var_set(*e, len, *e + len + 1, VAR_EXPORT) == -1) {
+			return -1;
+		}
+	}
+	var_environ();
+
+	return 0;
+}
+
+/* Description: Measures the variable name at the start of a string, a letter
+ *				or '_' followed by letters, digits and '_'.
+ *
+ * Returns:		The length of the name, 0 if the string does not start with one
+ */
+size_t var_name_len(const char *s) {
+	size_t len = 0;
+
+	if (s == NULL || !((*s >= 'a' && *s <= 'z') || (*s >= 'A' && *s <= 'Z') ||
+		*s == '_')) {
+		return 0;
+	}
+	while ((s[len] >= 'a' && s[len] <= 'z') || (s[len] >= 'A' && s[len] <= 'Z') ||
+		(s[len] >= '0' && s[len] <= '9') || s[len] == '_') {
+		++len;
+	}
+	return len;
+}
+
+/* Description: Finds the value of a variable.
+ *
+ * Arguments:	name:	Name, not necessarily NUL terminated
+ *				len:	Length of the name
+ *
+ * Returns:		- If the variable has a value, the value
+ * 				- Otherwise, NULL
+ *
+ * Notes:		The value is only valid till the variable changes.
+ */
+const char * var_lookup(const char *name, size_t len) {
+	struct var *v;
+
+	if (slots == NULL || (v = var_find(name, len, hash_name(name, len))) == NULL ||
+		v->str == NULL || v->str == deleted || v->str[len] == '\0') {
+		return NULL;
+	}
+	return v->str + len + 1;
+}
+
+/* Description: Finds the value of a variable by its NUL terminated name.
+ *
+ * Returns:		- If the variable has a value, the value
+ * 				- Otherwise, NULL
+ */
+const char * var_get(const char *name) {
+	return name == NULL ? NULL : var_lookup(name, strlen(name));
+}
+
+/* Description: Finds the value of a parameter, a variable or one of the
+ *				special parameters ? $ # ! 0, 1 to 9, @ and *.
+ *
+ * Arguments:	name:	Name, not necessarily NUL terminated
+ *				len:	Length of the name
+ *				num:	Space for the value of a numeric parameter, 24 bytes
+ *
+ * Returns:		- If the parameter is set, the value
+ * 				- Otherwise, NULL
+ *
+ * Notes:		Positional parameters are the arguments of the running
+ *				function, $@ and $* are them joined with spaces ("$@" is
+ *				split by the expansion). The shell has no background jobs,
+ *				so $! is never set.
+ */
+const char * var_param(const char *name, size_t len, char *num) {
+
+	if (len != 1 || var_name_len(name) == 1) {
+		return var_lookup(name, len);
+	}
+
+	switch (*name) {
+		case '?':
+			snprintf(num, 24, "%d", pg_status);
+			return num;
+		case '$':
+			snprintf(num, 24, "%ld", (long)shell_pid);
+			return num;
+		case '#':
+			snprintf(num, 24, "%d", args.n);
+			return num;
+		case '0':
+			return "pgsh";
+		case '@':
+		case '*':
+			return args_join();
+		default:
+			if (*name >= '1' && *name <= '9' && *name - '0' <= args.n) {
+				return args.v[*name - '1'];
+			}
+			return NULL;
+	}
+}
+
+/* Description: Sets a variable, creating it if it does not exist.
+ *
+ * Arguments:	name:	Name, not necessarily NUL terminated
+ *				len:	Length of the name
+ *				value:	New value, NULL to keep the current one
+ *				flags:	Flags added to the variable (VAR_EXPORT)
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG : Invalid name
+ */
+int var_set(const char *name, size_t len, const char *value, int flags) {
+	struct var *v;
+	unsigned long hash;
+	char *str;
+	size_t vlen;
+
+	if (name == NULL || len == 0 || var_name_len(name) < len) {
+		pg_errno = EARG;
+		return -1;
+	}
+
+	if ((nused + 1) * 2 > nslots && var_grow() == -1) {
+		return -1;
+	}
+	hash = hash_name(name, len);
+	v = var_find(name, len, hash);
+
+	if (v->str != NULL && v->str != deleted) {
+		if (value == NULL) {
+			if ((flags & ~v->flags) & VAR_EXPORT) {
+				++gen;		// Exported now
+			}
+			v->flags |= flags;
+			return 0;
+		}
+		vlen = strlen(value);
+		if (v->str[len] == '=' && strcmp(v->str + len + 1, value) == 0 &&
+			(flags & ~v->flags) == 0) {
+			return 0;		// Nothing changed
+		}
+	} else {
+		vlen = (value != NULL) ? strlen(value) : 0;
+	}
+
+	if ((str = (char *)malloc(len + vlen + 2)) == NULL) {
+		perror("malloc");
+		return -1;
+	}
+	memcpy(str, name, len);
+	str[len] = '\0';
+	if (value != NULL) {
+		str[len] = '=';
+		memcpy(str + len + 1, value, vlen + 1);
+	}
+
+	if (v->str == NULL) {
+		++nused;
+	}
+	if (v->str != NULL && v->str != deleted) {
+		var_retire(v);
+		v->flags |= flags;
+	} else {
+		v->flags = flags;
+	}
+	v->str = str;
+	v->nlen = len;
+	v->hash = hash;
+	if (v->flags & VAR_EXPORT) {
+		++gen;
+	}
+
+	return 0;
+}
+
+/* Description: Sets a variable from an assignment word, "NAME=VALUE".
+ *
+ * Arguments:	word:	Assignment
+ *				flags:	Flags added to the variable (VAR_EXPORT)
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG : The word is not an assignment
+ */
+int var_assign(const char *word, int flags) {
+	size_t len = var_name_len(word);
+
+	if (len == 0 || word[len] != '=') {
+		pg_errno = EARG;
+		return -1;
+	}
+	return var_set(word, len, word + len + 1, flags);
+}
+
+/* Description: Removes a variable.
+ *
+ * Arguments:	name:	Name of the variable
+ *
+ * Returns:		- On success,  0 (also if the variable did not exist)
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG : Invalid name
+ */
+int var_unset(const char *name) {
+	struct var *v;
+	size_t len = var_name_len(name);
+
+	if (len == 0 || name[len] != '\0') {
+		pg_errno = EARG;
+		return -1;
+	}
+	if (slots == NULL || (v = var_find(name, len, hash_name(name, len))) == NULL ||
+		v->str == NULL || v->str == deleted) {
+		return 0;
+	}
+
+	if (v->flags & VAR_EXPORT) {
+		++gen;
+	}
+	var_retire(v);
+	v->str = deleted;
+	v->flags = 0;
+
+	return 0;
+}
+
+/* Description: Returns the environment of commands, the exported variables
+ *				with a value. The array is only built again if an exported
+ *				variable changed since it was last built.
+ *
+ * Returns:		The environment, which environ is set to
+ *
+ * Notes:		Only called by the shell's own thread, before it starts
+ *				commands. Strings of changed variables are freed here, once
+ *				no environment points to them.
+ */
+char ** var_environ(void) {
+	char **tmp;
+	size_t i, n = 0;
+
+	if (built == gen && envp != NULL) {
+		return envp;
+	}
+
+	for (i = 0; i < nslots; ++i) {
+		if (slots[i].str != NULL && slots[i].str != deleted &&
+			(slots[i].flags & VAR_EXPORT) && slots[i].str[slots[i].nlen] == '=') {
+			++n;
+		}
+	}
+	if ((tmp = (char **)malloc((n + 1) * sizeof(char *))) == NULL) {
+		perror("malloc");
+		return envp != NULL ? envp : environ;	// Old environment, till next time
+	}
+	for (i = 0, n = 0; i < nslots; ++i) {
+		if (slots[i].str != NULL && slots[i].str != deleted &&
+			(slots[i].flags & VAR_EXPORT) && slots[i].str[slots[i].nlen] == '=') {
+			tmp[n++] = slots[i].str;
+		}
+	}
+	tmp[n] = NULL;
+
+	environ = tmp;
+	free(envp);
+	envp = tmp;
+	built = gen;
+
+	while (nretired > 0) {
+		free(retired[--nretired]);
+	}
+
+	return envp;
+}
+
+/* Description: Returns the environment of a command with assignments of its
+ *				own, "NAME=VALUE cmd": the environment of commands with the
+ *				assigned variables replaced or added. The strings are shared
+ *				with the shell, only the array of pointers is new.
+ *
+ * Arguments:	assigns:	Assignments, "NAME=VALUE"
+ *				n:			Number of assignments
+ *
+ * Returns:		- On success, the environment, to be freed by the caller
+ * 				- On failure, NULL
+ *
+ * Notes:		Meant for the forked child that executes the command, so the
+ *				environment of the shell never changes around a fork.
+ */
+char ** var_overlay(char **assigns, int n) {
+	char **base = (envp != NULL) ? envp : environ;
+	char **env;
+	size_t nbase, len;
+	int i, j, m = 0, nover;
+
+	for (nbase = 0; base[nbase] != NULL; ++nbase)
+		;
+	if ((env = (char **)malloc((nbase + n + 1) * sizeof(char *))) == NULL) {
+		perror("malloc");
+		return NULL;
+	}
+
+	// The last assignment of a name wins
+	for (i = 0; i < n; ++i) {
+		len = var_name_len(assigns[i]);
+		if (len == 0 || assigns[i][len] != '=') {
+			continue;
+		}
+		for (j = i + 1; j < n && strncmp(assigns[j], assigns[i], len + 1) != 0; ++j)
+			;
+		if (j == n) {
+			env[m++] = assigns[i];
+		}
+	}
+	nover = m;
+
+	for (i = 0; (size_t)i < nbase; ++i) {
+		for (j = 0; j < nover &&
+			strncmp(base[i], env[j], var_name_len(env[j]) + 1) != 0; ++j)
+			;
+		if (j == nover) {
+			env[m++] = base[i];
+		}
+	}
+	env[m] = NULL;
+
+	return env;
+}
+
+/* Description: Returns the positional parameters.
+ *
+ * Arguments:	n:	Stores the number of parameters
+ *
+ * Returns:		The parameters, $1 first
+ */
+char ** var_args_get(int *n) {
+	*n = args.n;
+	return args.v;
+}
+
+/* Description: Swaps the positional parameters with others, to set the
+ *				arguments of a function and to restore the caller's after it.
+ *
+ * Arguments:	a:	New parameters, stores the old ones
+ *
+ * Returns:		void: Nothing
+ *
+ * Notes:		The parameters are not copied and must live till they are
+ *				swapped back.
+ */
+void var_args_swap(struct var_args *a) {
+	struct var_args old = args;
+
+	args = *a;
+	*a = old;
+	joinedok = 0;
+}
+
+/* Description: export [NAME[=VALUE]]...
+ *				Exports variables, setting them first if a value is given.
+ *				Without arguments prints the exported variables.
+ */
+int bi_export(int argc, char **argv, struct bi_ctx *ctx) {
+	size_t i, len;
+	int status = 0;
+
+	if (argc == 1) {
+		for (i = 0; i < nslots; ++i) {
+			if (slots[i].str == NULL || slots[i].str == deleted ||
+				!(slots[i].flags & VAR_EXPORT)) {
+				continue;
+			}
+			if (slots[i].str[slots[i].nlen] == '\0') {
+				bi_printf(ctx, "export %s\n", slots[i].str);
+			} else if (bi_printf(ctx, "export %.*s=\"%s\"\n", (int)slots[i].nlen,
+				slots[i].str, slots[i].str + slots[i].nlen + 1) == -1) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+
+	for (i = 1; i < (size_t)argc; ++i) {
+		len = var_name_len(argv[i]);
+		if (len == 0 || (argv[i][len] != '\0' && argv[i][len] != '=')) {
+			bi_error(ctx, "%s: not a valid name", argv[i]);
+			status = 1;
+			continue;
+		}
+		if (var_set(argv[i], len, argv[i][len] == '=' ? argv[i] + len + 1 : NULL,
+			VAR_EXPORT) == -1) {
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+/* Description: unset NAME...
+ *				Removes variables.
+ */
+int bi_unset(int argc, char **argv, struct bi_ctx *ctx) {
+	int i, status = 0;
+
+	for (i = 1; i < argc; ++i) {
+		if (var_unset(argv[i]) == -1) {
+			bi_error(ctx, "%s: not a valid name", argv[i]);
+			status = 1;
+		}
+	}
+
+	return status;
+}
+
+// Finds the slot of a variable, or the empty slot it would take (NULL if
+// there is no table)
+static struct var * var_find(const char *name, size_t len, unsigned long hash) {
+	struct var *tomb = NULL;	// First deleted slot on the way
+	struct var *v;
+	size_t i;
+
+	if (slots == NULL) {
+		return NULL;
+	}
+
+	for (i = hash & (nslots - 1); ; i = (i + 1) & (nslots - 1)) {
+		v = &slots[i];
+		if (v->str == NULL) {
+			return tomb != NULL ? tomb : v;
+		}
+		if (v->str == deleted) {
+			if (tomb == NULL) {
+				tomb = v;
+			}
+		} else if (v->hash == hash && v->nlen == len &&
+			memcmp(v->str, name, len) == 0) {
+			return v;
+		}
+	}
+}
+
+// Doubles the table (or creates it) and drops the deleted slots. Returns -1
+// on failure.
+static int var_grow(void) {
+	struct var *old = slots;
+	size_t oldn = nslots, i, j;
+
+	nslots = (oldn == 0) ? VAR_SLOTS_MIN : oldn * 2;
+	if ((slots = (struct var *)calloc(nslots, sizeof(struct var))) == NULL) {
+		perror("calloc");
+		slots = old;
+		nslots = oldn;
+		return -1;
+	}
+
+	nused = 0;
+	for (i = 0; i < oldn; ++i) {
+		if (old[i].str == NULL || old[i].str == deleted) {
+			continue;
+		}
+		for (j = old[i].hash & (nslots - 1); slots[j].str != NULL;
+			j = (j + 1) & (nslots - 1))
+			;
+		slots[j] = old[i];
+		++nused;
+	}
+	free(old);
+
+	return 0;
+}
+
+// Frees the string of a variable, later if the environment may point to it
+static void var_retire(struct var *v) {
+	char **tmp;
+
+	if (!(v->flags & VAR_EXPORT)) {
+		free(v->str);
+		return;
+	}
+
+	if (nretired == retiredcap) {
+		retiredcap = (retiredcap == 0) ? 16 : retiredcap * 2;
+		if ((tmp = (char **)realloc(retired, retiredcap * sizeof(char *))) == NULL) {
+			perror("realloc");
+			retiredcap = nretired;
+			return;		// Leaked rather than freed too early
+		}
+		retired = tmp;
+	}
+	retired[nretired++] = v->str;
+}
+
+// Hashes a variable name (FNV-1a)
+static unsigned long hash_name(const char *name, size_t len) {
+	unsigned long hash = 2166136261UL;
+	size_t i;
+
+	for (i = 0; i < len; ++i) {
+		hash = (hash ^ (unsigned char)name[i]) * 16777619UL;
+	}
+	return hash;
+}
+
+// Joins the positional parameters with spaces, for $* and $@. Returns NULL if
+// there are none.
+static const char * args_join(void) {
+	size_t len = 0, n;
+	char *tmp;
+	int i;
+
+	if (args.n == 0) {
+		return NULL;
+	}
+	if (joinedok) {
+		return joined;
+	}
+
+	for (i = 0; i < args.n; ++i) {
+		len += strlen(args.v[i]) + 1;
+	}
+	if (len > joinedcap) {
+		if ((tmp = (char *)realloc(joined, len)) == NULL) {
+			perror("realloc");
+			return NULL;
+		}
+		joined = tmp;
+		joinedcap = len;
+	}
+	for (i = 0, len = 0; i < args.n; ++i) {
+		n = strlen(args.v[i]);
+		memcpy(joined + len, args.v[i], n);
+		len += n;
+		joined[len++] = ' ';
+	}
+	joined[len - 1] = '\0';
+	joinedok = 1;
+
+	return joined;
+}
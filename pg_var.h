@@ -0,0 +1,32 @@
+#ifndef PG_VAR_H
+#define PG_VAR_H
+
+#include <stddef.h>
+#include "pg_builtin.h"
+
+// Variable flags
+#define VAR_EXPORT	0x01	// Passed to the environment of commands, else local
+
+// Positional parameters, $1 and on
+struct var_args {
+	char **v;
+	int n;
+};
+
+int var_init(void);
+size_t var_name_len(const char *s);
+const char * var_lookup(const char *name, size_t len);
+const char * var_get(const char *name);
+const char * var_param(const char *name, size_t len, char *num);
+int var_set(const char *name, size_t len, const char *value, int flags);
+int var_assign(const char *word, int flags);
+int var_unset(const char *name);
+char ** var_environ(void);
+char ** var_overlay(char **assigns, int n);
+char ** var_args_get(int *n);
+void var_args_swap(struct var_args *args);
+
+int bi_export(int argc, char **argv, struct bi_ctx *ctx);
+int bi_unset(int argc, char **argv, struct bi_ctx *ctx);
+
+#endif
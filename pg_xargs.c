@@ -0,0 +1,534 @@
+/* * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * *
+ * Description:
+ * The xargs builtin. Items are read from the builtin's input and packed into
+ * argument vectors as big as the kernel takes: sysconf(_SC_ARG_MAX) less the
+ * environment and some headroom. Every batch is started with spawn_argv, which
+ * does not fork the shell, and up to -P batches run at the same time. Output of
+ * the commands goes straight to the builtin's output, or through a pump thread
+ * when the output is a ring.
+ * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * * */
+
+#define _GNU_SOURCE		// environ
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "pg_error.h"
+#include "pg_string.h"
+#include "pg_file.h"
+#include "processes.h"
+#include "pg_builtin.h"
+
+#define XARGS_BUFSIZE	(64 * 1024)		// Input read at a time
+#define XARGS_HEADROOM	2048			// Left free in the argument space (POSIX)
+#define XARGS_ARG_MAX	(128 * 1024)	// If sysconf does not know
+
+// Options of xargs
+struct xargs_opts {
+	int nul;		// Items end with NUL (-0)
+	int maxargs;	// Items per command (-n), 0 for no limit
+	int procs;		// Commands run at the same time (-P)
+	long size;		// Characters of a command line (-s), 0 for no limit
+	int norun;		// No command for empty input (-r)
+	int first;		// Index of the command
+};
+
+// Running xargs
+struct xargs {
+	struct bi_ctx *ctx;
+	const struct xargs_opts *o;
+	char **cmd;			// Command and initial arguments
+	int ncmd;
+	char **vec;			// Argument vector of a batch
+	char *strs;			// Items of the batch, NUL terminated
+	size_t len, cap;
+	size_t *offs;		// Offsets of the items in strs
+	int nitems, itemcap;
+	size_t size;		// Argument space the batch takes, pointers included
+	size_t limit;		// Argument space a command may take
+	size_t chars;		// Characters of the batch's command line
+	size_t maxchars;	// Characters a command line may have (-s)
+	pid_t *pids;		// Running commands
+	int *pidfds;
+	int running;
+	int out, err;		// Descriptors of the commands
+	int ran;			// A command was started
+	int stop;			// A command failed so that xargs gives up
+	int status;			// Exit status of xargs
+};
+
+// Static Function Prototypes //
+static int get_xargs_opts(int argc, char **argv, struct xargs_opts *o);
+static size_t arg_limit(void);
+static void batch_reset(struct xargs *x);
+static int item_end(struct xargs *x, size_t start);
+static int item_byte(struct xargs *x, char c);
+static int batch_run(struct xargs *x);
+static int batch_reap(struct xargs *x);
+static int read_items(struct xargs *x);
+static void * pump_main(void *arg);
+
+// Pump of command output to a ring
+struct pump {
+	struct bi_ctx *ctx;
+	int fd;
+};
+
+/* Description: xargs [-0r] [-n N] [-P N] [-s SIZE] [COMMAND [ARG]...]
+ *				Runs COMMAND (echo) with the initial ARGs followed by as many
+ *				items of the input as fit in one command line. Items are
+ *				separated by blanks and newlines and can be quoted with ' or " or
+ *				escaped with \, or are separated by NUL with -0. -P runs up to N
+ *				commands at the same time, 0 one per processor.
+ *				Exits with 123 if a command failed, 124 if one exited with 255,
+ *				125 if one was killed and 126 or 127 if one could not be run.
+ */
+int bi_xargs(int argc, char **argv, struct bi_ctx *ctx) {
+	static char *echo[] = { "echo", NULL };
+	struct xargs_opts o;
+	struct xargs x;
+	struct pump pump;
+	pthread_t tid;
+	int pipeFd[2];
+	int pumping = 0;
+
+	if (get_xargs_opts(argc, argv, &o) == -1) {
+		bi_error(ctx, "usage: xargs [-0r] [-n N] [-P N] [-s SIZE] [COMMAND [ARG]...]");
+		return 1;
+	}
+
+	memset(&x, 0, sizeof(x));
+	x.ctx = ctx;
+	x.o = &o;
+	x.cmd = (o.first < argc) ? argv + o.first : echo;
+	x.ncmd = (o.first < argc) ? argc - o.first : 1;
+	x.limit = arg_limit();
+	x.maxchars = (o.size > 0) ? (size_t)o.size : (size_t)-1;
+	x.out = ctx->out;
+	x.err = ctx->err;
+
+	// The initial arguments take space in every command
+	batch_reset(&x);
+	if (x.size > x.limit || x.chars > x.maxchars) {
+		bi_error(ctx, "argument list too long");
+		return 1;
+	}
+
+	// Commands cannot write to a ring, a thread moves their output there
+	if (ctx->out < 0 || ctx->err < 0) {
+		if (fd_pipe(pipeFd) == -1) {
+			bi_error(ctx, "pipe: %s", strerror(errno));
+			return 1;
+		}
+		pump.ctx = ctx;
+		pump.fd = pipeFd[0];
+		if (pthread_create(&tid, NULL, pump_main, &pump) != 0) {
+			close(pipeFd[0]);
+			close(pipeFd[1]);
+			bi_error(ctx, "cannot create thread");
+			return 1;
+		}
+		pumping = 1;
+		if (ctx->out < 0) {
+			x.out = pipeFd[1];
+		}
+		if (ctx->err < 0) {
+			x.err = pipeFd[1];
+		}
+	}
+
+	x.vec = (char **)malloc((x.ncmd + 1) * sizeof(char *));
+	x.pids = (pid_t *)malloc(o.procs * sizeof(pid_t));
+	x.pidfds = (int *)malloc(o.procs * sizeof(int));
+	if (x.vec == NULL || x.pids == NULL || x.pidfds == NULL) {
+		bi_error(ctx, "%s", strerror(ENOMEM));
+		x.status = 1;
+	} else {
+		if (read_items(&x) == -1 && x.status == 0) {
+			x.status = 1;
+		}
+		// What is left, or a single command for empty input
+		if (!x.stop && (x.nitems > 0 || (!x.ran && !o.norun))) {
+			batch_run(&x);
+		}
+		while (x.running > 0) {
+			batch_reap(&x);
+		}
+	}
+
+	if (pumping) {
+		close(pipeFd[1]);		// The pump sees EOF once the commands are gone
+		pthread_join(tid, NULL);
+	}
+
+	free(x.vec);
+	free(x.strs);
+	free(x.offs);
+	free(x.pids);
+	free(x.pidfds);
+
+	return x.status;
+}
+
+/* Description: Checks if the xargs builtin handles the arguments.
+ *
+ * Returns:		- If it does, 1
+ * 				- Otherwise, 0
+ */
+int bi_xargs_accepts(int argc, char **argv) {
+	struct xargs_opts o;
+
+	return get_xargs_opts(argc, argv, &o) == 0;
+}
+
+// Parses the options of xargs. Returns -1 for unsupported arguments.
+static int get_xargs_opts(int argc, char **argv, struct xargs_opts *o) {
+	const char *opt, *value;
+	long num;
+	int i;
+
+	o->nul = 0;
+	o->maxargs = 0;
+	o->procs = 1;
+	o->size = 0;
+	o->norun = 0;
+
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1] != '\0'; ++i) {
+		if (strcmp(argv[i], "--") == 0) {
+			++i;
+			break;
+		}
+		for (opt = argv[i] + 1; *opt; ++opt) {
+			if (*opt == '0') {
+				o->nul = 1;
+				continue;
+			}
+			if (*opt == 'r') {
+				o->norun = 1;
+				continue;
+			}
+			if (*opt != 'n' && *opt != 'P' && *opt != 's') {
+				return -1;
+			}
+
+			// Options with a value take the rest of the word or the next one
+			if (opt[1] != '\0') {
+				value = opt + 1;
+			} else if (++i < argc) {
+				value = argv[i];
+			} else {
+				return -1;
+			}
+			if (strtosize(value, &num) == -1 || num > 0x7FFFFFFF) {
+				return -1;
+			}
+			switch (*opt) {
+				case 'n':
+					o->maxargs = (int)num;
+					break;
+				case 'P':
+					o->procs = (num > 0) ? (int)num :
+						(int)sysconf(_SC_NPROCESSORS_ONLN);
+					if (o->procs <= 0) {
+						o->procs = 1;
+					}
+					break;
+				case 's':
+					o->size = num;
+					break;
+			}
+			break;
+		}
+	}
+
+	o->first = i;
+	return 0;
+}
+
+// Argument space of a command: the kernel limit less the environment
+static size_t arg_limit(void) {
+	long max = sysconf(_SC_ARG_MAX);
+	size_t env = sizeof(char *);
+	char **e;
+
+	if (max <= 0) {
+		max = XARGS_ARG_MAX;
+	}
+	for (e = environ; *e != NULL; ++e) {
+		env += strlen(*e) + 1 + sizeof(char *);
+	}
+
+	if ((size_t)max <= env + XARGS_HEADROOM) {
+		return 0;
+	}
+	max -= env + XARGS_HEADROOM;
+
+	return max;
+}
+
+// Empties the batch, leaving the space the command and its initial arguments take
+static void batch_reset(struct xargs *x) {
+	int i;
+
+	x->nitems = 0;
+	x->len = 0;
+	x->size = sizeof(char *);	// NULL of the vector
+	x->chars = 0;
+	for (i = 0; i < x->ncmd; ++i) {
+		x->chars += strlen(x->cmd[i]) + 1;
+		x->size += strlen(x->cmd[i]) + 1 + sizeof(char *);
+	}
+}
+
+// Reads the input and runs a batch whenever one is full
+static int read_items(struct xargs *x) {
+	char buf[XARGS_BUFSIZE];
+	const char *p, *end, *nul;
+	size_t start = 0;
+	int quote = 0, escape = 0, initem = 0;
+	ssize_t n;
+
+	while (!x->stop) {
+		if ((n = bi_read(x->ctx, buf, sizeof(buf))) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			bi_error(x->ctx, "%s", strerror(errno));
+			return -1;
+		}
+		if (n == 0) {
+			break;
+		}
+
+		for (p = buf, end = buf + n; p < end && !x->stop; ++p) {
+			if (!initem) {
+				start = x->len;
+			}
+
+			if (x->o->nul) {
+				// Whole spans up to the NUL are copied at once
+				nul = memchr(p, '\0', end - p);
+				while (p < (nul ? nul : end)) {
+					if (item_byte(x, *p++) == -1) {
+						return -1;
+					}
+				}
+				initem = 1;
+				if (nul == NULL) {
+					break;
+				}
+				initem = 0;
+				if (item_end(x, start) == -1) {
+					return -1;
+				}
+				continue;
+			}
+
+			if (escape) {
+				escape = 0;
+			} else if (quote) {
+				if (*p == quote) {
+					quote = 0;
+					continue;
+				}
+				if (*p == '\n') {
+					bi_error(x->ctx, "unmatched %s quote",
+						quote == '"' ? "double" : "single");
+					return -1;
+				}
+			} else if (*p == ' ' || *p == '\t' || *p == '\n') {
+				if (initem) {
+					initem = 0;
+					if (item_end(x, start) == -1) {
+						return -1;
+					}
+				}
+				continue;
+			} else if (*p == '\'' || *p == '"') {
+				quote = *p;
+				initem = 1;
+				continue;
+			} else if (*p == '\\') {
+				escape = 1;
+				initem = 1;
+				continue;
+			}
+
+			initem = 1;
+			if (item_byte(x, *p) == -1) {
+				return -1;
+			}
+		}
+	}
+
+	if (quote) {
+		bi_error(x->ctx, "unmatched %s quote", quote == '"' ? "double" : "single");
+		return -1;
+	}
+	if (initem && !x->stop) {
+		return item_end(x, start);
+	}
+	return 0;
+}
+
+// Adds a byte to the item being read
+static int item_byte(struct xargs *x, char c) {
+	char *tmp;
+
+	if (x->len == x->cap) {
+		x->cap = x->cap ? 2 * x->cap : XARGS_BUFSIZE;
+		if ((tmp = (char *)realloc(x->strs, x->cap)) == NULL) {
+			bi_error(x->ctx, "%s", strerror(ENOMEM));
+			return -1;
+		}
+		x->strs = tmp;
+	}
+	x->strs[x->len++] = c;
+	return 0;
+}
+
+// Ends the item that starts at start, running the batch first if it is full
+static int item_end(struct xargs *x, size_t start) {
+	size_t *tmp;
+	size_t cost, len;
+
+	if (item_byte(x, '\0') == -1) {
+		return -1;
+	}
+	len = x->len - start;
+	cost = len + sizeof(char *);
+
+	if (x->nitems > 0 && (x->size + cost > x->limit ||
+		x->chars + len > x->maxchars ||
+		(x->o->maxargs > 0 && x->nitems == x->o->maxargs))) {
+		if (batch_run(x) == -1) {
+			return -1;
+		}
+		// The item moves to the start of the next batch
+		memmove(x->strs, x->strs + start, len);
+		x->len = len;
+		start = 0;
+	}
+	if (x->size + cost > x->limit || x->chars + len > x->maxchars) {
+		bi_error(x->ctx, "argument line too long");
+		x->stop = 1;
+		x->status = 1;
+		return -1;
+	}
+
+	if (x->nitems == x->itemcap) {
+		x->itemcap = x->itemcap ? 2 * x->itemcap : 1024;
+		if ((tmp = (size_t *)realloc(x->offs, x->itemcap * sizeof(size_t))) == NULL) {
+			bi_error(x->ctx, "%s", strerror(ENOMEM));
+			return -1;
+		}
+		x->offs = tmp;
+	}
+	x->offs[x->nitems++] = start;
+	x->size += cost;
+	x->chars += len;
+	return 0;
+}
+
+// Starts a command for the batch, once a running one ends if there are -P
+static int batch_run(struct xargs *x) {
+	char **tmp;
+	pid_t pid;
+	int i;
+
+	while (x->running == x->o->procs) {
+		if (batch_reap(x) == -1) {
+			return -1;
+		}
+	}
+	if (x->stop) {
+		return -1;
+	}
+
+	if ((tmp = (char **)realloc(x->vec, (x->ncmd + x->nitems + 1) * sizeof(char *)))
+		== NULL) {
+		bi_error(x->ctx, "%s", strerror(ENOMEM));
+		return -1;
+	}
+	x->vec = tmp;
+	memcpy(x->vec, x->cmd, x->ncmd * sizeof(char *));
+	for (i = 0; i < x->nitems; ++i) {
+		x->vec[x->ncmd + i] = x->strs + x->offs[i];
+	}
+	x->vec[x->ncmd + x->nitems] = NULL;
+
+	// The vector is copied by the time spawn_argv returns and can be reused
+	pid = spawn_argv(x->vec, -1, x->out, x->err, 0);
+	x->ran = 1;
+	batch_reset(x);
+
+	if (pid == -1) {
+		bi_error(x->ctx, "%s: %s", x->cmd[0], strerror(errno));
+		x->status = (errno == ENOENT) ? 127 : 126;
+		x->stop = 1;
+		return -1;
+	}
+
+	x->pids[x->running] = pid;
+	x->pidfds[x->running] = pid_open(pid);
+	++x->running;
+	return 0;
+}
+
+// Waits for a running command and takes its status
+static int batch_reap(struct xargs *x) {
+	int status, i;
+
+	if ((i = wait_any(x->pids, x->pidfds, x->running, &status)) == -1) {
+		bi_error(x->ctx, "wait: %s", strerror(errno));
+		x->running = 0;
+		x->stop = 1;
+		return -1;
+	}
+
+	if (x->pidfds[i] != -1) {
+		close(x->pidfds[i]);
+	}
+	--x->running;
+	x->pids[i] = x->pids[x->running];
+	x->pidfds[i] = x->pidfds[x->running];
+
+	if (WIFSIGNALED(status)) {
+		bi_error(x->ctx, "%s: terminated by signal %d", x->cmd[0], WTERMSIG(status));
+		x->status = 125;
+		x->stop = 1;
+	} else if (WEXITSTATUS(status) == 255) {
+		bi_error(x->ctx, "%s: exited with status 255; aborting", x->cmd[0]);
+		x->status = 124;
+		x->stop = 1;
+	} else if (WEXITSTATUS(status) != 0 && x->status == 0) {
+		x->status = 123;
+	}
+	return 0;
+}
+
+// Copies the output of the commands to the ring output of xargs
+static void * pump_main(void *arg) {
+	struct pump *pump = (struct pump *)arg;
+	char buf[XARGS_BUFSIZE];
+	ssize_t n;
+
+	while ((n = read(pump->fd, buf, sizeof(buf))) != 0) {
+		if (n == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (bi_write(pump->ctx, buf, n) == -1) {
+			break;		// The commands get EPIPE once the pipe is closed
+		}
+	}
+
+	close(pump->fd);
+	return NULL;
+}
@@ -18,12 +18,39 @@
 #include "pg_error.h"
 #include "processes.h"	// create_child(), wait_child()
 #include "pg_string.h"	// astrcat()
+#include "pg_suggest.h"	// suggest_load(), suggest_add()
+#include "pg_plan.h"	// plan_get(), plan_put()
+#include "pg_file.h"	// fd_cloexec()
+#include "pg_builtin.h"	// builtin_for(), builtin_exec()
+#include "pg_limit.h"	// limits_begin(), limits_end()
+#include "pg_subst.h"	// subst_begin(), subst_end()
+#include "pg_var.h"		// var_init(), var_assign(), var_environ()
+#include "pg_func.h"	// func_define(), func_find()
+#include "pg_glob.h"	// glob_match()
+#include "pg_rc.h"		// rc_load()
+#include "pg_stat.h"	// STAT_START(), STAT_STOP()
 #include "pgsh.h"
 
+// Frame of a loop or a case command of a running plan
+struct frame {
+	struct expansion exp;	// Memory of the expanded words
+	char **words;			// Words of a for loop
+	int nwords;
+	int next;				// Next word of a for loop
+	const char *name;		// Variable of a for loop
+	const char *word;		// Word of a case command, NULL if it failed
+	int status;				// Status of the last run of a loop body
+};
+
 // Static Function Prototypes //
-static int check_redirect_symb(char * string);
-static char * pipe_redirect_filename(char **pipe_tokens, int tokens, enum 
-	RedirectType redirection);
+static int exec_plan(struct plan *plan, int pc);
+static int exec_pipe(const struct plan_pipe *pl);
+static int exec_stages(const struct plan_pipe *pl);
+static void frame_for(struct frame *f, const struct plan_cmd *cmd);
+static void frame_case(struct frame *f, const struct plan_cmd *cmd);
+static int case_match(struct frame *f, const struct plan_cmd *cmd);
+static void exec_return(const struct plan_cmd *cmd);
+static void expand_error(void);
 
 // Functions //
 
@@ -43,13 +70,18 @@ int pgsh(const char *history) {
 	
 	// Variables //
 	
-	int i;				// Counter
 	char *cmd_line;		// Whole command line
-	char *tmpstr;
+	char *more, *joined;	// Lines of here-documents
+	char *lines[2];
+	char *rc;			// Startup file of the user
 	FILE *historyPtr;	// Pointer to history file
 	
 	// File Configurations //
 	
+	if (var_init() == -1) {
+		fprintf(stderr, "Cannot import the environment\n");
+		exit(EXIT_FAILURE);
+	}
 	historyPtr = load_history(history);
 	
 	// History Load error checking
@@ -68,13 +100,38 @@ int pgsh(const char *history) {
 			exit(EXIT_FAILURE);
 	}
 	
+	// Commands of previous sessions are used for suggestions
+	if (suggest_load(history) == -1) {
+		pg_perror("suggest_load");
+	}
+	
+	// Builtin stages run as threads of the shell, a closed pipe must fail
+	// their writes instead of killing the shell
+	signal(SIGPIPE, SIG_IGN);
+	
+	// Startup file of the user, ~/.pgshrc, run before the first command
+	if ((lines[0] = (char *)var_get("HOME")) != NULL) {
+		lines[1] = RC_FILE;
+		if ((rc = astrcat(lines, "/", 0, 1)) != NULL && rc_load(rc) == SPEXIT) {
+			free(rc);
+			fclose(historyPtr);
+			puts("Exited pgsh shell");
+			return 0;
+		}
+		free(rc);
+	}
+	
 	// Functional Code //
 	
 	intro();	// Print introduction screen
 	
 	do {
-		printf("%s", "pgsh:$ ");
-		cmd_line = enter_command();				// Read command from terminal
+		cmd_line = enter_command("pgsh:$ ");	// Read command from terminal
+		
+		// End of input (ctrl-D on an empty line), exit the shell
+		if (cmd_line == NULL) {
+			break;
+		}
 		
 		// Tradeoff bug when executing with ctrd+d instead of enter
 		// will produce command history on the same line
@@ -82,24 +139,34 @@ int pgsh(const char *history) {
 		
 		// If user just pressed enter, prompt new shell line
 		if (cmd_line[0] == '\n') {
+			free(cmd_line);
 			continue;
 		}
 		
+		// Here-documents go on till their delimiter lines, and compound
+		// commands till their closing words
+		while (line_open(cmd_line)) {
+			if ((more = enter_command("> ")) == NULL) {
+				break;		// Reported as not terminated
+			}
+			lines[0] = cmd_line;
+			lines[1] = more;
+			joined = astrcat(lines, "", 0, 1);
+			free(more);
+			if (joined == NULL) {
+				break;
+			}
+			free(cmd_line);
+			cmd_line = joined;
+		}
+		
 		
 		
 		append_command(historyPtr, cmd_line);	// Store command to history
+		suggest_add(cmd_line);					// and suggest it from now on
 		
 		// Command handling (analyze and execution) //
 		
-		// Clean cmd line from empty pair of double quotes
-		tmpstr = cmd_line;	// store old string pointer for later memory free
-		cmd_line = strepclean(cmd_line, '"');
-		
-		// Strepclean allocated new space for the clean string
-		if (tmpstr != cmd_line) {
-			free(tmpstr);	// free memory
-		}	// else strepclean return the same string because it was clean
-		
 		// Handle entered command line
 		if ( handle_cmd_line(cmd_line) == SPEXIT) {
 			break;
@@ -146,9 +213,9 @@ int special_cmd_id(char * cmd) {
 		return -1;
 	}
 	
-	if (strstr("exit", cmd) != NULL) {
+	if (strcmp("exit", cmd) == 0) {
 		return SPEXIT;
-	} else if (strstr("cd", cmd) != NULL) {
+	} else if (strcmp("cd", cmd) == 0) {
 		return SPCD;
 	} else {	// No special command entered
 		return NOSP;
@@ -206,6 +273,7 @@ FILE * load_history(const char * filename) {
 				pg_errno = EOPEN;
 				exit(EXIT_FAILURE);
 			}
+			fd_cloexec(fileno(historyPtr));	// Commands must not inherit it
 		} else {
 			pg_errno = EPERM;	// Write permission denied
 			return NULL;
@@ -300,9 +368,9 @@ int append_command(FILE *historyPtr, const char * command) {
 
 
 /* Description: 	Handles the command line typed by the user.
- *					It is responsible for detecting pipeline commands, input and 
- *					output redirections and reporting syntax or execution errors.
- *					It also handles the special commands exit and cd.
+ *					The line is parsed and compiled to an execution plan (or the
+ *					cached plan of the same line is used) and the plan is then 
+ *					executed. It also handles the special commands exit and cd.
  *	
  * Arguments:		cmd_line: Command line to be executed
  * 
@@ -317,357 +385,485 @@ int append_command(FILE *historyPtr, const char * command) {
  */ 
 int handle_cmd_line(char * cmd_line) {
 	
-	int i;
-	int pipe_token_cnt;
-	int cmd_tkn_cnt;
-	int append=1;			// Redirection append mode
-	pid_t childPid;
-	int skip;			// Number of tokens skipped from the end to exclude
-						// redirection symbols and filenames
+	struct plan *plan;
 	
-	char *input=NULL;			// Redirection input filename
-	char *output=NULL;			// Redirection output filename
-	char **pipe_tokens;		// Command line splitted by pipes
-	char **redirect_cmd;	// Commands with redirection
-	char ***pipe_commands;	// Command line splitted by pipes and arguments
+	plan = plan_get(cmd_line);
+	if (plan == NULL) {
+		return plan_failed();
+	}
 	
+	return handle_plan(plan);
+}
+
+/* Description: 	Executes a plan, as handle_cmd_line does, and gives it back
+ *					with plan_put.
+ *	
+ * Arguments:		plan: Plan taken with plan_get or made with plan_compile
+ * 
+ * Return Value:	The same as handle_cmd_line
+ *
+ */ 
+int handle_plan(struct plan *plan) {
 	
-	// Count the number of commands participating in a pipe connection
-	pipe_token_cnt = ctoken_counter(cmd_line, "|");
+	int result;
 	
-	if (pipe_token_cnt > 1) {	// Command entered has a pipe
-		pipe_tokens = ctokenize(cmd_line, "|");
-		
-		// Allocate space for the pipe commands
-		
-		pipe_commands = (char***)malloc( pipe_token_cnt * sizeof(char**));
-		if (pipe_commands == NULL) {
-			perror("malloc");
-			exit(EXIT_FAILURE);
-		}
-		
-		// Check for input and output redirection in the the pipeline commands //
-		
-		// check input redirection
-		input = pipe_redirect_filename(pipe_tokens, pipe_token_cnt, REDIN);
-		
-		if (input == NULL) { // No redirection exists or error occurred
-			switch (pg_errno) { 
-				case EOK: // No redirection input without append found
-					break;
-				case EARG:	// Wrong redirect type
-					fprintf(stderr, "%s\n", "No such redirect error");
-					return -1;
-				case ESYNTAX:
-					return -1;
-			}
-		}
-		
-		output = pipe_redirect_filename(pipe_tokens, pipe_token_cnt, REDOUTA);
-		if (output == NULL) {
-			
-			switch (pg_errno) {
-				case EOK: // No input redirection with append
-					// check redirection without append
-					output = pipe_redirect_filename(pipe_tokens, pipe_token_cnt,
-						REDOUT);
-					append = 0; 	// Set append to zero
-					if (output == NULL) { // No redirection exists or error occurred
-						switch (pg_errno) {
-							case EOK: // No redirection input without append found
-								break;
-							case EARG:	// Wrong redirect type
-								fprintf(stderr, "%s\n", "No such RedirectType");
-								return -1;
-							case ESYNTAX:
-								fprintf(stderr, "%s\n", pg_strerror(ESYNTAX));
-								return -1;
-						}
-					}
-					break;
-				case EARG:
-					fprintf(stderr, "%s\n", "No such redirect error");
-					return -1;
-				case ESYNTAX:
-					fprintf(stderr, "%s\n", pg_strerror(ESYNTAX));
-					return -1;
-			}
-		}
-		
-		// Tokenize pipe subtokens to commands and arguments
-		
-		for(i=0; i<pipe_token_cnt; ++i) {
-			pipe_commands[i] = ctokenize( pipe_tokens[i], " " );
-		}
-		
-		free2d_n(pipe_tokens);
-		
-		// Check for special command
-		
-		switch(special_cmd_id(pipe_commands[0][0])) {
-			case SPEXIT:
-				return SPEXIT;
-			case SPCD:
-				if ( shell_chdir(pipe_commands[0]) == -1 ) {
-					perror("cd");
-					return -1;
-				}
-				return SPCD;
-			case -1:
-				pg_perror("special_cmd_id");
-				return -1;
-		}
-		
-		// Execute commands in the pipe
-		if (pipe_chain_r(pipe_commands, pipe_token_cnt, input, output, append)==-1){
-			pg_perror("pipe_chain_r");
+	result = exec_plan(plan, 0);
+	
+	plan_put(plan);
+	
+	return result;
+}
+
+/* Description: 	Reports why a command line has no plan, from pg_errno, and
+ *					sets the exit status of the line.
+ * 
+ * Return Value:	The same as handle_cmd_line
+ *
+ */ 
+int plan_failed(void) {
+	
+	switch (pg_errno) {
+		case ENOTOKEN:		// Only blanks or a comment
+			pg_errno = EOK;
+			return NOSP;
+		case EPARSE:		// Already reported by the parser
+		case ESYNTAX:
+			pg_status = 2;
+			pg_errno = EOK;
 			return -1;
-		}
-		
-		// Memory Clean Up //
-		
-		if (input!=NULL) {
-			free(input);
-		}
-		if (output!=NULL) {
-			free(output);
-		}
-		
-		// Free space for each pipe command
-		for(i=0; i<pipe_token_cnt; ++i) {
-			free2d_n(pipe_commands[i]);
-		}
-		free(pipe_commands);
-		
-	} else {// No pipes, check just for redirection though
-		
-		cmd_tkn_cnt = ctoken_counter(cmd_line, " ");
-		if ( cmd_tkn_cnt < 1) {
-			fprintf(stderr, "%s\n", "No tokens in command");
+		case EHEREDOC:
+		case EINCOMPLETE:
+			fprintf(stderr, "pgsh: %s\n", pg_strerror(pg_errno));
+			pg_status = 2;
+			pg_errno = EOK;
+			return -1;
+		case EREDIR:
+			fprintf(stderr, "pgsh: %s\n", pg_strerror(EREDIR));
+			pg_status = 1;
+			pg_errno = EOK;
+			return -1;
+		default:
+			pg_perror("plan_get");
 			return -1;
-		}
-		redirect_cmd = ctokenize(cmd_line, " ");
-		
-		// Check for special command
-		
-		switch(special_cmd_id(redirect_cmd[0])) {
-			case SPEXIT:
-				return SPEXIT;
-			case SPCD:
-				if ( shell_chdir(redirect_cmd) == -1) {
-					perror("cd");
-					return -1;
-				}
-				return SPCD;
-			case -1:
-				pg_perror("special_cmd_id");
-				return -1;
-		}
-		
-		// If there are more or than four tokens
-		// ( cmd args redir_symb fname redir_symb fname ) check for a second redirect
-		// symbol in the third from last position
-		if (cmd_tkn_cnt >= 5) {
-			skip = 2;
-		}
-		
-		// If there are more than two tokens (command args redirect_symbol filename)
-		// check if the one before the last is a redirect symbol
-		else if (cmd_tkn_cnt >= 3) {
-			skip = 0;
-		} else {	// No redirection (two or less tokens)
-			skip = -1;
-		}
-	
-		while (skip >= 0) {	// If there is dual or single redirection
-							// loops twice for dual, one for single
-			
-			// Check the kind of redirection
-			switch ( check_redirect_symb( redirect_cmd[cmd_tkn_cnt - 2 - skip]) ) {
-				case REDIN:
-					input = redirect_cmd[cmd_tkn_cnt - 1 - skip];
-					break;
-				case REDOUTA:
-					output = redirect_cmd[cmd_tkn_cnt - 1 - skip];
-					break;
-				case REDOUT:
-					output = redirect_cmd[cmd_tkn_cnt - 1 - skip];
-					append = 0;	// Set append to zero
-					break;
-				default: // No redirection found on this position, move to next one
-					skip-=2;
-					continue;
-			}
-			
-			// Remove redirection part from the command part by setting the
-			// redirection symbols as NULL
-			redirect_cmd[cmd_tkn_cnt - 2 - skip] = (char*)NULL;
-			
-			skip-=2;
-			
-		}
-		
-		
-	// NOTE : If there are two tokens, then there is no way for redirection to exist
-		
-		// No redirection, just execute command
-		if (input == NULL && output == NULL) {
-			childPid = create_child(redirect_cmd);	
-		} else { // Command with redirection
-			childPid = create_child_r(redirect_cmd, input, output, append);	
-		}
-		
-		wait_child(childPid);	// Wait for child to execute command
-		
-		switch(pg_errno) {
-			case EFCHLD:
-				//fprintf(stderr, "Failed to execute command : '%s'\n", redirect_cmd[0]);
-				pg_errno = EOK;		// Reset pg_errno
-				return -1;
-			case EWAIT:
-				perror("wait");
-				pg_errno = EOK;		// Reset pg_errno
-				return -1;
-			case EARG:
-				fprintf(stderr, "%s\n", "wait_child: Process ID cannot be negative");
-				pg_errno = EOK;		// Reset pg_errno
-				return -1;
-			case EUNKNOWN:
-				pg_perror("wait_child");
-				pg_errno = EOK;		// Reset pg_errno
-				return -1;
-		}
-		
-		free2d_n(redirect_cmd);
-		
 	}
-	return NOSP;	// Command line to handle executed successfully
 }
 
-/* Description: 	Searches for an input or output redirection, in appending mode
- *					or not in the given pipe tokens. If one is found, its filename
- *					is returned, NULL otherwise. It also filters the pipe token
- *					that contain the redirection file in the 
+/* Description: 	Executes the instructions of a plan.
  *	
- * Arguments:		pipe_tokens : Tokens separated from a command containing pipes
- *					tokens		: Number of tokens
- *					redirection : Type of redirection to be searched
- *						# REDIN 	= Input redirection without append
- * 						# REDOUT	= Output redirection without append
- * 						# REDOUTA 	= Output redirection with append
- *
- * Return Value:	- on success, returns redirection filename
- *					- on failure, returns NULL
- *
- * Possible Errors: 	# EARG   	: No such RedirectType
- *						# EOK	 	: No error, but no redirection found
- *						# ESYNTAX	: More than one redirection symbols found in 
- *									  one command.
- *
- * Notes:			None
+ * Arguments:		plan: Execution plan
+ *					pc:   First instruction, 0 or the body of a function
+ * 
+ * Return Value:	- SPEXIT, if exit was executed
+ *					- otherwise, the result of the last pipeline executed
  *
+ * Notes:			The exit status of every pipeline is stored to pg_status and
+ *					is tested by the conditional jumps. Loops and case commands
+ *					keep their words in frames, closed when they end or when
+ *					break, continue, return or exit leaves them.
  */ 
-static char * pipe_redirect_filename(char **pipe_tokens, int tokens, enum 
-	RedirectType redirection) {
-	
-	char **redirect_tkn;	// Holds the tokens left and right of the redirection
-							// symbol (i.e command left and filename right
-	char **temp2d;			// Used to temporary store pointer to be freed
-	char *redir_fname;		// Redirection filename
-	char redirSymbol[3];	// String containing the redirection symbol
-	int index;		// Index of the pipe token that contain the redirection symbol
-	
-	// 
-	switch (redirection) {
-		case REDIN:
-			strcpy(redirSymbol, "<");
-			index=0;
-			break;
-		case REDOUT:
-			strcpy(redirSymbol, ">");
-			index=tokens-1;
-			break;
-		case REDOUTA:
-			strcpy(redirSymbol, ">>");
-			index=tokens-1;
-			break;
-		default:
-			pg_errno = EARG;
-			return NULL;
+static int exec_plan(struct plan *plan, int pc) {
+	
+	const struct plan_insn *insn;
+	struct frame *frames = NULL;
+	int nframes = 0;	// Frames open
+	int result = NOSP;
+	
+	if (plan->depth > 0 &&
+		(frames = (struct frame *)calloc(plan->depth, sizeof(struct frame))) == NULL) {
+		perror("calloc");
+		return -1;
 	}
 	
-	// Check if there is an output redirection without append
-		switch ( stoken_counter(pipe_tokens[index], redirSymbol) ) {
-			case 1:		// Does not exist
-				pg_errno = EOK;
-				return NULL;
-			case 2:		// Exists
-			
-				// Split command and redirection filename
-				redirect_tkn = stokenize(pipe_tokens[index], redirSymbol);
-				
-				// Place only the command into the pipe token where previously 
-				// existed both command and redirection filename
-				// Place '\0' just after the command, skipping the redirection
-				// filename, so that only the command is stored in pipe_tokens[index]
-				pipe_tokens[index][strlen(redirect_tkn[0])] = '\0';
-				
+	do {
+		insn = &plan->code[pc++];
+		switch (insn->op) {
+			case OP_RUN:
+				result = exec_pipe(&plan->pipes[insn->arg]);
+				break;
+			case OP_JMPZ:
+				if (pg_status == 0) {
+					pc = insn->arg;
+				}
+				break;
+			case OP_JMPNZ:
+				if (pg_status != 0) {
+					pc = insn->arg;
+				}
+				break;
+			case OP_JMP:
+				pc = insn->arg;
+				break;
+			case OP_STATUS:
+				pg_status = insn->arg;
+				break;
+			case OP_LOOP:
+				memset(&frames[nframes++], 0, sizeof(struct frame));
+				break;
+			case OP_FOR:
+				frame_for(&frames[nframes++], &plan->pipes[insn->aux].cmds[0]);
+				break;
+			case OP_NEXT:
+				if (frames[nframes - 1].next == frames[nframes - 1].nwords) {
+					pc = insn->arg;
+				} else if (var_set(frames[nframes - 1].name,
+					strlen(frames[nframes - 1].name),
+					frames[nframes - 1].words[frames[nframes - 1].next++], 0) == -1) {
+					fprintf(stderr, "pgsh: %s: cannot assign\n",
+						frames[nframes - 1].name);
+					pg_errno = EOK;		// Reset pg_errno
+				}
+				break;
+			case OP_AGAIN:
+				frames[nframes - 1].status = pg_status;
+				pc = insn->arg;
+				break;
+			case OP_DONE:
+				pg_status = frames[--nframes].status;
+				expand_free(&frames[nframes].exp);
+				break;
+			case OP_BREAK:
+				while (nframes > insn->aux) {
+					expand_free(&frames[--nframes].exp);
+				}
+				pg_status = 0;
+				pc = insn->arg;
+				break;
+			case OP_CASE:
+				frame_case(&frames[nframes++], &plan->pipes[insn->aux].cmds[0]);
+				break;
+			case OP_MATCH:
+				if (!case_match(&frames[nframes - 1], &plan->pipes[insn->aux].cmds[0])) {
+					pc = insn->arg;
+				}
+				break;
+			case OP_ESAC:
+				expand_free(&frames[--nframes].exp);
+				break;
+			case OP_DEFUN:
+				if (func_define(plan->pipes[insn->aux].cmds[0].argv[0], plan, pc) == -1) {
+					pg_perror("func_define");
+					pg_errno = EOK;		// Reset pg_errno
+					pg_status = 1;
+				} else {
+					pg_status = 0;
+				}
+				pc = insn->arg;
+				break;
+			case OP_RETURN:
+				if (insn->arg >= 0) {
+					exec_return(&plan->pipes[insn->arg].cmds[0]);
+				}
+				pc = plan->ncode - 1;	// OP_END
+				break;
+			case OP_END:
 				break;
-			case -1:	// Null pointer passed to stoken_counter
-				pg_perror("stoken_counter");
-				pg_errno = EOK; 	// Reset pg_errno
-				return NULL;
-			default:	// More than 3 tokens found
-				pg_errno = ESYNTAX;
-				return NULL;
 		}
+	} while (insn->op != OP_END && result != SPEXIT);
 	
-	// Clear redirection filename from extra spaces
-	
-	temp2d = redirect_tkn;
-	redirect_tkn = ctokenize(redirect_tkn[1], " ");
+	while (nframes > 0) {
+		expand_free(&frames[--nframes].exp);
+	}
+	free(frames);
 	
-	free2d_n(temp2d);
+	return result;
+}
+
+/* Description: 	Calls a shell function.
+ *	
+ * Arguments:		fn:   Function
+ *					argc: Number of arguments, the function name included
+ *					argv: Arguments, the positional parameters of the call
+ * 
+ * Return Value:	- SPEXIT, if exit was executed
+ *					- otherwise, NOSP
+ *
+ * Notes:			The body runs from the plan that defined it, held during
+ *					the call in case the function is defined again. The
+ *					arguments must live till the call returns. The status is
+ *					left in pg_status.
+ */ 
+int exec_func(const struct func *fn, int argc, char **argv) {
+	
+	static int depth;		// Calls running
+	struct var_args args;
+	struct plan *plan = fn->plan;
+	int pc = fn->pc;
+	int result;
+	
+	if (depth >= FUNC_DEPTH_MAX) {
+		fprintf(stderr, "pgsh: %s: maximum function nesting level exceeded\n",
+			argv[0]);
+		pg_status = 1;
+		return NOSP;
+	}
 	
-	redir_fname = redirect_tkn[0];
+	args.v = argv + 1;
+	args.n = argc - 1;
+	var_args_swap(&args);
+	plan_hold(plan);
+	++depth;
 	
-	free(redirect_tkn);	// Free only the 2D pointer, not the 1D inside
-						// because it is used by redir_fname
+	result = exec_plan(plan, pc);
 	
-	return redir_fname;
+	--depth;
+	plan_put(plan);
+	var_args_swap(&args);
 	
+	return result == SPEXIT ? SPEXIT : NOSP;
 }
 
-/* Description: 	Checks the given string if it contains a redirection symbol and
- *					returns the enum type of that symbol
+/* Description: 	Runs a compound command that is a stage of a pipeline or
+ *					has redirections, in the child of the stage.
  *	
- * Arguments:		string : Tokens separated from a command containing pipes
- *						
+ * Arguments:		plan: Plan of the compound command
+ *					pc:   Its first instruction
+ * 
+ * Return Value:	- SPEXIT, if exit was executed
+ *					- otherwise, NOSP
  *
- * Return Value:	- on success, returns redirection enum type
- *					
- *					 	# REDIN 	= Input redirection without append
- * 						# REDOUT	= Output redirection without append
- * 						# REDOUTA 	= Output redirection with append
+ * Notes:			The status is left in pg_status.
+ */ 
+int exec_body(struct plan *plan, int pc) {
+	
+	return exec_plan(plan, pc) == SPEXIT ? SPEXIT : NOSP;
+}
+
+/* Description: 	Executes one pipeline of a plan, with its process and
+ *					command substitutions.
  *	
+ * Arguments:		pl: Planned pipeline
+ * 
+ * Return Value:	- on success, returns  >= 0 (see handle_cmd_line)
+ *					- on failure, returns -1
+ */ 
+static int exec_pipe(const struct plan_pipe *pl) {
+	
+	struct subst_run run;
+	int result;
+	STAT_VAR(t);
+	
+	STAT_START(t);
+	result = subst_begin(pl, &run);
+	STAT_STOP(ST_EXPAND, t);
+	if (result == -1) {
+		expand_error();
+		return -1;
+	}
+	
+	result = exec_stages(&run.pipe);
+	
+	subst_end(&run);
+	return result;
+}
+
+/* Description: 	Executes the commands of a pipeline.
+ *	
+ * Arguments:		pl: Pipeline, with its process substitutions started
+ * 
+ * Return Value:	- on success, returns  >= 0 (see handle_cmd_line)
  *					- on failure, returns -1
- *						# Redirection symbol not found
- *
- * Notes:			None
  *
+ * Notes:			Special commands are only recognised when they are not part
+ *					of a pipe.
  */ 
-static int check_redirect_symb(char * string) {
-	if (strstr (string, "<")) {
-		return REDIN;
-	} 
-	
-	if (strstr (string, ">>")) {
-		return REDOUTA;
-	} else if (strstr (string, ">")) {
-		return REDOUT;
-	} 
-	
-	return -1;
+static int exec_stages(const struct plan_pipe *pl) {
+	
+	const struct plan_cmd *cmd = &pl->cmds[0];
+	const struct builtin *bi;
+	const struct func *fn;
+	pid_t childPid;
+	int result;
+	int i;
+	STAT_VAR(t);
+	
+	var_environ();		// Environment of the commands, built if it changed
+	
+	if (pl->ncmds > 1) {	// Command entered has a pipe
+		
+		// Execute commands in the pipe
+		limits_begin();
+		result = pipe_chain_r(pl);
+		limits_end();
+		if (result == -1) {
+			if (pg_errno != EFCHLD) {	// Failed children already reported
+				pg_perror("pipe_chain_r");
+			}
+			pg_errno = EOK;		// Reset pg_errno
+			return -1;
+		}
+		return NOSP;
+	}
+	
+	// Check for special command
+	
+	switch(cmd->argc > 0 ? special_cmd_id(cmd->argv[0]) : NOSP) {
+		case SPEXIT:
+			return SPEXIT;
+		case SPCD:
+			if ( shell_chdir(cmd->argv) == -1) {
+				perror("cd");
+				pg_status = 1;
+				return -1;
+			}
+			pg_status = 0;
+			return SPCD;
+		case -1:
+			pg_perror("special_cmd_id");
+			return -1;
+	}
+	
+	// Assignments set shell variables, their status is set on expansion
+	for (i = 0; cmd->argc == 0 && i < cmd->nassigns; ++i) {
+		if (var_assign(cmd->assigns[i], 0) == -1) {
+			fprintf(stderr, "pgsh: %s: cannot assign\n", cmd->assigns[i]);
+			pg_errno = EOK;		// Reset pg_errno
+			pg_status = 1;
+			return -1;
+		}
+		if (!cmd->expand) {
+			pg_status = 0;
+		}
+	}
+	
+	// A command expanded to nothing keeps the status of its substitutions
+	if (cmd->argc == 0 && cmd->nredirs == 0) {
+		return NOSP;
+	}
+
+	// Functions run inside the shell, unless they have redirections or an
+	// environment of their own, then a child runs them
+	if ((fn = func_find(cmd->argv[0])) != NULL && cmd->nredirs == 0 &&
+		cmd->nassigns == 0) {
+		return exec_func(fn, cmd->argc, cmd->argv);
+	}
+	
+	// Builtins run inside the shell, unless they have an environment of their own
+	if (fn == NULL && cmd->nassigns == 0 && (bi = builtin_for(cmd)) != NULL) {
+		STAT_START(t);
+		result = builtin_exec(bi, cmd);
+		STAT_STOP(ST_BUILTIN, t);
+		if (result == -1) {
+			pg_errno = EOK;		// Already reported by the builtin
+			return -1;
+		}
+		return NOSP;
+	}
+	
+	// No redirection, just execute command
+	limits_begin();
+	if (cmd->nredirs == 0 && cmd->nassigns == 0) {
+		childPid = create_child(cmd->argv);	
+	} else { // Command with redirection or assignments
+		childPid = create_child_r(cmd);	
+	}
+	
+	if (childPid == -1) {
+		limits_end();
+		pg_perror("create_child");
+		pg_status = 1;
+		return -1;
+	}
+	
+	STAT_START(t);
+	wait_child(childPid);	// Wait for child to execute command
+	STAT_STOP(ST_WAIT, t);
+	limits_end();
+	
+	switch(pg_errno) {
+		case EFCHLD:
+			//fprintf(stderr, "Failed to execute command : '%s'\n", cmd->argv[0]);
+			pg_errno = EOK;		// Reset pg_errno
+			return -1;
+		case EWAIT:
+			perror("wait");
+			pg_errno = EOK;		// Reset pg_errno
+			return -1;
+		case EARG:
+			fprintf(stderr, "%s\n", "wait_child: Process ID cannot be negative");
+			pg_errno = EOK;		// Reset pg_errno
+			return -1;
+		case EUNKNOWN:
+			pg_perror("wait_child");
+			pg_errno = EOK;		// Reset pg_errno
+			return -1;
+	}
+	
+	return NOSP;	// Command to handle executed successfully
+}
+
+// Opens the frame of a for loop over the expanded words of cmd, after the
+// name of the variable. A failed expansion leaves the loop without words.
+static void frame_for(struct frame *f, const struct plan_cmd *cmd) {
+	
+	struct plan_cmd words = *cmd;
+	
+	memset(f, 0, sizeof(struct frame));
+	f->name = cmd->argv[0];
+	if (expand_cmd(&words, &f->exp) == -1) {
+		expand_error();
+		return;
+	}
+	f->words = words.argv + 1;
+	f->nwords = words.argc - 1;
+}
+
+// Opens the frame of a case command with its expanded word
+static void frame_case(struct frame *f, const struct plan_cmd *cmd) {
+	
+	memset(f, 0, sizeof(struct frame));
+	if ((f->word = expand_text(cmd->argv[0], 0, &f->exp)) == NULL) {
+		expand_error();
+	}
+}
+
+// Checks if the word of a case frame matches one of the patterns of cmd
+static int case_match(struct frame *f, const struct plan_cmd *cmd) {
+	
+	const char *pattern;
+	int i, match = 0;
+	
+	for (i = 0; i < cmd->argc && f->word != NULL && match != 1; ++i) {
+		if ((pattern = expand_text(cmd->argv[i], 1, &f->exp)) == NULL) {
+			expand_error();
+			return 0;
+		}
+		match = glob_match(pattern, f->word);
+	}
+	return match == 1;
+}
+
+// Sets the status of return from its argument
+static void exec_return(const struct plan_cmd *cmd) {
+	
+	struct expansion exp;
+	const char *arg;
+	char *end;
+	long n;
+	
+	memset(&exp, 0, sizeof(exp));
+	if ((arg = expand_text(cmd->argv[1], 0, &exp)) == NULL) {
+		expand_error();
+	} else {
+		n = strtol(arg, &end, 10);
+		if (*arg == '\0' || *end != '\0') {
+			fprintf(stderr, "pgsh: return: %s: numeric argument required\n", arg);
+			pg_status = 2;
+		} else {
+			pg_status = (int)(n & 0xff);
+		}
+	}
+	expand_free(&exp);
+}
+
+// Reports a failed expansion and sets the status to 1
+static void expand_error(void) {
+	
+	// Failed parameters and arithmetic are already reported
+	if (pg_errno != ENOENV && pg_errno != ESYNTAX && pg_errno != EARITH) {
+		pg_perror("substitution");
+	}
+	pg_status = 1;
+	pg_errno = EOK;		// Reset pg_errno
 }
 
 /* Description: It changes the current shell's working directory
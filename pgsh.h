@@ -13,13 +13,10 @@
 #define PRINT(x) puts(x)
 #endif
 
-// Enumerations
+#define FUNC_DEPTH_MAX	1000	// Most function calls running at once
 
-enum RedirectType {
-	REDIN,		// Input redirection
-	REDOUT,		// Output redirection
-	REDOUTA		// Output redirection with append
-};
+struct func;
+struct plan;
 
 // Enumerations
 
@@ -37,6 +34,10 @@ FILE * load_history(const char * filename);
 int append_command(FILE *historyPtr, const char * command);
 FILE * new_history(const char * filename);
 int handle_cmd_line(char * cmd_line);
+int handle_plan(struct plan *plan);
+int plan_failed(void);
+int exec_func(const struct func *fn, int argc, char **argv);
+int exec_body(struct plan *plan, int pc);
 int special_cmd_id(char * cmd);
 int shell_chdir(char ** cmd);
 int chdir_home(void);
@@ -1,3 +1,4 @@
+#define _GNU_SOURCE		// RUSAGE_THREAD
 #include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
@@ -5,13 +6,71 @@
 #include <unistd.h> // fork(), sleep()
 #include <sys/wait.h> // wait function
 #include <sys/types.h> 
+#include <sys/time.h>
+#include <sys/resource.h> // wait4()
 #include <fcntl.h>
 #include <signal.h>
+#include <pthread.h>
+#include <string.h>
+#include <spawn.h>
+#include <poll.h>
+#include <sys/syscall.h>	// pidfd_open
+#include <stdint.h>
+#ifdef __linux__
+#include <sys/timerfd.h>
+#endif
 #include "pg_string.h"
 #include "pg_file.h"
 #include "pg_error.h"
+#include "pg_readline.h"
+#include "pg_plan.h"
+#include "pg_builtin.h"
+#include "pg_ring.h"
+#include "pg_limit.h"
+#include "pg_affinity.h"
+#include "pg_var.h"
+#include "pg_func.h"
+#include "pg_stat.h"
+#include "pgsh.h"		// exec_func(), exec_body()
 #include "processes.h"
 
+int pg_status;		// Exit status of the last command waited
+long pg_pipe_size;	// Size of pipeline pipes, 0 for the kernel default
+long pg_deadline;	// Deadline of every external command (ms), 0 for none
+long pg_grace = DEFAULT_GRACE;	// Time from SIGTERM to SIGKILL at a deadline (ms)
+
+static struct stage_stat *stats;	// Resource usage of the last pipeline
+static int nstats, statcap;
+
+// Stage of a running pipeline
+struct stage {
+	const struct plan_cmd *cmd;
+	const struct builtin *bi;	// Builtin run in a thread, NULL for a process
+	int index;				// Position in the pipeline
+	int in, out;			// Descriptors, or BI_RING_IN and BI_RING_OUT
+	int ownin, ownout;		// in and out are pipe ends held for the stage
+	struct ring *rin;		// Ring from the previous builtin stage
+	struct ring *rout;		// Ring to the next builtin stage
+	pid_t pid;				// Process of an external stage (-1 if none)
+	pthread_t tid;			// Thread of a builtin stage
+	int started;			// The thread was started
+	int status;				// Exit status of a builtin stage
+	struct stage_stat *stat;
+};
+
+// Static Function Prototypes //
+static void add_fd_op(struct fd_op *ops, int *n, enum FdOpType type, int fd, int src);
+static int stats_reserve(int n);
+static void * stage_main(void *arg);
+static void stage_release(struct stage *st);
+static void stage_usage(struct stage_stat *stat, const struct rusage *usage);
+static int deadline_group(void);
+static void timer_arm(int tfd, long ms);
+static char ** child_environ(const struct plan_cmd *cmd);
+static int child_func(const struct func *fn, const struct plan_cmd *cmd);
+static int child_body(const struct plan_cmd *cmd);
+
+
 // Creates a child process which will execute the function given as a parameter
 // The function does not take any arguments nor return any value.
 // The child should be waited by the wait_child function.
@@ -53,7 +112,7 @@ pid_t create_child_full( char *cmd, char **args ) {
 	if (pid>=0) {	// fork success
 		if (pid == 0) {	// Child code
 			execv(cmd, args);	// Execute child's function
-			exit(EXIT_FAILURE);	// Child exited due to execv failure
+			_exit(EXIT_FAILURE);	// Child exited due to execv failure
 		} else {		// Parent code
 			return 0;
 		}
@@ -81,13 +140,27 @@ pid_t create_child_full( char *cmd, char **args ) {
 pid_t create_child( char **args ) {
 	
 	pid_t pid;
+	int status;		// Exit status of the child, if it fails to execute
+	STAT_VAR(t);
+	STAT_START(t);
 	pid=fork();	// Create child
 	if (pid>=0) {	// fork success
 		if (pid == 0) {	// Child code
+			signal(SIGPIPE, SIG_DFL);	// Ignored by the shell only
+			if (deadline_group()) {
+				setpgid(0, 0);
+			}
+			limits_enter();
+			fd_report(args[0]);
 			execvp(args[0], args);	// Execute child's function
+			status = (errno == ENOENT) ? 127 : 126;	// Before perror changes errno
 			perror(args[0]);
-			exit(EXIT_FAILURE);	// Child exited due to execv failure
+			_exit(status);	// Child exited due to execvp failure
 		} else {		// Parent code
+			if (deadline_group()) {
+				setpgid(pid, pid);	// Either side may get here first
+			}
+			STAT_STOP(ST_SPAWN, t);
 			return pid;
 		}
 	} else {		// fork failure
@@ -100,10 +173,11 @@ pid_t create_child( char **args ) {
 /* Description: Waits for a child process specified by its pid. 
  *
  * Arguments:	pid: Process ID of the child to be waited
- * Returns:		- On success, 0
+ * Returns:		- On success, 0 and stores the exit status to pg_status
  *				- On failure,
  *					# EFCHLD	 : 	Child could not execute the function or error 
- *						 			occured at execvp.
+ *						 			occured at execvp, or it was stopped at the
+ *									session deadline (pg_status TIMEOUT_STATUS).
  *					# EWAIT 	 : 	No such child process.
  *					# EARG		 : 	Wrong process ID
  *					# EUNKNOWN	 :	Unknown error. Check errno
@@ -111,6 +185,8 @@ pid_t create_child( char **args ) {
  * Notes:		When used with create_child function as an input, and it returns -2
  *				for the child, then wait_child returns -3 indicating that the child
  *				had an error. In that case also, wait_child returns -1 to the father.
+ *				With a session deadline (pg_deadline) the child is sent SIGTERM
+ *				when it passes and SIGKILL pg_grace later.
  */
 
 
@@ -119,12 +195,18 @@ int wait_child(pid_t pid) {
 	int hasEnded=0;	// Boolean value that indicates the executing state of the child
 	pid_t endPID=1;	// PID of waited child (set to 1 to enter while loop)
 	int status;		// exit status of child process
+	int timedOut=0;	// The session deadline passed
 
 	if (pid <= 0) {
 		pg_errno = EARG;
 		return -1;
 	}
 	
+	if (pg_deadline > 0) {
+		timedOut = deadline_wait(&pid, 1, pg_deadline, pg_grace, SIGTERM,
+			deadline_group()) == 1;
+	}
+	
 	// Needs while instead of if, in case the stopped child is terminated by a signal
 	// Loops are performed only when continue signal is sent to the child process
 	// after it was stopped.
@@ -138,7 +220,15 @@ int wait_child(pid_t pid) {
 		}
 	
 	
+		if (timedOut && !WIFSTOPPED(status)) {	// Ended by the deadline
+			fprintf(stderr, "pgsh: deadline passed, command stopped\n");
+			pg_status = TIMEOUT_STATUS;
+			pg_errno = EFCHLD;
+			return -1;
+		}
+		
 		if(WIFEXITED(status)) {	// Exited naturally
+			pg_status = WEXITSTATUS(status);
 			if(WEXITSTATUS(status) == EXIT_FAILURE) {
 				pg_errno = EFCHLD;
 				return -1; // child exited unsuccessfully
@@ -148,6 +238,7 @@ int wait_child(pid_t pid) {
 	
 		// Process signaled 
 		else if (WIFSIGNALED(status)) {	// Termination signal
+			pg_status = 128 + WTERMSIG(status);
 			printf("Terminated by signal %d\n", WTERMSIG(status) );
 			return 0;
 		} else if (WIFSTOPPED(status)) {	// Stop signal
@@ -165,13 +256,10 @@ int wait_child(pid_t pid) {
 
 }
 
-/* Description: Creates a child that executes the given command with redirected
- *				input and or output.		
+/* Description: Creates a child that executes the given command with its
+ *				redirections applied.
  *
- * Arguments:	cmd:		Command to be executed
- * 				input: 		Filename of the input file
- *				output:		Filename of the output file
- *				append:		Append data(TRUE) or Overwrite them(FALSE).
+ * Arguments:	cmd:		Planned command, with its arguments and redirections
  *
  * Returns:		- On success, pid of the created process
  * 				- On failure, -1
@@ -181,28 +269,58 @@ int wait_child(pid_t pid) {
  *
  * Notes:		This function may return twice. Once for the parent and 
  *				once for the child. If the child returns, an error occured
- *				in execvp, so the parent code should handle it accordingly.			
+ *				in execvp, so the parent code should handle it accordingly.
+ *				A command without arguments only applies its redirections.
+ *				Assignments of the command go to its environment only, and
+ *				a builtin with assignments is run by the child.
  */
 
-pid_t create_child_r(char **cmd, char *input, char *output, int append) {
+pid_t create_child_r(const struct plan_cmd *cmd) {
 
 	pid_t pid;
+	const struct builtin *bi;
+	const struct func *fn;
+	char **env;
+	int status;		// Exit status of the child, if it fails to execute
+	STAT_VAR(t);
+	STAT_START(t);
 	pid=fork();	// Create child
 	if (pid>=0) {	// fork success
 		if (pid == 0) {	// Child code
-			int redirect_status; // Stores the return value of redirect function
 			
-			// Redirect input and output before of the child
-			redirect_status = redirect(input, output, append);
-	
-			if (redirect_status < 0) {	// Redirection failed
-				pg_perror("redirect");
-				exit(EXIT_FAILURE);	// Child exited due to redirection failure
+			signal(SIGPIPE, SIG_DFL);	// Ignored by the shell only
+			if (deadline_group()) {
+				setpgid(0, 0);
+			}
+			limits_enter();
+			
+			// Apply the redirections of the command
+			if (fd_apply(cmd->redirs, cmd->nredirs) < 0) {	// Already reported
+				_exit(EXIT_FAILURE);	// Child exited due to redirection failure
+			}
+			if (cmd->plan != NULL) {	// Compound command
+				_exit(child_body(cmd));
+			}
+			if (cmd->argc == 0) {	// Nothing to execute
+				_exit(EXIT_SUCCESS);
 			}
-			execvp(cmd[0], cmd);	// Execute child's function
-			perror(cmd[0]);		// Print error
-			exit(EXIT_FAILURE);	// Child exited due to execvp failure
+			if ((fn = func_find(cmd->argv[0])) != NULL) {	// Function
+				_exit(child_func(fn, cmd));
+			}
+			env = child_environ(cmd);
+			if ((bi = builtin_for(cmd)) != NULL) {	// Builtin with assignments
+				_exit(builtin_child(bi, cmd));
+			}
+			fd_report(cmd->argv[0]);
+			execvpe(cmd->argv[0], cmd->argv, env);	// Execute child's function
+			status = (errno == ENOENT) ? 127 : 126;	// Before perror changes errno
+			perror(cmd->argv[0]);		// Print error
+			_exit(status);	// Child exited due to execvp failure
 		} else {		// Parent code
+			if (deadline_group()) {
+				setpgid(pid, pid);	// Either side may get here first
+			}
+			STAT_STOP(ST_SPAWN, t);
 			return pid;
 		}
 	} else {		// fork failure
@@ -211,83 +329,37 @@ pid_t create_child_r(char **cmd, char *input, char *output, int append) {
 	}
 }
 
-/* Description: Given an array of tokenized commands, it sequentially connects
- * 				them with a pipe and then executes them, redirecting input and or
- *				output in truncating or appending mode. It is same as pipe_chain,
- *				but with the support of redirection.
+/* Description: Executes a planned pipeline, connecting its commands with pipes
+ *				and applying the redirections of every command. It is same as 
+ *				pipe_chain, but starts from the shell's standard input and output.
  *
- * Arguments:	commands:	Commands array
- *				n:			Number of commands
- *				input:		First process's filename used for input redirection
- *				output:		Last process's filename used for output redirection
- *				append:		Appending or truncating mode
+ * Arguments:	pl:			Planned pipeline
  *
  * Returns:		- On success,  0
  * 				- On failure, -1 and sets pg_errno to:
  *						# ENULL : 	NULL pointer passed as an argument
- *						# EARG	:	Wrong arguments passed (in==1 or out==0)
  *						# EFCHLD:	Execution of a child failed
  *						# EWAIT : 	Error while waiting children
- *						# EPIPE :	Error creating pipe
+ *						# EPIPEF:	Error creating pipe
  *						
  *
  * Notes:		Children participating in the pipe are siblings.
- *				If both input and output are NULL, then standard input and
- *				standard output is used. In that case, 5th argument is ignored.
- *			
+ *				Redirections of a command are applied after its pipe ends, so
+ *				they take precedence over the pipe.
  */
 
-int pipe_chain_r(char ***commands, int n, char *input, char *output, int append) {
-	int inFd, outFd;	// Input and output file descriptor
-	int backOutFd;		// Backup stdout file descriptor
-	int openFlag;
-	
-	// Exceptions //
-	if (input == NULL && output == NULL) {
-		return pipe_chain(commands, n, STDIN_FILENO, STDOUT_FILENO);
-	}
-	
-	// Open input file
-	if (input != NULL) {
-		inFd = open(input, O_RDONLY);
-		if(inFd==-1) {	
-			pg_errno = EOPEN;
-			return -1;
-		}
-	
-	} else {	// No input file defined, use standard input
-		inFd = STDIN_FILENO;
-	}
-	
-	// Open output file
-	if (output != NULL) {
-		
-		// Configure open flag argument
-		openFlag = O_WRONLY | O_CREAT;
-		if (append) {
-			openFlag |= O_APPEND; // Add append flag
-		} else {
-			openFlag |= O_TRUNC;  // Add truncate flag (delete previous contents)
-		}
-
-		outFd = open(output, openFlag, 0644);
-		if(outFd==-1) {
-			pg_errno = EOPEN;
-			return -1;
-		}
-	} else {	// No output file defined, use standard output
-		outFd = STDOUT_FILENO;
-	}
-	
-	return pipe_chain(commands, n, inFd, outFd);
+int pipe_chain_r(const struct plan_pipe *pl) {
+	return pipe_chain(pl, STDIN_FILENO, STDOUT_FILENO);
 }
 
-/* Description: Given an array of tokenized commands, it sequentially connects
- * 				them with a pipe and then executes them.
+/* Description: Given a planned pipeline, it sequentially connects its commands
+ * 				and then executes them. External commands become processes
+ *				connected with pipes. Builtins run as threads of the shell and
+ *				two neighbouring builtins are connected with a ring instead of
+ *				a pipe.
  *
- * Arguments:	commands:	Commands array
- *				n:			Number of commands
- *				inFd:			First process's fd used for input redirection
+ * Arguments:	pl:			Planned pipeline
+ *				inFd:		First process's fd used for input redirection
  *				outFd:		Last process's fd used for output redirection
  *
  * Returns:		- On success,  0
@@ -296,21 +368,32 @@ int pipe_chain_r(char ***commands, int n, char *input, char *output, int append)
  *						# EARG	:	Wrong arguments passed (in==1 or out==0)
  *						# EFCHLD:	Execution of a child failed
  *						# EWAIT : 	Error while waiting children
- *						# EPIPE :	Error creating pipe
+ *						# EPIPEF:	Error creating pipe
  *						
  *
- * Notes:		Children participating in the pipe are siblings.			
+ * Notes:		Children participating in the pipe are siblings. The exit status
+ *				of the last command is stored to pg_status. Pipes are sized by
+ *				the command's pipesize or else pg_pipe_size, and the resource
+ *				usage of every stage is kept for pipe_stats.
+ *				All the processes are forked before any thread starts, so no
+ *				child is forked while builtin threads are running.
  */
-int pipe_chain(char ***commands, int n, int inFd, int outFd) {
-	int i, j;
-	pid_t pid;
+int pipe_chain(const struct plan_pipe *pl, int inFd, int outFd) {
+	int i;
+	int n;
+	struct stage *st;	// Stages of the pipeline
 	int pipeFd [2];
+	long size;
 	int status;
-	int waitFlag;
-	int remain_proc;	// Remaining processes to be waited.
+	struct rusage usage;	// Resource usage of a stage
+	int result = 0;
+	pid_t *pids;			// Processes of the pipeline, for the deadline
+	int npids = 0;
+	int timedOut = 0;
+	STAT_VAR(t);
 	
 	// Exceptions //
-	if (commands == NULL) {
+	if (pl == NULL) {
 		pg_errno = ENULL;
 		return -1;
 	}
@@ -323,121 +406,276 @@ int pipe_chain(char ***commands, int n, int inFd, int outFd) {
 		return -1;
 	}
 	
-	remain_proc = n;	// Initialize number of remaining processes
+	var_environ();		// Environment of the children, before they fork
+	n = pl->ncmds;
+	st = (struct stage *)calloc(n, sizeof(struct stage));
+	if (st == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	
+	nstats = 0;
+	if (stats_reserve(n) == -1) {
+		free(st);
+		return -1;
+	}
+	memset(stats, 0, n * sizeof(struct stage_stat));
+	
+	for (i = 0; i < n; ++i) {
+		st[i].cmd = &pl->cmds[i];
+		st[i].index = i;
+		st[i].bi = builtin_for(st[i].cmd);
+		if (st[i].bi != NULL &&
+			((st[i].bi->flags & BI_PROCESS) || st[i].cmd->nassigns > 0 ||
+			func_find(st[i].cmd->argv[0]) != NULL)) {
+			st[i].bi = NULL;	// Forked, spawn_proc runs it in the child
+		}
+		st[i].stat = &stats[i];
+		st[i].pid = -1;
+		if (st[i].cmd->argc > 0) {
+			strncpy(stats[i].name, st[i].cmd->argv[0], sizeof(stats[i].name) - 1);
+		}
+	}
+	st[0].in = inFd;
+	st[n-1].out = outFd;
+	place_begin(n);		// Without a placement, stages run anywhere
 	
-	// Note the loop bound, we spawn here all, but the last stage of the pipeline.
+	// Connect every stage to the next one
 	for (i = 0; i < n - 1; ++i) {
+		size = (pl->cmds[i].pipesize > 0) ? pl->cmds[i].pipesize : pg_pipe_size;
 		
-		if (pipe(pipeFd) == -1) {
-			pg_errno = EPIPEF;
-			return -1;
-		}
-			
-
-		// f[1] is the write end of the pipe, we carry `in` from the prev iteration.
-		if (spawn_proc(commands[i], inFd, pipeFd[1]) == -1) { // Error in spawn_proc
-			if(pg_errno == ENULL) {			// Father error occured 
-				pg_perror("spawn_proc");	// NULL pointer passed
-				return -1;
-			} else if (pg_errno == EEXEC) { // Child error occured
-				fprintf(stderr, "%s: %s\n", "No such command", commands[i][0]);	
-				exit(EXIT_FAILURE);
-			} else {	// EDUP(child) or EFORK(father)
-				pg_perror("spawn_proc");
-				exit(EXIT_FAILURE);
+		if (st[i].bi != NULL && st[i+1].bi != NULL) {	// Both run in the shell
+			if ((st[i].rout = ring_new(size)) == NULL) {
+				result = -1;
+				break;
+			}
+			st[i+1].rin = st[i].rout;
+			st[i].out = BI_RING_OUT;
+			st[i+1].in = BI_RING_IN;
+			stats[i].pipesize = st[i].rout->size;
+		} else {
+			if (fd_pipe(pipeFd) == -1) {
+				pg_perror("pipe");
+				result = -1;
+				break;
 			}
+			// Resize the pipe before the writer starts
+			stats[i].pipesize = fd_pipe_size(pipeFd[1], size);
+			st[i].out = pipeFd[1];
+			st[i].ownout = 1;
+			st[i+1].in = pipeFd[0];
+			st[i+1].ownin = 1;
+		}
+	}
+	
+	// Fork the external commands
+	for (i = 0; i < n && result == 0; ++i) {
+		if (st[i].bi != NULL) {
+			continue;
 		}
-
-      	// No need for the write end of the pipe, the child will write here.
-		close (pipeFd[1]);
-
-      	// Keep the read end of the pipe, the next child will read from there.
-		inFd = pipeFd[0];
 		
-		// Loop for every created process so far and checking its return status
-		// via wait (without hanging)
-		for (j=0; j<i; ++j) {
-	
-			waitFlag = waitpid(-1, &status, WNOHANG);
-	
-			if (waitFlag == -1) {	// No child to wait or error in wait, check errno
-				// Ignore ECHILD error because there might be no processes to wait
-				if (errno != ECHILD) {
-					pg_errno = EWAIT;
-					return -1;
-				} else {	
-					// all children so far have finished
-				}
-				
-			} else if (waitFlag == 0) {	// There are still children processes running
+		st[i].pid = spawn_proc(st[i].cmd, st[i].in, st[i].out, i);
+		if (st[i].pid == -1) { // Error in spawn_proc
+			if(pg_errno == ENULL || pg_errno == EFORK) {	// Father error occured 
+				pg_perror("spawn_proc");
+				result = -1;
 				break;
-			} else {			// A process has finished
-				if (WIFEXITED(status)) {	// Process exited normally
-					// process finished with error (because exec failed)
-					if (WEXITSTATUS(status)==EXIT_FAILURE) {
-						pg_errno = EFCHLD;
-						return -1;	// 
-					}
-				}
-				--remain_proc;	// Decrement the number of processes by one
+			} else if (pg_errno == EEXEC) { // Child error occured
+				status = (errno == ENOENT) ? 127 : 126;
+				fprintf(stderr, "%s: %s\n", "No such command", 
+					st[i].cmd->argc > 0 ? st[i].cmd->argv[0] : "");	
+				_exit(status);
+			} else {	// EDUP or EOPEN (child), already reported
+				_exit(EXIT_FAILURE);
 			}
 		}
+		stats[i].pid = st[i].pid;
 		
-		// Check to see if any of the created processes had an error in executing
-		// command (usually command did not exist) checking their status
-		
+		// The child has its own copies of the pipe ends. Closing them now lets
+		// the neighbours see EOF (or EPIPE) when this stage exits.
+		stage_release(&st[i]);
 	}
 	
-	// Execute the last stage using a child process.
-	if ( (pid = fork()) == 0 ) {	// Child code
+	// Start the builtins
+	for (i = 0; i < n && result == 0; ++i) {
+		if (st[i].bi != NULL) {
+			if (pthread_create(&st[i].tid, NULL, stage_main, &st[i]) != 0) {
+				fprintf(stderr, "pgsh: %s: cannot create thread\n", stats[i].name);
+				st[i].status = EXIT_FAILURE;
+				stage_release(&st[i]);
+			} else {
+				st[i].started = 1;
+			}
+		}
+	}
 	
-	// Last stage of the pipeline - set stdin be the read end of the previous pipe
-    // and redirect output to the given file descriptor. 
-		if (inFd != 0) {
-			if ( dup2(inFd, 0) == -1) {
-				pg_errno = EDUP;
-				return -1;
+	// Stages that will never run must not keep their neighbours waiting
+	for (i = 0; i < n; ++i) {
+		if (st[i].pid == -1 && !st[i].started) {
+			stage_release(&st[i]);
+		}
+	}
+	
+	// The deadline stops the processes. Builtin threads then see their
+	// neighbours go away and end as well.
+	STAT_START(t);
+	if (pg_deadline > 0 && (pids = (pid_t *)malloc(n * sizeof(pid_t))) != NULL) {
+		for (i = 0; i < n; ++i) {
+			if (st[i].pid != -1) {
+				pids[npids++] = st[i].pid;
 			}
 		}
+		if (npids > 0) {
+			timedOut = deadline_wait(pids, npids, pg_deadline, pg_grace, SIGTERM,
+				deadline_group()) == 1;
+		}
+		free(pids);
+	}
+	
+	// Wait for all the stages
+	for (i = 0; i < n; ++i) {
+		if (st[i].started) {
+			pthread_join(st[i].tid, NULL);
+			status = st[i].status;
+		} else if (st[i].pid != -1) {
+			if (wait4(st[i].pid, &status, 0, &usage) == -1) {
+				pg_errno = EWAIT;
+				result = -1;
+				continue;
+			}
+			stage_usage(&stats[i], &usage);
+			status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+		} else {
+			continue;
+		}
+		nstats = i + 1;
 		
-		// Redirect last processes's output
-		if (dup2(outFd, STDOUT_FILENO) ==-1) {
-			pg_errno = EDUP;
-			return -1;
+		if (i == n - 1) {	// Exit status of the pipeline is the last one's
+			pg_status = status;
+		}
+		
+		// Child failed mostly because command to execute does not exist
+		if(status == EXIT_FAILURE && result == 0) {
+			pg_errno = EFCHLD;
+			result = -1;
 		}
+	}
+	STAT_STOP(ST_WAIT, t);
 	
-		execvp (commands[i][0], commands[i]);
-		// execvp failed
-		pg_errno = EEXEC;
-		fprintf(stderr, "%s: %s\n", "No such command", commands[i][0]);	
-		exit(EXIT_FAILURE);
-	} else if (pid == -1) {
-		pg_errno = EFORK;
-		pg_perror("fork");
-		exit(EXIT_FAILURE);
+	if (timedOut) {
+		fprintf(stderr, "pgsh: deadline passed, pipeline stopped\n");
+		pg_status = TIMEOUT_STATUS;
+		pg_errno = EFCHLD;
+		result = -1;
 	}
 	
-	// Wait for all the remaining processes
-	for (i=0 ; i< remain_proc + 1; ++i) {
-		waitFlag = wait(&status);
-		if(WIFEXITED(status)) {
-			// Child failed mostly because command to execute does not exist
-			if(WEXITSTATUS(status) == EXIT_FAILURE) {
-				pg_errno = EFCHLD;
-				return -1;
-			}
+	for (i = 0; i < n - 1; ++i) {
+		ring_free(st[i].rout);
+	}
+	free(st);
+	place_end();
+	
+	return result;	// Function execution status
+}
+
+/* Description: Runs a builtin stage of a pipeline. It is the thread function of
+ *				the stage.
+ *
+ * Arguments:	arg:	The stage
+ *
+ * Returns:		NULL, the exit status is stored to the stage
+ */
+static void * stage_main(void *arg) {
+	struct stage *st = (struct stage *)arg;
+	struct bi_ctx ctx;
+	int fds[3];
+	int opened[FD_OPS_MAX];
+	int nopened = 0;
+#ifdef RUSAGE_THREAD
+	struct rusage usage;
+#endif
+	
+	place_enter(st->index);
+	
+	fds[0] = st->in;
+	fds[1] = st->out;
+	fds[2] = STDERR_FILENO;
+	
+	if (fd_resolve(st->cmd->redirs, st->cmd->nredirs, fds, opened, &nopened) == -1) {
+		st->status = EXIT_FAILURE;
+	} else {
+		ctx.in = fds[0];
+		ctx.out = fds[1];
+		ctx.err = fds[2];
+		ctx.rin = (fds[0] == BI_RING_IN) ? st->rin : NULL;
+		ctx.rout = (fds[1] == BI_RING_OUT || fds[2] == BI_RING_OUT) ? st->rout : NULL;
+		ctx.broken = 0;
+		ctx.name = st->cmd->argv[0];
+		
+		// Ends a redirection replaced are released before the builtin runs
+		if (st->rin != NULL && ctx.rin == NULL) {
+			ring_close_read(st->rin);
+		}
+		if (st->rout != NULL && ctx.rout == NULL) {
+			ring_close_write(st->rout);
+		}
+		
+		st->status = st->bi->func(st->cmd->argc, st->cmd->argv, &ctx);
+		
+		while (nopened > 0) {
+			close(opened[--nopened]);
 		}
 	}
 	
-	return 0;	// Function execution success
+	stage_release(st);
+	
+#ifdef RUSAGE_THREAD
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		stage_usage(st->stat, &usage);
+	}
+#endif
+	
+	return NULL;
+}
+
+/* Description: Releases the connections of a stage to its neighbours: the pipe
+ *				ends the shell holds for it are closed and its ring ends are
+ *				marked closed.
+ *
+ * Returns:		void: Nothing
+ */
+static void stage_release(struct stage *st) {
+	if (st->ownin) {
+		close(st->in);
+		st->ownin = 0;
+	}
+	if (st->ownout) {
+		close(st->out);
+		st->ownout = 0;
+	}
+	if (st->rin != NULL) {
+		ring_close_read(st->rin);
+	}
+	if (st->rout != NULL) {
+		ring_close_write(st->rout);
+	}
+}
+
+// Stores the context switches and CPU time of a stage
+static void stage_usage(struct stage_stat *stat, const struct rusage *usage) {
+	stat->vcsw = usage->ru_nvcsw;
+	stat->ivcsw = usage->ru_nivcsw;
+	stat->utime = usage->ru_utime.tv_sec * 1000L + usage->ru_utime.tv_usec / 1000;
+	stat->stime = usage->ru_stime.tv_sec * 1000L + usage->ru_stime.tv_usec / 1000;
 }
 
 /* Description: Spawns a process with redirected standard input and output file
  *				descriptors and executes the given command.
  *
- * Arguments:	command:	Command to be executed in the created process
+ * Arguments:	cmd:		Planned command to be executed in the created process
  *				in:			Input file descriptor
  *				out:		Output file descriptor
+ *				stage:		Position in the pipeline, for place_enter
  *
  * Returns:		- On success,  pid of the created child
  * 				- On failure, -1 and sets pg_errno to:
@@ -445,41 +683,77 @@ int pipe_chain(char ***commands, int n, int inFd, int outFd) {
  *						# EFORK: fork error   	
  *						# EEXEC: execvp error
  *						# EDUP : dup error
+ *						# EOPEN: redirection file could not be opened
  *
  * Notes:		All errors above apart from ENULL, are better described by
  *				the errno and not pg_errno globar error variable.
+ *				The command's own redirections are applied after in and out.
+ *				EDUP and EOPEN are reported to stderr by the child.
+ *				in and out must be close-on-exec (see fd_pipe), or else the
+ *				command inherits a second copy of them.
  */
-int spawn_proc (char **command, int in, int out) {
+int spawn_proc (const struct plan_cmd *cmd, int in, int out, int stage) {
 	pid_t pid;
+	const struct builtin *bi;
+	const struct func *fn;
+	struct fd_op ops[FD_OPS_MAX + 2];	// Pipe ends and redirections
+	char **env;
+	int n = 0;
+	STAT_VAR(t);
 	
 	// Exceptions //
-	if(command==NULL) {		// Command given is NULL
+	if(cmd==NULL) {		// Command given is NULL
 		pg_errno=ENULL;
 		return -1;
 	}
 	
 	// Create child process
+	STAT_START(t);
 	if ((pid = fork ()) == 0) {  // Child Code
   		
-  		// If file descriptor is not STDIN, redirect it
-		if (in != 0) {
-			if ( dup2(in, 0) == -1 ) {
-				pg_errno = EDUP;	// dup error
-				return -1;
-			}
-			close(in);
+		if (deadline_group()) {
+			setpgid(0, 0);
 		}
+		limits_enter();
+		place_enter(stage);
 		
-		// If file descriptor is not STDOUT, redirect it
+		// The pipe ends are applied together with the command's redirections,
+		// so an end that a redirection replaces is never dup2()ed. The ends
+		// themselves are close-on-exec and need no close.
+		if (in != 0) {
+			add_fd_op(ops, &n, FD_DUP, 0, in);
+		}
 		if (out != 1) {
-			if ( dup2(out, 1) == -1 ) {
-				pg_errno = EDUP;	// dup error
-				return -1;
-			}
-			close(out);
+			add_fd_op(ops, &n, FD_DUP, 1, out);
+		}
+		memcpy(ops + n, cmd->redirs, cmd->nredirs * sizeof(struct fd_op));
+		n += cmd->nredirs;
+		
+		if (fd_apply(ops, n) < 0) {
+			return -1;		// pg_errno set by fd_apply
+		}
+		
+		if (cmd->plan != NULL) {	// Compound command stage
+			_exit(child_body(cmd));
+		}
+		if (cmd->argc == 0) {	// Only redirections
+			_exit(EXIT_SUCCESS);
+		}
+		if ((fn = func_find(cmd->argv[0])) != NULL) {	// Function stage
+			_exit(child_func(fn, cmd));
+		}
+		env = child_environ(cmd);
+		
+		// Builtin stage, run it in this child
+		// _exit, so that stdio of the shell (e.g. a buffered script on stdin)
+		// is not flushed or rewound by the child
+		if ((bi = builtin_for(cmd)) != NULL) {
+			_exit(builtin_child(bi, cmd));
 		}
 		
-		execvp(command[0], command);	// Execute command
+		signal(SIGPIPE, SIG_DFL);	// Ignored by the shell only
+		fd_report(cmd->argv[0]);
+		execvpe(cmd->argv[0], cmd->argv, env);	// Execute command
 		
 		// Error: execvp, returned -1
 		pg_errno = EEXEC;
@@ -489,26 +763,424 @@ int spawn_proc (char **command, int in, int out) {
 		return -1;
 	}
 
+	if (deadline_group()) {
+		setpgid(pid, pid);
+	}
+	STAT_STOP(ST_SPAWN, t);
+	return pid;
+}
+
+/* Description: Starts a command with posix_spawn, with the given standard
+ *				descriptors.
+ *
+ * Arguments:	argv:	Command and its arguments, NULL terminated
+ *				in:		Standard input (-1 for /dev/null)
+ *				out:	Standard output
+ *				err:	Standard error
+ *				flags:	SPAWN_PGROUP to start it in a process group of its own
+ *
+ * Returns:		- On success, pid of the started command
+ * 				- On failure, -1, sets errno and pg_errno to:
+ *						# EEXEC: The command could not be started
+ *
+ * Notes:		The shell is not forked, so it is safe to call from builtin
+ *				threads, and starting many commands is cheap however big the
+ *				shell is. The command's other descriptors are close-on-exec.
+ */
+pid_t spawn_argv(char **argv, int in, int out, int err, int flags) {
+	posix_spawn_file_actions_t actions;
+	posix_spawnattr_t attr;
+	sigset_t sigs;
+	pid_t pid;
+	int ret;
+	
+	posix_spawn_file_actions_init(&actions);
+	posix_spawnattr_init(&attr);
+	
+	if (in == -1) {
+		posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null",
+			O_RDONLY, 0);
+	} else if (in != STDIN_FILENO) {
+		posix_spawn_file_actions_adddup2(&actions, in, STDIN_FILENO);
+	}
+	if (out != STDOUT_FILENO) {
+		posix_spawn_file_actions_adddup2(&actions, out, STDOUT_FILENO);
+	}
+	if (err != STDERR_FILENO) {
+		posix_spawn_file_actions_adddup2(&actions, err, STDERR_FILENO);
+	}
+	
+	// SIGPIPE is ignored by the shell only
+	sigemptyset(&sigs);
+	sigaddset(&sigs, SIGPIPE);
+	posix_spawnattr_setsigdefault(&attr, &sigs);
+	if (flags & SPAWN_PGROUP) {
+		posix_spawnattr_setpgroup(&attr, 0);
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETPGROUP);
+	} else {
+		posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+	}
+	
+	// The command inherits the descriptors the shell has open now, apart
+	// from the standard ones, so they are checked here
+	fd_report(argv[0]);
+	ret = posix_spawnp(&pid, argv[0], &actions, &attr, argv, environ);
+	
+	posix_spawn_file_actions_destroy(&actions);
+	posix_spawnattr_destroy(&attr);
+	
+	if (ret != 0) {
+		errno = ret;
+		pg_errno = EEXEC;
+		return -1;
+	}
+	return pid;
+}
+
+/* Description: Forks a child that prepares itself with a function and then
+ *				executes a command with the given standard descriptors.
+ *
+ * Arguments:	argv:	Command and its arguments, NULL terminated
+ *				in:		Standard input
+ *				out:	Standard output
+ *				err:	Standard error
+ *				setup:	Called by the child before exec, e.g. to set limits
+ *				arg:	Argument of setup
+ *
+ * Returns:		- On success, pid of the child
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EFORK: fork error
+ *
+ * Notes:		The child reports its own errors, and exits with 127 if the
+ *				command is not found, 126 if it cannot be run and 1 if setup
+ *				fails. Unlike spawn_argv, it must not be called from builtin
+ *				threads.
+ */
+pid_t fork_argv(char **argv, int in, int out, int err, int (*setup)(void *), void *arg) {
+	pid_t pid;
+	
+	if ((pid = fork()) == 0) {
+		if (setup(arg) == -1) {
+			perror(argv[0]);
+			_exit(EXIT_FAILURE);
+		}
+		if ((in != STDIN_FILENO && dup2(in, STDIN_FILENO) == -1) ||
+			(out != STDOUT_FILENO && dup2(out, STDOUT_FILENO) == -1) ||
+			(err != STDERR_FILENO && dup2(err, STDERR_FILENO) == -1)) {
+			perror(argv[0]);
+			_exit(EXIT_FAILURE);
+		}
+		signal(SIGPIPE, SIG_DFL);	// Ignored by the shell only
+		fd_report(argv[0]);
+		execvp(argv[0], argv);
+		perror(argv[0]);
+		_exit(errno == ENOENT ? 127 : 126);
+	} else if (pid == -1) {
+		pg_errno = EFORK;
+		return -1;
+	}
+	
 	return pid;
 }
 
+/* Description: Waits for a command started by fork_argv or spawn_argv, under
+ *				the session deadline.
+ *
+ * Arguments:	pid:	The command
+ *				usage:	Stores its resource usage (may be NULL)
+ *
+ * Returns:		- On success, its exit status as the shell sees it: 128 + the
+ *				  signal that killed it, or TIMEOUT_STATUS at the deadline
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EWAIT: Error while waiting the child
+ */
+int wait_argv(pid_t pid, struct rusage *usage) {
+	int status, timedOut = 0;
+	
+	if (pg_deadline > 0) {
+		timedOut = deadline_wait(&pid, 1, pg_deadline, pg_grace, SIGTERM, 0) == 1;
+	}
+	while (wait4(pid, &status, 0, usage) == -1) {
+		if (errno != EINTR) {
+			pg_errno = EWAIT;
+			return -1;
+		}
+	}
+	
+	if (timedOut) {
+		return TIMEOUT_STATUS;
+	}
+	return WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+}
+
+/* Description: Opens a descriptor that becomes readable when a child ends.
+ *
+ * Arguments:	pid:	Child
+ *
+ * Returns:		- On success, the descriptor (close-on-exec)
+ * 				- If the kernel has no pidfds, -1
+ */
+int pid_open(pid_t pid) {
+#ifdef SYS_pidfd_open
+	return (int)syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void)pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+/* Description: Waits for any one of a set of children. Other children of the
+ *				shell, such as pipeline stages, are never reaped.
+ *
+ * Arguments:	pids:	Children
+ *				pidfds:	Their pid_open descriptors (-1 where there is none)
+ *				n:		Number of children
+ *				status:	Stores the wait status of the child
+ *
+ * Returns:		- On success, index of the child that ended
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EARG : No children given
+ *						# EWAIT: Error while waiting
+ *
+ * Notes:		Without pidfds the first child is waited.
+ */
+int wait_any(const pid_t *pids, const int *pidfds, int n, int *status) {
+	struct pollfd fds[n > 0 ? n : 1];
+	int i, ready = 0;
+	
+	if (n <= 0) {
+		pg_errno = EARG;
+		return -1;
+	}
+	
+	for (i = 0; i < n; ++i) {
+		if (pidfds[i] == -1) {
+			break;
+		}
+		fds[i].fd = pidfds[i];
+		fds[i].events = POLLIN;
+	}
+	
+	if (i == n) {
+		while ((ready = poll(fds, n, -1)) == -1 && errno == EINTR)
+			;
+	}
+	if (ready > 0) {
+		for (i = 0; i < n && !(fds[i].revents & (POLLIN | POLLHUP)); ++i)
+			;
+	} else {
+		i = 0;
+	}
+	
+	while (waitpid(pids[i], status, 0) == -1) {
+		if (errno != EINTR) {
+			pg_errno = EWAIT;
+			return -1;
+		}
+	}
+	return i;
+}
+
+/* Description: Waits until the given children end or a deadline passes. At the
+ *				deadline the children are sent a signal and, if they are still
+ *				there after the grace period, SIGKILL.
+ *
+ * Arguments:	pids:	Children
+ *				n:		Number of children
+ *				ms:		Deadline, from now (ms)
+ *				grace:	Time from the signal to SIGKILL (ms), 0 for none
+ *				sig:	Signal sent at the deadline
+ *				group:	Signal the process group of every child instead
+ *
+ * Returns:		- If the deadline passed, 1
+ * 				- If the children ended before it, 0
+ * 				- On failure, -1 and sets pg_errno to:
+ *						# EWAIT: Error while waiting
+ *
+ * Notes:		The children are not reaped, so they are waited as usual after.
+ *				A timerfd and the children's pidfds are polled together, so
+ *				nothing wakes up before something happened. Without timerfds or
+ *				pidfds the deadline is not enforced and 0 is returned at once.
+ */
+int deadline_wait(const pid_t *pids, int n, long ms, long grace, int sig, int group) {
+#ifdef __linux__
+	struct pollfd fds[n + 1];
+	uint64_t ticks;
+	int left = n, phase = 0, result = 0;
+	int tfd, i;
+	
+	if ((tfd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC)) == -1) {
+		return 0;
+	}
+	for (i = 0; i < n; ++i) {
+		fds[i].events = POLLIN;
+		if ((fds[i].fd = pid_open(pids[i])) == -1) {
+			while (i > 0) {
+				close(fds[--i].fd);
+			}
+			close(tfd);
+			return 0;
+		}
+	}
+	fds[n].fd = tfd;
+	fds[n].events = POLLIN;
+	timer_arm(tfd, ms);
+	
+	while (left > 0) {
+		if (poll(fds, n + 1, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			pg_errno = EWAIT;
+			result = -1;
+			break;
+		}
+		
+		// Ended children are ignored by poll from now on
+		for (i = 0; i < n; ++i) {
+			if (fds[i].fd >= 0 && fds[i].revents != 0) {
+				close(fds[i].fd);
+				fds[i].fd = -1;
+				--left;
+			}
+		}
+		
+		if (left > 0 && (fds[n].revents & POLLIN) &&
+			read(tfd, &ticks, sizeof(ticks)) == sizeof(ticks)) {
+			for (i = 0; i < n; ++i) {
+				if (fds[i].fd >= 0) {
+					kill(group ? -pids[i] : pids[i], phase == 0 ? sig : SIGKILL);
+				}
+			}
+			if (phase == 0 && grace > 0 && sig != SIGKILL) {
+				timer_arm(tfd, grace);
+			}
+			++phase;
+			result = 1;
+		}
+	}
+	
+	for (i = 0; i < n; ++i) {
+		if (fds[i].fd >= 0) {
+			close(fds[i].fd);
+		}
+	}
+	close(tfd);
+	return result;
+#else
+	(void)pids;
+	(void)n;
+	(void)ms;
+	(void)grace;
+	(void)sig;
+	(void)group;
+	return 0;
+#endif
+}
+
+// Arms a timerfd to expire once after ms milliseconds
+static void timer_arm(int tfd, long ms) {
+#ifdef __linux__
+	struct itimerspec its;
+	
+	memset(&its, 0, sizeof(its));
+	its.it_value.tv_sec = ms / 1000;
+	its.it_value.tv_nsec = (ms % 1000) * 1000000L;
+	if (ms <= 0) {
+		its.it_value.tv_nsec = 1;	// Zero would disarm it
+	}
+	timerfd_settime(tfd, 0, &its, NULL);
+#else
+	(void)tfd;
+	(void)ms;
+#endif
+}
+
+/* Description: Checks if external commands run in process groups of their own,
+ *				so that a deadline stops everything they started.
+ *
+ * Returns:		- If they do, 1
+ * 				- Otherwise, 0
+ *
+ * Notes:		Only with a session deadline and when the shell does not read a
+ *				terminal. On a terminal commands stay in the foreground group and
+ *				only the command itself is signalled.
+ */
+static int deadline_group(void) {
+	return pg_deadline > 0 && !isatty(STDIN_FILENO);
+}
+
+/* Description: Appends a file descriptor operation to a list.
+ *
+ * Arguments:	ops:	Operations list
+ *				n:		Number of operations, increased by one
+ *				type:	FD_DUP or FD_CLOSE
+ *				fd:		Descriptor changed
+ *				src:	Copied descriptor (FD_DUP)
+ *
+ * Returns:		void: Nothing
+ */
+static void add_fd_op(struct fd_op *ops, int *n, enum FdOpType type, int fd, int src) {
+	ops[*n].type = type;
+	ops[*n].fd = fd;
+	ops[*n].src = src;
+	ops[*n].flags = 0;
+	ops[*n].path = NULL;
+	++*n;
+}
+
+/* Description: Returns the resource usage of the stages of the last pipeline
+ *				executed by pipe_chain.
+ *
+ * Arguments:	n:	Stores the number of stages
+ *
+ * Returns:		The stages, in pipeline order (NULL if no pipeline was executed)
+ */
+const struct stage_stat * pipe_stats(int *n) {
+	*n = nstats;
+	return stats;
+}
+
+/* Description: Makes room for the statistics of n stages.
+ *
+ * Returns:		- On success,  0
+ * 				- On failure, -1
+ */
+static int stats_reserve(int n) {
+	struct stage_stat *tmp;
+	
+	if (n <= statcap) {
+		return 0;
+	}
+	if ((tmp = (struct stage_stat *)realloc(stats, n * sizeof(struct stage_stat)))
+		== NULL) {
+		perror("realloc");
+		return -1;
+	}
+	stats = tmp;
+	statcap = n;
+	return 0;
+}
+
 /* Description: Prompts user to enter a command along with its arguments.
  *
- * Arguments:	void: Nothing
+ * Arguments:	prompt: Prompt printed before reading the command
  * Returns:		- On success, the command line entered.
- * 				- On failure, NULL.
+ * 				- On failure or end of input, NULL.
  *					
- * Notes:		None
+ * Notes:		On a terminal the command line can be edited and completed
+ *				with tab before it is entered.
  */
 
-char *enter_command() {
-	char *cmd_list=NULL;	// indicate that getline will allocate space
-	size_t len=0;
-	if ( getline(&cmd_list, &len, stdin) == -1 ) {
-		return NULL;
-	}
+char *enter_command(const char *prompt) {
+	char *line;
+	STAT_VAR(t);
 	
-	return cmd_list;
+	STAT_START(t);
+	line = pg_readline(prompt);
+	STAT_STOP(ST_READ, t);
+	return line;
 }
 
 
@@ -516,3 +1188,37 @@ char *enter_command() {
 		 Create pipe_chine_r with redirection support and appending mode	
 
 */
+
+// Environment of a forked command, with the assignments of the command added.
+// environ is set too, so that builtins of the child pass it on.
+static char ** child_environ(const struct plan_cmd *cmd) {
+	char **env;
+
+	if (cmd->nassigns > 0 &&
+		(env = var_overlay(cmd->assigns, cmd->nassigns)) != NULL) {
+		environ = env;
+	}
+	return environ;
+}
+
+// Runs a function in a child, with the assignments of the command exported
+// to the commands of its body. Returns the exit status of the child.
+static int child_func(const struct func *fn, const struct plan_cmd *cmd) {
+	int i;
+
+	for (i = 0; i < cmd->nassigns; ++i) {
+		var_assign(cmd->assigns[i], VAR_EXPORT);
+	}
+	exec_func(fn, cmd->argc, cmd->argv);
+	fflush(stdout);
+
+	return pg_status;
+}
+
+// Runs a compound command in a child. Returns the exit status of the child.
+static int child_body(const struct plan_cmd *cmd) {
+	exec_body(cmd->plan, cmd->pc);
+	fflush(stdout);
+
+	return pg_status;
+}
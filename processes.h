@@ -1,13 +1,47 @@
 #ifndef PROCESSES_H
 #define PROCESSES_H
+
+#include <sys/types.h>
+
+struct plan_cmd;
+struct plan_pipe;
+struct rusage;
+
+extern int pg_status;	// Exit status of the last command waited
+extern long pg_pipe_size;	// Size of pipeline pipes, 0 for the kernel default
+extern long pg_deadline;	// Deadline of every external command (ms), 0 for none
+extern long pg_grace;		// Time from SIGTERM to SIGKILL at a deadline (ms)
+
+#define TIMEOUT_STATUS	124		// Exit status of a command stopped at its deadline
+#define DEFAULT_GRACE	5000	// Default of pg_grace (ms)
+#define SPAWN_PGROUP	1		// spawn_argv: process group of its own
+
+// Resource usage of a pipeline stage
+struct stage_stat {
+	char name[32];		// Command name
+	pid_t pid;
+	long pipesize;		// Size of the pipe the stage writes to (0 for the last)
+	long vcsw;			// Voluntary context switches
+	long ivcsw;			// Involuntary context switches
+	long utime;			// User time (ms)
+	long stime;			// System time (ms)
+};
+
 pid_t create_child_func( void (*func)(void));
 pid_t create_child_full( char *cmd, char **args );
 pid_t create_child( char **args );
 int wait_child(pid_t pid);
-char *enter_command();
-pid_t create_child_r(char **cmd, char *input, char *output, int append);
-int spawn_proc (char **command, int in, int out);
-int pipe_chain(char ***commands, int n, int inFd, int outFd);
-int pipe_chain_r(char ***commands, int n, char *input, char *output, int append);
+char *enter_command(const char *prompt);
+pid_t create_child_r(const struct plan_cmd *cmd);
+int spawn_proc (const struct plan_cmd *cmd, int in, int out, int stage);
+int pipe_chain(const struct plan_pipe *pl, int inFd, int outFd);
+int pipe_chain_r(const struct plan_pipe *pl);
+pid_t spawn_argv(char **argv, int in, int out, int err, int flags);
+pid_t fork_argv(char **argv, int in, int out, int err, int (*setup)(void *), void *arg);
+int wait_argv(pid_t pid, struct rusage *usage);
+int pid_open(pid_t pid);
+int wait_any(const pid_t *pids, const int *pidfds, int n, int *status);
+int deadline_wait(const pid_t *pids, int n, long ms, long grace, int sig, int group);
+const struct stage_stat * pipe_stats(int *n);
 
 #endif